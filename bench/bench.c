@@ -0,0 +1,768 @@
+/*
+ * Load generator for the database server.
+ *
+ * Spawns the server (or connects to a running one), loads the keyspace and then drives it from several
+ * connections, each on its own thread, with pipelined select/replace commands. Prints the throughput and
+ * latency percentiles as a single JSON object, or as text with --format text.
+ *
+ * With --cluster the keys are spread over the nodes of a cluster. The slot map is read from the node at
+ * --port, every connection talks to every node and sends each command to the node serving its slot,
+ * following MOVED and ASK redirections like a cluster aware client.
+ *
+ * With --unix the connections go to a unix socket of the server instead of its port, and --compare runs
+ * the same workload over TCP and then over the unix socket, printing the results of both.
+ *
+ */
+
+#include "../src/cluster.h"
+#include "../src/histogram.h"
+#include "../src/network.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MAX_PIPELINE 1024
+// one thread per connection, a spawned server is told to take them all
+#define BENCH_MAX_CONNECTIONS 1024
+// longest command we send, the server cuts commands longer than its buffer
+#define BENCH_MAX_VALUE_SIZE (BUFFER_SIZE - 128)
+#define BENCH_MAX_NODES 16
+
+typedef enum KeyDistribution {
+    DIST_UNIFORM,
+    DIST_ZIPF,
+} KeyDistribution_t;
+
+typedef struct BenchConfig {
+    const char *serverPath; /* Server executable to spawn, NULL to use a running server */
+    int port;
+    int connections;
+    int pipeline;
+    uint64_t requests;
+    uint64_t keyspace;
+    KeyDistribution_t dist;
+    double zipfTheta;
+    int valueSize;
+    int readRatio; /* Percentage of the requests that are reads */
+    uint64_t seed;
+    int textOutput;
+    int cluster; /* Route commands to the nodes of a cluster */
+    const char *unixPath; /* Unix socket of the server, @name for the abstract namespace */
+    int compare;          /* Run over TCP and then over the unix socket */
+} BenchConfig_t;
+
+// Zipfian generator from "Quickly Generating Billion-Record Synthetic Databases", Gray et al.
+typedef struct Zipf {
+    uint64_t n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+} Zipf_t;
+
+typedef struct Worker {
+    pthread_t thread;
+    int id;
+    uint64_t requests; /* Requests this worker sends */
+    uint64_t errors;   /* Replies other than the expected successful ones */
+    uint64_t rng;
+    uint64_t redirects;  /* Commands sent again to another node after a MOVED or ASK reply */
+    Histogram_t latency; /* Nanoseconds from sending a pipeline to receiving each reply */
+    int fds[BENCH_MAX_NODES];      /* Connection to every node */
+    uint8_t slots[CLUSTER_SLOTS];  /* Node serving every slot, updated by MOVED replies */
+} Worker_t;
+
+typedef struct BenchNode {
+    char addr[CLUSTER_MAX_ADDR_LEN]; /* host:port, as named in the slot map */
+    char host[CLUSTER_MAX_ADDR_LEN];
+    int port;
+} BenchNode_t;
+
+// Commands of a pipeline that go to one node
+typedef struct NodeBatch {
+    char *buf;
+    size_t len;
+    int count;
+    size_t starts[BENCH_MAX_PIPELINE + 1]; /* Offset of every command in buf, and the end of the last one */
+    const char *ok[BENCH_MAX_PIPELINE];
+    int redirect[BENCH_MAX_PIPELINE]; /* Node a command was redirected to, -1 if none */
+    int ask[BENCH_MAX_PIPELINE];      /* Set if the redirection is for that command only */
+} NodeBatch_t;
+
+static BenchConfig_t config = {
+    .serverPath = "./db",
+    .port = SERVER_DEFAULT_PORT,
+    .connections = 4,
+    .pipeline = 1,
+    .requests = 100000,
+    .keyspace = 10000,
+    .dist = DIST_UNIFORM,
+    .zipfTheta = 0.99,
+    .valueSize = 64,
+    .readRatio = 90,
+    .seed = 1,
+    .textOutput = 0,
+    .cluster = 0,
+    .unixPath = NULL,
+    .compare = 0,
+};
+static Zipf_t zipf;
+static char *value;
+static pid_t serverPid = -1;
+// the first node is the one at --port, the others are found in its slot map
+static BenchNode_t nodes[BENCH_MAX_NODES];
+static int numNodes;
+static uint8_t slotNodes[CLUSTER_SLOTS];
+// set while the connections go to the unix socket instead of the port
+static int overUnix;
+
+static uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// xorshift64*, cheap enough to not show up in the measurements
+static uint64_t nextRandom(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static double nextDouble(uint64_t *state) {
+    return (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void zipfInit(Zipf_t *z, uint64_t n, double theta) {
+    z->n = n;
+    z->theta = theta;
+    z->zetan = 0;
+    for (uint64_t i = 1; i <= n; i++) {
+        z->zetan += 1.0 / pow(i, theta);
+    }
+    double zeta2 = 1.0 + 1.0 / pow(2, theta);
+    z->alpha = 1.0 / (1.0 - theta);
+    z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+static uint64_t zipfNext(Zipf_t *z, uint64_t *state) {
+    double u = nextDouble(state);
+    double uz = u * z->zetan;
+    if (uz < 1.0) {
+        return 0;
+    }
+    if (uz < 1.0 + pow(0.5, z->theta)) {
+        return 1;
+    }
+    uint64_t k = (uint64_t)(z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+    return k < z->n ? k : z->n - 1;
+}
+
+static uint64_t nextKey(Worker_t *w) {
+    if (config.dist == DIST_ZIPF) {
+        return zipfNext(&zipf, &w->rng);
+    }
+    return nextRandom(&w->rng) % config.keyspace;
+}
+
+// find a node, adding it if it is not known yet, returns -1 if there is no room or addr is malformed
+static int findNode(const char *addr, int add) {
+    for (int i = 0; i < numNodes; i++) {
+        if (strcmp(nodes[i].addr, addr) == 0) {
+            return i;
+        }
+    }
+    BenchNode_t *node = &nodes[numNodes];
+    if (!add || numNodes == BENCH_MAX_NODES || strlen(addr) >= CLUSTER_MAX_ADDR_LEN ||
+        clusterParseAddr(addr, node->host, sizeof(node->host), &node->port) != 0) {
+        return -1;
+    }
+    strcpy(node->addr, addr);
+    return numNodes++;
+}
+
+static int connectToUnix(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    size_t len = strlen(path);
+    if (len >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    memcpy(addr.sun_path, path, len);
+    if (path[0] == '@') {
+        addr.sun_path[0] = '\0';
+    }
+    int socketFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socketFd != -1 && connect(socketFd, (struct sockaddr *)&addr, offsetof(struct sockaddr_un, sun_path) + len) == -1) {
+        close(socketFd);
+        socketFd = -1;
+    }
+    return socketFd;
+}
+
+static int connectToNode(int node) {
+    if (overUnix) {
+        return connectToUnix(config.unixPath);
+    }
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *res;
+    char service[16];
+    sprintf(service, "%d", nodes[node].port);
+    if (getaddrinfo(nodes[node].host, service, &hints, &res) != 0) {
+        return -1;
+    }
+    int socketFd = socket(res->ai_family, SOCK_STREAM, 0);
+    if (socketFd != -1 && connect(socketFd, res->ai_addr, res->ai_addrlen) == -1) {
+        close(socketFd);
+        socketFd = -1;
+    }
+    freeaddrinfo(res);
+    if (socketFd != -1) {
+        int nodelay = 1;
+        setsockopt(socketFd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    }
+    return socketFd;
+}
+
+static int sendAll(int socketFd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(socketFd, buf, len, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// spawn the server like the tests do, with its output silenced
+static int spawnServer() {
+    serverPid = fork();
+    if (serverPid == -1) {
+        fprintf(stderr, "Error creating server process %d\n", errno);
+        return -1;
+    }
+    if (serverPid == 0) {
+        prctl(PR_SET_PDEATHSIG, SIGHUP);
+        freopen("/dev/null", "w", stdout);
+        // one more client than the connections, for the connection that checks the server is up
+        char maxClients[16];
+        sprintf(maxClients, "%d", config.connections + 1);
+        char *argv[6] = {(char *)config.serverPath, "--max-clients", maxClients, NULL, NULL, NULL};
+        if (config.unixPath != NULL) {
+            argv[3] = "--unix";
+            argv[4] = (char *)config.unixPath;
+        }
+        execv(config.serverPath, argv);
+        fprintf(stderr, "Error executing server %s: %d\n", config.serverPath, errno);
+        exit(EXIT_FAILURE);
+    }
+    // wait for the server to accept connections
+    for (int i = 0; i < 200; i++) {
+        int socketFd = connectToNode(0);
+        if (socketFd != -1) {
+            close(socketFd);
+            return 0;
+        }
+        usleep(10000);
+    }
+    fprintf(stderr, "Server did not start listening on port %d\n", config.port);
+    return -1;
+}
+
+static void stopServer() {
+    if (serverPid > 0) {
+        kill(serverPid, SIGTERM);
+        waitpid(serverPid, NULL, 0);
+        serverPid = -1;
+    }
+}
+
+/*
+ * Parse a MOVED or ASK reply into the node to send the command to, remembering the new node of the slot
+ * for MOVED. Returns 0 if the reply is not a redirection to a known node.
+ */
+static int parseRedirect(Worker_t *w, const char *reply, size_t len, int *node, int *ask) {
+    char line[BUFFER_SIZE];
+    char addr[CLUSTER_MAX_ADDR_LEN];
+    int slot;
+    snprintf(line, sizeof(line), "%.*s", (int)len, reply);
+    int moved = strncmp(line, "MOVED ", 6) == 0;
+    *ask = strncmp(line, "ASK ", 4) == 0;
+    if ((!moved && !*ask) || sscanf(line + (moved ? 6 : 4), "%d %63s", &slot, addr) != 2 || slot < 0 ||
+        slot >= CLUSTER_SLOTS || (*node = findNode(addr, 0)) == -1) {
+        return 0;
+    }
+    if (moved) {
+        w->slots[slot] = *node;
+    }
+    return 1;
+}
+
+/*
+ * Wait for one reply per command sent at start. Every reply is recorded in the worker's histogram if
+ * record is set and counted as an error unless it starts with ok, or it is a redirection and batch is
+ * given, in which case it is noted in the batch.
+ */
+static int receiveReplies(Worker_t *w, int socketFd, int count, const char **ok, uint64_t start, int record,
+                          NodeBatch_t *batch) {
+    static __thread char replies[BUFFER_SIZE * 4];
+    int received = 0;
+    size_t used = 0;
+    while (received < count) {
+        ssize_t n = recv(socketFd, replies + used, sizeof(replies) - used, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        uint64_t now = nowNs();
+        used += n;
+        size_t lineStart = 0;
+        for (size_t i = 0; i < used; i++) {
+            if (replies[i] != '\n') {
+                continue;
+            }
+            if (record) {
+                histogramRecord(&w->latency, now - start);
+            }
+            if (batch != NULL && parseRedirect(w, replies + lineStart, i - lineStart, &batch->redirect[received],
+                                               &batch->ask[received])) {
+                // sent again once the replies of every node are in
+            } else if (strncmp(replies + lineStart, ok[received], strlen(ok[received])) != 0) {
+                w->errors++;
+            }
+            received++;
+            lineStart = i + 1;
+        }
+        // keep a partial reply for the next recv
+        memmove(replies, replies + lineStart, used - lineStart);
+        used -= lineStart;
+    }
+    return 0;
+}
+
+// send a batch of newline terminated commands and wait for one reply per command
+static int runPipeline(Worker_t *w, int socketFd, const char *batch, size_t len, int count, const char **ok,
+                       int record) {
+    uint64_t start = nowNs();
+    if (sendAll(socketFd, batch, len) != 0) {
+        return -1;
+    }
+    return receiveReplies(w, socketFd, count, ok, start, record, NULL);
+}
+
+static NodeBatch_t *createBatches(int depth) {
+    NodeBatch_t *batches = calloc(numNodes, sizeof(NodeBatch_t));
+    for (int i = 0; batches != NULL && i < numNodes; i++) {
+        batches[i].buf = malloc((size_t)depth * (BENCH_MAX_VALUE_SIZE + 64));
+    }
+    return batches;
+}
+
+static void deleteBatches(NodeBatch_t *batches) {
+    for (int i = 0; batches != NULL && i < numNodes; i++) {
+        free(batches[i].buf);
+    }
+    free(batches);
+}
+
+// queue a command for key on the node serving its slot
+static void batchAdd(Worker_t *w, NodeBatch_t *batches, uint64_t key, const char *ok, const char *fmt, ...) {
+    char name[32];
+    va_list args;
+    int namelen = sprintf(name, "key:%lu", key);
+    NodeBatch_t *b = &batches[w->slots[clusterKeySlot(name, namelen)]];
+    va_start(args, fmt);
+    b->len += vsprintf(b->buf + b->len, fmt, args);
+    va_end(args);
+    b->ok[b->count] = ok;
+    b->redirect[b->count] = -1;
+    b->starts[++b->count] = b->len;
+}
+
+// send the commands queued on every node, wait for all the replies and follow redirections
+static int runBatches(Worker_t *w, NodeBatch_t *batches, int record) {
+    uint64_t start = nowNs();
+    for (int n = 0; n < numNodes; n++) {
+        if (batches[n].count > 0 && sendAll(w->fds[n], batches[n].buf, batches[n].len) != 0) {
+            return -1;
+        }
+    }
+    for (int n = 0; n < numNodes; n++) {
+        if (batches[n].count > 0 &&
+            receiveReplies(w, w->fds[n], batches[n].count, batches[n].ok, start, record, &batches[n]) != 0) {
+            return -1;
+        }
+    }
+    for (int n = 0; n < numNodes; n++) {
+        NodeBatch_t *b = &batches[n];
+        for (int i = 0; i < b->count; i++) {
+            if (b->redirect[i] == -1) {
+                continue;
+            }
+            char command[BENCH_MAX_VALUE_SIZE + 128];
+            int len = sprintf(command, "%s%.*s", b->ask[i] ? "asking " : "", (int)(b->starts[i + 1] - b->starts[i]),
+                              b->buf + b->starts[i]);
+            w->redirects++;
+            if (runPipeline(w, w->fds[b->redirect[i]], command, len, 1, &b->ok[i], 0) != 0) {
+                return -1;
+            }
+        }
+        b->len = 0;
+        b->count = 0;
+    }
+    return 0;
+}
+
+// connect a worker to every node
+static int connectWorker(Worker_t *w) {
+    const char *ok[1] = {""};
+    memcpy(w->slots, slotNodes, sizeof(slotNodes));
+    for (int n = 0; n < numNodes; n++) {
+        w->fds[n] = connectToNode(n);
+        // a single command first so the server knows this connection terminates commands with newlines
+        if (w->fds[n] == -1 || runPipeline(w, w->fds[n], "select key:0\n", 13, 1, ok, 0) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void closeWorker(Worker_t *w) {
+    for (int n = 0; n < numNodes; n++) {
+        if (w->fds[n] > 0) {
+            close(w->fds[n]);
+        }
+    }
+}
+
+static void *runWorker(void *arg) {
+    Worker_t *w = arg;
+    NodeBatch_t *batches = createBatches(config.pipeline);
+    if (batches == NULL || connectWorker(w) != 0) {
+        fprintf(stderr, "Worker %d could not connect %d\n", w->id, errno);
+        w->errors = w->requests;
+        deleteBatches(batches);
+        closeWorker(w);
+        return NULL;
+    }
+    uint64_t sent = 0;
+    while (sent < w->requests) {
+        int count = 0;
+        while (count < config.pipeline && sent + count < w->requests) {
+            uint64_t key = nextKey(w);
+            if ((int)(nextRandom(&w->rng) % 100) < config.readRatio) {
+                batchAdd(w, batches, key, "{", "select key:%lu\n", key);
+            } else {
+                batchAdd(w, batches, key, "Key replaced", "replace key:%lu string %s\n", key, value);
+            }
+            count++;
+        }
+        if (runBatches(w, batches, 1) != 0) {
+            fprintf(stderr, "Worker %d lost its connection\n", w->id);
+            w->errors += w->requests - sent;
+            break;
+        }
+        sent += count;
+    }
+    deleteBatches(batches);
+    closeWorker(w);
+    return NULL;
+}
+
+// insert every key of the keyspace so reads hit and replaces succeed
+static int loadKeyspace() {
+    Worker_t *loader = calloc(1, sizeof(Worker_t));
+    NodeBatch_t *batches = createBatches(BENCH_MAX_PIPELINE);
+    int retval = loader == NULL || batches == NULL || connectWorker(loader) != 0 ? -1 : 0;
+    for (uint64_t key = 0; key < config.keyspace && retval == 0;) {
+        for (int count = 0; count < BENCH_MAX_PIPELINE && key < config.keyspace; count++, key++) {
+            // a key left over from a previous run against the same server is fine
+            batchAdd(loader, batches, key, "", "insert key:%lu string %s\n", key, value);
+        }
+        retval = runBatches(loader, batches, 0);
+    }
+    deleteBatches(batches);
+    if (loader != NULL) {
+        closeWorker(loader);
+    }
+    free(loader);
+    return retval;
+}
+
+// read the slot map from the first node
+static int loadSlotMap() {
+    char reply[BUFFER_SIZE * 4];
+    int socketFd = connectToNode(0);
+    if (socketFd == -1 || sendAll(socketFd, "cluster slots\n", 14) != 0) {
+        return -1;
+    }
+    size_t used = 0;
+    ssize_t n;
+    while (memchr(reply, '\n', used) == NULL && used < sizeof(reply) - 1 &&
+           (n = recv(socketFd, reply + used, sizeof(reply) - 1 - used, 0)) > 0) {
+        used += n;
+    }
+    reply[used] = '\0';
+    close(socketFd);
+    int first, last, len;
+    char addr[CLUSTER_MAX_ADDR_LEN];
+    int covered = 0;
+    for (const char *p = reply + 1; sscanf(p, "%d-%d: %63[^,}]%n", &first, &last, addr, &len) == 3; p += 2) {
+        int node = findNode(addr, 1);
+        if (node == -1 || first < 0 || last >= CLUSTER_SLOTS) {
+            return -1;
+        }
+        for (int slot = first; slot <= last; slot++) {
+            slotNodes[slot] = node;
+        }
+        covered += last - first + 1;
+        p += len;
+        if (*p != ',') {
+            break;
+        }
+    }
+    if (covered != CLUSTER_SLOTS) {
+        fprintf(stderr, "The cluster does not serve every slot: %s", reply);
+        return -1;
+    }
+    return 0;
+}
+
+static void printResults(Histogram_t *latency, uint64_t errors, uint64_t redirects, double seconds) {
+    double opsPerSec = latency->count / seconds;
+    const char *dist = config.dist == DIST_ZIPF ? "zipf" : "uniform";
+    double mean = latency->count ? (double)latency->sum / latency->count / 1000.0 : 0;
+    double min = latency->count ? latency->min / 1000.0 : 0;
+    const char *transport = overUnix ? "unix" : "tcp";
+    if (config.textOutput) {
+        printf("%lu requests over %s, %d connections, pipeline %d, %s keys over %lu, %d byte values, %d%% reads\n",
+               config.requests, transport, config.connections, config.pipeline, dist, config.keyspace,
+               config.valueSize, config.readRatio);
+        printf("%.2f seconds, %.0f ops/sec, %lu errors, %lu redirects\n", seconds, opsPerSec, errors, redirects);
+        printf("latency us: min %.1f mean %.1f p50 %.1f p99 %.1f p999 %.1f max %.1f\n", min, mean,
+               histogramPercentile(latency, 50) / 1000.0, histogramPercentile(latency, 99) / 1000.0,
+               histogramPercentile(latency, 99.9) / 1000.0, latency->max / 1000.0);
+        return;
+    }
+    printf("{\"transport\": \"%s\", \"requests\": %lu, \"connections\": %d, \"pipeline\": %d, \"distribution\": \"%s\", "
+           "\"keyspace\": %lu, \"value_size\": %d, \"read_ratio\": %d, \"seconds\": %.3f, \"ops_per_sec\": %.0f, "
+           "\"errors\": %lu, \"redirects\": %lu, \"latency_us\": {\"min\": %.1f, \"mean\": %.1f, \"p50\": %.1f, \"p99\": %.1f, "
+           "\"p999\": %.1f, \"max\": %.1f}}\n",
+           transport, config.requests, config.connections, config.pipeline, dist, config.keyspace, config.valueSize,
+           config.readRatio, seconds, opsPerSec, errors, redirects, min, mean, histogramPercentile(latency, 50) / 1000.0,
+           histogramPercentile(latency, 99) / 1000.0, histogramPercentile(latency, 99.9) / 1000.0,
+           latency->max / 1000.0);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -s, --server PATH      server executable to spawn (default ./db)\n"
+            "      --no-spawn         benchmark a server that is already running\n"
+            "  -p, --port PORT        server port (default %d)\n"
+            "  -c, --connections N    concurrent connections (default 4), a server that is already running must\n"
+            "                         allow as many clients\n"
+            "  -P, --pipeline N       commands in flight per connection (default 1)\n"
+            "  -n, --requests N       total requests (default 100000)\n"
+            "  -k, --keyspace N       number of distinct keys (default 10000)\n"
+            "  -d, --distribution D   uniform or zipf (default uniform)\n"
+            "      --zipf-theta T     skew of the zipf distribution (default 0.99)\n"
+            "  -v, --value-size N     bytes per value (default 64)\n"
+            "  -r, --read-ratio N     percentage of reads, the rest are replaces (default 90)\n"
+            "      --seed N           seed of the key and operation streams (default 1)\n"
+            "  -f, --format F         json or text (default json)\n"
+            "      --cluster          spread the keys over the cluster the server at --port is part of,\n"
+            "                         which must be running already\n"
+            "  -u, --unix PATH        connect to the unix socket of the server at PATH, @NAME for the abstract\n"
+            "                         namespace, a spawned server is told to listen on it\n"
+            "      --compare          run over TCP and then over --unix against the same server\n",
+            prog, SERVER_DEFAULT_PORT);
+}
+
+static int parseArgs(int argc, char *argv[]) {
+    static struct option options[] = {
+        {"server", required_argument, NULL, 's'},      {"no-spawn", no_argument, NULL, 'N'},
+        {"port", required_argument, NULL, 'p'},        {"connections", required_argument, NULL, 'c'},
+        {"pipeline", required_argument, NULL, 'P'},    {"requests", required_argument, NULL, 'n'},
+        {"keyspace", required_argument, NULL, 'k'},    {"distribution", required_argument, NULL, 'd'},
+        {"zipf-theta", required_argument, NULL, 'T'},  {"value-size", required_argument, NULL, 'v'},
+        {"read-ratio", required_argument, NULL, 'r'},  {"seed", required_argument, NULL, 'S'},
+        {"format", required_argument, NULL, 'f'},      {"cluster", no_argument, NULL, 'C'},
+        {"unix", required_argument, NULL, 'u'},        {"compare", no_argument, NULL, 'U'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "s:p:c:P:n:k:d:v:r:f:u:h", options, NULL)) != -1) {
+        switch (opt) {
+        case 's':
+            config.serverPath = optarg;
+            break;
+        case 'N':
+            config.serverPath = NULL;
+            break;
+        case 'p':
+            config.port = atoi(optarg);
+            break;
+        case 'c':
+            config.connections = atoi(optarg);
+            break;
+        case 'P':
+            config.pipeline = atoi(optarg);
+            break;
+        case 'n':
+            config.requests = strtoull(optarg, NULL, 10);
+            break;
+        case 'k':
+            config.keyspace = strtoull(optarg, NULL, 10);
+            break;
+        case 'd':
+            if (strcmp(optarg, "uniform") == 0) {
+                config.dist = DIST_UNIFORM;
+            } else if (strcmp(optarg, "zipf") == 0) {
+                config.dist = DIST_ZIPF;
+            } else {
+                return 1;
+            }
+            break;
+        case 'T':
+            config.zipfTheta = atof(optarg);
+            break;
+        case 'v':
+            config.valueSize = atoi(optarg);
+            break;
+        case 'r':
+            config.readRatio = atoi(optarg);
+            break;
+        case 'S':
+            config.seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'f':
+            if (strcmp(optarg, "json") == 0) {
+                config.textOutput = 0;
+            } else if (strcmp(optarg, "text") == 0) {
+                config.textOutput = 1;
+            } else {
+                return 1;
+            }
+            break;
+        case 'C':
+            config.cluster = 1;
+            config.serverPath = NULL;
+            break;
+        case 'u':
+            config.unixPath = optarg;
+            break;
+        case 'U':
+            config.compare = 1;
+            break;
+        default:
+            return 1;
+        }
+    }
+    if (config.connections < 1 || config.connections > BENCH_MAX_CONNECTIONS || config.pipeline < 1 ||
+        config.pipeline > BENCH_MAX_PIPELINE || config.keyspace < 2 || config.valueSize < 1 ||
+        config.valueSize > BENCH_MAX_VALUE_SIZE || config.readRatio < 0 || config.readRatio > 100 ||
+        config.zipfTheta <= 0 || config.zipfTheta >= 1) {
+        fprintf(stderr, "Invalid options, connections must be at most %d, pipeline at most %d, values at most %d "
+                        "bytes and the zipf theta between 0 and 1\n",
+                BENCH_MAX_CONNECTIONS, BENCH_MAX_PIPELINE, BENCH_MAX_VALUE_SIZE);
+        return 1;
+    }
+    if ((config.compare && config.unixPath == NULL) || (config.cluster && config.unixPath != NULL)) {
+        fprintf(stderr, "--compare needs --unix, and a cluster is only reached over TCP\n");
+        return 1;
+    }
+    return 0;
+}
+
+// drive the server from all connections, returns the number of errors
+static uint64_t runWorkers() {
+    Worker_t *workers = calloc(config.connections, sizeof(Worker_t));
+    uint64_t start = nowNs();
+    for (int i = 0; i < config.connections; i++) {
+        workers[i].id = i;
+        workers[i].requests = config.requests / config.connections + (i < config.requests % config.connections);
+        workers[i].rng = config.seed * 0x9E3779B97F4A7C15ULL + i + 1;
+        histogramInit(&workers[i].latency);
+        pthread_create(&workers[i].thread, NULL, runWorker, &workers[i]);
+    }
+    Histogram_t latency;
+    histogramInit(&latency);
+    uint64_t errors = 0;
+    uint64_t redirects = 0;
+    for (int i = 0; i < config.connections; i++) {
+        pthread_join(workers[i].thread, NULL);
+        histogramMerge(&latency, &workers[i].latency);
+        errors += workers[i].errors;
+        redirects += workers[i].redirects;
+    }
+    double seconds = (nowNs() - start) / 1e9;
+    printResults(&latency, errors, redirects, seconds);
+    free(workers);
+    return errors;
+}
+
+int main(int argc, char *argv[]) {
+    if (parseArgs(argc, argv) != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    value = malloc(config.valueSize + 1);
+    for (int i = 0; i < config.valueSize; i++) {
+        value[i] = 'a' + i % 26;
+    }
+    value[config.valueSize] = '\0';
+    if (config.dist == DIST_ZIPF) {
+        zipfInit(&zipf, config.keyspace, config.zipfTheta);
+    }
+
+    char seed[CLUSTER_MAX_ADDR_LEN];
+    sprintf(seed, "127.0.0.1:%d", config.port);
+    findNode(seed, 1);
+    // the server listens on its port before its unix socket, so once the unix socket takes connections both do
+    overUnix = config.unixPath != NULL;
+    if (config.serverPath != NULL && spawnServer() != 0) {
+        stopServer();
+        return 1;
+    }
+    if (config.cluster && loadSlotMap() != 0) {
+        fprintf(stderr, "Error reading the slot map from %s\n", seed);
+        return 1;
+    }
+    if (loadKeyspace() != 0) {
+        fprintf(stderr, "Error loading the keyspace\n");
+        stopServer();
+        return 1;
+    }
+
+    uint64_t errors = 0;
+    if (config.compare) {
+        overUnix = 0;
+        errors += runWorkers();
+        overUnix = 1;
+    }
+    errors += runWorkers();
+    stopServer();
+    free(value);
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,554 @@
+/*
+ * In-process microbenchmarks for the hashtable, the hash function and the structures built on them.
+ *
+ * Every benchmark is run once as warmup and then repeatedly on the CPU the harness is pinned to. Wall
+ * time and, where perf_event_open is permitted, cycles, instructions, LLC misses and branch misses are
+ * reported per operation as the median over the repetitions. Table sizes go from L1 resident to 10x the
+ * last level cache. Results are printed as a single JSON object.
+ *
+ */
+
+#define _GNU_SOURCE
+#include "../src/art.h"
+#include "../src/hashtable.h"
+#include "../src/lz4.h"
+#include "../src/siphash.h"
+#include <errno.h>
+#include <getopt.h>
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// rough memory footprint of a key in the table: the entry, its key and its bucket pointer
+#define BYTES_PER_KEY 96
+#define MAX_REPS 101
+#define MAX_SIZES 16
+// lookups per repetition for the benchmarks that don't touch every key once
+#define MIN_OPS 200000
+#define NUM_COUNTERS 4
+
+typedef struct Counters {
+    int fds[NUM_COUNTERS]; /* fds[0] leads the group, -1 when the counter isn't available */
+    int available;
+} Counters_t;
+
+static const char *counterNames[NUM_COUNTERS] = {"cycles", "instructions", "llc_misses", "branch_misses"};
+static const uint64_t counterConfigs[NUM_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+typedef struct Measurement {
+    double nsPerOp;
+    double counters[NUM_COUNTERS]; /* Per operation */
+} Measurement_t;
+
+// state shared by the setup, run and teardown of a benchmark
+typedef struct BenchCtx {
+    uint64_t n;         /* Keys in the table */
+    char **keys;        /* n keys plus n keys that are never inserted */
+    uint64_t *order;    /* Random permutation of the n keys */
+    Hashtable_t *ht;
+    Art_t *art;
+    size_t size;        /* Input size of the siphash and lz4 benchmarks */
+    char *buf;
+    char *out;
+    size_t outlen;
+} BenchCtx_t;
+
+typedef struct Benchmark {
+    const char *name;
+    void (*setup)(BenchCtx_t *ctx);
+    uint64_t (*run)(BenchCtx_t *ctx); /* Returns the number of operations done */
+    void (*teardown)(BenchCtx_t *ctx);
+} Benchmark_t;
+
+static int reps = 11;
+static int cpu = -1;
+static uint64_t maxKeys = 1 << 22;
+static uint64_t sizes[MAX_SIZES];
+static int numSizes = 0;
+static Counters_t counters;
+static volatile uint64_t sink;
+
+static uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t nextRandom(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static void countersOpen(Counters_t *c) {
+    c->available = 1;
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = counterConfigs[i];
+        attr.disabled = i == 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        c->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : c->fds[0], 0);
+        if (c->fds[i] == -1) {
+            c->available = 0;
+        }
+    }
+    if (!c->available) {
+        fprintf(stderr, "Hardware counters not available (%s), only reporting time\n", strerror(errno));
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            if (c->fds[i] != -1) {
+                close(c->fds[i]);
+            }
+        }
+    }
+}
+
+static void countersStart(Counters_t *c) {
+    if (c->available) {
+        ioctl(c->fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(c->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+static void countersStop(Counters_t *c, uint64_t values[NUM_COUNTERS]) {
+    memset(values, 0, NUM_COUNTERS * sizeof(uint64_t));
+    if (c->available) {
+        ioctl(c->fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        // group read format: number of counters followed by their values
+        uint64_t data[NUM_COUNTERS + 1];
+        if (read(c->fds[0], data, sizeof(data)) == sizeof(data)) {
+            memcpy(values, data + 1, NUM_COUNTERS * sizeof(uint64_t));
+        }
+    }
+}
+
+static void pinToCpu() {
+    if (cpu < 0) {
+        cpu = sched_getcpu();
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        fprintf(stderr, "Could not pin to cpu %d: %s\n", cpu, strerror(errno));
+    }
+}
+
+static long cacheSize(int name, long fallback) {
+    long size = sysconf(name);
+    return size > 0 ? size : fallback;
+}
+
+static void fillTable(BenchCtx_t *ctx) {
+    ctx->ht = htCreateTable();
+    HashtableValue_t htv;
+    htv.entryType = UNSIGNED_INT;
+    for (uint64_t i = 0; i < ctx->n; i++) {
+        htv.v.u64 = i;
+        htAdd(ctx->ht, ctx->keys[i], strlen(ctx->keys[i]), htv);
+    }
+}
+
+static void deleteTable(BenchCtx_t *ctx) {
+    htDeleteTable(ctx->ht);
+    ctx->ht = NULL;
+}
+
+static uint64_t runFind(BenchCtx_t *ctx) {
+    uint64_t ops = ctx->n > MIN_OPS ? ctx->n : MIN_OPS;
+    uint64_t found = 0;
+    for (uint64_t i = 0; i < ops; i++) {
+        const char *key = ctx->keys[ctx->order[i % ctx->n]];
+        found += htFind(ctx->ht, key, strlen(key)).entryType == NONE ? 0 : 1;
+    }
+    sink = found;
+    return ops;
+}
+
+static uint64_t runFindMiss(BenchCtx_t *ctx) {
+    uint64_t ops = ctx->n > MIN_OPS ? ctx->n : MIN_OPS;
+    uint64_t found = 0;
+    for (uint64_t i = 0; i < ops; i++) {
+        const char *key = ctx->keys[ctx->n + ctx->order[i % ctx->n]];
+        found += htFind(ctx->ht, key, strlen(key)).entryType == NONE ? 0 : 1;
+    }
+    sink = found;
+    return ops;
+}
+
+static void createTable(BenchCtx_t *ctx) {
+    ctx->ht = htCreateTable();
+}
+
+static uint64_t runAdd(BenchCtx_t *ctx) {
+    HashtableValue_t htv;
+    htv.entryType = UNSIGNED_INT;
+    for (uint64_t i = 0; i < ctx->n; i++) {
+        const char *key = ctx->keys[ctx->order[i]];
+        htv.v.u64 = i;
+        htAdd(ctx->ht, key, strlen(key), htv);
+    }
+    return ctx->n;
+}
+
+static uint64_t runRemove(BenchCtx_t *ctx) {
+    for (uint64_t i = 0; i < ctx->n; i++) {
+        const char *key = ctx->keys[ctx->order[i]];
+        htRemove(ctx->ht, key, strlen(key));
+    }
+    return ctx->n;
+}
+
+static uint64_t runReplace(BenchCtx_t *ctx) {
+    HashtableValue_t htv;
+    htv.entryType = UNSIGNED_INT;
+    for (uint64_t i = 0; i < ctx->n; i++) {
+        const char *key = ctx->keys[ctx->order[i]];
+        htv.v.u64 = i + 1;
+        htReplace(ctx->ht, key, strlen(key), htv);
+    }
+    return ctx->n;
+}
+
+// the cost of a rehash is reported per entry moved
+static uint64_t runExpand(BenchCtx_t *ctx) {
+    htExpandAndRehash(ctx->ht);
+    return ctx->n;
+}
+
+static void fillArt(BenchCtx_t *ctx) {
+    ctx->art = artCreate();
+    for (uint64_t i = 0; i < ctx->n; i++) {
+        artInsert(ctx->art, ctx->keys[i], strlen(ctx->keys[i]));
+    }
+}
+
+static void deleteArt(BenchCtx_t *ctx) {
+    artDelete(ctx->art);
+    ctx->art = NULL;
+}
+
+static int countKey(const char *key, size_t keylen, void *arg) {
+    uint64_t *count = arg;
+    return ++*count >= 100;
+}
+
+// scans of 100 keys starting at random keys, reported per scan
+static uint64_t runArtScan(BenchCtx_t *ctx) {
+    uint64_t ops = MIN_OPS / 10;
+    uint64_t visited = 0;
+    for (uint64_t i = 0; i < ops; i++) {
+        const char *start = ctx->keys[ctx->order[i % ctx->n]];
+        uint64_t count = 0;
+        artScan(ctx->art, start, strlen(start), 0, countKey, &count);
+        visited += count;
+    }
+    sink = visited;
+    return ops;
+}
+
+typedef struct PrefixPage {
+    uint64_t count;
+    char last[24]; /* Cursor the next page resumes after */
+    size_t lastlen;
+} PrefixPage_t;
+
+// a page of keys under the prefix scanned by runArtPrefixScan
+static int collectPrefixKey(const char *key, size_t keylen, void *arg) {
+    PrefixPage_t *page = arg;
+    if (keylen < 5 || memcmp(key, "key:1", 5) != 0) {
+        return 1;
+    }
+    memcpy(page->last, key, keylen);
+    page->lastlen = keylen;
+    return ++page->count >= 100;
+}
+
+// every key under one prefix, about a ninth of the keyspace, in pages of 100 resumed from a cursor like the
+// prefix command does, reported per key
+static uint64_t runArtPrefixScan(BenchCtx_t *ctx) {
+    uint64_t visited = 0;
+    PrefixPage_t page = {0};
+    artScan(ctx->art, "key:1", 5, 0, collectPrefixKey, &page);
+    while (page.count == 100) {
+        char cursor[24];
+        size_t cursorlen = page.lastlen;
+        memcpy(cursor, page.last, cursorlen);
+        visited += page.count;
+        page.count = 0;
+        artScan(ctx->art, cursor, cursorlen, 1, collectPrefixKey, &page);
+    }
+    visited += page.count;
+    sink = visited;
+    return visited > 0 ? visited : 1;
+}
+
+static void createBuffers(BenchCtx_t *ctx) {
+    ctx->buf = malloc(ctx->size);
+    ctx->outlen = LZ4_COMPRESSBOUND(ctx->size);
+    ctx->out = malloc(ctx->outlen);
+    // JSON documents, a typical value for clients to store
+    size_t off = 0;
+    for (int i = 0; off < ctx->size; i++) {
+        int n = snprintf(ctx->buf + off, ctx->size - off, "{\"id\": %d, \"name\": \"user%d\", \"active\": %s}, ", i,
+                         i % 97, i % 3 ? "true" : "false");
+        off += n < ctx->size - off ? n : ctx->size - off;
+    }
+}
+
+static void freeBuffers(BenchCtx_t *ctx) {
+    free(ctx->buf);
+    free(ctx->out);
+}
+
+static uint64_t runSiphash(BenchCtx_t *ctx) {
+    static const uint8_t k[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+    uint64_t ops = MIN_OPS;
+    uint64_t hash, acc = 0;
+    for (uint64_t i = 0; i < ops; i++) {
+        ctx->buf[0] = i;
+        siphash(ctx->buf, ctx->size, k, (uint8_t *)&hash, sizeof(hash));
+        acc ^= hash;
+    }
+    sink = acc;
+    return ops;
+}
+
+// compression is reported per input byte
+static uint64_t runLz4Compress(BenchCtx_t *ctx) {
+    uint64_t ops = MIN_OPS * 64 / ctx->size + 1;
+    for (uint64_t i = 0; i < ops; i++) {
+        ctx->outlen = lz4Compress(ctx->buf, ctx->size, ctx->out, LZ4_COMPRESSBOUND(ctx->size));
+    }
+    return ops * ctx->size;
+}
+
+static void createCompressed(BenchCtx_t *ctx) {
+    createBuffers(ctx);
+    ctx->outlen = lz4Compress(ctx->buf, ctx->size, ctx->out, LZ4_COMPRESSBOUND(ctx->size));
+}
+
+static uint64_t runLz4Decompress(BenchCtx_t *ctx) {
+    uint64_t ops = MIN_OPS * 64 / ctx->size + 1;
+    long total = 0;
+    for (uint64_t i = 0; i < ops; i++) {
+        total += lz4Decompress(ctx->out, ctx->outlen, ctx->buf, ctx->size);
+    }
+    sink = total;
+    return ops * ctx->size;
+}
+
+static int cmpDouble(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double median(double *values, int count) {
+    qsort(values, count, sizeof(double), cmpDouble);
+    return values[count / 2];
+}
+
+static Measurement_t measure(const Benchmark_t *bench, BenchCtx_t *ctx) {
+    double ns[MAX_REPS];
+    double perOp[NUM_COUNTERS][MAX_REPS];
+    // warmup, also faults in the memory the benchmark touches
+    bench->setup(ctx);
+    bench->run(ctx);
+    bench->teardown(ctx);
+    for (int r = 0; r < reps; r++) {
+        uint64_t values[NUM_COUNTERS];
+        bench->setup(ctx);
+        countersStart(&counters);
+        uint64_t start = nowNs();
+        uint64_t ops = bench->run(ctx);
+        uint64_t end = nowNs();
+        countersStop(&counters, values);
+        bench->teardown(ctx);
+        ns[r] = (double)(end - start) / ops;
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            perOp[i][r] = (double)values[i] / ops;
+        }
+    }
+    Measurement_t m;
+    m.nsPerOp = median(ns, reps);
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        m.counters[i] = median(perOp[i], reps);
+    }
+    return m;
+}
+
+static int first = 1;
+
+static void printMeasurement(const char *name, const char *param, uint64_t value, Measurement_t m, double ratio) {
+    printf("%s\n    {\"op\": \"%s\", \"%s\": %lu, \"ns_per_op\": %.2f", first ? "" : ",", name, param, value, m.nsPerOp);
+    first = 0;
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        if (counters.available) {
+            printf(", \"%s_per_op\": %.3f", counterNames[i], m.counters[i]);
+        } else {
+            printf(", \"%s_per_op\": null", counterNames[i]);
+        }
+    }
+    if (ratio > 0) {
+        printf(", \"ratio\": %.3f", ratio);
+    }
+    printf("}");
+    fflush(stdout);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -r, --reps N        measured repetitions of every benchmark (default 11)\n"
+            "  -c, --cpu N         cpu to pin to (default the current one)\n"
+            "  -s, --size N        table size in keys, repeat for several sizes (default L1 to 10x LLC)\n"
+            "  -m, --max-keys N    cap on the default table sizes (default %lu)\n",
+            prog, maxKeys);
+}
+
+static int parseArgs(int argc, char *argv[]) {
+    static struct option options[] = {
+        {"reps", required_argument, NULL, 'r'}, {"cpu", required_argument, NULL, 'c'},
+        {"size", required_argument, NULL, 's'}, {"max-keys", required_argument, NULL, 'm'},
+        {"help", no_argument, NULL, 'h'},       {NULL, 0, NULL, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "r:c:s:m:h", options, NULL)) != -1) {
+        switch (opt) {
+        case 'r':
+            reps = atoi(optarg);
+            break;
+        case 'c':
+            cpu = atoi(optarg);
+            break;
+        case 's':
+            if (numSizes == MAX_SIZES) {
+                return 1;
+            }
+            sizes[numSizes++] = strtoull(optarg, NULL, 10);
+            break;
+        case 'm':
+            maxKeys = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            return 1;
+        }
+    }
+    for (int i = 0; i < numSizes; i++) {
+        if (sizes[i] < 2) {
+            return 1;
+        }
+    }
+    return reps < 1 || reps > MAX_REPS || maxKeys < 2;
+}
+
+int main(int argc, char *argv[]) {
+    if (parseArgs(argc, argv) != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    pinToCpu();
+    countersOpen(&counters);
+
+    long l1 = cacheSize(_SC_LEVEL1_DCACHE_SIZE, 32 * 1024);
+    long l2 = cacheSize(_SC_LEVEL2_CACHE_SIZE, 1024 * 1024);
+    long llc = cacheSize(_SC_LEVEL3_CACHE_SIZE, l2);
+    if (numSizes == 0) {
+        // half of each cache so the table stays resident, then well past the last level
+        long bytes[] = {l1 / 2, l2 / 2, llc / 2, llc * 10};
+        for (int i = 0; i < 4; i++) {
+            uint64_t n = bytes[i] / BYTES_PER_KEY;
+            n = n < 2 ? 2 : n;
+            n = n > maxKeys ? maxKeys : n;
+            if (numSizes == 0 || n > sizes[numSizes - 1]) {
+                sizes[numSizes++] = n;
+            }
+        }
+    }
+
+    printf("{\"cpu\": %d, \"reps\": %d, \"l1d_bytes\": %ld, \"l2_bytes\": %ld, \"llc_bytes\": %ld, "
+           "\"counters\": %s, \"results\": [",
+           cpu, reps, l1, l2, llc, counters.available ? "true" : "false");
+
+    const Benchmark_t tableBenchmarks[] = {
+        {"htFind", fillTable, runFind, deleteTable},
+        {"htFindMiss", fillTable, runFindMiss, deleteTable},
+        {"htAdd", createTable, runAdd, deleteTable},
+        {"htRemove", fillTable, runRemove, deleteTable},
+        {"htReplace", fillTable, runReplace, deleteTable},
+        {"htExpandAndRehash", fillTable, runExpand, deleteTable},
+        {"artScan100", fillArt, runArtScan, deleteArt},
+        {"artPrefixScan", fillArt, runArtPrefixScan, deleteArt},
+    };
+    for (int s = 0; s < numSizes; s++) {
+        BenchCtx_t ctx = {0};
+        ctx.n = sizes[s];
+        ctx.keys = malloc(2 * ctx.n * sizeof(char *));
+        ctx.order = malloc(ctx.n * sizeof(uint64_t));
+        for (uint64_t i = 0; i < 2 * ctx.n; i++) {
+            ctx.keys[i] = malloc(24);
+            sprintf(ctx.keys[i], "%s:%lu", i < ctx.n ? "key" : "missing", i);
+        }
+        // shuffle the access order so the hardware prefetcher can't follow the allocation order
+        uint64_t rng = 42;
+        for (uint64_t i = 0; i < ctx.n; i++) {
+            ctx.order[i] = i;
+        }
+        for (uint64_t i = ctx.n - 1; i > 0; i--) {
+            uint64_t j = nextRandom(&rng) % (i + 1);
+            uint64_t tmp = ctx.order[i];
+            ctx.order[i] = ctx.order[j];
+            ctx.order[j] = tmp;
+        }
+        for (int b = 0; b < sizeof(tableBenchmarks) / sizeof(tableBenchmarks[0]); b++) {
+            printMeasurement(tableBenchmarks[b].name, "keys", ctx.n, measure(&tableBenchmarks[b], &ctx), 0);
+        }
+        for (uint64_t i = 0; i < 2 * ctx.n; i++) {
+            free(ctx.keys[i]);
+        }
+        free(ctx.keys);
+        free(ctx.order);
+    }
+
+    const Benchmark_t siphashBenchmark = {"siphash", createBuffers, runSiphash, freeBuffers};
+    const size_t keySizes[] = {8, 16, 32, 64, 256, 1024};
+    for (int i = 0; i < sizeof(keySizes) / sizeof(keySizes[0]); i++) {
+        BenchCtx_t ctx = {0};
+        ctx.size = keySizes[i];
+        printMeasurement(siphashBenchmark.name, "bytes", ctx.size, measure(&siphashBenchmark, &ctx), 0);
+    }
+
+    const Benchmark_t lz4Benchmarks[] = {
+        {"lz4Compress", createBuffers, runLz4Compress, freeBuffers},
+        {"lz4Decompress", createCompressed, runLz4Decompress, freeBuffers},
+    };
+    const size_t valueSizes[] = {256, 4096, 65536};
+    for (int i = 0; i < sizeof(valueSizes) / sizeof(valueSizes[0]); i++) {
+        for (int b = 0; b < 2; b++) {
+            BenchCtx_t ctx = {0};
+            ctx.size = valueSizes[i];
+            createCompressed(&ctx);
+            double ratio = (double)ctx.outlen / ctx.size;
+            freeBuffers(&ctx);
+            printMeasurement(lz4Benchmarks[b].name, "bytes", ctx.size, measure(&lz4Benchmarks[b], &ctx), ratio);
+        }
+    }
+    printf("\n]}\n");
+    return 0;
+}
@@ -0,0 +1,607 @@
+#include "art.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Leaves are stored in child slots as tagged pointers, the lowest bit is set for leaves
+#define IS_LEAF(p) (((uintptr_t)(p)) & 1)
+#define TO_LEAF(p) ((ArtLeaf_t *)((uintptr_t)(p) & ~(uintptr_t)1))
+#define FROM_LEAF(l) ((void *)((uintptr_t)(l) | 1))
+
+static ArtLeaf_t *artCreateLeaf(const uint8_t *key, size_t keylen) {
+    ArtLeaf_t *l = malloc(sizeof(ArtLeaf_t) + keylen);
+    l->keylen = keylen;
+    memcpy(l->key, key, keylen);
+    return l;
+}
+
+static int artLeafMatches(ArtLeaf_t *l, const uint8_t *key, size_t keylen) {
+    return l->keylen == keylen && memcmp(l->key, key, keylen) == 0;
+}
+
+static ArtNode_t *artCreateNode(ArtNodeType_t type) {
+    ArtNode_t *n;
+    switch (type) {
+    case NODE4:
+        n = calloc(1, sizeof(ArtNode4_t));
+        break;
+    case NODE16:
+        n = calloc(1, sizeof(ArtNode16_t));
+        break;
+    case NODE48:
+        n = calloc(1, sizeof(ArtNode48_t));
+        break;
+    default:
+        n = calloc(1, sizeof(ArtNode256_t));
+        break;
+    }
+    n->type = type;
+    return n;
+}
+
+static void artSetPrefix(ArtNode_t *n, const uint8_t *prefix, size_t prefixlen) {
+    uint8_t *newPrefix = NULL;
+    if (prefixlen > 0) {
+        newPrefix = malloc(prefixlen);
+        memcpy(newPrefix, prefix, prefixlen);
+    }
+    free(n->prefix);
+    n->prefix = newPrefix;
+    n->prefixlen = prefixlen;
+}
+
+// compare the first len bytes of the node's path with key, like memcmp
+static int artPrefixCmp(ArtNode_t *n, const uint8_t *key, size_t len) {
+    return len > 0 ? memcmp(n->prefix, key, len) : 0;
+}
+
+// move the header of a node being grown or shrunk into its replacement
+static void artCopyHeader(ArtNode_t *dst, ArtNode_t *src) {
+    dst->numChildren = src->numChildren;
+    dst->prefixlen = src->prefixlen;
+    dst->prefix = src->prefix;
+    dst->leaf = src->leaf;
+}
+
+// returns the slot holding the child for the byte, or NULL if there is no such child
+static void **artFindChild(ArtNode_t *n, uint8_t b) {
+    switch (n->type) {
+    case NODE4: {
+        ArtNode4_t *n4 = (ArtNode4_t *)n;
+        for (int i = 0; i < n->numChildren; i++) {
+            if (n4->keys[i] == b) {
+                return &n4->children[i];
+            }
+        }
+        return NULL;
+    }
+    case NODE16: {
+        ArtNode16_t *n16 = (ArtNode16_t *)n;
+        for (int i = 0; i < n->numChildren; i++) {
+            if (n16->keys[i] == b) {
+                return &n16->children[i];
+            }
+        }
+        return NULL;
+    }
+    case NODE48: {
+        ArtNode48_t *n48 = (ArtNode48_t *)n;
+        if (n48->childIndex[b] == 0) {
+            return NULL;
+        }
+        return &n48->children[n48->childIndex[b] - 1];
+    }
+    default: {
+        ArtNode256_t *n256 = (ArtNode256_t *)n;
+        return n256->children[b] != NULL ? &n256->children[b] : NULL;
+    }
+    }
+}
+
+// insert into a sorted keys/children array with room for one more child
+static void artSortedInsert(uint8_t *keys, void **children, int num, uint8_t b, void *child) {
+    int pos = 0;
+    while (pos < num && keys[pos] < b) {
+        pos++;
+    }
+    memmove(keys + pos + 1, keys + pos, num - pos);
+    memmove(children + pos + 1, children + pos, (num - pos) * sizeof(void *));
+    keys[pos] = b;
+    children[pos] = child;
+}
+
+// add a child to the node referenced by ref, growing the node (and updating ref) if it is full
+static void artAddChild(void **ref, ArtNode_t *n, uint8_t b, void *child) {
+    switch (n->type) {
+    case NODE4: {
+        ArtNode4_t *n4 = (ArtNode4_t *)n;
+        if (n->numChildren < 4) {
+            artSortedInsert(n4->keys, n4->children, n->numChildren, b, child);
+            n->numChildren++;
+            return;
+        }
+        ArtNode16_t *n16 = (ArtNode16_t *)artCreateNode(NODE16);
+        artCopyHeader(&n16->n, n);
+        memcpy(n16->keys, n4->keys, sizeof(n4->keys));
+        memcpy(n16->children, n4->children, sizeof(n4->children));
+        *ref = n16;
+        free(n4);
+        artAddChild(ref, &n16->n, b, child);
+        return;
+    }
+    case NODE16: {
+        ArtNode16_t *n16 = (ArtNode16_t *)n;
+        if (n->numChildren < 16) {
+            artSortedInsert(n16->keys, n16->children, n->numChildren, b, child);
+            n->numChildren++;
+            return;
+        }
+        ArtNode48_t *n48 = (ArtNode48_t *)artCreateNode(NODE48);
+        artCopyHeader(&n48->n, n);
+        for (int i = 0; i < n->numChildren; i++) {
+            n48->childIndex[n16->keys[i]] = i + 1;
+            n48->children[i] = n16->children[i];
+        }
+        *ref = n48;
+        free(n16);
+        artAddChild(ref, &n48->n, b, child);
+        return;
+    }
+    case NODE48: {
+        ArtNode48_t *n48 = (ArtNode48_t *)n;
+        if (n->numChildren < 48) {
+            int pos = 0;
+            while (n48->children[pos] != NULL) {
+                pos++;
+            }
+            n48->children[pos] = child;
+            n48->childIndex[b] = pos + 1;
+            n->numChildren++;
+            return;
+        }
+        ArtNode256_t *n256 = (ArtNode256_t *)artCreateNode(NODE256);
+        artCopyHeader(&n256->n, n);
+        for (int i = 0; i < 256; i++) {
+            if (n48->childIndex[i] != 0) {
+                n256->children[i] = n48->children[n48->childIndex[i] - 1];
+            }
+        }
+        *ref = n256;
+        free(n48);
+        artAddChild(ref, &n256->n, b, child);
+        return;
+    }
+    default: {
+        ArtNode256_t *n256 = (ArtNode256_t *)n;
+        n256->children[b] = child;
+        n->numChildren++;
+        return;
+    }
+    }
+}
+
+// remove the child for the byte from the node referenced by ref, shrinking the node (and updating ref)
+// once it gets small enough
+static void artRemoveChild(void **ref, ArtNode_t *n, uint8_t b) {
+    switch (n->type) {
+    case NODE4: {
+        ArtNode4_t *n4 = (ArtNode4_t *)n;
+        int pos = 0;
+        while (n4->keys[pos] != b) {
+            pos++;
+        }
+        memmove(n4->keys + pos, n4->keys + pos + 1, n->numChildren - pos - 1);
+        memmove(n4->children + pos, n4->children + pos + 1, (n->numChildren - pos - 1) * sizeof(void *));
+        n->numChildren--;
+        return;
+    }
+    case NODE16: {
+        ArtNode16_t *n16 = (ArtNode16_t *)n;
+        int pos = 0;
+        while (n16->keys[pos] != b) {
+            pos++;
+        }
+        memmove(n16->keys + pos, n16->keys + pos + 1, n->numChildren - pos - 1);
+        memmove(n16->children + pos, n16->children + pos + 1, (n->numChildren - pos - 1) * sizeof(void *));
+        n->numChildren--;
+        if (n->numChildren == 3) {
+            ArtNode4_t *n4 = (ArtNode4_t *)artCreateNode(NODE4);
+            artCopyHeader(&n4->n, n);
+            memcpy(n4->keys, n16->keys, 3);
+            memcpy(n4->children, n16->children, 3 * sizeof(void *));
+            *ref = n4;
+            free(n16);
+        }
+        return;
+    }
+    case NODE48: {
+        ArtNode48_t *n48 = (ArtNode48_t *)n;
+        n48->children[n48->childIndex[b] - 1] = NULL;
+        n48->childIndex[b] = 0;
+        n->numChildren--;
+        if (n->numChildren == 12) {
+            ArtNode16_t *n16 = (ArtNode16_t *)artCreateNode(NODE16);
+            artCopyHeader(&n16->n, n);
+            int pos = 0;
+            for (int i = 0; i < 256; i++) {
+                if (n48->childIndex[i] != 0) {
+                    n16->keys[pos] = i;
+                    n16->children[pos] = n48->children[n48->childIndex[i] - 1];
+                    pos++;
+                }
+            }
+            *ref = n16;
+            free(n48);
+        }
+        return;
+    }
+    default: {
+        ArtNode256_t *n256 = (ArtNode256_t *)n;
+        n256->children[b] = NULL;
+        n->numChildren--;
+        if (n->numChildren == 37) {
+            ArtNode48_t *n48 = (ArtNode48_t *)artCreateNode(NODE48);
+            artCopyHeader(&n48->n, n);
+            int pos = 0;
+            for (int i = 0; i < 256; i++) {
+                if (n256->children[i] != NULL) {
+                    n48->children[pos] = n256->children[i];
+                    n48->childIndex[i] = pos + 1;
+                    pos++;
+                }
+            }
+            *ref = n48;
+            free(n256);
+        }
+        return;
+    }
+    }
+}
+
+// store a leaf in the node referenced by ref, depth being the number of key bytes consumed by the node's path
+static void artPlaceLeaf(void **ref, ArtLeaf_t *l, size_t depth) {
+    ArtNode_t *n = *ref;
+    if (l->keylen == depth) {
+        n->leaf = l;
+    } else {
+        artAddChild(ref, n, (uint8_t)l->key[depth], FROM_LEAF(l));
+    }
+}
+
+// collapse a node that is left with a single key or child after a removal (path compression)
+static void artCompact(void **ref) {
+    ArtNode_t *n = *ref;
+    if (n->numChildren == 0) {
+        *ref = n->leaf != NULL ? FROM_LEAF(n->leaf) : NULL;
+        free(n->prefix);
+        free(n);
+        return;
+    }
+    if (n->numChildren > 1 || n->leaf != NULL || n->type != NODE4) {
+        return;
+    }
+    ArtNode4_t *n4 = (ArtNode4_t *)n;
+    void *child = n4->children[0];
+    if (!IS_LEAF(child)) {
+        // prepend the path of this node and the byte leading to the child to the child's path
+        ArtNode_t *c = child;
+        size_t prefixlen = n->prefixlen + 1 + c->prefixlen;
+        uint8_t *prefix = malloc(prefixlen);
+        if (n->prefixlen > 0) {
+            memcpy(prefix, n->prefix, n->prefixlen);
+        }
+        prefix[n->prefixlen] = n4->keys[0];
+        if (c->prefixlen > 0) {
+            memcpy(prefix + n->prefixlen + 1, c->prefix, c->prefixlen);
+        }
+        free(c->prefix);
+        c->prefix = prefix;
+        c->prefixlen = prefixlen;
+    }
+    *ref = child;
+    free(n->prefix);
+    free(n);
+}
+
+static void artDeleteNode(void *p) {
+    if (p == NULL) {
+        return;
+    }
+    if (IS_LEAF(p)) {
+        free(TO_LEAF(p));
+        return;
+    }
+    ArtNode_t *n = p;
+    switch (n->type) {
+    case NODE4:
+        for (int i = 0; i < n->numChildren; i++) {
+            artDeleteNode(((ArtNode4_t *)n)->children[i]);
+        }
+        break;
+    case NODE16:
+        for (int i = 0; i < n->numChildren; i++) {
+            artDeleteNode(((ArtNode16_t *)n)->children[i]);
+        }
+        break;
+    case NODE48:
+        for (int i = 0; i < 48; i++) {
+            artDeleteNode(((ArtNode48_t *)n)->children[i]);
+        }
+        break;
+    default:
+        for (int i = 0; i < 256; i++) {
+            artDeleteNode(((ArtNode256_t *)n)->children[i]);
+        }
+        break;
+    }
+    free(n->leaf);
+    free(n->prefix);
+    free(n);
+}
+
+Art_t *artCreate() {
+    Art_t *art = malloc(sizeof(Art_t));
+    if (art) {
+        art->root = NULL;
+        art->len = 0;
+    }
+    return art;
+}
+
+void artDelete(Art_t *art) {
+    artDeleteNode(art->root);
+    free(art);
+}
+
+static int artInsertRec(void **ref, const uint8_t *key, size_t keylen, size_t depth) {
+    void *p = *ref;
+    if (p == NULL) {
+        *ref = FROM_LEAF(artCreateLeaf(key, keylen));
+        return 0;
+    }
+    if (IS_LEAF(p)) {
+        ArtLeaf_t *l = TO_LEAF(p);
+        if (artLeafMatches(l, key, keylen)) {
+            return 1;
+        }
+        // replace the leaf with a node holding both keys, the node's path is their common prefix
+        size_t max = (l->keylen < keylen ? l->keylen : keylen) - depth;
+        size_t lcp = 0;
+        while (lcp < max && (uint8_t)l->key[depth + lcp] == key[depth + lcp]) {
+            lcp++;
+        }
+        void *newRef = artCreateNode(NODE4);
+        artSetPrefix(newRef, key + depth, lcp);
+        artPlaceLeaf(&newRef, l, depth + lcp);
+        artPlaceLeaf(&newRef, artCreateLeaf(key, keylen), depth + lcp);
+        *ref = newRef;
+        return 0;
+    }
+
+    ArtNode_t *n = p;
+    size_t max = n->prefixlen < keylen - depth ? n->prefixlen : keylen - depth;
+    size_t m = 0;
+    while (m < max && n->prefix[m] == key[depth + m]) {
+        m++;
+    }
+    if (m < n->prefixlen) {
+        // the key diverges inside the compressed path, split the path at the divergence
+        void *newRef = artCreateNode(NODE4);
+        artSetPrefix(newRef, n->prefix, m);
+        uint8_t b = n->prefix[m];
+        artSetPrefix(n, n->prefix + m + 1, n->prefixlen - m - 1);
+        artAddChild(&newRef, newRef, b, n);
+        artPlaceLeaf(&newRef, artCreateLeaf(key, keylen), depth + m);
+        *ref = newRef;
+        return 0;
+    }
+    depth += n->prefixlen;
+    if (keylen == depth) {
+        if (n->leaf != NULL) {
+            return 1;
+        }
+        n->leaf = artCreateLeaf(key, keylen);
+        return 0;
+    }
+    void **child = artFindChild(n, key[depth]);
+    if (child != NULL) {
+        return artInsertRec(child, key, keylen, depth + 1);
+    }
+    artAddChild(ref, n, key[depth], FROM_LEAF(artCreateLeaf(key, keylen)));
+    return 0;
+}
+
+int artInsert(Art_t *art, const char *key, size_t keylen) {
+    if (artInsertRec(&art->root, (const uint8_t *)key, keylen, 0) != 0) {
+        return 1;
+    }
+    art->len++;
+    return 0;
+}
+
+static int artRemoveRec(void **ref, const uint8_t *key, size_t keylen, size_t depth) {
+    void *p = *ref;
+    if (p == NULL) {
+        return 1;
+    }
+    if (IS_LEAF(p)) {
+        if (!artLeafMatches(TO_LEAF(p), key, keylen)) {
+            return 1;
+        }
+        free(TO_LEAF(p));
+        *ref = NULL;
+        return 0;
+    }
+
+    ArtNode_t *n = p;
+    if (keylen - depth < n->prefixlen || artPrefixCmp(n, key + depth, n->prefixlen) != 0) {
+        return 1;
+    }
+    depth += n->prefixlen;
+    if (keylen == depth) {
+        if (n->leaf == NULL) {
+            return 1;
+        }
+        free(n->leaf);
+        n->leaf = NULL;
+        artCompact(ref);
+        return 0;
+    }
+    void **child = artFindChild(n, key[depth]);
+    if (child == NULL || artRemoveRec(child, key, keylen, depth + 1) != 0) {
+        return 1;
+    }
+    if (*child == NULL) {
+        artRemoveChild(ref, n, key[depth]);
+        artCompact(ref);
+    }
+    return 0;
+}
+
+int artRemove(Art_t *art, const char *key, size_t keylen) {
+    if (artRemoveRec(&art->root, (const uint8_t *)key, keylen, 0) != 0) {
+        return 1;
+    }
+    art->len--;
+    return 0;
+}
+
+int artSearch(Art_t *art, const char *key, size_t keylen) {
+    const uint8_t *k = (const uint8_t *)key;
+    void *p = art->root;
+    size_t depth = 0;
+    while (p != NULL) {
+        if (IS_LEAF(p)) {
+            return artLeafMatches(TO_LEAF(p), k, keylen);
+        }
+        ArtNode_t *n = p;
+        if (keylen - depth < n->prefixlen || artPrefixCmp(n, k + depth, n->prefixlen) != 0) {
+            return 0;
+        }
+        depth += n->prefixlen;
+        if (keylen == depth) {
+            return n->leaf != NULL;
+        }
+        void **child = artFindChild(n, k[depth]);
+        p = child != NULL ? *child : NULL;
+        depth++;
+    }
+    return 0;
+}
+
+typedef struct ArtScan {
+    const uint8_t *start;
+    size_t startlen;
+    int exclusive;
+    artVisitor_t visitor;
+    void *ctx;
+    uint64_t visited;
+} ArtScan_t;
+
+static int artScanRec(ArtScan_t *scan, void *p, size_t depth, int bounded);
+
+static int artScanVisit(ArtScan_t *scan, ArtLeaf_t *l) {
+    scan->visited++;
+    return scan->visitor(l->key, l->keylen, scan->ctx);
+}
+
+// scan a child reached through byte b, bounded tells whether the path so far equals the lower bound
+static int artScanChild(ArtScan_t *scan, void *child, uint8_t b, size_t depth, int bounded) {
+    if (bounded && depth < scan->startlen) {
+        if (b < scan->start[depth]) {
+            return 0;
+        }
+        bounded = b == scan->start[depth];
+    } else {
+        // the path so far already is the whole lower bound, every key below is greater
+        bounded = 0;
+    }
+    return artScanRec(scan, child, depth + 1, bounded);
+}
+
+static int artScanRec(ArtScan_t *scan, void *p, size_t depth, int bounded) {
+    if (IS_LEAF(p)) {
+        ArtLeaf_t *l = TO_LEAF(p);
+        if (bounded) {
+            size_t minlen = l->keylen < scan->startlen ? l->keylen : scan->startlen;
+            int cmp = memcmp(l->key, scan->start, minlen);
+            if (cmp == 0) {
+                cmp = (l->keylen > scan->startlen) - (l->keylen < scan->startlen);
+            }
+            if (cmp < 0 || (cmp == 0 && scan->exclusive)) {
+                return 0;
+            }
+        }
+        return artScanVisit(scan, l);
+    }
+
+    ArtNode_t *n = p;
+    if (bounded) {
+        size_t remaining = scan->startlen - depth;
+        size_t m = n->prefixlen < remaining ? n->prefixlen : remaining;
+        int cmp = artPrefixCmp(n, scan->start + depth, m);
+        if (cmp < 0) {
+            return 0; // every key below this node is smaller than the lower bound
+        }
+        if (cmp > 0 || m < n->prefixlen) {
+            bounded = 0; // every key below this node is greater than the lower bound
+        }
+    }
+    depth += n->prefixlen;
+    if (n->leaf != NULL) {
+        // the key ending here is a prefix of (or equal to) the lower bound if we are still bounded
+        int skip = bounded && (depth < scan->startlen || scan->exclusive);
+        if (!skip && artScanVisit(scan, n->leaf) != 0) {
+            return 1;
+        }
+    }
+
+    switch (n->type) {
+    case NODE4: {
+        ArtNode4_t *n4 = (ArtNode4_t *)n;
+        for (int i = 0; i < n->numChildren; i++) {
+            if (artScanChild(scan, n4->children[i], n4->keys[i], depth, bounded) != 0) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    case NODE16: {
+        ArtNode16_t *n16 = (ArtNode16_t *)n;
+        for (int i = 0; i < n->numChildren; i++) {
+            if (artScanChild(scan, n16->children[i], n16->keys[i], depth, bounded) != 0) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    case NODE48: {
+        ArtNode48_t *n48 = (ArtNode48_t *)n;
+        int first = bounded && depth < scan->startlen ? scan->start[depth] : 0;
+        for (int i = first; i < 256; i++) {
+            if (n48->childIndex[i] != 0 &&
+                artScanChild(scan, n48->children[n48->childIndex[i] - 1], i, depth, bounded) != 0) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    default: {
+        ArtNode256_t *n256 = (ArtNode256_t *)n;
+        int first = bounded && depth < scan->startlen ? scan->start[depth] : 0;
+        for (int i = first; i < 256; i++) {
+            if (n256->children[i] != NULL && artScanChild(scan, n256->children[i], i, depth, bounded) != 0) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    }
+}
+
+uint64_t artScan(Art_t *art, const char *start, size_t startlen, int exclusive, artVisitor_t visitor, void *ctx) {
+    ArtScan_t scan = {(const uint8_t *)start, startlen, exclusive, visitor, ctx, 0};
+    if (art->root != NULL) {
+        artScanRec(&scan, art->root, 0, startlen > 0);
+    }
+    return scan.visited;
+}
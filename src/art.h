@@ -0,0 +1,138 @@
+/*
+ * Adaptive radix tree over binary keys, based on the paper
+ * "The Adaptive Radix Tree: ARTful Indexing for Main-Memory Databases" (Leis et al.)
+ * https://db.in.tum.de/~leis/papers/ART.pdf
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef __ART_H
+#define __ART_H
+
+typedef enum ArtNodeType {
+    NODE4,
+    NODE16,
+    NODE48,
+    NODE256,
+} ArtNodeType_t;
+
+typedef struct ArtLeaf {
+    size_t keylen;
+    char key[];
+} ArtLeaf_t;
+
+// Header shared by all the inner node types
+typedef struct ArtNode {
+    ArtNodeType_t type;
+    uint16_t numChildren;
+    uint32_t prefixlen; /* Length of the compressed path in front of this node */
+    uint8_t *prefix;    /* Compressed path, NULL if prefixlen is 0 */
+    ArtLeaf_t *leaf;    /* Key that ends exactly at this node, if any */
+} ArtNode_t;
+
+typedef struct ArtNode4 {
+    ArtNode_t n;
+    uint8_t keys[4]; /* Sorted */
+    void *children[4];
+} ArtNode4_t;
+
+typedef struct ArtNode16 {
+    ArtNode_t n;
+    uint8_t keys[16]; /* Sorted */
+    void *children[16];
+} ArtNode16_t;
+
+typedef struct ArtNode48 {
+    ArtNode_t n;
+    uint8_t childIndex[256]; /* 1 based index into children, 0 if there is no child for the byte */
+    void *children[48];
+} ArtNode48_t;
+
+typedef struct ArtNode256 {
+    ArtNode_t n;
+    void *children[256];
+} ArtNode256_t;
+
+typedef struct Art {
+    void *root;   /* Either an inner node or a tagged leaf pointer */
+    uint64_t len; /* number of keys in the tree */
+} Art_t;
+
+/**
+ * Callback invoked for every key visited by artScan
+ *
+ * @param key The key being visited
+ * @param keylen The length of the key
+ * @param ctx The context pointer passed to artScan
+ *
+ * @returns 0 to continue visiting, non-zero to stop the scan
+ * */
+typedef int (*artVisitor_t)(const char *key, size_t keylen, void *ctx);
+
+/**
+ * Create an empty adaptive radix tree
+ *
+ * @returns The empty tree or NULL on error
+ * */
+Art_t *artCreate();
+
+/**
+ * Free the tree and all of its keys
+ *
+ * @param art The tree to free
+ * */
+void artDelete(Art_t *art);
+
+/**
+ * Insert a key into the tree, the key is copied
+ *
+ * @param art The tree to insert into
+ * @param key The key
+ * @param keylen The length of the key
+ *
+ * @returns 0 if insert successful, 1 if the key already exists
+ * */
+int artInsert(Art_t *art, const char *key, size_t keylen);
+
+/**
+ * Remove a key from the tree
+ *
+ * @param art The tree to remove from
+ * @param key The key
+ * @param keylen The length of the key
+ *
+ * @returns 0 if successful, 1 if the key was not found
+ * */
+int artRemove(Art_t *art, const char *key, size_t keylen);
+
+/**
+ * Check whether a key is in the tree
+ *
+ * @param art The tree to search
+ * @param key The key
+ * @param keylen The length of the key
+ *
+ * @returns 1 if the key was found, 0 otherwise
+ * */
+int artSearch(Art_t *art, const char *key, size_t keylen);
+
+/**
+ * Visit the keys of the tree in lexicographic byte order, starting at a lower bound.
+ * Seeking to the lower bound costs O(keylen), so a prefix scan costs O(keylen + k)
+ *
+ * @param art The tree to scan
+ * @param start The lower bound to start from
+ * @param startlen The length of the lower bound, 0 to start at the smallest key
+ * @param exclusive If non-zero, a key equal to the lower bound is skipped
+ * @param visitor Called for every key visited, in order
+ * @param ctx Passed through to the visitor
+ *
+ * @returns The number of keys visited
+ * */
+uint64_t artScan(Art_t *art, const char *start, size_t startlen, int exclusive, artVisitor_t visitor, void *ctx);
+
+#endif /* __ART_H */
@@ -0,0 +1,248 @@
+#include "cluster.h"
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+uint16_t clusterCrc16(const char *buf, size_t len) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)(unsigned char)buf[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+int clusterKeySlot(const char *key, size_t keylen) {
+    const char *open = memchr(key, '{', keylen);
+    if (open != NULL) {
+        const char *tag = open + 1;
+        const char *close = memchr(tag, '}', keylen - (tag - key));
+        if (close != NULL && close > tag) {
+            key = tag;
+            keylen = close - tag;
+        }
+    }
+    return clusterCrc16(key, keylen) & (CLUSTER_SLOTS - 1);
+}
+
+Cluster_t *clusterCreate(const char *myself) {
+    Cluster_t *cluster = calloc(1, sizeof(Cluster_t));
+    if (cluster == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < CLUSTER_SLOTS; i++) {
+        cluster->owner[i] = -1;
+        cluster->migrating[i] = -1;
+        cluster->importing[i] = -1;
+    }
+    cluster->myself = clusterNode(cluster, myself);
+    if (cluster->myself == -1) {
+        free(cluster);
+        return NULL;
+    }
+    return cluster;
+}
+
+void clusterDelete(Cluster_t *cluster) {
+    free(cluster);
+}
+
+int clusterNode(Cluster_t *cluster, const char *addr) {
+    for (int i = 0; i < cluster->numNodes; i++) {
+        if (strcmp(cluster->nodes[i], addr) == 0) {
+            return i;
+        }
+    }
+    char host[CLUSTER_MAX_ADDR_LEN];
+    int port;
+    if (cluster->numNodes == CLUSTER_MAX_NODES || clusterParseAddr(addr, host, sizeof(host), &port) != 0) {
+        return -1;
+    }
+    strcpy(cluster->nodes[cluster->numNodes], addr);
+    return cluster->numNodes++;
+}
+
+int clusterAssign(Cluster_t *cluster, int first, int last, const char *addr) {
+    if (first < 0 || last >= CLUSTER_SLOTS || first > last) {
+        return -1;
+    }
+    int node = clusterNode(cluster, addr);
+    if (node == -1) {
+        return -1;
+    }
+    for (int slot = first; slot <= last; slot++) {
+        cluster->owner[slot] = node;
+        cluster->migrating[slot] = -1;
+        cluster->importing[slot] = -1;
+    }
+    return 0;
+}
+
+int clusterSetMigrating(Cluster_t *cluster, int slot, const char *addr) {
+    if (slot < 0 || slot >= CLUSTER_SLOTS || cluster->owner[slot] != cluster->myself) {
+        return -1;
+    }
+    int node = clusterNode(cluster, addr);
+    if (node == -1 || node == cluster->myself) {
+        return -1;
+    }
+    cluster->migrating[slot] = node;
+    return 0;
+}
+
+int clusterSetImporting(Cluster_t *cluster, int slot, const char *addr) {
+    if (slot < 0 || slot >= CLUSTER_SLOTS || cluster->owner[slot] == cluster->myself) {
+        return -1;
+    }
+    int node = clusterNode(cluster, addr);
+    if (node == -1 || node == cluster->myself) {
+        return -1;
+    }
+    cluster->importing[slot] = node;
+    return 0;
+}
+
+ClusterRoute_t clusterRoute(Cluster_t *cluster, int slot, int exists, int asking, const char **addr) {
+    int owner = cluster->owner[slot];
+    if (owner == cluster->myself) {
+        if (cluster->migrating[slot] != -1 && !exists) {
+            // the key was moved already, or will be created on the target
+            *addr = cluster->nodes[cluster->migrating[slot]];
+            return CLUSTER_ROUTE_ASK;
+        }
+        return CLUSTER_ROUTE_LOCAL;
+    }
+    if (cluster->importing[slot] != -1 && asking) {
+        return CLUSTER_ROUTE_LOCAL;
+    }
+    if (owner == -1) {
+        return CLUSTER_ROUTE_DOWN;
+    }
+    *addr = cluster->nodes[owner];
+    return CLUSTER_ROUTE_MOVED;
+}
+
+int clusterFormatSlots(Cluster_t *cluster, char *buf, int cap) {
+    int len = snprintf(buf, cap, "{");
+    for (int first = 0; first < CLUSTER_SLOTS;) {
+        int last = first;
+        while (last + 1 < CLUSTER_SLOTS && cluster->owner[last + 1] == cluster->owner[first]) {
+            last++;
+        }
+        if (cluster->owner[first] != -1) {
+            len += snprintf(buf + len, len < cap ? cap - len : 0, "%s%d-%d: %s", len > 1 ? ", " : "", first, last,
+                            cluster->nodes[cluster->owner[first]]);
+        }
+        first = last + 1;
+    }
+    len += snprintf(buf + len, len < cap ? cap - len : 0, "}");
+    return len < cap ? len : -1;
+}
+
+int clusterParseAddr(const char *addr, char *host, int hostcap, int *port) {
+    const char *colon = strrchr(addr, ':');
+    if (colon == NULL || colon == addr || colon - addr >= hostcap) {
+        return -1;
+    }
+    char *end;
+    long p = strtol(colon + 1, &end, 10);
+    if (*end != '\0' || p <= 0 || p > 65535) {
+        return -1;
+    }
+    memcpy(host, addr, colon - addr);
+    host[colon - addr] = '\0';
+    *port = p;
+    return 0;
+}
+
+// blocking connection that gives up after CLUSTER_MIGRATE_TIMEOUT_MS without progress
+static int clusterConnect(const char *addr) {
+    char host[CLUSTER_MAX_ADDR_LEN];
+    char service[16];
+    int port;
+    if (clusterParseAddr(addr, host, sizeof(host), &port) != 0) {
+        return -1;
+    }
+    sprintf(service, "%d", port);
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *res;
+    if (getaddrinfo(host, service, &hints, &res) != 0) {
+        return -1;
+    }
+    int fd = socket(res->ai_family, SOCK_STREAM, 0);
+    if (fd != -1) {
+        struct timeval timeout = {CLUSTER_MIGRATE_TIMEOUT_MS / 1000, CLUSTER_MIGRATE_TIMEOUT_MS % 1000 * 1000};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        int nodelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+        if (connect(fd, res->ai_addr, res->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+// replies of a node that didn't serve the command
+static int clusterRefused(const char *reply, size_t len) {
+    static const char *refusals[] = {"MOVED ", "ASK ", "CLUSTERDOWN", "Malformed query", "Query not supported",
+                                     "Replica is read only"};
+    for (size_t i = 0; i < sizeof(refusals) / sizeof(refusals[0]); i++) {
+        size_t n = strlen(refusals[i]);
+        if (len >= n && memcmp(reply, refusals[i], n) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int clusterSendCommands(const char *addr, const char *commands, uint64_t len, int count) {
+    int fd = clusterConnect(addr);
+    if (fd == -1) {
+        return -1;
+    }
+    for (uint64_t sent = 0; sent < len;) {
+        ssize_t n = send(fd, commands + sent, len - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            close(fd);
+            return -1;
+        }
+        sent += n;
+    }
+    char replies[4096];
+    size_t used = 0;
+    int received = 0;
+    int refused = 0;
+    while (received < count) {
+        ssize_t n = recv(fd, replies + used, sizeof(replies) - used, 0);
+        if (n <= 0) {
+            close(fd);
+            return -1;
+        }
+        used += n;
+        size_t lineStart = 0;
+        for (size_t i = 0; i < used; i++) {
+            if (replies[i] == '\n') {
+                refused |= clusterRefused(replies + lineStart, i - lineStart);
+                received++;
+                lineStart = i + 1;
+            }
+        }
+        // replies are at most BUFFER_SIZE bytes, so a partial one always fits
+        memmove(replies, replies + lineStart, used - lineStart);
+        used -= lineStart;
+    }
+    close(fd);
+    return refused ? -1 : 0;
+}
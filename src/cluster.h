@@ -0,0 +1,146 @@
+/*
+ * Cluster mode in the spirit of redis cluster. The keyspace is split into CLUSTER_SLOTS hash slots and
+ * every slot is served by a single node, named by the host:port its clients connect to. The slot of a
+ * key is the CRC16 of the key, or of the part between the first { and the next } if that part isn't
+ * empty, so keys sharing such a hash tag are always served by the same node.
+ *
+ * There is no gossip, every node is told the whole slot map with cluster assign. A node replies to a
+ * command for a key in a slot it doesn't serve with
+ *
+ *   MOVED <slot> <host:port>
+ *
+ * and the client sends the command again to that node. A slot moves to another node by marking it
+ * importing on the target and migrating on the source, moving its keys with cluster migrate and then
+ * assigning the slot to the target on every node. While the slot is migrating the source still serves
+ * the keys it has and replies to commands for other keys with
+ *
+ *   ASK <slot> <host:port>
+ *
+ * and the client sends just that command to the target, prefixed with asking so the target serves it
+ * although the slot isn't assigned to it yet.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef __CLUSTER_H
+#define __CLUSTER_H
+
+#define CLUSTER_SLOTS 16384
+#define CLUSTER_MAX_NODES 64
+#define CLUSTER_MAX_ADDR_LEN 64
+// how long cluster migrate waits on the target before giving up
+#define CLUSTER_MIGRATE_TIMEOUT_MS 1000
+
+typedef enum ClusterRoute {
+    CLUSTER_ROUTE_LOCAL, /* Serve the command here */
+    CLUSTER_ROUTE_MOVED, /* The slot is served by another node */
+    CLUSTER_ROUTE_ASK,   /* The key may already have migrated to another node */
+    CLUSTER_ROUTE_DOWN,  /* No node serves the slot */
+} ClusterRoute_t;
+
+typedef struct Cluster {
+    int myself; /* Index of this node in nodes */
+    int numNodes;
+    char nodes[CLUSTER_MAX_NODES][CLUSTER_MAX_ADDR_LEN];
+    int16_t owner[CLUSTER_SLOTS];     /* Node serving each slot, -1 if none */
+    int16_t migrating[CLUSTER_SLOTS]; /* Node a slot served here is moving to, -1 if none */
+    int16_t importing[CLUSTER_SLOTS]; /* Node a slot is moving here from, -1 if none */
+} Cluster_t;
+
+/**
+ * CRC16 with the XMODEM polynomial, as used by redis cluster
+ * */
+uint16_t clusterCrc16(const char *buf, size_t len);
+
+/**
+ * @returns The slot of a key, honouring hash tags
+ * */
+int clusterKeySlot(const char *key, size_t keylen);
+
+/**
+ * Create the cluster state of a node with no slots assigned
+ *
+ * @param myself The host:port clients reach this node on
+ *
+ * @returns The cluster state or NULL on error
+ * */
+Cluster_t *clusterCreate(const char *myself);
+
+/**
+ * Free the cluster state
+ * */
+void clusterDelete(Cluster_t *cluster);
+
+/**
+ * Find a node, adding it if it is not known yet
+ *
+ * @returns The index of the node, or -1 if the address is too long or there are too many nodes
+ * */
+int clusterNode(Cluster_t *cluster, const char *addr);
+
+/**
+ * Assign a range of slots to a node, ending any migration of those slots
+ *
+ * @returns 0 if successful, -1 if the range or the node is invalid
+ * */
+int clusterAssign(Cluster_t *cluster, int first, int last, const char *addr);
+
+/**
+ * Mark a slot served by this node as migrating to another node
+ *
+ * @returns 0 if successful, -1 if the slot isn't served here or the node is invalid
+ * */
+int clusterSetMigrating(Cluster_t *cluster, int slot, const char *addr);
+
+/**
+ * Mark a slot served by another node as importing from it
+ *
+ * @returns 0 if successful, -1 if the slot is served here or the node is invalid
+ * */
+int clusterSetImporting(Cluster_t *cluster, int slot, const char *addr);
+
+/**
+ * Decide where a command for a key in slot is served
+ *
+ * @param cluster The cluster state
+ * @param slot The slot of the key
+ * @param exists Set if the key is in the local keyspace
+ * @param asking Set if the client prefixed the command with asking
+ * @param addr Set to the node to redirect to for MOVED and ASK
+ *
+ * @returns Where the command is served
+ * */
+ClusterRoute_t clusterRoute(Cluster_t *cluster, int slot, int exists, int asking, const char **addr);
+
+/**
+ * Write the slot map as {first-last: host:port, ...}, merging consecutive slots of a node
+ *
+ * @returns The length written, or -1 if it didn't fit in cap bytes
+ * */
+int clusterFormatSlots(Cluster_t *cluster, char *buf, int cap);
+
+/**
+ * Split host:port into its parts
+ *
+ * @returns 0 if successful, -1 if addr is malformed or the host doesn't fit in hostcap bytes
+ * */
+int clusterParseAddr(const char *addr, char *host, int hostcap, int *port);
+
+/**
+ * Send newline terminated commands to another node and wait for their replies, as cluster migrate does
+ * with the commands recreating the keys it moves
+ *
+ * @param addr The host:port of the node
+ * @param commands The commands
+ * @param len The length of the commands
+ * @param count The number of commands
+ *
+ * @returns 0 if every command was served, -1 if the node couldn't be reached or refused one
+ * */
+int clusterSendCommands(const char *addr, const char *commands, uint64_t len, int count);
+
+#endif /* __CLUSTER_H */
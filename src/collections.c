@@ -0,0 +1,558 @@
+#include "collections.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Lists */
+
+static ListNode_t *listCreateNode() {
+    ListNode_t *node = malloc(sizeof(ListNode_t));
+    if (node == NULL) {
+        return NULL;
+    }
+    node->lp = lpNew();
+    if (node->lp == NULL) {
+        free(node);
+        return NULL;
+    }
+    node->prev = NULL;
+    node->next = NULL;
+    return node;
+}
+
+static void listUnlinkNode(List_t *list, ListNode_t *node) {
+    if (node->prev != NULL) {
+        node->prev->next = node->next;
+    } else {
+        list->head = node->next;
+    }
+    if (node->next != NULL) {
+        node->next->prev = node->prev;
+    } else {
+        list->tail = node->prev;
+    }
+    lpFree(node->lp);
+    free(node);
+}
+
+List_t *listCreate() {
+    List_t *list = malloc(sizeof(List_t));
+    if (list) {
+        list->head = NULL;
+        list->tail = NULL;
+        list->len = 0;
+    }
+    return list;
+}
+
+void listDelete(List_t *list) {
+    ListNode_t *node = list->head;
+    while (node != NULL) {
+        ListNode_t *next = node->next;
+        lpFree(node->lp);
+        free(node);
+        node = next;
+    }
+    free(list);
+}
+
+uint64_t listPush(List_t *list, ListEnd_t where, const char *s, size_t len) {
+    ListNode_t *node = where == LIST_HEAD ? list->head : list->tail;
+    if (node == NULL || node->lp->count >= LIST_NODE_MAX_ENTRIES) {
+        // start a new node at this end of the list
+        ListNode_t *newNode = listCreateNode();
+        if (newNode == NULL) {
+            return 0;
+        }
+        if (where == LIST_HEAD) {
+            newNode->next = list->head;
+            if (list->head != NULL) {
+                list->head->prev = newNode;
+            }
+            list->head = newNode;
+            if (list->tail == NULL) {
+                list->tail = newNode;
+            }
+        } else {
+            newNode->prev = list->tail;
+            if (list->tail != NULL) {
+                list->tail->next = newNode;
+            }
+            list->tail = newNode;
+            if (list->head == NULL) {
+                list->head = newNode;
+            }
+        }
+        node = newNode;
+    }
+    Listpack_t *lp = where == LIST_HEAD ? lpInsert(node->lp, 0, s, len) : lpAppend(node->lp, s, len);
+    if (lp == NULL) {
+        // don't leave behind a node started for this element
+        if (node->lp->count == 0) {
+            listUnlinkNode(list, node);
+        }
+        return 0;
+    }
+    node->lp = lp;
+    list->len++;
+    return list->len;
+}
+
+int listPop(List_t *list, ListEnd_t where, char **out, size_t *outlen) {
+    ListNode_t *node = where == LIST_HEAD ? list->head : list->tail;
+    if (node == NULL) {
+        return 1;
+    }
+    size_t off = where == LIST_HEAD ? lpFirst(node->lp) : lpLast(node->lp);
+    const char *s = lpGet(node->lp, off, outlen);
+    *out = malloc(*outlen + 1);
+    memcpy(*out, s, *outlen);
+    (*out)[*outlen] = '\0';
+    node->lp = lpDelete(node->lp, off);
+    if (node->lp->count == 0) {
+        listUnlinkNode(list, node);
+    }
+    list->len--;
+    return 0;
+}
+
+uint64_t listRange(List_t *list, int64_t start, int64_t stop, elementVisitor_t visitor, void *ctx) {
+    int64_t len = list->len;
+    if (start < 0) {
+        start += len;
+    }
+    if (stop < 0) {
+        stop += len;
+    }
+    if (start < 0) {
+        start = 0;
+    }
+    if (stop >= len) {
+        stop = len - 1;
+    }
+    if (start > stop) {
+        return 0;
+    }
+
+    // skip whole nodes before the start of the range
+    ListNode_t *node = list->head;
+    int64_t index = 0;
+    while (index + node->lp->count <= start) {
+        index += node->lp->count;
+        node = node->next;
+    }
+    size_t off = lpSeek(node->lp, start - index);
+    index = start;
+    uint64_t visited = 0;
+    while (index <= stop) {
+        size_t len;
+        const char *s = lpGet(node->lp, off, &len);
+        visited++;
+        if (visitor(s, len, ctx) != 0) {
+            break;
+        }
+        index++;
+        off = lpNext(node->lp, off);
+        if (off == LP_NONE) {
+            node = node->next;
+            if (node == NULL) {
+                break;
+            }
+            off = lpFirst(node->lp);
+        }
+    }
+    return visited;
+}
+
+/* Hashes */
+
+// store a string value in a nested hashtable, values of a nested hashtable are NUL terminated strings
+static void hashTableSet(Hashtable_t *ht, const char *field, size_t fieldlen, const char *val, size_t vallen) {
+    char *copy = malloc(vallen + 1);
+    memcpy(copy, val, vallen);
+    copy[vallen] = '\0';
+    HashtableValue_t htv;
+    htv.entryType = STRING;
+    htv.v.val = copy;
+    htReplace(ht, field, fieldlen, htv);
+    free(copy);
+}
+
+// upgrade a listpack encoded hash to a hashtable
+static void hashConvert(Hash_t *h) {
+    Hashtable_t *ht = htCreateTable();
+    size_t off = lpFirst(h->c.lp);
+    while (off != LP_NONE) {
+        size_t fieldlen, vallen;
+        const char *field = lpGet(h->c.lp, off, &fieldlen);
+        off = lpNext(h->c.lp, off);
+        const char *val = lpGet(h->c.lp, off, &vallen);
+        hashTableSet(ht, field, fieldlen, val, vallen);
+        off = lpNext(h->c.lp, off);
+    }
+    lpFree(h->c.lp);
+    h->c.ht = ht;
+    h->encoding = ENCODING_HASHTABLE;
+}
+
+Hash_t *hashCreate() {
+    Hash_t *h = malloc(sizeof(Hash_t));
+    if (h) {
+        h->encoding = ENCODING_LISTPACK;
+        h->c.lp = lpNew();
+    }
+    return h;
+}
+
+void hashDelete(Hash_t *h) {
+    if (h->encoding == ENCODING_LISTPACK) {
+        lpFree(h->c.lp);
+    } else {
+        htDeleteTable(h->c.ht);
+    }
+    free(h);
+}
+
+int hashSet(Hash_t *h, const char *field, size_t fieldlen, const char *val, size_t vallen) {
+    if (h->encoding == ENCODING_LISTPACK) {
+        size_t off = lpFind(h->c.lp, lpFirst(h->c.lp), field, fieldlen, 1);
+        if (off != LP_NONE && vallen <= HASH_MAX_LISTPACK_VALUE) {
+            // insert the new value before the old one so the hash is unchanged if it can't grow
+            size_t valOff = lpNext(h->c.lp, off);
+            Listpack_t *lp = lpInsert(h->c.lp, valOff, val, vallen);
+            if (lp == NULL) {
+                return -1;
+            }
+            h->c.lp = lpDelete(lp, lpNext(lp, valOff));
+            return 0;
+        }
+        if (off == LP_NONE && h->c.lp->count / 2 < HASH_MAX_LISTPACK_ENTRIES &&
+            fieldlen <= HASH_MAX_LISTPACK_VALUE && vallen <= HASH_MAX_LISTPACK_VALUE) {
+            Listpack_t *lp = lpAppend(h->c.lp, field, fieldlen);
+            if (lp == NULL) {
+                return -1;
+            }
+            h->c.lp = lp;
+            lp = lpAppend(h->c.lp, val, vallen);
+            if (lp == NULL) {
+                // drop the field again so it isn't left without a value
+                h->c.lp = lpDelete(h->c.lp, lpLast(h->c.lp));
+                return -1;
+            }
+            h->c.lp = lp;
+            return 1;
+        }
+        hashConvert(h);
+    }
+    int isNew = htFind(h->c.ht, field, fieldlen).entryType == NONE;
+    hashTableSet(h->c.ht, field, fieldlen, val, vallen);
+    return isNew;
+}
+
+int hashGet(Hash_t *h, const char *field, size_t fieldlen, const char **val, size_t *vallen) {
+    if (h->encoding == ENCODING_LISTPACK) {
+        size_t off = lpFind(h->c.lp, lpFirst(h->c.lp), field, fieldlen, 1);
+        if (off == LP_NONE) {
+            return 1;
+        }
+        *val = lpGet(h->c.lp, lpNext(h->c.lp, off), vallen);
+        return 0;
+    }
+    HashtableValue_t htv = htFind(h->c.ht, field, fieldlen);
+    if (htv.entryType == NONE) {
+        return 1;
+    }
+    *val = htv.v.val;
+    *vallen = strlen(htv.v.val);
+    return 0;
+}
+
+int hashDel(Hash_t *h, const char *field, size_t fieldlen) {
+    if (h->encoding == ENCODING_LISTPACK) {
+        size_t off = lpFind(h->c.lp, lpFirst(h->c.lp), field, fieldlen, 1);
+        if (off == LP_NONE) {
+            return 1;
+        }
+        // deleting the field moves its value to the same offset
+        h->c.lp = lpDelete(h->c.lp, off);
+        h->c.lp = lpDelete(h->c.lp, off);
+        return 0;
+    }
+    return htRemove(h->c.ht, field, fieldlen);
+}
+
+uint64_t hashLen(Hash_t *h) {
+    if (h->encoding == ENCODING_LISTPACK) {
+        return h->c.lp->count / 2;
+    }
+    return h->c.ht->len;
+}
+
+typedef struct FieldVisit {
+    fieldVisitor_t visitor;
+    void *ctx;
+    uint64_t visited;
+} FieldVisit_t;
+
+static int hashVisitEntry(HashtableEntry_t *hte, void *ctx) {
+    FieldVisit_t *visit = ctx;
+    visit->visited++;
+    return visit->visitor(hte->key, hte->keylen, hte->htv.v.val, strlen(hte->htv.v.val), visit->ctx);
+}
+
+uint64_t hashForEach(Hash_t *h, fieldVisitor_t visitor, void *ctx) {
+    FieldVisit_t visit = {visitor, ctx, 0};
+    if (h->encoding == ENCODING_HASHTABLE) {
+        htForEach(h->c.ht, hashVisitEntry, &visit);
+        return visit.visited;
+    }
+    size_t off = lpFirst(h->c.lp);
+    while (off != LP_NONE) {
+        size_t fieldlen, vallen;
+        const char *field = lpGet(h->c.lp, off, &fieldlen);
+        off = lpNext(h->c.lp, off);
+        const char *val = lpGet(h->c.lp, off, &vallen);
+        off = lpNext(h->c.lp, off);
+        visit.visited++;
+        if (visitor(field, fieldlen, val, vallen, ctx) != 0) {
+            break;
+        }
+    }
+    return visit.visited;
+}
+
+/* Sets */
+
+// parse a member that is the canonical decimal form of an integer, returns 0 if it is one
+static int setMemberToInt(const char *member, size_t len, int64_t *value) {
+    char buf[32];
+    if (len == 0 || len >= 21) {
+        return 1;
+    }
+    memcpy(buf, member, len);
+    buf[len] = '\0';
+    char *err = NULL;
+    errno = 0;
+    long long v = strtoll(buf, &err, 10);
+    if (errno != 0 || *err != '\0') {
+        return 1;
+    }
+    // "+1" or "01" must stay strings so they are returned exactly as added
+    char canonical[32];
+    if ((size_t)snprintf(canonical, sizeof(canonical), "%lld", v) != len || memcmp(canonical, member, len) != 0) {
+        return 1;
+    }
+    *value = v;
+    return 0;
+}
+
+static void setTableAdd(Hashtable_t *ht, const char *member, size_t len) {
+    HashtableValue_t htv;
+    htv.entryType = UNSIGNED_INT;
+    htv.v.u64 = 0;
+    htAdd(ht, member, len, htv);
+}
+
+// upgrade an intset or listpack encoded set to the given encoding, returns 0 if successful and leaves the
+// set unchanged otherwise
+static int setConvert(Set_t *set, CollectionEncoding_t encoding) {
+    Hashtable_t *ht = encoding == ENCODING_HASHTABLE ? htCreateTable() : NULL;
+    Listpack_t *lp = encoding == ENCODING_LISTPACK ? lpNew() : NULL;
+    if (ht == NULL && lp == NULL) {
+        return -1;
+    }
+    if (set->encoding == ENCODING_INTSET) {
+        for (uint32_t i = 0; i < set->c.is->len; i++) {
+            char buf[32];
+            int len = sprintf(buf, "%ld", intsetGet(set->c.is, i));
+            if (ht != NULL) {
+                setTableAdd(ht, buf, len);
+                continue;
+            }
+            Listpack_t *grown = lpAppend(lp, buf, len);
+            if (grown == NULL) {
+                lpFree(lp);
+                return -1;
+            }
+            lp = grown;
+        }
+        intsetFree(set->c.is);
+    } else {
+        for (size_t off = lpFirst(set->c.lp); off != LP_NONE; off = lpNext(set->c.lp, off)) {
+            size_t len;
+            const char *member = lpGet(set->c.lp, off, &len);
+            setTableAdd(ht, member, len);
+        }
+        lpFree(set->c.lp);
+    }
+    if (ht != NULL) {
+        set->c.ht = ht;
+    } else {
+        set->c.lp = lp;
+    }
+    set->encoding = encoding;
+    return 0;
+}
+
+Set_t *setCreate() {
+    Set_t *set = malloc(sizeof(Set_t));
+    if (set) {
+        set->encoding = ENCODING_INTSET;
+        set->c.is = intsetNew();
+    }
+    return set;
+}
+
+void setDelete(Set_t *set) {
+    switch (set->encoding) {
+    case ENCODING_INTSET:
+        intsetFree(set->c.is);
+        break;
+    case ENCODING_LISTPACK:
+        lpFree(set->c.lp);
+        break;
+    default:
+        htDeleteTable(set->c.ht);
+        break;
+    }
+    free(set);
+}
+
+int setAdd(Set_t *set, const char *member, size_t len) {
+    int64_t value;
+    if (set->encoding == ENCODING_INTSET) {
+        if (setMemberToInt(member, len, &value) == 0) {
+            if (intsetFind(set->c.is, value)) {
+                return 0;
+            }
+            if (set->c.is->len < SET_MAX_INTSET_ENTRIES) {
+                int added;
+                Intset_t *is = intsetAdd(set->c.is, value, &added);
+                if (is == NULL) {
+                    return -1;
+                }
+                set->c.is = is;
+                return added;
+            }
+            if (setConvert(set, ENCODING_HASHTABLE) != 0) {
+                return -1;
+            }
+        } else if (set->c.is->len < SET_MAX_LISTPACK_ENTRIES && len <= SET_MAX_LISTPACK_VALUE) {
+            if (setConvert(set, ENCODING_LISTPACK) != 0) {
+                return -1;
+            }
+        } else if (setConvert(set, ENCODING_HASHTABLE) != 0) {
+            return -1;
+        }
+    }
+    if (set->encoding == ENCODING_LISTPACK) {
+        if (lpFind(set->c.lp, lpFirst(set->c.lp), member, len, 0) != LP_NONE) {
+            return 0;
+        }
+        if (set->c.lp->count < SET_MAX_LISTPACK_ENTRIES && len <= SET_MAX_LISTPACK_VALUE) {
+            Listpack_t *lp = lpAppend(set->c.lp, member, len);
+            if (lp == NULL) {
+                return -1;
+            }
+            set->c.lp = lp;
+            return 1;
+        }
+        if (setConvert(set, ENCODING_HASHTABLE) != 0) {
+            return -1;
+        }
+    }
+    if (htFind(set->c.ht, member, len).entryType != NONE) {
+        return 0;
+    }
+    setTableAdd(set->c.ht, member, len);
+    return 1;
+}
+
+int setRemove(Set_t *set, const char *member, size_t len) {
+    int64_t value;
+    switch (set->encoding) {
+    case ENCODING_INTSET: {
+        int removed = 0;
+        if (setMemberToInt(member, len, &value) == 0) {
+            set->c.is = intsetRemove(set->c.is, value, &removed);
+        }
+        return removed;
+    }
+    case ENCODING_LISTPACK: {
+        size_t off = lpFind(set->c.lp, lpFirst(set->c.lp), member, len, 0);
+        if (off == LP_NONE) {
+            return 0;
+        }
+        set->c.lp = lpDelete(set->c.lp, off);
+        return 1;
+    }
+    default:
+        return htRemove(set->c.ht, member, len) == 0;
+    }
+}
+
+int setIsMember(Set_t *set, const char *member, size_t len) {
+    int64_t value;
+    switch (set->encoding) {
+    case ENCODING_INTSET:
+        return setMemberToInt(member, len, &value) == 0 && intsetFind(set->c.is, value);
+    case ENCODING_LISTPACK:
+        return lpFind(set->c.lp, lpFirst(set->c.lp), member, len, 0) != LP_NONE;
+    default:
+        return htFind(set->c.ht, member, len).entryType != NONE;
+    }
+}
+
+uint64_t setLen(Set_t *set) {
+    switch (set->encoding) {
+    case ENCODING_INTSET:
+        return set->c.is->len;
+    case ENCODING_LISTPACK:
+        return set->c.lp->count;
+    default:
+        return set->c.ht->len;
+    }
+}
+
+typedef struct ElementVisit {
+    elementVisitor_t visitor;
+    void *ctx;
+    uint64_t visited;
+} ElementVisit_t;
+
+static int setVisitEntry(HashtableEntry_t *hte, void *ctx) {
+    ElementVisit_t *visit = ctx;
+    visit->visited++;
+    return visit->visitor(hte->key, hte->keylen, visit->ctx);
+}
+
+uint64_t setForEach(Set_t *set, elementVisitor_t visitor, void *ctx) {
+    ElementVisit_t visit = {visitor, ctx, 0};
+    switch (set->encoding) {
+    case ENCODING_INTSET:
+        for (uint32_t i = 0; i < set->c.is->len; i++) {
+            char buf[32];
+            int len = sprintf(buf, "%ld", intsetGet(set->c.is, i));
+            visit.visited++;
+            if (visitor(buf, len, ctx) != 0) {
+                break;
+            }
+        }
+        break;
+    case ENCODING_LISTPACK:
+        for (size_t off = lpFirst(set->c.lp); off != LP_NONE; off = lpNext(set->c.lp, off)) {
+            size_t len;
+            const char *member = lpGet(set->c.lp, off, &len);
+            visit.visited++;
+            if (visitor(member, len, ctx) != 0) {
+                break;
+            }
+        }
+        break;
+    default:
+        htForEach(set->c.ht, setVisitEntry, &visit);
+        break;
+    }
+    return visit.visited;
+}
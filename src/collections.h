@@ -0,0 +1,223 @@
+/*
+ * List, hash and set value types. Small collections use the compact listpack and intset
+ * encodings and are upgraded to full structures once they grow past the limits below.
+ *
+ */
+
+#pragma once
+
+#include "hashtable.h"
+#include "intset.h"
+#include "listpack.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef __COLLECTIONS_H
+#define __COLLECTIONS_H
+
+// maximum number of entries in a single listpack node of a list
+#define LIST_NODE_MAX_ENTRIES 128
+// hashes are stored as a listpack of field/value pairs until one of these limits is exceeded
+#define HASH_MAX_LISTPACK_ENTRIES 128
+#define HASH_MAX_LISTPACK_VALUE 64
+// sets of integers are stored as an intset until this limit is exceeded
+#define SET_MAX_INTSET_ENTRIES 512
+// other sets are stored as a listpack until one of these limits is exceeded
+#define SET_MAX_LISTPACK_ENTRIES 128
+#define SET_MAX_LISTPACK_VALUE 64
+
+typedef enum CollectionEncoding {
+    ENCODING_LISTPACK,
+    ENCODING_INTSET,
+    ENCODING_HASHTABLE,
+} CollectionEncoding_t;
+
+typedef enum ListEnd {
+    LIST_HEAD,
+    LIST_TAIL,
+} ListEnd_t;
+
+typedef struct ListNode {
+    Listpack_t *lp;
+    struct ListNode *prev;
+    struct ListNode *next;
+} ListNode_t;
+
+// A list is a doubly linked list of listpacks, a small list is a single listpack
+typedef struct List {
+    ListNode_t *head;
+    ListNode_t *tail;
+    uint64_t len; /* number of elements in all nodes */
+} List_t;
+
+typedef struct Hash {
+    CollectionEncoding_t encoding; /* ENCODING_LISTPACK or ENCODING_HASHTABLE */
+    union {
+        Listpack_t *lp; /* field, value, field, value... */
+        Hashtable_t *ht;
+    } c;
+} Hash_t;
+
+typedef struct Set {
+    CollectionEncoding_t encoding;
+    union {
+        Intset_t *is;
+        Listpack_t *lp;
+        Hashtable_t *ht; /* members are the keys */
+    } c;
+} Set_t;
+
+/**
+ * Callback invoked for every element visited in a list or set
+ *
+ * @returns 0 to continue visiting, non-zero to stop
+ * */
+typedef int (*elementVisitor_t)(const char *s, size_t len, void *ctx);
+
+/**
+ * Callback invoked for every field/value pair visited in a hash
+ *
+ * @returns 0 to continue visiting, non-zero to stop
+ * */
+typedef int (*fieldVisitor_t)(const char *field, size_t fieldlen, const char *val, size_t vallen, void *ctx);
+
+/**
+ * Create an empty list
+ *
+ * @returns The empty list or NULL on error
+ * */
+List_t *listCreate();
+
+/**
+ * Free the list and all of its elements
+ * */
+void listDelete(List_t *list);
+
+/**
+ * Push an element at either end of the list, the element is copied
+ *
+ * @param list The list to push to
+ * @param where LIST_HEAD or LIST_TAIL
+ * @param s The element
+ * @param len The length of the element
+ *
+ * @returns The new length of the list, or 0 on allocation failure, leaving the list unchanged
+ * */
+uint64_t listPush(List_t *list, ListEnd_t where, const char *s, size_t len);
+
+/**
+ * Pop an element from either end of the list
+ *
+ * @param list The list to pop from
+ * @param where LIST_HEAD or LIST_TAIL
+ * @param out Set to a copy of the element, NUL terminated, which must be freed by the caller
+ * @param outlen Set to the length of the element
+ *
+ * @returns 0 if successful, 1 if the list is empty
+ * */
+int listPop(List_t *list, ListEnd_t where, char **out, size_t *outlen);
+
+/**
+ * Visit the elements between start and stop, both inclusive. Negative indexes count from the end
+ *
+ * @returns The number of elements visited
+ * */
+uint64_t listRange(List_t *list, int64_t start, int64_t stop, elementVisitor_t visitor, void *ctx);
+
+/**
+ * Create an empty hash
+ *
+ * @returns The empty hash or NULL on error
+ * */
+Hash_t *hashCreate();
+
+/**
+ * Free the hash and all of its fields
+ * */
+void hashDelete(Hash_t *h);
+
+/**
+ * Set a field of the hash, both the field and the value are copied
+ *
+ * @returns 1 if the field is new, 0 if an existing field was updated, -1 on allocation failure, leaving the
+ * hash unchanged
+ * */
+int hashSet(Hash_t *h, const char *field, size_t fieldlen, const char *val, size_t vallen);
+
+/**
+ * Get a field of the hash
+ *
+ * @param h The hash
+ * @param field The field
+ * @param fieldlen The length of the field
+ * @param val Set to the value, valid until the hash is modified
+ * @param vallen Set to the length of the value
+ *
+ * @returns 0 if found, 1 if the field does not exist
+ * */
+int hashGet(Hash_t *h, const char *field, size_t fieldlen, const char **val, size_t *vallen);
+
+/**
+ * Remove a field of the hash
+ *
+ * @returns 0 if successful, 1 if the field does not exist
+ * */
+int hashDel(Hash_t *h, const char *field, size_t fieldlen);
+
+/**
+ * @returns The number of fields in the hash
+ * */
+uint64_t hashLen(Hash_t *h);
+
+/**
+ * Visit every field of the hash
+ *
+ * @returns The number of fields visited
+ * */
+uint64_t hashForEach(Hash_t *h, fieldVisitor_t visitor, void *ctx);
+
+/**
+ * Create an empty set
+ *
+ * @returns The empty set or NULL on error
+ * */
+Set_t *setCreate();
+
+/**
+ * Free the set and all of its members
+ * */
+void setDelete(Set_t *set);
+
+/**
+ * Add a member to the set, the member is copied
+ *
+ * @returns 1 if the member was added, 0 if it already exists, -1 on allocation failure, leaving the set
+ * unchanged
+ * */
+int setAdd(Set_t *set, const char *member, size_t len);
+
+/**
+ * Remove a member from the set
+ *
+ * @returns 1 if the member was removed, 0 if it was not found
+ * */
+int setRemove(Set_t *set, const char *member, size_t len);
+
+/**
+ * @returns 1 if the member is in the set, 0 otherwise
+ * */
+int setIsMember(Set_t *set, const char *member, size_t len);
+
+/**
+ * @returns The number of members in the set
+ * */
+uint64_t setLen(Set_t *set);
+
+/**
+ * Visit every member of the set
+ *
+ * @returns The number of members visited
+ * */
+uint64_t setForEach(Set_t *set, elementVisitor_t visitor, void *ctx);
+
+#endif /* __COLLECTIONS_H */
@@ -0,0 +1,160 @@
+#include "config.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+ConfigParam_t *configFind(ConfigParam_t *params, int numParams, const char *name) {
+    for (int i = 0; i < numParams; i++) {
+        if (strcmp(params[i].name, name) == 0) {
+            return &params[i];
+        }
+    }
+    return NULL;
+}
+
+// parse an integer with an optional k, m or g suffix, returns 0 if the whole string is one
+static int configParseInt(const char *value, int64_t *out) {
+    char *end;
+    errno = 0;
+    int64_t n = strtoll(value, &end, 10);
+    if (end == value || errno != 0) {
+        return 1;
+    }
+    int shift = 0;
+    switch (tolower((unsigned char)*end)) {
+    case 'k':
+        shift = 10;
+        break;
+    case 'm':
+        shift = 20;
+        break;
+    case 'g':
+        shift = 30;
+        break;
+    }
+    if (shift > 0) {
+        end++;
+        if (n > (INT64_MAX >> shift) || n < (INT64_MIN >> shift)) {
+            return 1;
+        }
+        n *= (int64_t)1 << shift;
+    }
+    if (*end != '\0') {
+        return 1;
+    }
+    *out = n;
+    return 0;
+}
+
+int configSet(ConfigParam_t *param, const char *value) {
+    int64_t n;
+    switch (param->type) {
+    case CONFIG_INT:
+        if (configParseInt(value, &n) != 0 || n < param->min || n > param->max) {
+            return 1;
+        }
+        *(int64_t *)param->value = n;
+        return 0;
+    case CONFIG_BOOL:
+        if (strcmp(value, "yes") == 0) {
+            *(int *)param->value = 1;
+        } else if (strcmp(value, "no") == 0) {
+            *(int *)param->value = 0;
+        } else {
+            return 1;
+        }
+        return 0;
+    case CONFIG_ENUM:
+        for (int i = 0; param->choices[i] != NULL; i++) {
+            if (strcmp(value, param->choices[i]) == 0) {
+                *(int *)param->value = i;
+                return 0;
+            }
+        }
+        return 1;
+    case CONFIG_STRING: {
+        char *copy = strdup(value);
+        if (copy == NULL) {
+            return 2;
+        }
+        free(*(char **)param->value);
+        *(char **)param->value = copy;
+        return 0;
+    }
+    default:
+        return 1;
+    }
+}
+
+int configFormat(const ConfigParam_t *param, char *buf, size_t len) {
+    switch (param->type) {
+    case CONFIG_INT:
+        return snprintf(buf, len, "%ld", *(int64_t *)param->value);
+    case CONFIG_BOOL:
+        return snprintf(buf, len, "%s", *(int *)param->value ? "yes" : "no");
+    case CONFIG_ENUM:
+        return snprintf(buf, len, "%s", param->choices[*(int *)param->value]);
+    case CONFIG_STRING: {
+        const char *value = *(char **)param->value;
+        return snprintf(buf, len, "%s", value != NULL ? value : "");
+    }
+    default:
+        return snprintf(buf, len, "%s", "");
+    }
+}
+
+int configLoad(ConfigParam_t *params, int numParams, const char *path, char *err, size_t errlen) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        snprintf(err, errlen, "%s: %s", path, strerror(errno));
+        return -1;
+    }
+    char line[CONFIG_MAX_LINE];
+    int lineno = 0;
+    int retval = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lineno++;
+        size_t len = strlen(line);
+        if (len == sizeof(line) - 1 && line[len - 1] != '\n' && !feof(f)) {
+            snprintf(err, errlen, "%s:%d: Line too long", path, lineno);
+            retval = -1;
+            break;
+        }
+        while (len > 0 && isspace((unsigned char)line[len - 1])) {
+            line[--len] = '\0';
+        }
+        char *name = line;
+        while (isspace((unsigned char)*name)) {
+            name++;
+        }
+        if (*name == '\0' || *name == '#') {
+            continue;
+        }
+        // the value is the rest of the line, so paths can hold spaces
+        char *value = name;
+        while (*value != '\0' && !isspace((unsigned char)*value)) {
+            value++;
+        }
+        if (*value != '\0') {
+            *value++ = '\0';
+            while (isspace((unsigned char)*value)) {
+                value++;
+            }
+        }
+        ConfigParam_t *param = configFind(params, numParams, name);
+        if (param == NULL) {
+            snprintf(err, errlen, "%s:%d: Unknown setting %s", path, lineno, name);
+            retval = -1;
+            break;
+        }
+        if (*value == '\0' || configSet(param, value) != 0) {
+            snprintf(err, errlen, "%s:%d: Invalid value for %s", path, lineno, name);
+            retval = -1;
+            break;
+        }
+    }
+    fclose(f);
+    return retval;
+}
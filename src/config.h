@@ -0,0 +1,74 @@
+/*
+ * Settings read from a config file and from the command line. The file has one setting per line, its
+ * name and its value separated by spaces, and the same setting is given on the command line as
+ * --name value. Blank lines and lines starting with # are skipped.
+ *
+ *   # serve every interface, with room for more clients than the default
+ *   bind 0.0.0.0
+ *   max-clients 1000
+ *   client-output-limit 4m
+ *
+ * Integers take a k, m or g suffix for multiples of 1024. Booleans are yes or no.
+ *
+ * A setting with an apply function can be changed while the server runs with config set, which calls it
+ * once the new value is stored. The others are only read at startup.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef __CONFIG_H
+#define __CONFIG_H
+
+// longest line of a config file
+#define CONFIG_MAX_LINE 1024
+
+typedef enum ConfigType {
+    CONFIG_INT,    /* int64_t, between min and max */
+    CONFIG_BOOL,   /* int, 0 or 1 */
+    CONFIG_ENUM,   /* int, index of the value in choices */
+    CONFIG_STRING, /* char *, allocated, NULL until set */
+} ConfigType_t;
+
+typedef struct ConfigParam {
+    const char *name;
+    ConfigType_t type;
+    void *value; /* Where the setting is stored */
+    int64_t min;
+    int64_t max;
+    const char **choices; /* The values of a CONFIG_ENUM, NULL terminated */
+    void (*apply)(); /* Makes a change made with config set take effect, NULL if only read at startup */
+} ConfigParam_t;
+
+/**
+ * @returns The setting called name, or NULL if there is none
+ * */
+ConfigParam_t *configFind(ConfigParam_t *params, int numParams, const char *name);
+
+/**
+ * Parse and store a value of a setting. The stored value is left alone if the value is invalid
+ *
+ * @returns 0 if successful, 1 if the value is invalid, 2 on allocation failure
+ * */
+int configSet(ConfigParam_t *param, const char *value);
+
+/**
+ * Format the value of a setting as it would be written in the config file
+ *
+ * @returns The number of characters that would have been written, like snprintf
+ * */
+int configFormat(const ConfigParam_t *param, char *buf, size_t len);
+
+/**
+ * Set every setting in a config file
+ *
+ * @param err Set to the file, line and reason if the file can't be read or a line is invalid
+ *
+ * @returns 0 if successful, -1 on error
+ * */
+int configLoad(ConfigParam_t *params, int numParams, const char *path, char *err, size_t errlen);
+
+#endif /* __CONFIG_H */
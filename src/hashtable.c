@@ -1,8 +1,17 @@
 #include "hashtable.h"
+#include "collections.h"
+#include "lazyfree.h"
+#include "lz4.h"
 #include "siphash.h"
+#include "store.h"
+#include "trace.h"
+#include "vlog.h"
+#include <malloc.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
+#include <time.h>
 
 static const uint8_t k[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
 
@@ -19,8 +28,196 @@ static int cmpKey(const char *key1, size_t keylen1, const char *key2, size_t key
     return 1;
 }
 
+// get the value used to order an entry in an index, returns 0 if the value is numeric, 1 otherwise
+static int htIndexScore(HashtableValue_t htv, double *score) {
+    switch (htv.entryType) {
+    case UNSIGNED_INT:
+        *score = (double)htv.v.u64;
+        return 0;
+    case SIGNED_INT:
+        *score = (double)htv.v.s64;
+        return 0;
+    case DOUBLE:
+        *score = htv.v.d;
+        return 0;
+    default:
+        return 1;
+    }
+}
+
+static int htIndexMatches(HashtableIndex_t *idx, const char *key, size_t keylen) {
+    return keylen >= idx->prefixlen && memcmp(key, idx->prefix, idx->prefixlen) == 0;
+}
+
+// add the value of a key to every index covering the key
+static void htIndexInsert(Hashtable_t *ht, const char *key, size_t keylen, HashtableValue_t htv) {
+    double score;
+    if (ht->indexes == NULL || htIndexScore(htv, &score) != 0) {
+        return;
+    }
+    for (HashtableIndex_t *idx = ht->indexes; idx != NULL; idx = idx->next) {
+        if (htIndexMatches(idx, key, keylen)) {
+            slInsert(idx->sl, score, key, keylen);
+        }
+    }
+}
+
+// remove the value of a key from every index covering the key
+static void htIndexRemove(Hashtable_t *ht, const char *key, size_t keylen, HashtableValue_t htv) {
+    double score;
+    if (ht->indexes == NULL || htIndexScore(htv, &score) != 0) {
+        return;
+    }
+    for (HashtableIndex_t *idx = ht->indexes; idx != NULL; idx = idx->next) {
+        if (htIndexMatches(idx, key, keylen)) {
+            slRemove(idx->sl, score, key, keylen);
+        }
+    }
+}
+
+// try to store a STRING value compressed, returns 0 if the value was stored
+static int htCompressValue(Hashtable_t *ht, HashtableEntry_t *hte, const char *val, size_t len) {
+    size_t bound = LZ4_COMPRESSBOUND(len);
+    CompressedString_t *cstr = malloc(sizeof(CompressedString_t) + bound);
+    size_t complen = lz4Compress(val, len, cstr->data, bound);
+    if (complen == 0 || complen + sizeof(CompressedString_t) > len * (100 - ht->compressMinSavings) / 100) {
+        // not worth it, keep the value raw
+        free(cstr);
+        return 1;
+    }
+    cstr = realloc(cstr, sizeof(CompressedString_t) + complen);
+    cstr->rawlen = len;
+    cstr->complen = complen;
+    hte->htv.entryType = COMPRESSED_STRING;
+    hte->htv.v.cstr = cstr;
+    ht->compressedValues++;
+    ht->compressionSavedBytes += len + 1 - complen - sizeof(CompressedString_t);
+    return 0;
+}
+
+// store a value in an entry, STRING values are copied and collections are owned by the entry
+static void htSetValue(Hashtable_t *ht, HashtableEntry_t *hte, HashtableValue_t htv) {
+    hte->htv.entryType = htv.entryType;
+    if (htv.entryType == STRING) {
+        size_t len = strlen(htv.v.val);
+        if (ht->compressThreshold > 0 && len >= ht->compressThreshold && htCompressValue(ht, hte, htv.v.val, len) == 0) {
+            return;
+        }
+        hte->htv.v.val = malloc(len + 1);
+        strcpy(hte->htv.v.val, htv.v.val);
+    } else {
+        hte->htv.v = htv.v;
+    }
+}
+
+// free the memory owned by the value of an entry
+static void htFreeValue(Hashtable_t *ht, HashtableValue_t *htv) {
+    switch (htv->entryType) {
+    case STRING:
+        free(htv->v.val);
+        break;
+    case COMPRESSED_STRING:
+        ht->compressedValues--;
+        ht->compressionSavedBytes -= htv->v.cstr->rawlen + 1 - htv->v.cstr->complen - sizeof(CompressedString_t);
+        free(htv->v.cstr);
+        break;
+    case SPILLED_STRING:
+        // a table deleted lazily closed its value log already
+        if (ht->vlog != NULL) {
+            vlogRelease(ht->vlog, htv->v.spilled->offset, htv->v.spilled->len);
+        }
+        ht->spilledValues--;
+        ht->spilledBytes -= htv->v.spilled->len;
+        free(htv->v.spilled);
+        break;
+    case LIST:
+        listDelete(htv->v.list);
+        break;
+    case HASH:
+        hashDelete(htv->v.hash);
+        break;
+    case SET:
+        setDelete(htv->v.set);
+        break;
+    default:
+        break;
+    }
+}
+
+// how many allocations freeing a value takes, compared against HASHTABLE_LAZYFREE_EFFORT
+static uint64_t htFreeEffort(HashtableValue_t *htv) {
+    switch (htv->entryType) {
+    case STRING:
+        // a long string is unmapped page by page
+        return malloc_usable_size(htv->v.val) / 4096;
+    case COMPRESSED_STRING:
+        return htv->v.cstr->complen / 4096;
+    case LIST:
+        return htv->v.list->len;
+    case HASH:
+        return hashLen(htv->v.hash);
+    case SET:
+        return setLen(htv->v.set);
+    default:
+        return 1;
+    }
+}
+
+static void htLazyFreeList(void *list) {
+    listDelete(list);
+}
+
+static void htLazyFreeHash(void *hash) {
+    hashDelete(hash);
+}
+
+static void htLazyFreeSet(void *set) {
+    setDelete(set);
+}
+
+// free the value of an entry that was unlinked, handing it to the reclaimer if that takes long
+static void htDropValue(Hashtable_t *ht, HashtableValue_t *htv) {
+    if (htFreeEffort(htv) <= HASHTABLE_LAZYFREE_EFFORT) {
+        htFreeValue(ht, htv);
+        return;
+    }
+    switch (htv->entryType) {
+    case STRING:
+        lazyfreeSubmit(free, htv->v.val);
+        break;
+    case COMPRESSED_STRING:
+        // only the memory is freed later, the table accounts for the value now
+        ht->compressedValues--;
+        ht->compressionSavedBytes -= htv->v.cstr->rawlen + 1 - htv->v.cstr->complen - sizeof(CompressedString_t);
+        lazyfreeSubmit(free, htv->v.cstr);
+        break;
+    case LIST:
+        lazyfreeSubmit(htLazyFreeList, htv->v.list);
+        break;
+    case HASH:
+        lazyfreeSubmit(htLazyFreeHash, htv->v.hash);
+        break;
+    case SET:
+        lazyfreeSubmit(htLazyFreeSet, htv->v.set);
+        break;
+    default:
+        htFreeValue(ht, htv);
+        break;
+    }
+}
+
+// bucket of a key, the buckets of the upper half folded by a shrink in progress are in their lower half twin
+static uint64_t htBucket(Hashtable_t *ht, const char *key, size_t keylen) {
+    uint64_t idx = htHashFunction(key, keylen) & (((uint64_t)1 << ht->exp) - 1);
+    uint64_t half = (uint64_t)1 << (ht->exp - 1);
+    if (ht->shrinking && idx >= half && idx - half < ht->shrinkCursor) {
+        idx -= half;
+    }
+    return idx;
+}
+
 static HashtableEntry_t *htFindEntry(Hashtable_t *ht, const char *key, size_t keylen) {
-    uint64_t idx = htHashFunction(key, keylen) % (1 << ht->exp);
+    uint64_t idx = htBucket(ht, key, keylen);
     HashtableEntry_t *hte = ht->table[idx];
 
     // search for the entry, multiple entries may have hashed to the same spot so
@@ -34,14 +231,23 @@ static HashtableEntry_t *htFindEntry(Hashtable_t *ht, const char *key, size_t ke
     return hte;
 }
 
-static void htExpandAndRehash(Hashtable_t *ht) {
-    HashtableEntry_t **newTable = malloc((1 << (ht->exp + 1)) * sizeof(HashtableEntry_t));
-    memset(newTable, 0, (1 << (ht->exp + 1)) * sizeof(HashtableEntry_t));
-    for (uint64_t i = 0; i < (1 << ht->exp); i++) {
+// move every entry to a new table of 1 << exp buckets
+static int htRehash(Hashtable_t *ht, unsigned char exp) {
+#ifdef TRACE_ENABLED
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+#endif
+    TRACE2(rehash__start, ht->len, ht->exp);
+    uint64_t size = (uint64_t)1 << exp;
+    HashtableEntry_t **newTable = calloc(size, sizeof(HashtableEntry_t *));
+    if (newTable == NULL) {
+        return 1;
+    }
+    for (uint64_t i = 0; i < ((uint64_t)1 << ht->exp); i++) {
         HashtableEntry_t *hte = ht->table[i];
         while (hte != NULL) {
             HashtableEntry_t *next = hte->next;
-            uint64_t idx = htHashFunction(hte->key, hte->keylen) % (1 << (ht->exp + 1));
+            uint64_t idx = htHashFunction(hte->key, hte->keylen) & (size - 1);
 
             // add the entry at the top of the list
             hte->next = newTable[idx];
@@ -51,42 +257,271 @@ static void htExpandAndRehash(Hashtable_t *ht) {
     }
     free(ht->table);
     ht->table = newTable;
-    ht->exp++;
+    ht->exp = exp;
+#ifdef TRACE_ENABLED
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    TRACE3(rehash__done, ht->len, ht->exp, (end.tv_sec - start.tv_sec) * 1000000000 + end.tv_nsec - start.tv_nsec);
+#endif
+    return 0;
+}
+
+static void htNotify(Hashtable_t *ht, const char *key, size_t keylen, HashtableChange_t change) {
+    if (ht->onChange != NULL) {
+        ht->onChange(ht->onChangeCtx, key, keylen, change);
+    }
+}
+
+// add an entry to a mapped table, keeping the indexes up to date
+static int htStoreAdd(Hashtable_t *ht, const char *key, size_t keylen, HashtableValue_t htv) {
+    if (storeAdd(ht->store, key, keylen, htv) != 0) {
+        return 2;
+    }
+    if (ht->exp != ht->store->hdr->exp) {
+        ht->exp = ht->store->hdr->exp;
+        ht->rehashes++;
+    }
+    htIndexInsert(ht, key, keylen, htv);
+    if (ht->keyIndex != NULL) {
+        artInsert(ht->keyIndex, key, keylen);
+    }
+    ht->len++;
+    htNotify(ht, key, keylen, HT_CHANGE_ADD);
+    return 0;
+}
+
+static int htStoreRemove(Hashtable_t *ht, const char *key, size_t keylen) {
+    StoreEntry_t *se = storeFind(ht->store, key, keylen);
+    if (se == NULL) {
+        return 1; // nothing to remove
+    }
+    htIndexRemove(ht, key, keylen, storeValue(se));
+    if (ht->keyIndex != NULL) {
+        artRemove(ht->keyIndex, key, keylen);
+    }
+    storeRemove(ht->store, key, keylen);
+    ht->len--;
+    htNotify(ht, key, keylen, HT_CHANGE_REMOVE);
+    return 0;
+}
+
+static int htStoreReplace(Hashtable_t *ht, const char *key, size_t keylen, HashtableValue_t htv) {
+    StoreEntry_t *se = storeFind(ht->store, key, keylen);
+    if (se == NULL) {
+        return htStoreAdd(ht, key, keylen, htv);
+    }
+    HashtableValue_t old = storeValue(se);
+    if (storeReplace(ht->store, key, keylen, htv) != 0) {
+        return 2;
+    }
+    htIndexRemove(ht, key, keylen, old);
+    htIndexInsert(ht, key, keylen, htv);
+    htNotify(ht, key, keylen, HT_CHANGE_UPDATE);
+    return 0;
+}
+
+// write a new number to an entry of a mapped table
+static int htStoreSetNumber(Hashtable_t *ht, StoreEntry_t *se, HashtableValue_t htv, HashtableValue_t *result) {
+    htIndexRemove(ht, se->data, se->keylen, storeValue(se));
+    storeSetNumber(se, htv);
+    htIndexInsert(ht, se->data, se->keylen, htv);
+    htNotify(ht, se->data, se->keylen, HT_CHANGE_UPDATE);
+    if (result != NULL) {
+        *result = htv;
+    }
+    return 0;
+}
+
+typedef struct HtStoreVisit {
+    htVisitor_t visitor;
+    void *ctx;
+} HtStoreVisit_t;
+
+// visit an entry of a mapped table as a HashtableEntry_t
+static int htStoreVisitEntry(Store_t *store, StoreEntry_t *se, void *ctx) {
+    HtStoreVisit_t *visit = ctx;
+    HashtableEntry_t hte = {se->data, se->keylen, storeValue(se), NULL};
+    return visit->visitor(&hte, visit->ctx);
+}
+
+void htExpandAndRehash(Hashtable_t *ht) {
+    if (ht->store != NULL) {
+        if (storeRehash(ht->store, ht->exp + 1) == 0) {
+            ht->exp++;
+            ht->rehashes++;
+        }
+        return;
+    }
+    // a table filling up again while it shrinks finishes shrinking first
+    htShrinkStep(ht, UINT64_MAX);
+    if (htRehash(ht, ht->exp + 1) == 0) {
+        ht->rehashes++;
+    }
+}
+
+// start shrinking the table if few of its buckets are used
+static void htMaybeShrink(Hashtable_t *ht) {
+    if (!ht->shrinking && ht->exp > ht->minExp &&
+        ht->len * HASHTABLE_SHRINK_RATIO < ((uint64_t)1 << ht->exp)) {
+        ht->shrinking = 1;
+        ht->shrinkCursor = 0;
+    }
+}
+
+int htShrinkStep(Hashtable_t *ht, uint64_t buckets) {
+    if (!ht->shrinking || ht->exp <= ht->minExp) {
+        return 0;
+    }
+    // with a power of two size, the entries of bucket half + i belong in bucket i of the halved table
+    uint64_t half = (uint64_t)1 << (ht->exp - 1);
+    for (; buckets > 0 && ht->shrinkCursor < half; buckets--, ht->shrinkCursor++) {
+        HashtableEntry_t *upper = ht->table[half + ht->shrinkCursor];
+        if (upper == NULL) {
+            continue;
+        }
+        HashtableEntry_t *tail = upper;
+        while (tail->next != NULL) {
+            tail = tail->next;
+        }
+        tail->next = ht->table[ht->shrinkCursor];
+        ht->table[ht->shrinkCursor] = upper;
+        ht->table[half + ht->shrinkCursor] = NULL;
+    }
+    if (ht->shrinkCursor < half) {
+        return 1;
+    }
+    // if the smaller block can't be had, the upper half just stays unused
+    HashtableEntry_t **table = realloc(ht->table, half * sizeof(HashtableEntry_t *));
+    if (table != NULL) {
+        ht->table = table;
+    }
+    ht->exp--;
+    ht->shrinks++;
+    ht->shrinking = 0;
+    ht->shrinkCursor = 0;
+    TRACE2(shrink__done, ht->len, ht->exp);
+    // keep going if the table is still mostly empty
+    htMaybeShrink(ht);
+    return ht->shrinking;
+}
+
+int htResize(Hashtable_t *ht, unsigned char exp) {
+    if (exp < HASHTABLE_DEFAULTCAP || exp > HASHTABLE_MAX_INITIAL_EXP || ht->len > ((uint64_t)1 << exp)) {
+        return 1;
+    }
+    htShrinkStep(ht, UINT64_MAX);
+    if (exp == ht->exp) {
+        return 0;
+    }
+    unsigned char old = ht->exp;
+    // finishing a halving may have started the next one, which the rehash makes moot
+    ht->shrinking = 0;
+    ht->shrinkCursor = 0;
+    if (ht->store != NULL ? storeRehash(ht->store, exp) != 0 : htRehash(ht, exp) != 0) {
+        return 1;
+    }
+    ht->exp = exp;
+    if (exp > old) {
+        ht->rehashes++;
+    } else {
+        ht->shrinks++;
+    }
+    return 0;
 }
 
 Hashtable_t *htCreateTable() {
-    Hashtable_t *ht = malloc(sizeof(Hashtable_t));
-    memset(ht, 0, sizeof(Hashtable_t));
-    if (ht) {
-        ht->len = 0;
-        ht->exp = HASHTABLE_DEFAULTCAP;
-        ht->table = malloc((1 << HASHTABLE_DEFAULTCAP) * sizeof(HashtableEntry_t));
-        memset(ht->table, 0, (1 << HASHTABLE_DEFAULTCAP) * sizeof(HashtableEntry_t));
+    return htCreateSizedTable(HASHTABLE_DEFAULTCAP);
+}
+
+Hashtable_t *htCreateSizedTable(unsigned char exp) {
+    if (exp < HASHTABLE_DEFAULTCAP || exp > HASHTABLE_MAX_INITIAL_EXP) {
+        return NULL;
+    }
+    Hashtable_t *ht = calloc(1, sizeof(Hashtable_t));
+    if (ht == NULL) {
+        return NULL;
+    }
+    ht->exp = exp;
+    ht->minExp = exp;
+    ht->table = calloc((size_t)1 << exp, sizeof(HashtableEntry_t *));
+    if (ht->table == NULL) {
+        free(ht);
+        return NULL;
     }
+    return ht;
+}
 
+Hashtable_t *htCreateMappedTable(const char *path, int truncate) {
+    Hashtable_t *ht = calloc(1, sizeof(Hashtable_t));
+    if (ht == NULL) {
+        return NULL;
+    }
+    ht->store = storeOpen(path, truncate);
+    if (ht->store == NULL) {
+        free(ht);
+        return NULL;
+    }
+    ht->len = ht->store->hdr->len;
+    ht->exp = ht->store->hdr->exp;
     return ht;
 }
 
 void htDeleteTable(Hashtable_t *ht) {
+    // free all the indexes
+    while (ht->indexes != NULL) {
+        HashtableIndex_t *idx = ht->indexes;
+        ht->indexes = idx->next;
+        slDelete(idx->sl);
+        free(idx->prefix);
+        free(idx);
+    }
+    if (ht->keyIndex != NULL) {
+        artDelete(ht->keyIndex);
+    }
+    if (ht->store != NULL) {
+        storeClose(ht->store);
+        free(ht->scratch);
+        free(ht);
+        return;
+    }
     // free all the entries in the table
-    for (uint64_t i = 0; i < (1 << ht->exp); i++) {
+    for (uint64_t i = 0; i < ((uint64_t)1 << ht->exp); i++) {
         HashtableEntry_t *hte = ht->table[i];
         while (hte != NULL) {
             HashtableEntry_t *curr = hte;
             hte = hte->next;
-            if (curr->htv.entryType == STRING) {
-                free(curr->htv.v.val);
-            }
+            htFreeValue(ht, &curr->htv);
             free(curr->key);
             free(curr);
         }
     }
+    if (ht->vlog != NULL) {
+        vlogClose(ht->vlog);
+    }
     // free table
     free(ht->table);
+    free(ht->scratch);
     // free struct
     free(ht);
 }
 
+static void htDeleteTableJob(void *ht) {
+    htDeleteTable(ht);
+}
+
+void htDeleteTableLazy(Hashtable_t *ht) {
+    if (ht->store != NULL) {
+        // unmapping is cheap, the entries are in the file
+        htDeleteTable(ht);
+        return;
+    }
+    if (ht->vlog != NULL) {
+        // the log is removed now so a new table can create one at the same path
+        vlogClose(ht->vlog);
+        ht->vlog = NULL;
+    }
+    lazyfreeSubmit(htDeleteTableJob, ht);
+}
+
 uint64_t htHashFunction(const char *key, size_t keylen) {
     // Using siphash for the hashing function
     uint64_t hash;
@@ -94,7 +529,55 @@ uint64_t htHashFunction(const char *key, size_t keylen) {
     return hash;
 }
 
+// grow the buffer holding the last value read back by htFind
+static void htReserveScratch(Hashtable_t *ht, size_t len) {
+    if (ht->scratchlen < len) {
+        ht->scratch = realloc(ht->scratch, len);
+        ht->scratchlen = len;
+    }
+}
+
+// read a value back from the value log into the scratch buffer, NONE if it can't be read
+static HashtableValue_t htReadSpilled(Hashtable_t *ht, SpilledString_t *spilled) {
+    HashtableValue_t htv;
+    htReserveScratch(ht, spilled->len + 1);
+    if (vlogRead(ht->vlog, spilled->offset, spilled->len, ht->scratch) != 0) {
+        htv.entryType = NONE;
+        htv.v.val = 0;
+        return htv;
+    }
+    ht->scratch[spilled->len] = '\0';
+    htv.entryType = STRING;
+    htv.v.val = ht->scratch;
+    return htv;
+}
+
+// move a value read again since the last sweep back to memory
+static void htPromote(Hashtable_t *ht, HashtableEntry_t *hte) {
+    SpilledString_t *spilled = hte->htv.v.spilled;
+    char *val = malloc(spilled->len + 1);
+    if (val == NULL || vlogRead(ht->vlog, spilled->offset, spilled->len, val) != 0) {
+        free(val);
+        return;
+    }
+    val[spilled->len] = '\0';
+    htFreeValue(ht, &hte->htv);
+    hte->htv.entryType = STRING;
+    hte->htv.v.val = val;
+    ht->promotions++;
+}
+
 HashtableValue_t htFind(Hashtable_t *ht, const char *key, size_t keylen) {
+    if (ht->store != NULL) {
+        StoreEntry_t *se = storeFind(ht->store, key, keylen);
+        if (se != NULL) {
+            return storeValue(se);
+        }
+        HashtableValue_t htv;
+        htv.entryType = NONE;
+        htv.v.val = 0;
+        return htv;
+    }
     HashtableEntry_t *hte = htFindEntry(ht, key, keylen);
 
     if (hte == NULL) {
@@ -104,7 +587,31 @@ HashtableValue_t htFind(Hashtable_t *ht, const char *key, size_t keylen) {
         htv.v.val = 0;
         return htv;
     }
-    return hte->htv;
+    if (ht->vlog != NULL) {
+        if (hte->accessed && hte->htv.entryType == SPILLED_STRING) {
+            htPromote(ht, hte);
+        }
+        hte->accessed = 1;
+    }
+    return htEntryValue(ht, hte);
+}
+
+HashtableValue_t htEntryValue(Hashtable_t *ht, HashtableEntry_t *hte) {
+    if (hte->htv.entryType == SPILLED_STRING) {
+        return htReadSpilled(ht, hte->htv.v.spilled);
+    }
+    if (hte->htv.entryType != COMPRESSED_STRING) {
+        return hte->htv;
+    }
+    CompressedString_t *cstr = hte->htv.v.cstr;
+    htReserveScratch(ht, cstr->rawlen + 1);
+    lz4Decompress(cstr->data, cstr->complen, ht->scratch, cstr->rawlen);
+    ht->scratch[cstr->rawlen] = '\0';
+
+    HashtableValue_t htv;
+    htv.entryType = STRING;
+    htv.v.val = ht->scratch;
+    return htv;
 }
 
 int htAdd(Hashtable_t *ht, const char *key, size_t keylen, HashtableValue_t htv) {
@@ -112,33 +619,43 @@ int htAdd(Hashtable_t *ht, const char *key, size_t keylen, HashtableValue_t htv)
     if (htFind(ht, key, keylen).entryType != NONE) {
         return 1;
     }
+    if (ht->store != NULL) {
+        return htStoreAdd(ht, key, keylen, htv);
+    }
     // if more elements in hash table than size, we need to expand and re-hash
-    if (ht->len == (1 << ht->exp)) {
+    if (ht->len == ((uint64_t)1 << ht->exp)) {
         htExpandAndRehash(ht);
+    } else {
+        htShrinkStep(ht, HASHTABLE_SHRINK_STEP);
     }
-    uint64_t idx = htHashFunction(key, keylen) % (1 << ht->exp);
+    uint64_t idx = htBucket(ht, key, keylen);
     HashtableEntry_t *hte = malloc(sizeof(HashtableEntry_t));
     hte->key = malloc(keylen);
     memcpy(hte->key, key, keylen);
     hte->keylen = keylen;
-    hte->htv.entryType = htv.entryType;
-    if (htv.entryType == STRING) {
-        hte->htv.v.val = malloc(strlen(htv.v.val));
-        strcpy(hte->htv.v.val, htv.v.val);
-    } else {
-        hte->htv.v = htv.v;
-    }
+    htSetValue(ht, hte, htv);
+    hte->version = ++ht->version;
+    // a new value stays in memory until a sweep finds it wasn't read
+    hte->accessed = 1;
 
     // add the entry at the top of the list
     hte->next = ht->table[idx];
     ht->table[idx] = hte;
+    htIndexInsert(ht, hte->key, hte->keylen, hte->htv);
+    if (ht->keyIndex != NULL) {
+        artInsert(ht->keyIndex, hte->key, hte->keylen);
+    }
 
     ht->len++;
+    htNotify(ht, hte->key, hte->keylen, HT_CHANGE_ADD);
     return 0;
 }
 
 int htRemove(Hashtable_t *ht, const char *key, size_t keylen) {
-    uint64_t idx = htHashFunction(key, keylen) % (1 << ht->exp);
+    if (ht->store != NULL) {
+        return htStoreRemove(ht, key, keylen);
+    }
+    uint64_t idx = htBucket(ht, key, keylen);
     HashtableEntry_t *hte = ht->table[idx];
 
     // search for the entry, multiple entries may have hashed to the same spot so
@@ -159,29 +676,403 @@ int htRemove(Hashtable_t *ht, const char *key, size_t keylen) {
         // entry was at head of list
         ht->table[idx] = hte->next;
     }
+    htIndexRemove(ht, hte->key, hte->keylen, hte->htv);
+    if (ht->keyIndex != NULL) {
+        artRemove(ht->keyIndex, hte->key, hte->keylen);
+    }
+    htDropValue(ht, &hte->htv);
     free(hte->key);
     hte->key = NULL;
     free(hte);
 
     ht->len--;
+    htMaybeShrink(ht);
+    htShrinkStep(ht, HASHTABLE_SHRINK_STEP);
+    htNotify(ht, key, keylen, HT_CHANGE_REMOVE);
     return 0;
 }
 
 int htReplace(Hashtable_t *ht, const char *key, size_t keylen, HashtableValue_t htv) {
+    if (ht->store != NULL) {
+        return htStoreReplace(ht, key, keylen, htv);
+    }
     HashtableEntry_t *hte = htFindEntry(ht, key, keylen);
     if (hte != NULL) {
-        hte->htv.entryType = htv.entryType;
-        if (htv.entryType == STRING) {
-            hte->htv.v.val = malloc(strlen(htv.v.val));
-            strcpy(hte->htv.v.val, htv.v.val);
-        } else {
-            hte->htv.v = htv.v;
-        }
+        htIndexRemove(ht, hte->key, hte->keylen, hte->htv);
+        htDropValue(ht, &hte->htv);
+        htSetValue(ht, hte, htv);
+        hte->version = ++ht->version;
+        hte->accessed = 1;
         hte->key = realloc(hte->key, keylen);
         hte->keylen = keylen;
         memcpy(hte->key, key, keylen);
+        htIndexInsert(ht, hte->key, hte->keylen, hte->htv);
+        htNotify(ht, key, keylen, HT_CHANGE_UPDATE);
     } else {
         htAdd(ht, key, keylen, htv);
     }
     return 0;
 }
+
+int htReplaceIfVersion(Hashtable_t *ht, const char *key, size_t keylen, HashtableValue_t htv, uint64_t version) {
+    if (ht->store != NULL) {
+        return 2;
+    }
+    HashtableEntry_t *hte = htFindEntry(ht, key, keylen);
+    if ((hte != NULL ? hte->version : 0) != version) {
+        return 1;
+    }
+    return htReplace(ht, key, keylen, htv);
+}
+
+uint64_t htVersion(Hashtable_t *ht, const char *key, size_t keylen) {
+    HashtableEntry_t *hte = ht->store == NULL ? htFindEntry(ht, key, keylen) : NULL;
+    return hte != NULL ? hte->version : 0;
+}
+
+int htTouch(Hashtable_t *ht, const char *key, size_t keylen) {
+    HashtableEntry_t *hte = ht->store == NULL ? htFindEntry(ht, key, keylen) : NULL;
+    if (hte == NULL) {
+        return 1;
+    }
+    hte->version = ++ht->version;
+    htNotify(ht, key, keylen, HT_CHANGE_UPDATE);
+    return 0;
+}
+
+void htSetChangeHandler(Hashtable_t *ht, htChangeHandler_t handler, void *ctx) {
+    ht->onChange = handler;
+    ht->onChangeCtx = ctx;
+}
+
+// add delta to an integer value, returns 0 if successful, 1 if it is not an integer, 2 if it would overflow
+static int htAddInteger(HashtableValue_t *value, int64_t delta) {
+    HashtableValue_t htv = *value;
+    switch (htv.entryType) {
+    case UNSIGNED_INT:
+        if (delta >= 0 && __builtin_add_overflow(htv.v.u64, (uint64_t)delta, &htv.v.u64)) {
+            return 2;
+        }
+        if (delta < 0) {
+            // negate in unsigned arithmetic so INT64_MIN doesn't overflow
+            uint64_t sub = -(uint64_t)delta;
+            if (htv.v.u64 < sub) {
+                return 2;
+            }
+            htv.v.u64 -= sub;
+        }
+        break;
+    case SIGNED_INT:
+        if (__builtin_add_overflow(htv.v.s64, delta, &htv.v.s64)) {
+            return 2;
+        }
+        break;
+    default:
+        return 1;
+    }
+    *value = htv;
+    return 0;
+}
+
+int htIncrBy(Hashtable_t *ht, const char *key, size_t keylen, int64_t delta, HashtableValue_t *result) {
+    StoreEntry_t *se = ht->store != NULL ? storeFind(ht->store, key, keylen) : NULL;
+    if (se != NULL) {
+        HashtableValue_t htv = storeValue(se);
+        int retval = htAddInteger(&htv, delta);
+        return retval != 0 ? retval : htStoreSetNumber(ht, se, htv, result);
+    }
+    HashtableEntry_t *hte = ht->store == NULL ? htFindEntry(ht, key, keylen) : NULL;
+    if (hte == NULL) {
+        HashtableValue_t htv;
+        htv.entryType = SIGNED_INT;
+        htv.v.s64 = delta;
+        if (htAdd(ht, key, keylen, htv) != 0) {
+            return 3;
+        }
+        if (result != NULL) {
+            *result = htv;
+        }
+        return 0;
+    }
+
+    HashtableValue_t htv = hte->htv;
+    int retval = htAddInteger(&htv, delta);
+    if (retval != 0) {
+        return retval;
+    }
+    htIndexRemove(ht, hte->key, hte->keylen, hte->htv);
+    hte->htv.v = htv.v;
+    hte->version = ++ht->version;
+    htIndexInsert(ht, hte->key, hte->keylen, hte->htv);
+    htNotify(ht, key, keylen, HT_CHANGE_UPDATE);
+    if (result != NULL) {
+        *result = hte->htv;
+    }
+    return 0;
+}
+
+int htIncrByFloat(Hashtable_t *ht, const char *key, size_t keylen, double delta, HashtableValue_t *result) {
+    if (isnan(delta) || isinf(delta)) {
+        return 2;
+    }
+    StoreEntry_t *se = ht->store != NULL ? storeFind(ht->store, key, keylen) : NULL;
+    if (se != NULL) {
+        HashtableValue_t htv = storeValue(se);
+        if (htv.entryType != DOUBLE) {
+            return 1;
+        }
+        htv.v.d += delta;
+        return isnan(htv.v.d) || isinf(htv.v.d) ? 2 : htStoreSetNumber(ht, se, htv, result);
+    }
+    HashtableEntry_t *hte = ht->store == NULL ? htFindEntry(ht, key, keylen) : NULL;
+    if (hte == NULL) {
+        HashtableValue_t htv;
+        htv.entryType = DOUBLE;
+        htv.v.d = delta;
+        if (htAdd(ht, key, keylen, htv) != 0) {
+            return 3;
+        }
+        if (result != NULL) {
+            *result = htv;
+        }
+        return 0;
+    }
+    if (hte->htv.entryType != DOUBLE) {
+        return 1;
+    }
+    double d = hte->htv.v.d + delta;
+    if (isnan(d) || isinf(d)) {
+        return 2;
+    }
+    htIndexRemove(ht, hte->key, hte->keylen, hte->htv);
+    hte->htv.v.d = d;
+    hte->version = ++ht->version;
+    htIndexInsert(ht, hte->key, hte->keylen, hte->htv);
+    htNotify(ht, key, keylen, HT_CHANGE_UPDATE);
+    if (result != NULL) {
+        *result = hte->htv;
+    }
+    return 0;
+}
+
+int htEnableTiering(Hashtable_t *ht, const char *path, size_t threshold) {
+    if (ht->vlog != NULL || ht->store != NULL) {
+        return 1;
+    }
+    ht->vlog = vlogOpen(path);
+    if (ht->vlog == NULL) {
+        return 1;
+    }
+    ht->tierThreshold = threshold;
+    ht->tierCursor = 0;
+    return 0;
+}
+
+// move a STRING value to the value log, returns 0 if it was moved
+static int htSpill(Hashtable_t *ht, HashtableEntry_t *hte, size_t len) {
+    SpilledString_t *spilled = malloc(sizeof(SpilledString_t));
+    if (spilled == NULL || len > UINT32_MAX || vlogAppend(ht->vlog, hte->htv.v.val, len, &spilled->offset) != 0) {
+        free(spilled);
+        return 1;
+    }
+    spilled->len = len;
+    free(hte->htv.v.val);
+    hte->htv.entryType = SPILLED_STRING;
+    hte->htv.v.spilled = spilled;
+    ht->spilledValues++;
+    ht->spilledBytes += len;
+    return 0;
+}
+
+uint64_t htTierStep(Hashtable_t *ht, uint64_t buckets, int force) {
+    if (ht->vlog == NULL) {
+        return 0;
+    }
+    uint64_t size = (uint64_t)1 << ht->exp;
+    uint64_t spilled = 0;
+    if (force) {
+        ht->tierCursor = 0;
+    }
+    for (; buckets > 0; buckets--) {
+        if (ht->tierCursor >= size) {
+            ht->tierCursor = 0;
+            if (force) {
+                break;
+            }
+        }
+        for (HashtableEntry_t *hte = ht->table[ht->tierCursor]; hte != NULL; hte = hte->next) {
+            if (hte->accessed && !force) {
+                hte->accessed = 0;
+            } else if (hte->htv.entryType == STRING) {
+                size_t len = strlen(hte->htv.v.val);
+                if (len >= ht->tierThreshold && htSpill(ht, hte, len) == 0) {
+                    spilled++;
+                }
+            }
+        }
+        ht->tierCursor++;
+    }
+    if (vlogShouldCompact(ht->vlog)) {
+        htTierCompact(ht);
+    }
+    return spilled;
+}
+
+int htTierCompact(Hashtable_t *ht) {
+    if (ht->vlog == NULL || vlogCompactBegin(ht->vlog) != 0) {
+        return 1;
+    }
+    int failed = 0;
+    for (uint64_t i = 0; i < ((uint64_t)1 << ht->exp) && !failed; i++) {
+        for (HashtableEntry_t *hte = ht->table[i]; hte != NULL && !failed; hte = hte->next) {
+            if (hte->htv.entryType == SPILLED_STRING) {
+                SpilledString_t *spilled = hte->htv.v.spilled;
+                failed = vlogCompactCopy(ht->vlog, spilled->offset, spilled->len);
+            }
+        }
+    }
+    if (vlogCompactEnd(ht->vlog, failed) != 0) {
+        return 1;
+    }
+    // the values were copied back to back in the order of the walk, walking again finds them in order
+    uint64_t offset = 0;
+    for (uint64_t i = 0; i < ((uint64_t)1 << ht->exp); i++) {
+        for (HashtableEntry_t *hte = ht->table[i]; hte != NULL; hte = hte->next) {
+            if (hte->htv.entryType == SPILLED_STRING) {
+                hte->htv.v.spilled->offset = offset;
+                offset += hte->htv.v.spilled->len;
+            }
+        }
+    }
+    return 0;
+}
+
+void htGetStats(Hashtable_t *ht, HashtableStats_t *stats) {
+    memset(stats, 0, sizeof(HashtableStats_t));
+    stats->len = ht->len;
+    stats->exp = ht->exp;
+    stats->size = (uint64_t)1 << ht->exp;
+    stats->loadFactor = (double)ht->len / stats->size;
+    stats->rehashes = ht->rehashes;
+    stats->shrinks = ht->shrinks;
+    stats->shrinking = ht->shrinking;
+    if (ht->store != NULL) {
+        storeChainStats(ht->store, &stats->usedBuckets, &stats->longestChain);
+        return;
+    }
+    for (uint64_t i = 0; i < stats->size; i++) {
+        uint64_t chain = 0;
+        for (HashtableEntry_t *hte = ht->table[i]; hte != NULL; hte = hte->next) {
+            chain++;
+        }
+        if (chain > 0) {
+            stats->usedBuckets++;
+        }
+        if (chain > stats->longestChain) {
+            stats->longestChain = chain;
+        }
+    }
+}
+
+void htSetCompression(Hashtable_t *ht, size_t threshold, unsigned char minSavings) {
+    ht->compressThreshold = threshold;
+    ht->compressMinSavings = minSavings > 100 ? 100 : minSavings;
+}
+
+int htForEach(Hashtable_t *ht, htVisitor_t visitor, void *ctx) {
+    if (ht->store != NULL) {
+        HtStoreVisit_t visit = {visitor, ctx};
+        return storeForEach(ht->store, htStoreVisitEntry, &visit);
+    }
+    for (uint64_t i = 0; i < ((uint64_t)1 << ht->exp); i++) {
+        HashtableEntry_t *hte = ht->table[i];
+        while (hte != NULL) {
+            HashtableEntry_t *next = hte->next;
+            if (visitor(hte, ctx) != 0) {
+                return 1;
+            }
+            hte = next;
+        }
+    }
+    return 0;
+}
+
+// index an entry if it is covered by the index being created
+static int htIndexBackfill(HashtableEntry_t *hte, void *ctx) {
+    HashtableIndex_t *idx = ctx;
+    double score;
+    if (htIndexMatches(idx, hte->key, hte->keylen) && htIndexScore(hte->htv, &score) == 0) {
+        slInsert(idx->sl, score, hte->key, hte->keylen);
+    }
+    return 0;
+}
+
+int htCreateIndex(Hashtable_t *ht, const char *prefix, size_t prefixlen) {
+    if (htGetIndex(ht, prefix, prefixlen) != NULL) {
+        return 1;
+    }
+    HashtableIndex_t *idx = malloc(sizeof(HashtableIndex_t));
+    idx->prefix = malloc(prefixlen);
+    memcpy(idx->prefix, prefix, prefixlen);
+    idx->prefixlen = prefixlen;
+    idx->sl = slCreate();
+    htForEach(ht, htIndexBackfill, idx);
+
+    idx->next = ht->indexes;
+    ht->indexes = idx;
+    return 0;
+}
+
+int htDropIndex(Hashtable_t *ht, const char *prefix, size_t prefixlen) {
+    HashtableIndex_t *prev = NULL;
+    HashtableIndex_t *idx = ht->indexes;
+    while (idx != NULL && !cmpKey(idx->prefix, idx->prefixlen, prefix, prefixlen)) {
+        prev = idx;
+        idx = idx->next;
+    }
+    if (idx == NULL) {
+        return 1; // nothing to drop
+    }
+    if (prev != NULL) {
+        prev->next = idx->next;
+    } else {
+        ht->indexes = idx->next;
+    }
+    slDelete(idx->sl);
+    free(idx->prefix);
+    free(idx);
+    return 0;
+}
+
+HashtableIndex_t *htGetIndex(Hashtable_t *ht, const char *prefix, size_t prefixlen) {
+    for (HashtableIndex_t *idx = ht->indexes; idx != NULL; idx = idx->next) {
+        if (cmpKey(idx->prefix, idx->prefixlen, prefix, prefixlen)) {
+            return idx;
+        }
+    }
+    return NULL;
+}
+
+// add an entry to the key index being created
+static int htKeyIndexBackfill(HashtableEntry_t *hte, void *ctx) {
+    artInsert(ctx, hte->key, hte->keylen);
+    return 0;
+}
+
+int htEnableKeyIndex(Hashtable_t *ht) {
+    if (ht->keyIndex != NULL) {
+        return 1;
+    }
+    ht->keyIndex = artCreate();
+    htForEach(ht, htKeyIndexBackfill, ht->keyIndex);
+    return 0;
+}
+
+int htDisableKeyIndex(Hashtable_t *ht) {
+    if (ht->keyIndex == NULL) {
+        return 1;
+    }
+    artDelete(ht->keyIndex);
+    ht->keyIndex = NULL;
+    return 0;
+}
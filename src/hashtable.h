@@ -6,6 +6,8 @@
 
 #pragma once
 
+#include "art.h"
+#include "skiplist.h"
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -16,15 +18,48 @@
 
 // 2^5 (or 1 << 5) = 32
 #define HASHTABLE_DEFAULTCAP 5
+// largest table htCreateSizedTable or htResize creates at once, 8GB of buckets, tables only grow past it
+// as they fill up
+#define HASHTABLE_MAX_INITIAL_EXP 30
+// the table grows when it is full and starts shrinking once less than 1/HASHTABLE_SHRINK_RATIO of it is
+// used, so a table that just grew or shrank is far from doing either again
+#define HASHTABLE_SHRINK_RATIO 8
+// buckets folded by every add or remove while the table shrinks
+#define HASHTABLE_SHRINK_STEP 64
+// buckets folded per call by a server with time to spare between requests
+#define HASHTABLE_SHRINK_IDLE_STEP 16384
+// values costing more than this many allocations to free are freed by the reclaimer thread, see lazyfree.h.
+// STRING values count one per page
+#define HASHTABLE_LAZYFREE_EFFORT 64
+// STRING values of at least this many bytes are moved to the value log once cold, see htEnableTiering
+#define HASHTABLE_TIER_DEFAULT_THRESHOLD 256
+// buckets swept per call by a server with time to spare between requests
+#define HASHTABLE_TIER_IDLE_STEP 16384
 
 typedef enum EntryType {
     STRING,
     UNSIGNED_INT,
     SIGNED_INT,
     DOUBLE,
+    LIST,
+    HASH,
+    SET,
+    COMPRESSED_STRING, /* Only stored in entries, htFind returns the decompressed STRING */
+    SPILLED_STRING,    /* Only stored in entries, htFind returns the STRING read back from the value log */
     NONE,
 } EntryType_t;
 
+typedef struct CompressedString {
+    uint32_t rawlen;  /* Length of the original string without the NUL terminator */
+    uint32_t complen; /* Length of data */
+    char data[];      /* LZ4 block, see lz4.h */
+} CompressedString_t;
+
+typedef struct SpilledString {
+    uint64_t offset; /* Where the value is in the value log, see vlog.h */
+    uint32_t len;    /* Length of the value without the NUL terminator */
+} SpilledString_t;
+
 typedef struct HashtableValue_t {
     EntryType_t entryType;
     union {
@@ -32,6 +67,11 @@ typedef struct HashtableValue_t {
         uint64_t u64;
         int64_t s64;
         double d;
+        struct List *list; /* Collections are owned by the table, see collections.h */
+        struct Hash *hash;
+        struct Set *set;
+        CompressedString_t *cstr;
+        SpilledString_t *spilled;
     } v;
 } HashtableValue_t;
 
@@ -40,14 +80,84 @@ typedef struct HashtableEntry {
     size_t keylen;
     HashtableValue_t htv;
     struct HashtableEntry *next; // Using separate chaining to handle hash-conflicts
+    uint64_t version;            /* Changes every time the value does, see htVersion */
+    unsigned char accessed;      /* Set by htFind on a tiered table, cleared by htTierStep */
 } HashtableEntry_t;
 
+typedef struct HashtableIndex {
+    char *prefix;                /* Only keys starting with this prefix are indexed */
+    size_t prefixlen;
+    Skiplist_t *sl;              /* Numeric values of the indexed keys, ordered by value */
+    struct HashtableIndex *next; /* Next index of the same table */
+} HashtableIndex_t;
+
+typedef enum HashtableChange {
+    HT_CHANGE_ADD,    /* The key was added */
+    HT_CHANGE_UPDATE, /* The value of the key changed */
+    HT_CHANGE_REMOVE, /* The key was removed */
+} HashtableChange_t;
+
+/**
+ * Called after every change to a key, see htSetChangeHandler
+ *
+ * @param ctx The context pointer passed to htSetChangeHandler
+ * @param key The key that changed
+ * @param keylen The length of the key
+ * @param change What happened to the key
+ * */
+typedef void (*htChangeHandler_t)(void *ctx, const char *key, size_t keylen, HashtableChange_t change);
+
 typedef struct Hashtable {
-    HashtableEntry_t **table; /* Array of pointers to hashtable entries */
-    uint64_t len;             /* number of key/value pairs*/
-    unsigned char exp;        /* Size of the table array is 1<<exp (size is number of open slots) */
+    HashtableEntry_t **table;  /* Array of pointers to hashtable entries */
+    uint64_t len;              /* number of key/value pairs*/
+    unsigned char exp;         /* Size of the table array is 1<<exp (size is number of open slots) */
+    unsigned char minExp;      /* The table doesn't shrink below the size it was created with */
+    HashtableIndex_t *indexes; /* Ordered indexes over numeric values, NULL if there are none */
+    Art_t *keyIndex;           /* Ordered index over all keys, NULL unless enabled with htEnableKeyIndex */
+    size_t compressThreshold;  /* STRING values of at least this many bytes are compressed, 0 to disable */
+    unsigned char compressMinSavings; /* Compressed values are only kept if they save this percentage of the size */
+    uint64_t compressedValues;        /* Number of values stored compressed */
+    uint64_t compressionSavedBytes;   /* Bytes saved by storing these values compressed */
+    char *scratch;                    /* Holds the last value decompressed by htFind */
+    size_t scratchlen;
+    uint64_t rehashes;                /* Number of times the table was expanded */
+    uint64_t shrinks;                 /* Number of times the table was shrunk */
+    int shrinking;                    /* Set while the upper half of the table is folded into the lower half */
+    uint64_t shrinkCursor;            /* Buckets of the upper half already folded into their lower half twin */
+    struct Store *store;              /* Holds the entries of a mapped table instead of table, see store.h */
+    struct ValueLog *vlog;            /* Holds the values moved out of memory, NULL unless tiering is enabled */
+    size_t tierThreshold;             /* STRING values of at least this many bytes are moved to vlog once cold */
+    uint64_t tierCursor;              /* Next bucket swept by htTierStep */
+    uint64_t spilledValues;           /* Number of values in vlog */
+    uint64_t spilledBytes;            /* Bytes of these values */
+    uint64_t promotions;              /* Values moved back to memory because they were read again */
+    uint64_t version;                 /* Last version given to an entry, versions are never reused */
+    htChangeHandler_t onChange;       /* NULL unless set with htSetChangeHandler */
+    void *onChangeCtx;
 } Hashtable_t;
 
+typedef struct HashtableStats {
+    uint64_t len;
+    uint64_t size;         /* Number of buckets, 1<<exp */
+    unsigned char exp;
+    double loadFactor;     /* len / size */
+    uint64_t usedBuckets;  /* Buckets holding at least one entry */
+    uint64_t longestChain; /* Most entries in a single bucket */
+    uint64_t rehashes;
+    uint64_t shrinks;
+    int shrinking;
+} HashtableStats_t;
+
+/**
+ * Callback invoked for every entry visited by htForEach
+ *
+ * @param hte The entry being visited
+ * @param ctx The context pointer passed to htForEach
+ *
+ * @returns 0 to continue iterating, non-zero to stop
+ * */
+typedef int (*htVisitor_t)(HashtableEntry_t *hte, void *ctx);
+
 /**
  * Hash function for the hashtable
  *
@@ -65,6 +175,28 @@ uint64_t htHashFunction(const char *key, size_t keylen);
  * */
 Hashtable_t *htCreateTable();
 
+/**
+ * Create an empty Hashtable with room for many keys before it first expands. It never shrinks below
+ * this size on its own, only htResize makes it smaller
+ *
+ * @param exp The table starts with 1 << exp buckets, between HASHTABLE_DEFAULTCAP and HASHTABLE_MAX_INITIAL_EXP
+ *
+ * @returns The empty Hashtable structure or null on error
+ * */
+Hashtable_t *htCreateSizedTable(unsigned char exp);
+
+/**
+ * Create a Hashtable whose entries live in a memory mapped file and survive restarts, see store.h.
+ * It only holds STRING, UNSIGNED_INT, SIGNED_INT and DOUBLE values, is not compressed and doesn't
+ * shrink. Indexes are not stored in the file
+ *
+ * @param path The file, created if it doesn't exist
+ * @param truncate Set to drop the entries in the file
+ *
+ * @returns The Hashtable structure or null if the file can't be mapped
+ * */
+Hashtable_t *htCreateMappedTable(const char *path, int truncate);
+
 /**
  * Free the hashtable structure
  *
@@ -74,6 +206,15 @@ Hashtable_t *htCreateTable();
  * */
 void htDeleteTable(Hashtable_t *ht);
 
+/**
+ * Free the hashtable structure on the reclaimer thread, see lazyfree.h. The table must not be used
+ * anymore. A mapped table is closed right away, like the value log of a tiered table, so their files can
+ * be opened again as soon as this returns
+ *
+ * @param ht The Hashtable to free
+ * */
+void htDeleteTableLazy(Hashtable_t *ht);
+
 /**
  * Get an entry from the hashtable
  *
@@ -81,24 +222,37 @@ void htDeleteTable(Hashtable_t *ht);
  * @param key The key
  * @param keylen The size of the key
  *
- * @returns The value if found, otherwise returns a HashtableValue set to the NONE value
+ * @returns The value if found, otherwise returns a HashtableValue set to the NONE value.
+ *          Compressed values are decompressed into a buffer that is valid until the next htFind
  * */
 HashtableValue_t htFind(Hashtable_t *ht, const char *key, size_t keylen);
 
 /**
- * Add an entry to the hashtable
+ * Get the value of an entry, decompressing it if needed
+ *
+ * @param ht The table the entry belongs to
+ * @param hte The entry
+ *
+ * @returns The value of the entry, a decompressed value is valid until the next htFind or htEntryValue
+ * */
+HashtableValue_t htEntryValue(Hashtable_t *ht, HashtableEntry_t *hte);
+
+/**
+ * Add an entry to the hashtable. STRING values are copied, LIST, HASH and SET values are
+ * owned by the table from now on and freed when the entry is removed or replaced
  *
  * @param ht The hashtable to add to
  * @param key The key of the entry
  * @param keylen The length of the key
  * @param htv The value of the entry
  *
- * @returns 0 if insert successful, 1 if key already exists in table
+ * @returns 0 if insert successful, 1 if key already exists in table, 2 if a mapped table can't store the value
  * */
 int htAdd(Hashtable_t *ht, const char *key, size_t keylen, HashtableValue_t htv);
 
 /**
- * Remove an entry in the hashtable
+ * Remove an entry in the hashtable. Once less than 1/HASHTABLE_SHRINK_RATIO of the buckets would be
+ * used, the table starts shrinking a few buckets per add or remove
  *
  * @param ht The hashtable to remove the entry from
  * @param key The key of the entry
@@ -109,15 +263,244 @@ int htAdd(Hashtable_t *ht, const char *key, size_t keylen, HashtableValue_t htv)
 int htRemove(Hashtable_t *ht, const char *key, size_t keylen);
 
 /**
- * Replace an entry in the hashtable. If entry does not already exist, add the entry
+ * Replace an entry in the hashtable. If entry does not already exist, add the entry.
+ * The previous value is freed, the new value is copied or owned like in htAdd
  *
  * @param ht The hashtable to replace the entry from
  * @param key The key of the entry to replace
  * @param keylen The length of the key
  * @param htv The new value for the key
  *
- * @returns 0
+ * @returns 0 if successful, 2 if a mapped table can't store the value
  */
 int htReplace(Hashtable_t *ht, const char *key, size_t keylen, HashtableValue_t htv);
 
+/**
+ * Replace an entry only if its value didn't change since it had version, so a client that read the
+ * value can write it back without losing a concurrent write. Mapped tables don't keep versions
+ *
+ * @param ht The hashtable
+ * @param key The key of the entry to replace
+ * @param keylen The length of the key
+ * @param htv The new value for the key
+ * @param version The version read with htVersion, 0 to add a key that must not exist yet
+ *
+ * @returns 0 if successful, 1 if the version changed, 2 if the table is mapped
+ * */
+int htReplaceIfVersion(Hashtable_t *ht, const char *key, size_t keylen, HashtableValue_t htv, uint64_t version);
+
+/**
+ * The version of a value changes every time the value does, and a key added again after it was removed
+ * gets a version it never had before
+ *
+ * @param ht The hashtable
+ * @param key The key of the entry
+ * @param keylen The length of the key
+ *
+ * @returns The version of the value of key, 0 if the key doesn't exist or the table is mapped
+ * */
+uint64_t htVersion(Hashtable_t *ht, const char *key, size_t keylen);
+
+/**
+ * Call handler after every key the table adds, changes or removes. Deleting the table doesn't count as
+ * removing its keys
+ *
+ * @param ht The hashtable
+ * @param handler Called with ctx, NULL to stop
+ * @param ctx Passed to handler
+ * */
+void htSetChangeHandler(Hashtable_t *ht, htChangeHandler_t handler, void *ctx);
+
+/**
+ * Give the value of a key a new version, for values changed in place like the collections returned by htFind
+ *
+ * @param ht The hashtable
+ * @param key The key of the entry
+ * @param keylen The length of the key
+ *
+ * @returns 0 if successful, 1 if the key doesn't exist or the table is mapped
+ * */
+int htTouch(Hashtable_t *ht, const char *key, size_t keylen);
+
+/**
+ * Add delta to an integer (UNSIGNED_INT or SIGNED_INT) value in place. If the key does not exist,
+ * it is created as a SIGNED_INT with the value delta.
+ *
+ * @param ht The hashtable holding the value
+ * @param key The key of the entry
+ * @param keylen The length of the key
+ * @param delta The amount to add, negative to decrement
+ * @param result Set to the new value if successful, may be NULL
+ *
+ * @returns 0 if successful, 1 if the value is not an integer, 2 if the result would overflow the type of the value,
+ *          3 if the key doesn't exist and couldn't be added
+ * */
+int htIncrBy(Hashtable_t *ht, const char *key, size_t keylen, int64_t delta, HashtableValue_t *result);
+
+/**
+ * Add delta to a DOUBLE value in place. If the key does not exist, it is created as a DOUBLE with the value delta.
+ *
+ * @param ht The hashtable holding the value
+ * @param key The key of the entry
+ * @param keylen The length of the key
+ * @param delta The amount to add, negative to decrement
+ * @param result Set to the new value if successful, may be NULL
+ *
+ * @returns 0 if successful, 1 if the value is not a DOUBLE, 2 if the result would be NaN or infinite, 3 if the key
+ *          doesn't exist and couldn't be added
+ * */
+int htIncrByFloat(Hashtable_t *ht, const char *key, size_t keylen, double delta, HashtableValue_t *result);
+
+/**
+ * Double the size of the table and move every entry to its new bucket. Called by htAdd when the
+ * table is full, exposed so the cost of a rehash can be measured on its own
+ *
+ * @param ht The hashtable to expand
+ * */
+void htExpandAndRehash(Hashtable_t *ht);
+
+/**
+ * Fold buckets of the upper half of a shrinking table into the lower half, halving the table once
+ * every bucket is folded. Adds and removes call it with HASHTABLE_SHRINK_STEP, an idle server can call
+ * it to finish shrinking without waiting for writes
+ *
+ * @param ht The hashtable
+ * @param buckets The most buckets to fold
+ *
+ * @returns 1 if the table is still shrinking, 0 otherwise
+ * */
+int htShrinkStep(Hashtable_t *ht, uint64_t buckets);
+
+/**
+ * Move every entry to a table of 1 << exp buckets at once
+ *
+ * @param ht The hashtable
+ * @param exp The new size of the table, between HASHTABLE_DEFAULTCAP and HASHTABLE_MAX_INITIAL_EXP
+ *
+ * @returns 0 if successful, 1 if exp is out of range, too small for the entries or the table couldn't be
+ *          allocated
+ * */
+int htResize(Hashtable_t *ht, unsigned char exp);
+
+/**
+ * Move cold STRING values to an append-only value log on disk, keeping only the key and where the value
+ * is in memory. A value is cold if htFind didn't read it since htTierStep last swept its bucket. htFind
+ * reads a moved value back from the log, and moves it back to memory if it is read again before the next
+ * sweep. Mapped tables can't be tiered
+ *
+ * @param ht The hashtable
+ * @param path The value log, replaced if it exists and removed when the table is deleted
+ * @param threshold The minimum length of a value to move
+ *
+ * @returns 0 if successful, 1 if tiering is already enabled, the table is mapped or the log can't be created
+ * */
+int htEnableTiering(Hashtable_t *ht, const char *path, size_t threshold);
+
+/**
+ * Sweep buckets of a tiered table, moving the cold values to the value log and clearing the accessed
+ * mark of the others. Compacts the log once most of it is dead values
+ *
+ * @param ht The hashtable
+ * @param buckets The most buckets to sweep
+ * @param force Set to move every value long enough, whether it is cold or not
+ *
+ * @returns The number of values moved
+ * */
+uint64_t htTierStep(Hashtable_t *ht, uint64_t buckets, int force);
+
+/**
+ * Copy the values still referenced to a new value log, dropping the values that were replaced or removed
+ *
+ * @param ht The hashtable
+ *
+ * @returns 0 if successful, 1 if tiering is not enabled or the new log couldn't be written
+ * */
+int htTierCompact(Hashtable_t *ht);
+
+/**
+ * Collect statistics about the layout of the table, walks every bucket
+ *
+ * @param ht The hashtable
+ * @param stats Filled with the statistics
+ * */
+void htGetStats(Hashtable_t *ht, HashtableStats_t *stats);
+
+/**
+ * Compress STRING values added or replaced from now on if they are at least threshold bytes long
+ * and compressing them saves at least minSavings percent of their size
+ *
+ * Values set through the server are limited by BUFFER_SIZE (see network.h), which caps a whole command at
+ * 1KB, so a threshold above a few hundred bytes only affects values added directly through this API
+ *
+ * @param ht The hashtable
+ * @param threshold The minimum length of a value to compress, 0 to disable compression
+ * @param minSavings The minimum percentage of the size saved to keep a value compressed
+ * */
+void htSetCompression(Hashtable_t *ht, size_t threshold, unsigned char minSavings);
+
+/**
+ * Visit every entry in the hashtable. The table must not be modified while iterating
+ *
+ * @param ht The hashtable to iterate over
+ * @param visitor Called for every entry
+ * @param ctx Passed through to the visitor
+ *
+ * @returns 0 if every entry was visited, 1 if the visitor stopped the iteration
+ * */
+int htForEach(Hashtable_t *ht, htVisitor_t visitor, void *ctx);
+
+/**
+ * Create an ordered index over the numeric (UNSIGNED_INT, SIGNED_INT, DOUBLE) values of all keys
+ * starting with prefix. Existing keys are indexed immediately, and the index is kept up to date
+ * by htAdd, htReplace and htRemove.
+ *
+ * @param ht The hashtable to index
+ * @param prefix The key prefix to index
+ * @param prefixlen The length of the prefix
+ *
+ * @returns 0 if successful, 1 if an index with this prefix already exists
+ * */
+int htCreateIndex(Hashtable_t *ht, const char *prefix, size_t prefixlen);
+
+/**
+ * Drop an ordered index created by htCreateIndex
+ *
+ * @param ht The hashtable the index belongs to
+ * @param prefix The key prefix of the index
+ * @param prefixlen The length of the prefix
+ *
+ * @returns 0 if successful, 1 if there is no index with this prefix
+ * */
+int htDropIndex(Hashtable_t *ht, const char *prefix, size_t prefixlen);
+
+/**
+ * Get the ordered index with exactly this prefix
+ *
+ * @param ht The hashtable the index belongs to
+ * @param prefix The key prefix of the index
+ * @param prefixlen The length of the prefix
+ *
+ * @returns The index, or NULL if there is no index with this prefix
+ * */
+HashtableIndex_t *htGetIndex(Hashtable_t *ht, const char *prefix, size_t prefixlen);
+
+/**
+ * Keep an ordered index (adaptive radix tree) over all keys of the hashtable, used for prefix and
+ * range scans. Existing keys are indexed immediately. Point lookups keep using the hash table.
+ *
+ * @param ht The hashtable to index
+ *
+ * @returns 0 if successful, 1 if the key index is already enabled
+ * */
+int htEnableKeyIndex(Hashtable_t *ht);
+
+/**
+ * Drop the ordered key index created by htEnableKeyIndex
+ *
+ * @param ht The hashtable the index belongs to
+ *
+ * @returns 0 if successful, 1 if the key index is not enabled
+ * */
+int htDisableKeyIndex(Hashtable_t *ht);
+
 #endif /* __HASHTABLE_H */
\ No newline at end of file
@@ -0,0 +1,92 @@
+#include "histogram.h"
+#include <string.h>
+
+// lowest value recorded in a slot
+static uint64_t histogramSlotMin(int slot) {
+    int bucket = slot >> HISTOGRAM_SUB_BUCKET_BITS;
+    uint64_t sub = slot & (HISTOGRAM_SUB_BUCKETS - 1);
+    if (bucket == 0) {
+        return sub;
+    }
+    return (HISTOGRAM_SUB_BUCKETS + sub) << (bucket - 1);
+}
+
+void histogramInit(Histogram_t *h) {
+    memset(h, 0, sizeof(Histogram_t));
+    h->min = UINT64_MAX;
+}
+
+int histogramSlot(uint64_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return value;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - HISTOGRAM_SUB_BUCKET_BITS;
+    // keep the bits right below the most significant one as the sub-bucket
+    return ((shift + 1) << HISTOGRAM_SUB_BUCKET_BITS) + ((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+uint64_t histogramSlotMax(int slot) {
+    if (slot == HISTOGRAM_SLOTS - 1) {
+        return UINT64_MAX;
+    }
+    return histogramSlotMin(slot + 1) - 1;
+}
+
+void histogramRecord(Histogram_t *h, uint64_t value) {
+    h->counts[histogramSlot(value)]++;
+    h->count++;
+    h->sum += value;
+    if (value < h->min) {
+        h->min = value;
+    }
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+void histogramRecordAtomic(Histogram_t *h, uint64_t value) {
+    __atomic_fetch_add(&h->counts[histogramSlot(value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, value, __ATOMIC_RELAXED);
+    uint64_t cur = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+    while (value < cur && !__atomic_compare_exchange_n(&h->min, &cur, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    cur = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (value > cur && !__atomic_compare_exchange_n(&h->max, &cur, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void histogramMerge(Histogram_t *dst, const Histogram_t *src) {
+    for (int i = 0; i < HISTOGRAM_SLOTS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->min < dst->min) {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+uint64_t histogramPercentile(const Histogram_t *h, double percentile) {
+    if (h->count == 0) {
+        return 0;
+    }
+    // rank of the value we are looking for, at least the first value
+    uint64_t rank = (uint64_t)(percentile / 100.0 * h->count + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_SLOTS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            uint64_t value = histogramSlotMax(i);
+            return value < h->max ? value : h->max;
+        }
+    }
+    return h->max;
+}
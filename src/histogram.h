@@ -0,0 +1,72 @@
+/*
+ * Log-linear histogram in the spirit of HdrHistogram
+ * https://github.com/HdrHistogram/HdrHistogram
+ *
+ * Values are grouped in power of two buckets that are each split into HISTOGRAM_SUB_BUCKETS linear
+ * sub-buckets, so every recorded value is kept with a relative error of at most 1/HISTOGRAM_SUB_BUCKETS.
+ * Recording is a couple of shifts and an increment, with no allocation.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#ifndef __HISTOGRAM_H
+#define __HISTOGRAM_H
+
+#define HISTOGRAM_SUB_BUCKET_BITS 5
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+// enough slots for any uint64_t value
+#define HISTOGRAM_SLOTS ((64 - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct Histogram {
+    uint64_t counts[HISTOGRAM_SLOTS];
+    uint64_t count; /* Number of recorded values */
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+} Histogram_t;
+
+/**
+ * Reset the histogram to hold no values
+ * */
+void histogramInit(Histogram_t *h);
+
+/**
+ * Record a value
+ * */
+void histogramRecord(Histogram_t *h, uint64_t value);
+
+/**
+ * Record a value with atomic operations, so several threads can record in the same histogram and
+ * read it without locks
+ * */
+void histogramRecordAtomic(Histogram_t *h, uint64_t value);
+
+/**
+ * Add all the values recorded in src to dst
+ * */
+void histogramMerge(Histogram_t *dst, const Histogram_t *src);
+
+/**
+ * Get the value below which the given percentage of the recorded values fall
+ *
+ * @param h The histogram
+ * @param percentile The percentile between 0 and 100
+ *
+ * @returns The highest value equivalent to the percentile, or 0 if the histogram is empty
+ * */
+uint64_t histogramPercentile(const Histogram_t *h, double percentile);
+
+/**
+ * @returns The slot a value is recorded in
+ * */
+int histogramSlot(uint64_t value);
+
+/**
+ * @returns The highest value recorded in a slot
+ * */
+uint64_t histogramSlotMax(int slot);
+
+#endif /* __HISTOGRAM_H */
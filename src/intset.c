@@ -0,0 +1,137 @@
+#include "intset.h"
+#include <stdlib.h>
+#include <string.h>
+
+// smallest element width able to hold the value
+static uint32_t intsetValueEncoding(int64_t value) {
+    if (value < INT32_MIN || value > INT32_MAX) {
+        return sizeof(int64_t);
+    } else if (value < INT16_MIN || value > INT16_MAX) {
+        return sizeof(int32_t);
+    }
+    return sizeof(int16_t);
+}
+
+static int64_t intsetGetEncoded(Intset_t *is, uint32_t pos, uint32_t encoding) {
+    if (encoding == sizeof(int64_t)) {
+        int64_t v;
+        memcpy(&v, is->contents + pos * encoding, encoding);
+        return v;
+    } else if (encoding == sizeof(int32_t)) {
+        int32_t v;
+        memcpy(&v, is->contents + pos * encoding, encoding);
+        return v;
+    }
+    int16_t v;
+    memcpy(&v, is->contents + pos * encoding, encoding);
+    return v;
+}
+
+static void intsetSet(Intset_t *is, uint32_t pos, int64_t value) {
+    if (is->encoding == sizeof(int64_t)) {
+        memcpy(is->contents + pos * is->encoding, &value, is->encoding);
+    } else if (is->encoding == sizeof(int32_t)) {
+        int32_t v = value;
+        memcpy(is->contents + pos * is->encoding, &v, is->encoding);
+    } else {
+        int16_t v = value;
+        memcpy(is->contents + pos * is->encoding, &v, is->encoding);
+    }
+}
+
+// binary search for the value, sets pos to where it is or where it should be inserted
+static int intsetSearch(Intset_t *is, int64_t value, uint32_t *pos) {
+    int64_t lo = 0;
+    int64_t hi = (int64_t)is->len - 1;
+    while (lo <= hi) {
+        int64_t mid = (lo + hi) / 2;
+        int64_t cur = intsetGet(is, mid);
+        if (cur == value) {
+            *pos = mid;
+            return 1;
+        } else if (cur < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    *pos = lo;
+    return 0;
+}
+
+Intset_t *intsetNew() {
+    Intset_t *is = malloc(sizeof(Intset_t));
+    if (is) {
+        is->encoding = sizeof(int16_t);
+        is->len = 0;
+    }
+    return is;
+}
+
+void intsetFree(Intset_t *is) {
+    free(is);
+}
+
+int64_t intsetGet(Intset_t *is, uint32_t pos) {
+    return intsetGetEncoded(is, pos, is->encoding);
+}
+
+int intsetFind(Intset_t *is, int64_t value) {
+    uint32_t pos;
+    return intsetValueEncoding(value) <= is->encoding && intsetSearch(is, value, &pos);
+}
+
+Intset_t *intsetAdd(Intset_t *is, int64_t value, int *added) {
+    uint32_t encoding = intsetValueEncoding(value);
+    *added = 1;
+    if (encoding > is->encoding) {
+        // the value doesn't fit the current width, so it is either smaller or larger than every element
+        uint32_t oldEncoding = is->encoding;
+        Intset_t *grown = realloc(is, sizeof(Intset_t) + (is->len + 1) * encoding);
+        if (grown == NULL) {
+            *added = 0;
+            return NULL;
+        }
+        is = grown;
+        is->encoding = encoding;
+        int prepend = value < 0 ? 1 : 0;
+        // widen the elements back to front so none is overwritten before it is read
+        for (int64_t i = (int64_t)is->len - 1; i >= 0; i--) {
+            intsetSet(is, i + prepend, intsetGetEncoded(is, i, oldEncoding));
+        }
+        intsetSet(is, prepend ? 0 : is->len, value);
+        is->len++;
+        return is;
+    }
+
+    uint32_t pos;
+    if (intsetSearch(is, value, &pos)) {
+        *added = 0;
+        return is;
+    }
+    Intset_t *grown = realloc(is, sizeof(Intset_t) + (is->len + 1) * is->encoding);
+    if (grown == NULL) {
+        *added = 0;
+        return NULL;
+    }
+    is = grown;
+    memmove(is->contents + (pos + 1) * is->encoding, is->contents + pos * is->encoding,
+            (is->len - pos) * is->encoding);
+    intsetSet(is, pos, value);
+    is->len++;
+    return is;
+}
+
+Intset_t *intsetRemove(Intset_t *is, int64_t value, int *removed) {
+    uint32_t pos;
+    *removed = 0;
+    if (intsetValueEncoding(value) > is->encoding || !intsetSearch(is, value, &pos)) {
+        return is;
+    }
+    memmove(is->contents + pos * is->encoding, is->contents + (pos + 1) * is->encoding,
+            (is->len - pos - 1) * is->encoding);
+    is->len--;
+    *removed = 1;
+    Intset_t *shrunk = realloc(is, sizeof(Intset_t) + is->len * is->encoding);
+    return shrunk != NULL ? shrunk : is;
+}
@@ -0,0 +1,69 @@
+/*
+ * Taken inspiration from the redis implementation of the intset
+ * https://github.com/redis/redis/blob/3.2.6/src/intset.h
+ *
+ * A sorted array of integers stored with the smallest width able to hold all of them.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef __INTSET_H
+#define __INTSET_H
+
+typedef struct Intset {
+    uint32_t encoding; /* Width of every element in bytes: 2, 4 or 8 */
+    uint32_t len;      /* Number of elements */
+    int8_t contents[];
+} Intset_t;
+
+/**
+ * Create an empty intset
+ *
+ * @returns The empty intset or NULL on error
+ * */
+Intset_t *intsetNew();
+
+/**
+ * Free the intset
+ *
+ * @param is The intset to free
+ * */
+void intsetFree(Intset_t *is);
+
+/**
+ * Add a value to the intset, upgrading the width of the elements if needed. The intset may be reallocated
+ *
+ * @param is The intset to add to
+ * @param value The value to add
+ * @param added Set to 1 if the value was added, 0 if it already existed or on error
+ *
+ * @returns The intset, which may have moved, or NULL if it can't grow, in which case is is unchanged
+ * */
+Intset_t *intsetAdd(Intset_t *is, int64_t value, int *added);
+
+/**
+ * Remove a value from the intset. The intset may be reallocated
+ *
+ * @param is The intset to remove from
+ * @param value The value to remove
+ * @param removed Set to 1 if the value was removed, 0 if it was not found
+ *
+ * @returns The intset, which may have moved
+ * */
+Intset_t *intsetRemove(Intset_t *is, int64_t value, int *removed);
+
+/**
+ * @returns 1 if the value is in the intset, 0 otherwise
+ * */
+int intsetFind(Intset_t *is, int64_t value);
+
+/**
+ * @returns The value at position pos, pos must be smaller than is->len
+ * */
+int64_t intsetGet(Intset_t *is, uint32_t pos);
+
+#endif /* __INTSET_H */
@@ -0,0 +1,107 @@
+#include "lazyfree.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+
+typedef struct LazyfreeJob {
+    LazyfreeFn_t fn;
+    void *arg;
+    struct LazyfreeJob *next;
+} LazyfreeJob_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+// jobs are taken from the head and added at the tail
+static LazyfreeJob_t *head;
+static LazyfreeJob_t *tail;
+static int running;
+static int stopping;
+static pthread_t reclaimer;
+static uint64_t pending;
+static uint64_t done;
+
+static void *lazyfreeReclaimer(void *arg) {
+    pthread_mutex_lock(&lock);
+    while (1) {
+        while (head == NULL && !stopping) {
+            pthread_cond_wait(&cond, &lock);
+        }
+        if (head == NULL) {
+            break;
+        }
+        LazyfreeJob_t *job = head;
+        head = job->next;
+        if (head == NULL) {
+            tail = NULL;
+        }
+        // jobs run without the lock so the event loop can keep submitting
+        pthread_mutex_unlock(&lock);
+        job->fn(job->arg);
+        free(job);
+        __atomic_fetch_sub(&pending, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&done, 1, __ATOMIC_RELAXED);
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+int lazyfreeInit() {
+    if (running) {
+        return -1;
+    }
+    stopping = 0;
+    // the reclaimer inherits a mask blocking every signal, so handlers only run on the threads serving requests
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int err = pthread_create(&reclaimer, NULL, lazyfreeReclaimer, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err != 0) {
+        return -1;
+    }
+    running = 1;
+    return 0;
+}
+
+void lazyfreeShutdown() {
+    if (!running) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    stopping = 1;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+    // the reclaimer only stops once the queue is empty
+    pthread_join(reclaimer, NULL);
+    running = 0;
+}
+
+void lazyfreeSubmit(LazyfreeFn_t fn, void *arg) {
+    LazyfreeJob_t *job = running ? malloc(sizeof(LazyfreeJob_t)) : NULL;
+    if (job == NULL) {
+        fn(arg);
+        return;
+    }
+    job->fn = fn;
+    job->arg = arg;
+    job->next = NULL;
+    __atomic_fetch_add(&pending, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&lock);
+    if (tail != NULL) {
+        tail->next = job;
+    } else {
+        head = job;
+    }
+    tail = job;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+}
+
+uint64_t lazyfreePending() {
+    return __atomic_load_n(&pending, __ATOMIC_RELAXED);
+}
+
+uint64_t lazyfreeDone() {
+    return __atomic_load_n(&done, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,56 @@
+/*
+ * Background reclaimer thread. Memory that can no longer be reached by the event loop, a deleted table
+ * or the value of a removed key, is handed to the reclaimer to be freed, so dropping a whole keyspace
+ * or a huge value costs the thread serving requests no more than unlinking it.
+ *
+ * Jobs run one at a time in the order they were submitted. Before lazyfreeInit() or after
+ * lazyfreeShutdown() jobs run directly on the thread submitting them, so the tests and tools that never
+ * start the reclaimer free memory like they always did.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#ifndef __LAZYFREE_H
+#define __LAZYFREE_H
+
+/**
+ * Frees the memory it is given, run by the reclaimer thread
+ *
+ * @param arg The pointer passed to lazyfreeSubmit
+ * */
+typedef void (*LazyfreeFn_t)(void *arg);
+
+/**
+ * Start the reclaimer thread
+ *
+ * @returns 0 if successful, -1 if it is already running or the thread cannot be started
+ * */
+int lazyfreeInit();
+
+/**
+ * Run every pending job and stop the reclaimer thread
+ * */
+void lazyfreeShutdown();
+
+/**
+ * Hand memory to the reclaimer. It must not be reachable by any other thread anymore
+ *
+ * @param fn Called with arg by the reclaimer
+ * @param arg What to free
+ * */
+void lazyfreeSubmit(LazyfreeFn_t fn, void *arg);
+
+/**
+ * @returns The number of jobs submitted that haven't run yet
+ * */
+uint64_t lazyfreePending();
+
+/**
+ * @returns The number of jobs the reclaimer ran
+ * */
+uint64_t lazyfreeDone();
+
+#endif /* __LAZYFREE_H */
@@ -0,0 +1,123 @@
+#include "listpack.h"
+#include <stdlib.h>
+#include <string.h>
+
+// size of the length stored before and after the bytes of every entry
+#define LP_LENSIZE sizeof(uint32_t)
+
+static uint32_t lpReadLen(Listpack_t *lp, size_t off) {
+    uint32_t len;
+    memcpy(&len, lp->data + off, LP_LENSIZE);
+    return len;
+}
+
+Listpack_t *lpNew() {
+    Listpack_t *lp = malloc(sizeof(Listpack_t));
+    if (lp) {
+        lp->bytes = 0;
+        lp->count = 0;
+    }
+    return lp;
+}
+
+void lpFree(Listpack_t *lp) {
+    free(lp);
+}
+
+Listpack_t *lpInsert(Listpack_t *lp, size_t off, const char *s, size_t len) {
+    size_t entrySize = len + 2 * LP_LENSIZE;
+    Listpack_t *grown = realloc(lp, sizeof(Listpack_t) + lp->bytes + entrySize);
+    if (grown == NULL) {
+        return NULL;
+    }
+    lp = grown;
+    // make room for the new entry
+    memmove(lp->data + off + entrySize, lp->data + off, lp->bytes - off);
+    uint32_t len32 = len;
+    memcpy(lp->data + off, &len32, LP_LENSIZE);
+    memcpy(lp->data + off + LP_LENSIZE, s, len);
+    memcpy(lp->data + off + LP_LENSIZE + len, &len32, LP_LENSIZE);
+    lp->bytes += entrySize;
+    lp->count++;
+    return lp;
+}
+
+Listpack_t *lpAppend(Listpack_t *lp, const char *s, size_t len) {
+    return lpInsert(lp, lp->bytes, s, len);
+}
+
+Listpack_t *lpDelete(Listpack_t *lp, size_t off) {
+    size_t entrySize = lpReadLen(lp, off) + 2 * LP_LENSIZE;
+    memmove(lp->data + off, lp->data + off + entrySize, lp->bytes - off - entrySize);
+    lp->bytes -= entrySize;
+    lp->count--;
+    // shrinking in place can't lose data, so keep the larger block if it can't be moved
+    Listpack_t *shrunk = realloc(lp, sizeof(Listpack_t) + lp->bytes);
+    return shrunk != NULL ? shrunk : lp;
+}
+
+size_t lpFirst(Listpack_t *lp) {
+    return lp->count > 0 ? 0 : LP_NONE;
+}
+
+size_t lpLast(Listpack_t *lp) {
+    if (lp->count == 0) {
+        return LP_NONE;
+    }
+    return lpPrev(lp, lp->bytes);
+}
+
+size_t lpNext(Listpack_t *lp, size_t off) {
+    off += lpReadLen(lp, off) + 2 * LP_LENSIZE;
+    return off < lp->bytes ? off : LP_NONE;
+}
+
+size_t lpPrev(Listpack_t *lp, size_t off) {
+    if (off == 0) {
+        return LP_NONE;
+    }
+    // the length of the previous entry is stored right before this entry
+    return off - lpReadLen(lp, off - LP_LENSIZE) - 2 * LP_LENSIZE;
+}
+
+size_t lpSeek(Listpack_t *lp, int64_t index) {
+    if (index < 0) {
+        index += lp->count;
+    }
+    if (index < 0 || index >= lp->count) {
+        return LP_NONE;
+    }
+    // walk from whichever end is closer
+    size_t off;
+    if (index < lp->count / 2) {
+        off = lpFirst(lp);
+        while (index-- > 0) {
+            off = lpNext(lp, off);
+        }
+    } else {
+        off = lpLast(lp);
+        for (int64_t i = lp->count - 1; i > index; i--) {
+            off = lpPrev(lp, off);
+        }
+    }
+    return off;
+}
+
+const char *lpGet(Listpack_t *lp, size_t off, size_t *len) {
+    *len = lpReadLen(lp, off);
+    return (const char *)lp->data + off + LP_LENSIZE;
+}
+
+size_t lpFind(Listpack_t *lp, size_t off, const char *s, size_t len, int skip) {
+    while (off != LP_NONE) {
+        size_t entrylen;
+        const char *entry = lpGet(lp, off, &entrylen);
+        if (entrylen == len && memcmp(entry, s, len) == 0) {
+            return off;
+        }
+        for (int i = 0; i <= skip && off != LP_NONE; i++) {
+            off = lpNext(lp, off);
+        }
+    }
+    return LP_NONE;
+}
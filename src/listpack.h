@@ -0,0 +1,114 @@
+/*
+ * Compact encoding for small collections, inspired by the redis listpack
+ * https://github.com/redis/redis/blob/7.0.0/src/listpack.c
+ *
+ * All entries live in one contiguous allocation. Every entry is stored as
+ * [uint32 length][bytes][uint32 length] so it can be walked in both directions.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef __LISTPACK_H
+#define __LISTPACK_H
+
+// Returned by the iteration functions when there is no entry
+#define LP_NONE ((size_t)-1)
+
+typedef struct Listpack {
+    uint32_t bytes; /* Size of data */
+    uint32_t count; /* Number of entries */
+    unsigned char data[];
+} Listpack_t;
+
+/**
+ * Create an empty listpack
+ *
+ * @returns The empty listpack or NULL on error
+ * */
+Listpack_t *lpNew();
+
+/**
+ * Free the listpack
+ *
+ * @param lp The listpack to free
+ * */
+void lpFree(Listpack_t *lp);
+
+/**
+ * Insert an entry before the entry at offset off. The listpack may be reallocated
+ *
+ * @param lp The listpack to insert into
+ * @param off The offset of the entry to insert before, or lp->bytes to append
+ * @param s The bytes of the new entry
+ * @param len The length of the new entry
+ *
+ * @returns The listpack, which may have moved, or NULL if it can't grow, in which case lp is unchanged
+ * */
+Listpack_t *lpInsert(Listpack_t *lp, size_t off, const char *s, size_t len);
+
+/**
+ * Append an entry at the end of the listpack. The listpack may be reallocated
+ *
+ * @returns The listpack, which may have moved, or NULL if it can't grow, in which case lp is unchanged
+ * */
+Listpack_t *lpAppend(Listpack_t *lp, const char *s, size_t len);
+
+/**
+ * Delete the entry at offset off. The listpack may be reallocated
+ *
+ * @param lp The listpack to delete from
+ * @param off The offset of the entry to delete
+ *
+ * @returns The listpack, which may have moved
+ * */
+Listpack_t *lpDelete(Listpack_t *lp, size_t off);
+
+/**
+ * @returns The offset of the first entry, or LP_NONE if the listpack is empty
+ * */
+size_t lpFirst(Listpack_t *lp);
+
+/**
+ * @returns The offset of the last entry, or LP_NONE if the listpack is empty
+ * */
+size_t lpLast(Listpack_t *lp);
+
+/**
+ * @returns The offset of the entry after the entry at off, or LP_NONE if it is the last entry
+ * */
+size_t lpNext(Listpack_t *lp, size_t off);
+
+/**
+ * @returns The offset of the entry before the entry at off, or LP_NONE if it is the first entry
+ * */
+size_t lpPrev(Listpack_t *lp, size_t off);
+
+/**
+ * @returns The offset of the entry at index, negative indexes count from the end, LP_NONE if out of range
+ * */
+size_t lpSeek(Listpack_t *lp, int64_t index);
+
+/**
+ * Get the bytes of the entry at offset off
+ *
+ * @param lp The listpack
+ * @param off The offset of the entry
+ * @param len Set to the length of the entry
+ *
+ * @returns A pointer to the bytes of the entry, valid until the listpack is modified
+ * */
+const char *lpGet(Listpack_t *lp, size_t off, size_t *len);
+
+/**
+ * Find an entry equal to s, starting at offset off and skipping skip entries after every comparison
+ * (a skip of 1 only compares the fields of field/value pairs)
+ *
+ * @returns The offset of the entry, or LP_NONE if not found
+ * */
+size_t lpFind(Listpack_t *lp, size_t off, const char *s, size_t len, int skip);
+
+#endif /* __LISTPACK_H */
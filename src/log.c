@@ -0,0 +1,282 @@
+#include "log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// room for the timestamp, level and source of a record around its message
+#define LOG_MAX_LINE_LEN (LOG_MAX_MESSAGE_LEN + 128)
+// lines are written out once the batch can no longer take a full one
+#define LOG_BATCH_SIZE (64 * LOG_MAX_LINE_LEN)
+
+typedef struct LogRecord {
+    struct timespec ts;
+    LogLevel_t level;
+    const char *file; /* A string literal from __FILE__ */
+    int line;
+    int len;
+    char message[LOG_MAX_MESSAGE_LEN];
+} LogRecord_t;
+
+// Single producer, single consumer ring: only its thread advances head and only the flusher advances tail
+typedef struct LogRing {
+    _Alignas(64) uint64_t head;
+    _Alignas(64) uint64_t tail;
+    uint64_t dropped;
+    LogRecord_t records[LOG_RING_SIZE];
+} LogRing_t;
+
+LogLevel_t logLevel = LOG_LEVEL_INFO;
+
+static LogRing_t *rings[LOG_MAX_THREADS];
+static int numRings;
+static uint64_t droppedUnregistered;
+static __thread LogRing_t *localRing;
+static __thread int localRingFailed;
+
+static int logFd = -1;
+static int running;
+static int stopping;
+static pthread_t flusher;
+static uint64_t droppedReported;
+
+static const char *levelNames[] = {"debug", "info", "warn", "error", "off"};
+
+// the ring of the calling thread, created on its first record
+static LogRing_t *logLocalRing() {
+    if (localRing != NULL || localRingFailed) {
+        return localRing;
+    }
+    int slot = __atomic_load_n(&numRings, __ATOMIC_RELAXED);
+    do {
+        if (slot >= LOG_MAX_THREADS) {
+            localRingFailed = 1;
+            return NULL;
+        }
+    } while (!__atomic_compare_exchange_n(&numRings, &slot, slot + 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    LogRing_t *ring = calloc(1, sizeof(LogRing_t));
+    if (ring == NULL) {
+        localRingFailed = 1;
+        return NULL;
+    }
+    // the flusher finds the ring once it is published
+    __atomic_store_n(&rings[slot], ring, __ATOMIC_RELEASE);
+    localRing = ring;
+    return ring;
+}
+
+static int logFormatLine(char *buf, const LogRecord_t *rec) {
+    struct tm tm;
+    gmtime_r(&rec->ts.tv_sec, &tm);
+    const char *file = strrchr(rec->file, '/');
+    file = file != NULL ? file + 1 : rec->file;
+    int n = snprintf(buf, LOG_MAX_LINE_LEN, "ts=%04d-%02d-%02dT%02d:%02d:%02d.%06ldZ level=%s src=%s:%d msg=\"",
+                     tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                     rec->ts.tv_nsec / 1000, levelNames[rec->level], file, rec->line);
+    if (n < 0 || n > LOG_MAX_LINE_LEN - 4) {
+        n = LOG_MAX_LINE_LEN - 4;
+    }
+    // keep the record on a single line and the message quoted
+    for (int i = 0; i < rec->len && n < LOG_MAX_LINE_LEN - 4; i++) {
+        char c = rec->message[i];
+        if (c == '"' || c == '\\') {
+            buf[n++] = '\\';
+            buf[n++] = c;
+        } else if (c == '\n' || c == '\r') {
+            buf[n++] = ' ';
+        } else {
+            buf[n++] = c;
+        }
+    }
+    buf[n++] = '"';
+    buf[n++] = '\n';
+    return n;
+}
+
+static void logWriteAll(int fd, const char *buf, int len) {
+    while (len > 0) {
+        int n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+// write out every pending record, returns the number of records written
+static uint64_t logDrain(char *batch) {
+    uint64_t written = 0;
+    int len = 0;
+    int n = __atomic_load_n(&numRings, __ATOMIC_RELAXED);
+    for (int i = 0; i < n; i++) {
+        LogRing_t *ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+        if (ring == NULL) {
+            continue;
+        }
+        uint64_t tail = ring->tail;
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        while (tail != head) {
+            if (len > LOG_BATCH_SIZE - LOG_MAX_LINE_LEN) {
+                logWriteAll(logFd, batch, len);
+                len = 0;
+            }
+            len += logFormatLine(batch + len, &ring->records[tail & (LOG_RING_SIZE - 1)]);
+            tail++;
+            written++;
+            // hand the slot back as soon as it is formatted
+            __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+        }
+    }
+    uint64_t dropped = logDropped();
+    if (dropped != droppedReported) {
+        LogRecord_t rec = {.level = LOG_LEVEL_WARN, .file = __FILE__, .line = __LINE__};
+        clock_gettime(CLOCK_REALTIME, &rec.ts);
+        rec.len = snprintf(rec.message, LOG_MAX_MESSAGE_LEN, "Dropped %lu log records", dropped - droppedReported);
+        len += logFormatLine(batch + len, &rec);
+        droppedReported = dropped;
+    }
+    if (len > 0) {
+        logWriteAll(logFd, batch, len);
+    }
+    return written;
+}
+
+static void *logFlusher(void *arg) {
+    char *batch = arg;
+    struct timespec interval = {0, LOG_FLUSH_INTERVAL_MS * 1000000L};
+    while (1) {
+        int stop = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+        if (logDrain(batch) == 0) {
+            if (stop) {
+                break;
+            }
+            nanosleep(&interval, NULL);
+        }
+    }
+    free(batch);
+    return NULL;
+}
+
+int logInit(const char *path, LogLevel_t level) {
+    if (running) {
+        return -1;
+    }
+    int fd = STDOUT_FILENO;
+    if (path != NULL) {
+        fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd == -1) {
+            return -1;
+        }
+    }
+    // a formatted line may overrun the batch by one line before it is written out
+    char *batch = malloc(LOG_BATCH_SIZE + LOG_MAX_LINE_LEN);
+    if (batch == NULL) {
+        if (fd != STDOUT_FILENO) {
+            close(fd);
+        }
+        return -1;
+    }
+    logFd = fd;
+    stopping = 0;
+    droppedReported = logDropped();
+    // like the reclaimer, the flusher blocks every signal so shutdown never runs on it and joins itself
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int err = pthread_create(&flusher, NULL, logFlusher, batch);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err != 0) {
+        free(batch);
+        if (fd != STDOUT_FILENO) {
+            close(fd);
+        }
+        logFd = -1;
+        return -1;
+    }
+    logSetLevel(level);
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void logShutdown() {
+    if (!running) {
+        return;
+    }
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(flusher, NULL);
+    if (logFd != STDOUT_FILENO) {
+        close(logFd);
+    }
+    logFd = -1;
+}
+
+void logSetLevel(LogLevel_t level) {
+    __atomic_store_n(&logLevel, level, __ATOMIC_RELAXED);
+}
+
+int logParseLevel(const char *name) {
+    for (int i = 0; i <= LOG_LEVEL_OFF; i++) {
+        if (strcmp(name, levelNames[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void logWrite(LogLevel_t level, const char *file, int line, const char *fmt, ...) {
+    LogRecord_t direct;
+    LogRecord_t *rec = &direct;
+    LogRing_t *ring = NULL;
+    uint64_t head = 0;
+    if (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        ring = logLocalRing();
+        if (ring == NULL) {
+            __atomic_fetch_add(&droppedUnregistered, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        head = ring->head;
+        if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == LOG_RING_SIZE) {
+            __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        rec = &ring->records[head & (LOG_RING_SIZE - 1)];
+    }
+    clock_gettime(CLOCK_REALTIME, &rec->ts);
+    rec->level = level;
+    rec->file = file;
+    rec->line = line;
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(rec->message, LOG_MAX_MESSAGE_LEN, fmt, args);
+    va_end(args);
+    rec->len = n < 0 ? 0 : n >= LOG_MAX_MESSAGE_LEN ? LOG_MAX_MESSAGE_LEN - 1 : n;
+    if (ring != NULL) {
+        __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    } else {
+        char buf[LOG_MAX_LINE_LEN];
+        logWriteAll(STDERR_FILENO, buf, logFormatLine(buf, rec));
+    }
+}
+
+uint64_t logDropped() {
+    uint64_t dropped = __atomic_load_n(&droppedUnregistered, __ATOMIC_RELAXED);
+    int n = __atomic_load_n(&numRings, __ATOMIC_RELAXED);
+    for (int i = 0; i < n; i++) {
+        LogRing_t *ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+        if (ring != NULL) {
+            dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+        }
+    }
+    return dropped;
+}
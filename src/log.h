@@ -0,0 +1,106 @@
+/*
+ * Leveled logging that never blocks the thread logging. Every thread formats its records into its own
+ * lock-free ring and a background flusher thread writes them out in batches, so a slow stdout or log
+ * file only ever costs dropped records, never a stalled request. When the ring of a thread is full the
+ * record is dropped and counted.
+ *
+ * Records below the current level cost a single load and compare. Building with -DDB_DISABLE_LOG
+ * compiles the LOG_* macros to nothing.
+ *
+ * Before logInit() or after logShutdown() records are written directly to stderr, so errors of the
+ * tests and tools that never start the flusher are not lost.
+ *
+ * Every record is one line of key=value pairs:
+ *
+ *   ts=2024-01-01T12:00:00.000123Z level=info src=main.c:42 msg="Closing database"
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#ifndef __LOG_H
+#define __LOG_H
+
+// records per thread ring, must be a power of two
+#define LOG_RING_SIZE 1024
+// longer messages are cut
+#define LOG_MAX_MESSAGE_LEN 240
+// threads with a ring of their own, records of further threads are dropped
+#define LOG_MAX_THREADS 16
+// how long the flusher sleeps when every ring is empty
+#define LOG_FLUSH_INTERVAL_MS 10
+
+typedef enum LogLevel {
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_OFF,
+} LogLevel_t;
+
+// records below this level are discarded before being formatted
+extern LogLevel_t logLevel;
+
+#ifdef DB_DISABLE_LOG
+#define LOG(level, ...) \
+    do {                \
+    } while (0)
+#else
+#define LOG(level, ...)                                                                   \
+    do {                                                                                  \
+        if (__builtin_expect((level) >= __atomic_load_n(&logLevel, __ATOMIC_RELAXED), 0)) \
+            logWrite(level, __FILE__, __LINE__, __VA_ARGS__);                            \
+    } while (0)
+#endif
+
+#define LOG_DEBUG(...) LOG(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) LOG(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+/**
+ * Start the flusher thread. Records are written to the file at path, appending to it, or to stdout
+ *
+ * @param path The log file or NULL for stdout
+ * @param level The lowest level logged
+ *
+ * @returns 0 if successful, -1 if the file cannot be opened or the thread cannot be started
+ * */
+int logInit(const char *path, LogLevel_t level);
+
+/**
+ * Write out every pending record and stop the flusher thread
+ * */
+void logShutdown();
+
+/**
+ * Change the lowest level logged, can be called from any thread
+ * */
+void logSetLevel(LogLevel_t level);
+
+/**
+ * Parse the name of a level: debug, info, warn, error or off
+ *
+ * @returns The level or -1 if the name is unknown
+ * */
+int logParseLevel(const char *name);
+
+/**
+ * Log a record regardless of the current level, use the LOG_* macros instead
+ *
+ * @param level The level of the record
+ * @param file The source file logging
+ * @param line The line of the source file
+ * @param fmt The printf format of the message
+ * */
+void logWrite(LogLevel_t level, const char *file, int line, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+/**
+ * @returns The number of records dropped because the ring of their thread was full
+ * */
+uint64_t logDropped();
+
+#endif /* __LOG_H */
@@ -0,0 +1,164 @@
+#include "lz4.h"
+#include <stdint.h>
+#include <string.h>
+
+#define LZ4_MINMATCH 4
+#define LZ4_HASHLOG 12
+#define LZ4_MAXOFFSET 65535
+// the last match must start at least 12 bytes before the end, and the last 5 bytes are always literals
+#define LZ4_MFLIMIT 12
+#define LZ4_LASTLITERALS 5
+
+static uint32_t lz4Read32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t lz4Hash(uint32_t seq) {
+    return (seq * 2654435761U) >> (32 - LZ4_HASHLOG);
+}
+
+// write a length that did not fit in its 4 bit token field, returns the new output position or 0 if full
+static size_t lz4WriteLength(char *dst, size_t op, size_t dstcap, size_t len) {
+    while (len >= 255) {
+        if (op >= dstcap) {
+            return 0;
+        }
+        dst[op++] = (char)255;
+        len -= 255;
+    }
+    if (op >= dstcap) {
+        return 0;
+    }
+    dst[op++] = (char)len;
+    return op;
+}
+
+// write a sequence of literals followed by a match (or no match if matchlen is 0)
+static size_t lz4WriteSequence(char *dst, size_t op, size_t dstcap, const char *literals, size_t litlen,
+                               size_t offset, size_t matchlen) {
+    if (op >= dstcap) {
+        return 0;
+    }
+    size_t tokenPos = op++;
+    unsigned char token = (litlen >= 15 ? 15 : litlen) << 4;
+    if (litlen >= 15 && (op = lz4WriteLength(dst, op, dstcap, litlen - 15)) == 0) {
+        return 0;
+    }
+    if (op + litlen > dstcap) {
+        return 0;
+    }
+    memcpy(dst + op, literals, litlen);
+    op += litlen;
+    if (matchlen > 0) {
+        if (op + 2 > dstcap) {
+            return 0;
+        }
+        dst[op++] = offset & 0xFF;
+        dst[op++] = offset >> 8;
+        size_t mlcode = matchlen - LZ4_MINMATCH;
+        token |= mlcode >= 15 ? 15 : mlcode;
+        if (mlcode >= 15 && (op = lz4WriteLength(dst, op, dstcap, mlcode - 15)) == 0) {
+            return 0;
+        }
+    }
+    dst[tokenPos] = token;
+    return op;
+}
+
+size_t lz4Compress(const char *src, size_t srclen, char *dst, size_t dstcap) {
+    // positions + 1 of the last occurence of every hashed 4 byte sequence, 0 if none
+    uint32_t table[1 << LZ4_HASHLOG];
+    memset(table, 0, sizeof(table));
+    size_t ip = 0;
+    size_t anchor = 0;
+    size_t op = 0;
+
+    if (srclen > LZ4_MFLIMIT) {
+        size_t mflimit = srclen - LZ4_MFLIMIT;
+        size_t matchlimit = srclen - LZ4_LASTLITERALS;
+        while (ip < mflimit) {
+            uint32_t seq = lz4Read32(src + ip);
+            uint32_t h = lz4Hash(seq);
+            size_t ref = table[h];
+            table[h] = ip + 1;
+            if (ref == 0 || ip - (ref - 1) > LZ4_MAXOFFSET || lz4Read32(src + ref - 1) != seq) {
+                ip++;
+                continue;
+            }
+            ref--;
+            size_t matchlen = LZ4_MINMATCH;
+            while (ip + matchlen < matchlimit && src[ref + matchlen] == src[ip + matchlen]) {
+                matchlen++;
+            }
+            op = lz4WriteSequence(dst, op, dstcap, src + anchor, ip - anchor, ip - ref, matchlen);
+            if (op == 0) {
+                return 0;
+            }
+            ip += matchlen;
+            anchor = ip;
+        }
+    }
+    // the remaining bytes are written as literals
+    return lz4WriteSequence(dst, op, dstcap, src + anchor, srclen - anchor, 0, 0);
+}
+
+long lz4Decompress(const char *src, size_t srclen, char *dst, size_t dstcap) {
+    const unsigned char *in = (const unsigned char *)src;
+    size_t ip = 0;
+    size_t op = 0;
+    while (ip < srclen) {
+        unsigned char token = in[ip++];
+        size_t litlen = token >> 4;
+        if (litlen == 15) {
+            unsigned char b;
+            do {
+                if (ip >= srclen) {
+                    return -1;
+                }
+                b = in[ip++];
+                litlen += b;
+            } while (b == 255);
+        }
+        if (ip + litlen > srclen || op + litlen > dstcap) {
+            return -1;
+        }
+        memcpy(dst + op, src + ip, litlen);
+        ip += litlen;
+        op += litlen;
+        if (ip == srclen) {
+            break; // the last sequence has no match
+        }
+
+        if (ip + 2 > srclen) {
+            return -1;
+        }
+        size_t offset = in[ip] | (in[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) {
+            return -1;
+        }
+        size_t matchlen = (token & 15);
+        if (matchlen == 15) {
+            unsigned char b;
+            do {
+                if (ip >= srclen) {
+                    return -1;
+                }
+                b = in[ip++];
+                matchlen += b;
+            } while (b == 255);
+        }
+        matchlen += LZ4_MINMATCH;
+        if (op + matchlen > dstcap) {
+            return -1;
+        }
+        // copy byte by byte, the match may overlap the bytes being written
+        for (size_t i = 0; i < matchlen; i++) {
+            dst[op + i] = dst[op - offset + i];
+        }
+        op += matchlen;
+    }
+    return op;
+}
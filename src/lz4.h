@@ -0,0 +1,45 @@
+/*
+ * Compressor and decompressor for the LZ4 block format
+ * https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+ *
+ * A small single pass greedy implementation, output is compatible with the reference decoder.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#ifndef __LZ4_H
+#define __LZ4_H
+
+/**
+ * Worst case size of the compressed output for an input of srclen bytes
+ * */
+#define LZ4_COMPRESSBOUND(srclen) ((srclen) + (srclen) / 255 + 16)
+
+/**
+ * Compress a buffer
+ *
+ * @param src The bytes to compress
+ * @param srclen The number of bytes to compress
+ * @param dst The output buffer
+ * @param dstcap The size of the output buffer
+ *
+ * @returns The size of the compressed data, or 0 if it does not fit in dst
+ * */
+size_t lz4Compress(const char *src, size_t srclen, char *dst, size_t dstcap);
+
+/**
+ * Decompress a buffer produced by lz4Compress. Malformed input never reads or writes out of bounds
+ *
+ * @param src The compressed bytes
+ * @param srclen The number of compressed bytes
+ * @param dst The output buffer
+ * @param dstcap The size of the output buffer
+ *
+ * @returns The size of the decompressed data, or -1 if the input is malformed or does not fit in dst
+ * */
+long lz4Decompress(const char *src, size_t srclen, char *dst, size_t dstcap);
+
+#endif /* __LZ4_H */
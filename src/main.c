@@ -1,11 +1,33 @@
+#include "cluster.h"
+#include "collections.h"
+#include "config.h"
 #include "hashtable.h"
+#include "lazyfree.h"
+#include "log.h"
+#include "metrics.h"
 #include "network.h"
+#include "pubsub.h"
+#include "replication.h"
+#include "script.h"
+#include "slowlog.h"
+#include "stats.h"
+#include "tracking.h"
+#include "store.h"
+#include "trace.h"
+#include "vlog.h"
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <malloc.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 typedef struct Command {
     char *query;
@@ -14,10 +36,137 @@ typedef struct Command {
     char *value;
 } Command_t;
 
-// Implementation of the database
-Hashtable_t *ht;
+// most commands a client can queue between multi and exec
+#define MULTI_MAX_COMMANDS 64
+
+// Commands a client queued since multi, executed together by exec
+typedef struct Transaction {
+    int count;
+    int failed;      /* Set if a command couldn't be queued, exec then runs none of them */
+    size_t len;
+    size_t cap;
+    char commands[]; /* Every command newline terminated */
+} Transaction_t;
+
+// Databases clients can switch between with use
+#define NUM_DATABASES 16
+
+// Implementation of the databases, created when first used. Database 0 always exists
+Hashtable_t *dbs[NUM_DATABASES];
 // Implementation of the server
 Server_t *server;
+// Statistics of the requests served
+Stats_t *stats;
+// Commands that took longest to execute
+Slowlog_t *slowlog;
+// Replication stream and backlog, and the primary when this is a replica
+Replication_t *repl;
+// Slot map of the cluster, NULL unless running in cluster mode
+Cluster_t *cluster;
+// File the keyspace is mapped from, NULL to keep it in memory only
+static char *mmapPath;
+// Value log cold values are moved to, NULL to keep every value in memory
+static char *tierPath;
+static int64_t tierThreshold = HASHTABLE_TIER_DEFAULT_THRESHOLD;
+// Settings from the config file and the command line, some of them changed later with config set
+static struct {
+    char *bind;
+    int64_t port;
+    char *unixPath;
+    int64_t maxClients;
+    int64_t backlog;
+    int tcpNoDelay;
+    int64_t rcvbuf;
+    int64_t sndbuf;
+    int64_t clientOutputLimit;
+    int64_t dbInitialBuckets;
+    int64_t metricsPort; /* 0 for no metrics endpoint */
+    int logLevel;
+    char *logFile;
+    char *replicaof;
+    char *cluster;
+    int64_t trackingMaxKeys;
+} config = {
+    .port = SERVER_DEFAULT_PORT,
+    .maxClients = SERVER_DEFAULT_MAX_CLIENTS,
+    .backlog = SERVER_DEFAULT_BACKLOG,
+    .tcpNoDelay = 1,
+    .clientOutputLimit = CLIENT_DEFAULT_OUTPUT_LIMIT,
+    .dbInitialBuckets = 1 << HASHTABLE_DEFAULTCAP,
+    .logLevel = LOG_LEVEL_INFO,
+    .trackingMaxKeys = TRACKING_DEFAULT_MAX_KEYS,
+};
+// What the metrics endpoint reports on
+static MetricsSource_t metricsSource;
+// The client whose command is being executed
+static int currentClientFd = -1;
+// Its connection, NULL while applying the replication stream
+static ClientConnection_t *currentClient;
+// Database the replication stream is in, commands from the primary are applied to it
+static int streamDb;
+// Database of the client whose command is being executed, streamDb while applying the stream
+static int *currentDb = &streamDb;
+// Channels clients subscribed to
+static PubSub_t *pubsub;
+// Set when changes to keys are published to __keyspace@<db>__:<key>
+static int notifyKeyspace;
+// Keys read by clients that cache them, and the prefixes they want to hear about
+static Tracking_t *tracking;
+// Scripts loaded by clients, by digest
+static ScriptCache_t *scripts;
+// Fed to the replicas instead of the command being executed when it is set, for writes that don't
+// replay the same way on a replica
+static char streamRewrite[BUFFER_SIZE + 16];
+static int streamRewriteLen;
+
+static ServerOptions_t configuredServerOptions() {
+    ServerOptions_t options = {config.bind,   config.maxClients, config.backlog,          config.tcpNoDelay,
+                               config.rcvbuf, config.sndbuf,     config.clientOutputLimit};
+    return options;
+}
+
+static void applyServerOptions() {
+    ServerOptions_t options = configuredServerOptions();
+    serverSetOptions(server, &options);
+}
+
+static void applyLogLevel() {
+    logSetLevel(config.logLevel);
+}
+
+static void applyTrackingMaxKeys() {
+    // with fewer keys allowed than are tracked, the next reads forget the extra ones
+    tracking->maxKeys = config.trackingMaxKeys;
+}
+
+// in the order of LogLevel_t
+static const char *logLevelNames[] = {"debug", "info", "warn", "error", "off", NULL};
+
+// every setting of the config file, also taken on the command line as --name value
+static ConfigParam_t configParams[] = {
+    {"bind", CONFIG_STRING, &config.bind, 0, 0, NULL, NULL},
+    {"port", CONFIG_INT, &config.port, 0, 65535, NULL, NULL},
+    {"unix", CONFIG_STRING, &config.unixPath, 0, 0, NULL, NULL},
+    {"max-clients", CONFIG_INT, &config.maxClients, 1, 65536, NULL, NULL},
+    {"tcp-backlog", CONFIG_INT, &config.backlog, 1, 65535, NULL, NULL},
+    {"tcp-nodelay", CONFIG_BOOL, &config.tcpNoDelay, 0, 1, NULL, applyServerOptions},
+    {"socket-rcvbuf", CONFIG_INT, &config.rcvbuf, 0, 1 << 30, NULL, applyServerOptions},
+    {"socket-sndbuf", CONFIG_INT, &config.sndbuf, 0, 1 << 30, NULL, applyServerOptions},
+    {"client-output-limit", CONFIG_INT, &config.clientOutputLimit, BUFFER_SIZE, INT_MAX, NULL, applyServerOptions},
+    {"db-initial-buckets", CONFIG_INT, &config.dbInitialBuckets, 1 << HASHTABLE_DEFAULTCAP,
+     1 << HASHTABLE_MAX_INITIAL_EXP, NULL, NULL},
+    {"metrics-port", CONFIG_INT, &config.metricsPort, 0, 65535, NULL, NULL},
+    {"log-level", CONFIG_ENUM, &config.logLevel, 0, 0, logLevelNames, applyLogLevel},
+    {"log-file", CONFIG_STRING, &config.logFile, 0, 0, NULL, NULL},
+    {"replicaof", CONFIG_STRING, &config.replicaof, 0, 0, NULL, NULL},
+    {"cluster", CONFIG_STRING, &config.cluster, 0, 0, NULL, NULL},
+    {"mmap", CONFIG_STRING, &mmapPath, 0, 0, NULL, NULL},
+    {"tier", CONFIG_STRING, &tierPath, 0, 0, NULL, NULL},
+    {"tier-threshold", CONFIG_INT, &tierThreshold, 1, INT64_MAX, NULL, NULL},
+    {"tracking-max-keys", CONFIG_INT, &config.trackingMaxKeys, 1, INT64_MAX, NULL, applyTrackingMaxKeys},
+};
+
+#define NUM_CONFIG_PARAMS ((int)(sizeof(configParams) / sizeof(configParams[0])))
 
 int getKeyType(char *type) {
     if (strcmp(type, "string") == 0) {
@@ -31,6 +180,134 @@ int getKeyType(char *type) {
     }
 }
 
+// file of a database, database 0 uses the path given on the command line and the others add their number
+static void dbFilePath(const char *path, int db, char *buf) {
+    if (db == 0) {
+        snprintf(buf, PATH_MAX, "%s", path);
+    } else {
+        snprintf(buf, PATH_MAX, "%s.%d", path, db);
+    }
+}
+
+typedef struct Message {
+    char buf[BUFFER_SIZE + 1];
+    int len;
+} Message_t;
+
+static void deliverMessage(int fd, void *ctx) {
+    Message_t *msg = ctx;
+    sendClientData(server, fd, msg->buf, msg->len);
+}
+
+// send a message to the subscribers of a channel, returns how many got it
+static uint64_t publishMessage(const char *channel, size_t len, const char *message) {
+    Message_t msg;
+    msg.len = snprintf(msg.buf, BUFFER_SIZE, "{channel: %.*s, message: %s}", (int)len, channel, message);
+    msg.len = msg.len < BUFFER_SIZE ? msg.len : BUFFER_SIZE - 1;
+    // messages come between replies, so they are always newline terminated
+    msg.buf[msg.len++] = '\n';
+    return pubsubPublish(pubsub, channel, len, deliverMessage, &msg);
+}
+
+// tell a tracking client to drop a key from its cache, or its whole cache if key is NULL
+static void sendInvalidation(int fd, const char *key, size_t keylen, void *ctx) {
+    char msg[BUFFER_SIZE + 32];
+    int len;
+    if (key == NULL) {
+        len = sprintf(msg, "{invalidate_all: 1}\n");
+    } else {
+        len = snprintf(msg, sizeof(msg), "{invalidate: %.*s}\n", (int)keylen, key);
+        len = len < (int)sizeof(msg) ? len : (int)sizeof(msg) - 1;
+    }
+    sendClientData(server, fd, msg, len);
+}
+
+// every tracking client drops its whole cache, when whole databases go away at once
+static void invalidateAllTracking() {
+    int fds[server->options.maxClients];
+    int numFds = 0;
+    for (int i = 0; i < server->options.maxClients; i++) {
+        if (server->clients[i].clientFd != -1 && server->clients[i].tracking != TRACKING_OFF) {
+            fds[numFds++] = server->clients[i].clientFd;
+        }
+    }
+    trackingInvalidateAll(tracking, fds, numFds, sendInvalidation, NULL);
+}
+
+static const char *changeNames[] = {"add", "update", "remove"};
+
+// a change to a key of database ctx goes to the clients caching it and, with notify on, to the
+// subscribers of its keyspace channel
+static void onKeyChange(void *ctx, const char *key, size_t keylen, HashtableChange_t change) {
+    trackingInvalidate(tracking, key, keylen, sendInvalidation, NULL);
+    if (!notifyKeyspace) {
+        return;
+    }
+    char channel[BUFFER_SIZE];
+    int len = snprintf(channel, sizeof(channel), "__keyspace@%d__:%.*s", (int)(intptr_t)ctx, (int)keylen, key);
+    len = len < (int)sizeof(channel) ? len : (int)sizeof(channel) - 1;
+    if (pubsubHasSubscribers(pubsub, channel, len)) {
+        publishMessage(channel, len, changeNames[change]);
+    }
+}
+
+// create a database as configured on the command line, NULL on error
+static Hashtable_t *openDb(int db, int truncate) {
+    char path[PATH_MAX];
+    Hashtable_t *table;
+    if (mmapPath != NULL) {
+        dbFilePath(mmapPath, db, path);
+        table = htCreateMappedTable(path, truncate);
+        if (table == NULL) {
+            LOG_ERROR("Error mapping database %d from %s", db, path);
+            return NULL;
+        }
+        if (table->store->recovered) {
+            LOG_WARN("%s was not closed cleanly, the last writes before the server stopped may be lost", path);
+        }
+        LOG_INFO("Mapped %lu keys of database %d from %s", table->len, db, path);
+    } else {
+        // sized for the keys it is expected to hold, so loading them doesn't rehash every few inserts
+        unsigned char exp = HASHTABLE_DEFAULTCAP;
+        while (((int64_t)1 << exp) < config.dbInitialBuckets) {
+            exp++;
+        }
+        table = htCreateSizedTable(exp);
+        if (table == NULL) {
+            LOG_ERROR("Error creating database %d with %lu buckets", db, (uint64_t)1 << exp);
+            return NULL;
+        }
+    }
+    if (tierPath != NULL) {
+        dbFilePath(tierPath, db, path);
+        if (htEnableTiering(table, path, tierThreshold) != 0) {
+            LOG_ERROR("Error creating the value log %s", path);
+            htDeleteTable(table);
+            return NULL;
+        }
+    }
+    htSetChangeHandler(table, onKeyChange, (void *)(intptr_t)db);
+    return table;
+}
+
+// a database, created if it doesn't exist yet. NULL if it can't be created
+static Hashtable_t *getDb(int db) {
+    if (dbs[db] == NULL) {
+        dbs[db] = openDb(db, 0);
+    }
+    return dbs[db];
+}
+
+// add a write to the replication stream, switching the stream to the database it was made in first
+static void feedStream(int db, const char *data, int size) {
+    if (db != streamDb) {
+        char use[32];
+        replFeed(repl, use, sprintf(use, "use %d\n", db));
+        streamDb = db;
+    }
+    replFeed(repl, data, size);
+}
+
 int executeInsertCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
     HashtableValue_t htv;
     char *err = NULL;
@@ -88,6 +365,8 @@ int executeInsertCommand(Hashtable_t *ht, Command_t *command, char *commandResul
     }
     if (retVal == 0) {
         sprintf(commandResult, "Value inserted successfully");
+    } else if (retVal == 2) {
+        sprintf(commandResult, "Error inserting key");
     }
     return retVal;
 }
@@ -111,6 +390,15 @@ int executeSelectCommand(Hashtable_t *ht, Command_t *command, char *commandResul
     case DOUBLE:
         sprintf(commandResult, "{%s: %lf}", command->key, htv.v.d);
         return 0;
+    case LIST:
+        sprintf(commandResult, "{%s: list(%lu)}", command->key, htv.v.list->len);
+        return 0;
+    case HASH:
+        sprintf(commandResult, "{%s: hash(%lu)}", command->key, hashLen(htv.v.hash));
+        return 0;
+    case SET:
+        sprintf(commandResult, "{%s: set(%lu)}", command->key, setLen(htv.v.set));
+        return 0;
     default:
         return 1;
     }
@@ -126,46 +414,37 @@ int executeDeleteCommand(Hashtable_t *ht, Command_t *command, char *commandResul
     return retval;
 }
 
-int executeReplaceCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
-    HashtableValue_t htv;
+// parse the value of a replace or cas, returns 0 if it is valid for its type
+static int parseCommandValue(char *type, char *value, HashtableValue_t *htv) {
     char *err = NULL;
-    int retval;
-    switch (getKeyType(command->type)) {
+    switch (getKeyType(type)) {
     case STRING:
-        htv.entryType = STRING;
-        htv.v.val = command->value;
-        retval = htReplace(ht, command->key, strlen(command->key), htv);
-        break;
+        htv->entryType = STRING;
+        htv->v.val = value;
+        return 0;
     case UNSIGNED_INT:
-        htv.entryType = UNSIGNED_INT;
-        htv.v.u64 = (uint64_t)strtol(command->value, &err, 10);
-        if (strcmp(err, "") != 0) {
-            retval = 1;
-        } else {
-            retval = htReplace(ht, command->key, strlen(command->key), htv);
-        }
+        htv->entryType = UNSIGNED_INT;
+        htv->v.u64 = (uint64_t)strtol(value, &err, 10);
         break;
     case SIGNED_INT:
-        htv.entryType = SIGNED_INT;
-        htv.v.s64 = (int64_t)strtol(command->value, &err, 10);
-        if (strcmp(err, "") != 0) {
-            retval = 1;
-        } else {
-            retval = htReplace(ht, command->key, strlen(command->key), htv);
-        }
+        htv->entryType = SIGNED_INT;
+        htv->v.s64 = (int64_t)strtol(value, &err, 10);
         break;
     case DOUBLE:
-        htv.entryType = DOUBLE;
-        htv.v.d = strtod(command->value, &err);
-        if (strcmp(err, "") != 0) {
-            retval = 1;
-        } else {
-            retval = htReplace(ht, command->key, strlen(command->key), htv);
-        }
+        htv->entryType = DOUBLE;
+        htv->v.d = strtod(value, &err);
         break;
     default:
-        retval = 1;
-        break;
+        return 1;
+    }
+    return strcmp(err, "") != 0;
+}
+
+int executeReplaceCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    HashtableValue_t htv;
+    int retval = 1;
+    if (parseCommandValue(command->type, command->value, &htv) == 0) {
+        retval = htReplace(ht, command->key, strlen(command->key), htv);
     }
     if (retval == 0) {
         sprintf(commandResult, "Key replaced successfully");
@@ -175,86 +454,2124 @@ int executeReplaceCommand(Hashtable_t *ht, Command_t *command, char *commandResu
     return retval;
 }
 
-void closeDb() {
-    printf("Closing database...\n");
-    htDeleteTable(ht);
-    destroyServer(server);
-    exit(0);
+// parse a signed 64 bit integer, returns 0 if the whole string was a valid integer
+static int parseInt64(const char *str, int64_t *out) {
+    char *err = NULL;
+    errno = 0;
+    long long val = strtoll(str, &err, 10);
+    if (errno != 0 || err == str || strcmp(err, "") != 0) {
+        return 1;
+    }
+    *out = val;
+    return 0;
 }
 
-int executeDbCommand(const char *inputStatement, int inputStatementSize, Hashtable_t *ht, char *commandResult) {
-    Command_t command;
-    int retval;
-    char statementCopy[inputStatementSize];
-    memcpy(statementCopy, inputStatement, inputStatementSize);
-    char *saveptr;
-    if (statementCopy[inputStatementSize - 1] == '\n') {
-        // make sure statement is null terminated
-        statementCopy[inputStatementSize - 1] = '\0';
+// cas <key> <version> <type> <value> replaces the value if it still has the version a client read
+int executeCasCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    int64_t version;
+    HashtableValue_t htv;
+    if (command->type == NULL || parseInt64(command->type, &version) != 0 || version < 0) {
+        sprintf(commandResult, "Malformed query");
+        return 1;
     }
-    command.query = strtok_r(statementCopy, " ", &saveptr);
-    if (command.query != NULL) {
-        command.key = strtok_r(NULL, " ", &saveptr);
+    // the value token holds the type and the value
+    char *type = command->value;
+    char *value = strchr(type, ' ');
+    if (value != NULL) {
+        *value++ = '\0';
     } else {
-        command.key = NULL;
-        retval = 1;
-        sprintf(commandResult, "Malformed query");
+        value = type + strlen(type);
+    }
+    if (parseCommandValue(type, value, &htv) != 0) {
+        sprintf(commandResult, "Error replacing key");
+        return 1;
+    }
+    int retval = htReplaceIfVersion(ht, command->key, strlen(command->key), htv, version);
+    if (retval == 1) {
+        sprintf(commandResult, "Version mismatch");
+        return 1;
+    } else if (retval == 2) {
+        sprintf(commandResult, "Versions are not supported by the mapped keyspace");
+        return 1;
+    }
+    // the replicas have versions of their own, they get the replace the version allowed
+    streamRewriteLen = snprintf(streamRewrite, sizeof(streamRewrite), "replace %s %s %s", command->key, type, value);
+    sprintf(commandResult, "{%s: %lu}", command->key, htVersion(ht, command->key, strlen(command->key)));
+    return 0;
+}
+
+int executeVersionCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    if (ht->store != NULL) {
+        sprintf(commandResult, "Versions are not supported by the mapped keyspace");
+        return 1;
+    }
+    uint64_t version = htVersion(ht, command->key, strlen(command->key));
+    if (version == 0) {
+        sprintf(commandResult, "Key not found");
+        return 0;
+    }
+    sprintf(commandResult, "{%s: %lu}", command->key, version);
+    return 0;
+}
+
+int executeIncrCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    int64_t delta = 1;
+    if (strcmp(command->query, "incrby") == 0 || strcmp(command->query, "decrby") == 0) {
+        if (command->type == NULL || parseInt64(command->type, &delta) != 0) {
+            sprintf(commandResult, "Invalid increment");
+            return 1;
+        }
+    }
+    if (strncmp(command->query, "decr", 4) == 0) {
+        if (delta == INT64_MIN) {
+            sprintf(commandResult, "Increment would overflow");
+            return 1;
+        }
+        delta = -delta;
     }
-    if (command.key != NULL) {
-        command.type = strtok_r(NULL, " ", &saveptr);
+    HashtableValue_t htv;
+    switch (htIncrBy(ht, command->key, strlen(command->key), delta, &htv)) {
+    case 0:
+        break;
+    case 1:
+        sprintf(commandResult, "Value is not an integer");
+        return 1;
+    case 3:
+        sprintf(commandResult, "Error inserting key");
+        return 1;
+    default:
+        sprintf(commandResult, "Increment would overflow");
+        return 1;
+    }
+    if (htv.entryType == UNSIGNED_INT) {
+        sprintf(commandResult, "{%s: %lu}", command->key, htv.v.u64);
     } else {
-        command.type = NULL;
-        retval = 1;
+        sprintf(commandResult, "{%s: %ld}", command->key, htv.v.s64);
+    }
+    return 0;
+}
+
+int executeIncrByFloatCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    char *err = NULL;
+    if (command->type == NULL) {
+        sprintf(commandResult, "Invalid increment");
+        return 1;
+    }
+    double delta = strtod(command->type, &err);
+    if (err == command->type || strcmp(err, "") != 0) {
+        sprintf(commandResult, "Invalid increment");
+        return 1;
+    }
+    HashtableValue_t htv;
+    switch (htIncrByFloat(ht, command->key, strlen(command->key), delta, &htv)) {
+    case 0:
+        break;
+    case 1:
+        sprintf(commandResult, "Value is not a double");
+        return 1;
+    case 3:
+        sprintf(commandResult, "Error inserting key");
+        return 1;
+    default:
+        sprintf(commandResult, "Increment would produce NaN or Infinity");
+        return 1;
+    }
+    sprintf(commandResult, "{%s: %lf}", command->key, htv.v.d);
+    return 0;
+}
+
+typedef struct RangeResult {
+    Hashtable_t *ht;
+    char *buf;  /* Output buffer of the command */
+    size_t len; /* Number of characters written to buf */
+    size_t cap; /* Size of buf */
+} RangeResult_t;
+
+// append "key: value" of an indexed key to the command result, stops the traversal once the result is full
+static int appendRangeEntry(const char *key, size_t keylen, double score, void *ctx) {
+    RangeResult_t *res = ctx;
+    HashtableValue_t htv = htFind(res->ht, key, keylen);
+    const char *sep = res->len > 1 ? ", " : "";
+    int n;
+    switch (htv.entryType) {
+    case UNSIGNED_INT:
+        n = snprintf(res->buf + res->len, res->cap - res->len, "%s%.*s: %ld", sep, (int)keylen, key, htv.v.u64);
+        break;
+    case SIGNED_INT:
+        n = snprintf(res->buf + res->len, res->cap - res->len, "%s%.*s: %ld", sep, (int)keylen, key, htv.v.s64);
+        break;
+    default:
+        n = snprintf(res->buf + res->len, res->cap - res->len, "%s%.*s: %lf", sep, (int)keylen, key, score);
+        break;
+    }
+    // always leave room for the closing brace
+    if (n < 0 || res->len + n + 2 > res->cap) {
+        res->buf[res->len] = '\0';
+        return 1;
+    }
+    res->len += n;
+    return 0;
+}
+
+int executeIndexCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    if (htCreateIndex(ht, command->key, strlen(command->key)) != 0) {
+        sprintf(commandResult, "Index %s already exists", command->key);
+        return 1;
+    }
+    sprintf(commandResult, "Index created successfully");
+    return 0;
+}
+
+int executeDropIndexCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    if (htDropIndex(ht, command->key, strlen(command->key)) != 0) {
+        sprintf(commandResult, "Index not found");
+        return 1;
+    }
+    sprintf(commandResult, "Index dropped successfully");
+    return 0;
+}
+
+int executeRangeCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    char *err = NULL;
+    if (command->type == NULL || strlen(command->value) == 0) {
+        sprintf(commandResult, "Malformed query");
+        return 1;
+    }
+    double min = strtod(command->type, &err);
+    if (strcmp(err, "") != 0) {
+        sprintf(commandResult, "Invalid range");
+        return 1;
+    }
+    double max = strtod(command->value, &err);
+    if (strcmp(err, "") != 0) {
+        sprintf(commandResult, "Invalid range");
+        return 1;
+    }
+    HashtableIndex_t *idx = htGetIndex(ht, command->key, strlen(command->key));
+    if (idx == NULL) {
+        sprintf(commandResult, "Index not found");
+        return 1;
+    }
+    RangeResult_t res = {ht, commandResult, 1, BUFFER_SIZE};
+    commandResult[0] = '{';
+    slRangeByScore(idx->sl, min, max, appendRangeEntry, &res);
+    strcpy(commandResult + res.len, "}");
+    return 0;
+}
+
+int executeTopCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    char *err = NULL;
+    if (command->type == NULL) {
         sprintf(commandResult, "Malformed query");
+        return 1;
+    }
+    uint64_t n = (uint64_t)strtoul(command->type, &err, 10);
+    if (strcmp(err, "") != 0) {
+        sprintf(commandResult, "Invalid count");
+        return 1;
+    }
+    HashtableIndex_t *idx = htGetIndex(ht, command->key, strlen(command->key));
+    if (idx == NULL) {
+        sprintf(commandResult, "Index not found");
+        return 1;
+    }
+    RangeResult_t res = {ht, commandResult, 1, BUFFER_SIZE};
+    commandResult[0] = '{';
+    slTop(idx->sl, n, appendRangeEntry, &res);
+    strcpy(commandResult + res.len, "}");
+    return 0;
+}
+
+// maximum number of keys returned by a single prefix or keyrange page
+#define SCAN_PAGE_SIZE 100
+// a cursor is the last key of a page after this mark, so no key can be mistaken for the 0 that starts and
+// ends a scan
+#define SCAN_CURSOR_MARK '>'
+// percentage of its size a value must shrink by to be kept compressed when no minimum is given
+#define COMPRESSION_DEFAULT_MIN_SAVINGS 10
+
+typedef struct ScanResult {
+    char keys[BUFFER_SIZE]; /* Keys of the page, comma separated */
+    size_t len;             /* Number of characters written to keys */
+    uint64_t count;         /* Number of keys in the page */
+    const char *last;       /* Last key of the page, used as the cursor of the next page */
+    size_t lastlen;
+    const char *prefix; /* Keys must start with prefix, if not NULL */
+    size_t prefixlen;
+    const char *end; /* Keys must be smaller or equal to end, if not NULL */
+    size_t endlen;
+    int more; /* Set if the page is full and there are keys left */
+} ScanResult_t;
+
+// append a key to the page, stops once a key falls out of the prefix or range or the page is full
+static int appendScanKey(const char *key, size_t keylen, void *ctx) {
+    ScanResult_t *res = ctx;
+    if (res->prefix != NULL && (keylen < res->prefixlen || memcmp(key, res->prefix, res->prefixlen) != 0)) {
+        return 1;
+    }
+    if (res->end != NULL) {
+        size_t minlen = keylen < res->endlen ? keylen : res->endlen;
+        int cmp = memcmp(key, res->end, minlen);
+        if (cmp > 0 || (cmp == 0 && keylen > res->endlen)) {
+            return 1;
+        }
+    }
+    // the key is written twice if it ends up being the cursor, keep room for it and the braces
+    if (res->count == SCAN_PAGE_SIZE || res->len + 2 * keylen + 32 > BUFFER_SIZE) {
+        res->more = 1;
+        return 1;
     }
-    if (command.type != NULL) {
-        // get end of input as value
-        command.value = command.type + strlen(command.type) + 1;
+    res->len += sprintf(res->keys + res->len, "%s%.*s", res->count > 0 ? ", " : "", (int)keylen, key);
+    res->count++;
+    res->last = key;
+    res->lastlen = keylen;
+    return 0;
+}
+
+static void formatScanResult(ScanResult_t *res, char *commandResult) {
+    if (res->more) {
+        sprintf(commandResult, "{cursor: %c%.*s, keys: [%s]}", SCAN_CURSOR_MARK, (int)res->lastlen, res->last,
+                res->keys);
     } else {
-        command.value = NULL;
-        if (strncmp(command.query, "insert", 6) == 0 || strncmp(command.query, "replace", 7) == 0) {
-            retval = 1;
-            sprintf(commandResult, "Malformed query");
+        sprintf(commandResult, "{cursor: 0, keys: [%s]}", res->keys);
+    }
+}
+
+// scan from the start of the page given by a cursor, from start if the cursor is NULL or 0
+static int scanFromCursor(Hashtable_t *ht, const char *cursor, const char *start, ScanResult_t *res,
+                          char *commandResult) {
+    if (cursor == NULL || strcmp(cursor, "0") == 0) {
+        artScan(ht->keyIndex, start, strlen(start), 0, appendScanKey, res);
+    } else if (cursor[0] == SCAN_CURSOR_MARK && cursor[1] != '\0') {
+        // resume after the last key of the previous page
+        artScan(ht->keyIndex, cursor + 1, strlen(cursor + 1), 1, appendScanKey, res);
+    } else {
+        sprintf(commandResult, "Invalid cursor");
+        return 1;
+    }
+    formatScanResult(res, commandResult);
+    return 0;
+}
+
+int executeKeyIndexCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    if (strcmp(command->key, "enable") == 0) {
+        if (htEnableKeyIndex(ht) != 0) {
+            sprintf(commandResult, "Key index already enabled");
+            return 1;
+        }
+        sprintf(commandResult, "Key index enabled");
+        return 0;
+    } else if (strcmp(command->key, "disable") == 0) {
+        if (htDisableKeyIndex(ht) != 0) {
+            sprintf(commandResult, "Key index not enabled");
+            return 1;
         }
+        sprintf(commandResult, "Key index disabled");
+        return 0;
+    }
+    sprintf(commandResult, "Malformed query");
+    return 1;
+}
+
+// compression <threshold> [minsavings]
+int executeCompressionCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    int64_t threshold;
+    int64_t minSavings = COMPRESSION_DEFAULT_MIN_SAVINGS;
+    if (parseInt64(command->key, &threshold) != 0 || threshold < 0 ||
+        (command->type != NULL && (parseInt64(command->type, &minSavings) != 0 || minSavings < 0 || minSavings > 100))) {
+        sprintf(commandResult, "Invalid compression settings");
+        return 1;
+    }
+    htSetCompression(ht, threshold, minSavings);
+    sprintf(commandResult, "Compression set successfully");
+    return 0;
+}
+
+int executePrefixCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    if (ht->keyIndex == NULL) {
+        sprintf(commandResult, "Key index not enabled");
+        return 1;
+    }
+    ScanResult_t res;
+    memset(&res, 0, sizeof(ScanResult_t));
+    res.prefix = command->key;
+    res.prefixlen = strlen(command->key);
+    return scanFromCursor(ht, command->type, command->key, &res, commandResult);
+}
+
+int executeKeyRangeCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    if (command->type == NULL) {
+        sprintf(commandResult, "Malformed query");
+        return 1;
+    }
+    if (ht->keyIndex == NULL) {
+        sprintf(commandResult, "Key index not enabled");
+        return 1;
     }
-    if (retval != 1) {
-        if (strncmp(command.query, "insert", 6) == 0) {
-            retval = executeInsertCommand(ht, &command, commandResult);
-        } else if (strncmp(command.query, "select", 6) == 0) {
-            retval = executeSelectCommand(ht, &command, commandResult);
-        } else if (strncmp(command.query, "delete", 6) == 0) {
-            retval = executeDeleteCommand(ht, &command, commandResult);
-        } else if (strncmp(command.query, "replace", 7) == 0) {
-            retval = executeReplaceCommand(ht, &command, commandResult);
+    ScanResult_t res;
+    memset(&res, 0, sizeof(ScanResult_t));
+    res.end = command->type;
+    res.endlen = strlen(command->type);
+    return scanFromCursor(ht, strlen(command->value) > 0 ? command->value : NULL, command->key, &res, commandResult);
+}
+
+// get the collection of the given type stored at key, creating an empty one if create is set
+static int lookupCollection(Hashtable_t *ht, Command_t *command, EntryType_t type, int create, HashtableValue_t *htv,
+                            char *commandResult) {
+    *htv = htFind(ht, command->key, strlen(command->key));
+    if (htv->entryType == NONE && create) {
+        htv->entryType = type;
+        if (type == LIST) {
+            htv->v.list = listCreate();
+        } else if (type == HASH) {
+            htv->v.hash = hashCreate();
         } else {
-            retval = 1;
-            sprintf(commandResult, "Query not supported");
+            htv->v.set = setCreate();
+        }
+        if (htAdd(ht, command->key, strlen(command->key), *htv) != 0) {
+            if (type == LIST) {
+                listDelete(htv->v.list);
+            } else if (type == HASH) {
+                hashDelete(htv->v.hash);
+            } else {
+                setDelete(htv->v.set);
+            }
+            sprintf(commandResult, "Collections are not supported by the mapped keyspace");
+            return 1;
         }
     }
-    return retval;
+    if (htv->entryType == NONE) {
+        sprintf(commandResult, "Key not found");
+        return 1;
+    }
+    if (htv->entryType != type) {
+        sprintf(commandResult, "Wrong type for key %s", command->key);
+        return 1;
+    }
+    return 0;
 }
 
-void onData(int clientFd, const char *data, int size, struct sockaddr *addr, socklen_t addrLen) {
-    char commandResult[BUFFER_SIZE];
-    memset(commandResult, 0, BUFFER_SIZE);
-    if (executeDbCommand(data, size, ht, commandResult) != 0) {
-        printf("Error completing command\n");
-    } else {
-        printf("Command completed successfully\n");
+// the element of a list or set command is everything after the key
+static const char *commandElement(Command_t *command, char *buf) {
+    if (strlen(command->value) == 0) {
+        return command->type;
     }
-    sendClientData(clientFd, commandResult, strlen(commandResult));
+    sprintf(buf, "%s %s", command->type, command->value);
+    return buf;
 }
 
-int main(int argc, char *argv[]) {
-    // close program on Ctrl-C
-    signal(SIGINT, closeDb);
-    signal(SIGTERM, closeDb);
+typedef struct ElementsResult {
+    char *buf;  /* Output buffer of the command */
+    size_t len; /* Number of characters written to buf */
+    uint64_t count;
+} ElementsResult_t;
 
-    server = createServer(SERVER_DEFAULT_PORT);
-    if (server != NULL) {
-        ht = htCreateTable();
+// append an element to the command result, stops once the result is full
+static int appendElement(const char *s, size_t len, void *ctx) {
+    ElementsResult_t *res = ctx;
+    // always leave room for the closing brackets
+    if (res->len + len + 5 > BUFFER_SIZE) {
+        return 1;
+    }
+    res->len += sprintf(res->buf + res->len, "%s%.*s", res->count > 0 ? ", " : "", (int)len, s);
+    res->count++;
+    return 0;
+}
+
+// append a field and its value to the command result, stops once the result is full
+static int appendField(const char *field, size_t fieldlen, const char *val, size_t vallen, void *ctx) {
+    ElementsResult_t *res = ctx;
+    if (res->len + fieldlen + vallen + 7 > BUFFER_SIZE) {
+        return 1;
+    }
+    res->len +=
+        sprintf(res->buf + res->len, "%s%.*s: %.*s", res->count > 0 ? ", " : "", (int)fieldlen, field, (int)vallen, val);
+    res->count++;
+    return 0;
+}
+
+int executePushCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    char buf[BUFFER_SIZE];
+    HashtableValue_t htv;
+    if (command->type == NULL) {
+        sprintf(commandResult, "Malformed query");
+        return 1;
+    }
+    if (lookupCollection(ht, command, LIST, 1, &htv, commandResult) != 0) {
+        return 1;
+    }
+    const char *element = commandElement(command, buf);
+    ListEnd_t where = command->query[0] == 'l' ? LIST_HEAD : LIST_TAIL;
+    uint64_t len = listPush(htv.v.list, where, element, strlen(element));
+    if (len == 0) {
+        if (htv.v.list->len == 0) {
+            htRemove(ht, command->key, strlen(command->key));
+        }
+        sprintf(commandResult, "Error pushing element");
+        return 1;
+    }
+    htTouch(ht, command->key, strlen(command->key));
+    sprintf(commandResult, "{%s: %lu}", command->key, len);
+    return 0;
+}
+
+int executePopCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    HashtableValue_t htv;
+    if (lookupCollection(ht, command, LIST, 0, &htv, commandResult) != 0) {
+        return 1;
+    }
+    char *element;
+    size_t len;
+    listPop(htv.v.list, command->query[0] == 'l' ? LIST_HEAD : LIST_TAIL, &element, &len);
+    snprintf(commandResult, BUFFER_SIZE, "{%s: %s}", command->key, element);
+    free(element);
+    htTouch(ht, command->key, strlen(command->key));
+    if (htv.v.list->len == 0) {
+        // empty collections don't exist
+        htRemove(ht, command->key, strlen(command->key));
+    }
+    return 0;
+}
+
+int executeLlenCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    HashtableValue_t htv;
+    if (lookupCollection(ht, command, LIST, 0, &htv, commandResult) != 0) {
+        return 1;
+    }
+    sprintf(commandResult, "{%s: %lu}", command->key, htv.v.list->len);
+    return 0;
+}
+
+int executeLrangeCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    HashtableValue_t htv;
+    int64_t start, stop;
+    if (command->type == NULL || parseInt64(command->type, &start) != 0 || parseInt64(command->value, &stop) != 0) {
+        sprintf(commandResult, "Malformed query");
+        return 1;
+    }
+    if (lookupCollection(ht, command, LIST, 0, &htv, commandResult) != 0) {
+        return 1;
+    }
+    ElementsResult_t res = {commandResult, 0, 0};
+    res.len = sprintf(commandResult, "{%s: [", command->key);
+    listRange(htv.v.list, start, stop, appendElement, &res);
+    strcpy(commandResult + res.len, "]}");
+    return 0;
+}
+
+int executeHsetCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    HashtableValue_t htv;
+    if (command->type == NULL || strlen(command->value) == 0) {
+        sprintf(commandResult, "Malformed query");
+        return 1;
+    }
+    if (lookupCollection(ht, command, HASH, 1, &htv, commandResult) != 0) {
+        return 1;
+    }
+    if (hashSet(htv.v.hash, command->type, strlen(command->type), command->value, strlen(command->value)) < 0) {
+        if (hashLen(htv.v.hash) == 0) {
+            htRemove(ht, command->key, strlen(command->key));
+        }
+        sprintf(commandResult, "Error setting field");
+        return 1;
+    }
+    htTouch(ht, command->key, strlen(command->key));
+    sprintf(commandResult, "Field set successfully");
+    return 0;
+}
+
+int executeHgetCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    HashtableValue_t htv;
+    if (command->type == NULL) {
+        sprintf(commandResult, "Malformed query");
+        return 1;
+    }
+    if (lookupCollection(ht, command, HASH, 0, &htv, commandResult) != 0) {
+        return 1;
+    }
+    const char *val;
+    size_t vallen;
+    if (hashGet(htv.v.hash, command->type, strlen(command->type), &val, &vallen) != 0) {
+        sprintf(commandResult, "Field not found");
+        return 1;
+    }
+    snprintf(commandResult, BUFFER_SIZE, "{%s: %.*s}", command->type, (int)vallen, val);
+    return 0;
+}
+
+int executeHdelCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    HashtableValue_t htv;
+    if (command->type == NULL) {
+        sprintf(commandResult, "Malformed query");
+        return 1;
+    }
+    if (lookupCollection(ht, command, HASH, 0, &htv, commandResult) != 0) {
+        return 1;
+    }
+    if (hashDel(htv.v.hash, command->type, strlen(command->type)) != 0) {
+        sprintf(commandResult, "Field not found");
+        return 1;
+    }
+    htTouch(ht, command->key, strlen(command->key));
+    if (hashLen(htv.v.hash) == 0) {
+        htRemove(ht, command->key, strlen(command->key));
+    }
+    sprintf(commandResult, "Field removed successfully");
+    return 0;
+}
+
+int executeHlenCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    HashtableValue_t htv;
+    if (lookupCollection(ht, command, HASH, 0, &htv, commandResult) != 0) {
+        return 1;
+    }
+    sprintf(commandResult, "{%s: %lu}", command->key, hashLen(htv.v.hash));
+    return 0;
+}
+
+int executeHgetallCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    HashtableValue_t htv;
+    if (lookupCollection(ht, command, HASH, 0, &htv, commandResult) != 0) {
+        return 1;
+    }
+    ElementsResult_t res = {commandResult, 1, 0};
+    commandResult[0] = '{';
+    hashForEach(htv.v.hash, appendField, &res);
+    strcpy(commandResult + res.len, "}");
+    return 0;
+}
+
+int executeSaddCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    char buf[BUFFER_SIZE];
+    HashtableValue_t htv;
+    if (command->type == NULL) {
+        sprintf(commandResult, "Malformed query");
+        return 1;
+    }
+    if (lookupCollection(ht, command, SET, 1, &htv, commandResult) != 0) {
+        return 1;
+    }
+    const char *member = commandElement(command, buf);
+    int added = setAdd(htv.v.set, member, strlen(member));
+    if (added < 0) {
+        if (setLen(htv.v.set) == 0) {
+            htRemove(ht, command->key, strlen(command->key));
+        }
+        sprintf(commandResult, "Error adding member");
+        return 1;
+    }
+    if (added == 0) {
+        sprintf(commandResult, "Member already exists");
+        return 1;
+    }
+    htTouch(ht, command->key, strlen(command->key));
+    sprintf(commandResult, "Member added successfully");
+    return 0;
+}
+
+int executeSremCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    char buf[BUFFER_SIZE];
+    HashtableValue_t htv;
+    if (command->type == NULL) {
+        sprintf(commandResult, "Malformed query");
+        return 1;
+    }
+    if (lookupCollection(ht, command, SET, 0, &htv, commandResult) != 0) {
+        return 1;
+    }
+    const char *member = commandElement(command, buf);
+    if (setRemove(htv.v.set, member, strlen(member)) == 0) {
+        sprintf(commandResult, "Member not found");
+        return 1;
+    }
+    htTouch(ht, command->key, strlen(command->key));
+    if (setLen(htv.v.set) == 0) {
+        htRemove(ht, command->key, strlen(command->key));
+    }
+    sprintf(commandResult, "Member removed successfully");
+    return 0;
+}
+
+int executeSismemberCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    char buf[BUFFER_SIZE];
+    HashtableValue_t htv;
+    if (command->type == NULL) {
+        sprintf(commandResult, "Malformed query");
+        return 1;
+    }
+    if (lookupCollection(ht, command, SET, 0, &htv, commandResult) != 0) {
+        return 1;
+    }
+    const char *member = commandElement(command, buf);
+    if (!setIsMember(htv.v.set, member, strlen(member))) {
+        sprintf(commandResult, "Member not found");
+        return 0;
+    }
+    sprintf(commandResult, "Member found");
+    return 0;
+}
+
+int executeScardCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    HashtableValue_t htv;
+    if (lookupCollection(ht, command, SET, 0, &htv, commandResult) != 0) {
+        return 1;
+    }
+    sprintf(commandResult, "{%s: %lu}", command->key, setLen(htv.v.set));
+    return 0;
+}
+
+int executeSmembersCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    HashtableValue_t htv;
+    if (lookupCollection(ht, command, SET, 0, &htv, commandResult) != 0) {
+        return 1;
+    }
+    ElementsResult_t res = {commandResult, 0, 0};
+    res.len = sprintf(commandResult, "{%s: [", command->key);
+    setForEach(htv.v.set, appendElement, &res);
+    strcpy(commandResult + res.len, "]}");
+    return 0;
+}
+
+void closeDb() {
+    LOG_INFO("Closing database...");
+    for (int i = 0; i < NUM_DATABASES; i++) {
+        if (dbs[i] != NULL) {
+            htDeleteTable(dbs[i]);
+        }
+    }
+    destroyServer(server);
+    statsDelete(stats);
+    slowlogDelete(slowlog);
+    replDelete(repl);
+    clusterDelete(cluster);
+    pubsubDelete(pubsub);
+    scriptCacheDelete(scripts);
+    trackingDelete(tracking);
+    lazyfreeShutdown();
+    logShutdown();
+    exit(0);
+}
+
+typedef int (*commandHandler_t)(Hashtable_t *ht, Command_t *command, char *commandResult);
+
+typedef struct CommandSpec {
+    const char *name;
+    commandHandler_t handler;
+    int prefix; /* Match any query starting with name, as the original commands always did */
+    int write;  /* Modifies the keyspace, so it is replicated */
+    int keyed;  /* The key token is a key, so in cluster mode the node serving its slot runs the command */
+} CommandSpec_t;
+
+int executeInfoCommand(Hashtable_t *ht, Command_t *command, char *commandResult);
+int executeSlowlogCommand(Hashtable_t *ht, Command_t *command, char *commandResult);
+int executeSyncCommand(Hashtable_t *ht, Command_t *command, char *commandResult);
+int executeReplicaofCommand(Hashtable_t *ht, Command_t *command, char *commandResult);
+int executeClusterCommand(Hashtable_t *ht, Command_t *command, char *commandResult);
+int executeResizeCommand(Hashtable_t *ht, Command_t *command, char *commandResult);
+int executeTierCommand(Hashtable_t *ht, Command_t *command, char *commandResult);
+int executeUseCommand(Hashtable_t *ht, Command_t *command, char *commandResult);
+int executeFlushCommand(Hashtable_t *ht, Command_t *command, char *commandResult);
+int executeMultiCommand(Hashtable_t *ht, Command_t *command, char *commandResult);
+int executeExecCommand(Hashtable_t *ht, Command_t *command, char *commandResult);
+int executeDiscardCommand(Hashtable_t *ht, Command_t *command, char *commandResult);
+int executeSubscribeCommand(Hashtable_t *ht, Command_t *command, char *commandResult);
+int executeUnsubscribeCommand(Hashtable_t *ht, Command_t *command, char *commandResult);
+int executePublishCommand(Hashtable_t *ht, Command_t *command, char *commandResult);
+int executeNotifyCommand(Hashtable_t *ht, Command_t *command, char *commandResult);
+int executeScriptCommand(Hashtable_t *ht, Command_t *command, char *commandResult);
+int executeTrackingCommand(Hashtable_t *ht, Command_t *command, char *commandResult);
+int executeEvalshaCommand(Hashtable_t *ht, Command_t *command, char *commandResult);
+int executeConfigCommand(Hashtable_t *ht, Command_t *command, char *commandResult);
+
+static const CommandSpec_t commandTable[] = {
+    {"insert", executeInsertCommand, 1, 1, 1},
+    {"select", executeSelectCommand, 1, 0, 1},
+    {"delete", executeDeleteCommand, 1, 1, 1},
+    {"replace", executeReplaceCommand, 1, 1, 1},
+    {"cas", executeCasCommand, 0, 1, 1},
+    {"version", executeVersionCommand, 0, 0, 1},
+    {"index", executeIndexCommand, 0, 1, 0},
+    {"dropindex", executeDropIndexCommand, 0, 1, 0},
+    {"range", executeRangeCommand, 0, 0, 0},
+    {"top", executeTopCommand, 0, 0, 0},
+    {"keyindex", executeKeyIndexCommand, 0, 1, 0},
+    {"compression", executeCompressionCommand, 0, 1, 0},
+    {"prefix", executePrefixCommand, 0, 0, 0},
+    {"keyrange", executeKeyRangeCommand, 0, 0, 0},
+    {"incr", executeIncrCommand, 0, 1, 1},
+    {"decr", executeIncrCommand, 0, 1, 1},
+    {"incrby", executeIncrCommand, 0, 1, 1},
+    {"decrby", executeIncrCommand, 0, 1, 1},
+    {"incrbyfloat", executeIncrByFloatCommand, 0, 1, 1},
+    {"lpush", executePushCommand, 0, 1, 1},
+    {"rpush", executePushCommand, 0, 1, 1},
+    {"lpop", executePopCommand, 0, 1, 1},
+    {"rpop", executePopCommand, 0, 1, 1},
+    {"llen", executeLlenCommand, 0, 0, 1},
+    {"lrange", executeLrangeCommand, 0, 0, 1},
+    {"hset", executeHsetCommand, 0, 1, 1},
+    {"hget", executeHgetCommand, 0, 0, 1},
+    {"hdel", executeHdelCommand, 0, 1, 1},
+    {"hlen", executeHlenCommand, 0, 0, 1},
+    {"hgetall", executeHgetallCommand, 0, 0, 1},
+    {"sadd", executeSaddCommand, 0, 1, 1},
+    {"srem", executeSremCommand, 0, 1, 1},
+    {"sismember", executeSismemberCommand, 0, 0, 1},
+    {"scard", executeScardCommand, 0, 0, 1},
+    {"smembers", executeSmembersCommand, 0, 0, 1},
+    {"info", executeInfoCommand, 0, 0, 0},
+    {"slowlog", executeSlowlogCommand, 0, 0, 0},
+    {"sync", executeSyncCommand, 0, 0, 0},
+    {"replicaof", executeReplicaofCommand, 0, 0, 0},
+    {"cluster", executeClusterCommand, 0, 0, 0},
+    {"resize", executeResizeCommand, 0, 0, 0},
+    {"tier", executeTierCommand, 0, 0, 0},
+    {"use", executeUseCommand, 0, 0, 0},
+    {"flush", executeFlushCommand, 0, 1, 0},
+    {"multi", executeMultiCommand, 0, 0, 0},
+    {"exec", executeExecCommand, 0, 0, 0},
+    {"discard", executeDiscardCommand, 0, 0, 0},
+    {"subscribe", executeSubscribeCommand, 0, 0, 0},
+    {"unsubscribe", executeUnsubscribeCommand, 0, 0, 0},
+    {"publish", executePublishCommand, 0, 0, 0},
+    {"notify", executeNotifyCommand, 0, 0, 0},
+    {"script", executeScriptCommand, 0, 0, 0},
+    {"tracking", executeTrackingCommand, 0, 0, 0},
+    // not a write itself, the writes a script makes are fed to the replicas one by one
+    {"evalsha", executeEvalshaCommand, 0, 0, 0},
+    {"config", executeConfigCommand, 0, 0, 0},
+};
+
+#define NUM_COMMANDS ((int)(sizeof(commandTable) / sizeof(commandTable[0])))
+
+// find the command handling the query, returns its index in commandTable or -1
+static int lookupCommand(const char *query) {
+    for (int i = 0; i < NUM_COMMANDS; i++) {
+        const CommandSpec_t *spec = &commandTable[i];
+        if (spec->prefix ? strncmp(query, spec->name, strlen(spec->name)) == 0 : strcmp(query, spec->name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+typedef struct InfoResult {
+    char *buf;
+    size_t len;
+    size_t cap;
+} InfoResult_t;
+
+// append to the info result, returns non-zero once the result is full
+static int appendInfo(InfoResult_t *res, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(res->buf + res->len, res->cap - res->len, fmt, args);
+    va_end(args);
+    // always leave room for the closing brackets
+    if (n < 0 || res->len + n + 3 > res->cap) {
+        res->buf[res->len] = '\0';
+        return 1;
+    }
+    res->len += n;
+    return 0;
+}
+
+static void appendLatencyInfo(InfoResult_t *res, const char *name, Histogram_t *h) {
+    appendInfo(res, "%s%s: {count: %lu, p50_us: %.1f, p99_us: %.1f, p999_us: %.1f, max_us: %.1f}",
+               res->len > 1 ? ", " : "", name, statsRead(&h->count), histogramPercentile(h, 50) / 1000.0,
+               histogramPercentile(h, 99) / 1000.0, histogramPercentile(h, 99.9) / 1000.0,
+               statsRead(&h->max) / 1000.0);
+}
+
+// info server|table|latency|commands|replication|scripts|tracking
+int executeInfoCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    InfoResult_t res = {commandResult, 1, BUFFER_SIZE};
+    commandResult[0] = '{';
+    if (strcmp(command->key, "server") == 0) {
+        appendInfo(&res, "uptime_s: %lu, commands: %lu, errors: %lu, connections: %d",
+                   (statsNow() - stats->startTime) / 1000000000, statsRead(&stats->commands),
+                   statsRead(&stats->errors), serverNumClients(server));
+    } else if (strcmp(command->key, "table") == 0) {
+        HashtableStats_t hts;
+        htGetStats(ht, &hts);
+        appendInfo(&res,
+                   "len: %lu, exp: %u, size: %lu, load_factor: %.3f, used_buckets: %lu, longest_chain: %lu, "
+                   "rehashes: %lu, shrinks: %lu, shrinking: %d, compressed_values: %lu, compression_saved_bytes: %lu, "
+                   "mapped: %d",
+                   hts.len, hts.exp, hts.size, hts.loadFactor, hts.usedBuckets, hts.longestChain, hts.rehashes,
+                   hts.shrinks, hts.shrinking, ht->compressedValues, ht->compressionSavedBytes, ht->store != NULL);
+    } else if (strcmp(command->key, "latency") == 0) {
+        appendLatencyInfo(&res, "parse", &stats->phases[PHASE_PARSE]);
+        appendLatencyInfo(&res, "execute", &stats->phases[PHASE_EXECUTE]);
+        appendLatencyInfo(&res, "send", &stats->phases[PHASE_SEND]);
+    } else if (strcmp(command->key, "commands") == 0) {
+        // only the commands that were called, as many as fit in the reply
+        for (int i = 0; i < NUM_COMMANDS; i++) {
+            CommandStats_t *cs = &stats->commandStats[i];
+            uint64_t calls = statsRead(&cs->calls);
+            if (calls > 0 &&
+                appendInfo(&res, "%s%s: {calls: %lu, errors: %lu, p50_us: %.1f, p99_us: %.1f}",
+                           res.len > 1 ? ", " : "", commandTable[i].name, calls, statsRead(&cs->errors),
+                           histogramPercentile(&cs->latency, 50) / 1000.0,
+                           histogramPercentile(&cs->latency, 99) / 1000.0) != 0) {
+                break;
+            }
+        }
+    } else if (strcmp(command->key, "keyspace") == 0) {
+        appendInfo(&res, "db: %d", *currentDb);
+        for (int i = 0; i < NUM_DATABASES; i++) {
+            if (dbs[i] != NULL) {
+                appendInfo(&res, ", db%d: {keys: %lu, exp: %u, rehashes: %lu, shrinks: %lu}", i, dbs[i]->len,
+                           dbs[i]->exp, dbs[i]->rehashes, dbs[i]->shrinks);
+            }
+        }
+    } else if (strcmp(command->key, "pubsub") == 0) {
+        appendInfo(&res,
+                   "channels: %lu, subscriptions: %lu, published: %lu, delivered: %lu, slow_clients_closed: %lu, "
+                   "notifications: %d",
+                   pubsub->numChannels, pubsub->numSubscriptions, pubsub->published, pubsub->delivered,
+                   server->slowClientsClosed, notifyKeyspace);
+    } else if (strcmp(command->key, "tracking") == 0) {
+        appendInfo(&res, "tracked_keys: %lu, prefixes: %d, invalidations: %lu, evictions: %lu",
+                   tracking->keys->numChannels, tracking->numPrefixes, tracking->invalidations, tracking->evictions);
+    } else if (strcmp(command->key, "scripts") == 0) {
+        appendInfo(&res, "scripts: %lu, runs: %lu, errors: %lu", scripts->numScripts, scripts->runs,
+                   scripts->errors);
+    } else if (strcmp(command->key, "lazyfree") == 0) {
+        appendInfo(&res, "pending: %lu, freed: %lu", lazyfreePending(), lazyfreeDone());
+    } else if (strcmp(command->key, "tier") == 0) {
+        ValueLog_t *vlog = ht->vlog;
+        appendInfo(&res, "enabled: %d", vlog != NULL);
+        if (vlog != NULL) {
+            appendInfo(&res,
+                       ", threshold: %lu, spilled_values: %lu, spilled_bytes: %lu, log_bytes: %lu, dead_bytes: %lu, "
+                       "cache_hits: %lu, cache_misses: %lu, promotions: %lu, compactions: %lu",
+                       ht->tierThreshold, ht->spilledValues, ht->spilledBytes, vlog->size, vlog->deadBytes,
+                       vlog->cacheHits, vlog->cacheMisses, ht->promotions, vlog->compactions);
+        }
+    } else if (strcmp(command->key, "replication") == 0) {
+        static const char *states[] = {"none", "connect", "handshake", "snapshot", "streaming"};
+        appendInfo(&res, "role: %s, replid: %s, offset: %lu, backlog_bytes: %lu, full_syncs: %lu, partial_syncs: %lu",
+                   repl->state == REPL_NONE ? "primary" : "replica", repl->replid, repl->offset, repl->backlogLen,
+                   repl->fullSyncs, repl->partialSyncs);
+        if (repl->state != REPL_NONE) {
+            appendInfo(&res, ", primary: %s:%d, link: %s, lag_ms: %ld", repl->primaryHost, repl->primaryPort,
+                       states[repl->state], replLagMs(repl));
+        }
+        appendInfo(&res, ", replicas: [");
+        int n = 0;
+        uint64_t now = replNowMs();
+        for (int i = 0; i < MAX_REPLICA_CONN; i++) {
+            ReplicaCursor_t *cursor = &server->replicas[i].cursor;
+            if (server->replicas[i].fd == -1) {
+                continue;
+            }
+            // until a replica reports its offset, its lag is unknown
+            appendInfo(&res, "%s{fd: %d, offset: %lu, ack_offset: %lu, lag_bytes: %ld, ack_age_ms: %ld}",
+                       n++ > 0 ? ", " : "", server->replicas[i].fd, cursor->offset, cursor->ackOffset,
+                       cursor->ackTimeMs > 0 ? (int64_t)(repl->offset - cursor->ackOffset) : -1,
+                       cursor->ackTimeMs > 0 ? (int64_t)(now - cursor->ackTimeMs) : -1);
+        }
+        appendInfo(&res, "]");
+    } else {
+        sprintf(commandResult, "Unknown info section");
+        return 1;
+    }
+    strcpy(commandResult + res.len, "}");
+    return 0;
+}
+
+// slowlog get [n] | len | reset | threshold <us>
+int executeSlowlogCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    int64_t n = SLOWLOG_DEFAULT_MAX_LEN;
+    if (strcmp(command->key, "len") == 0) {
+        sprintf(commandResult, "{len: %lu}", slowlog->len);
+    } else if (strcmp(command->key, "reset") == 0) {
+        slowlogReset(slowlog);
+        sprintf(commandResult, "Slowlog reset successfully");
+    } else if (strcmp(command->key, "threshold") == 0) {
+        if (command->type == NULL || parseInt64(command->type, &n) != 0 || n < -1) {
+            sprintf(commandResult, "Invalid threshold");
+            return 1;
+        }
+        slowlogSetThreshold(slowlog, n);
+        sprintf(commandResult, "Slowlog threshold set successfully");
+    } else if (strcmp(command->key, "get") == 0) {
+        if (command->type != NULL && (parseInt64(command->type, &n) != 0 || n < 0)) {
+            sprintf(commandResult, "Invalid count");
+            return 1;
+        }
+        InfoResult_t res = {commandResult, 0, BUFFER_SIZE};
+        appendInfo(&res, "{entries: [");
+        SlowlogEntry_t *entry;
+        for (int64_t i = 0; i < n && (entry = slowlogGet(slowlog, i)) != NULL; i++) {
+            if (appendInfo(&res,
+                           "%s{id: %lu, time_us: %lu, client: %s, parse_us: %.1f, execute_us: %.1f, send_us: %.1f, "
+                           "command: %s}",
+                           i > 0 ? ", " : "", entry->id, entry->timestamp, entry->client,
+                           entry->phaseNs[PHASE_PARSE] / 1000.0, entry->phaseNs[PHASE_EXECUTE] / 1000.0,
+                           entry->phaseNs[PHASE_SEND] / 1000.0, entry->command) != 0) {
+                break;
+            }
+        }
+        strcpy(commandResult + res.len, "]}");
+    } else {
+        sprintf(commandResult, "Unknown slowlog command");
+        return 1;
+    }
+    return 0;
+}
+
+// resize auto | resize <buckets>, rehash the table at once and give the memory freed back to the system
+int executeResizeCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    int64_t buckets;
+    unsigned char exp = HASHTABLE_DEFAULTCAP;
+    if (strcmp(command->key, "auto") == 0) {
+        // the smallest table that is at most half full
+        while (((uint64_t)1 << exp) < ht->len * 2) {
+            exp++;
+        }
+    } else if (parseInt64(command->key, &buckets) == 0 && buckets > 0) {
+        while (exp < 63 && ((uint64_t)1 << exp) < (uint64_t)buckets) {
+            exp++;
+        }
+        if (exp > HASHTABLE_MAX_INITIAL_EXP) {
+            sprintf(commandResult, "Can't resize to more than %lu buckets", (uint64_t)1 << HASHTABLE_MAX_INITIAL_EXP);
+            return 1;
+        }
+    } else {
+        sprintf(commandResult, "Malformed query");
+        return 1;
+    }
+    uint64_t rssBefore, rssAfter, vsz;
+    unsigned char expBefore = ht->exp;
+    metricsMemory(&rssBefore, &vsz);
+    if (htResize(ht, exp) != 0) {
+        sprintf(commandResult, "Error resizing to %lu buckets for %lu keys", (uint64_t)1 << exp, ht->len);
+        return 1;
+    }
+    malloc_trim(0);
+    metricsMemory(&rssAfter, &vsz);
+    sprintf(commandResult, "{exp_before: %u, exp_after: %u, rss_before_bytes: %lu, rss_after_bytes: %lu}", expBefore,
+            ht->exp, rssBefore, rssAfter);
+    return 0;
+}
+
+// tier spill moves every value long enough to the value log now, tier compact drops the dead values of the log
+int executeTierCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    if (ht->vlog == NULL) {
+        sprintf(commandResult, "Tiering is not enabled");
+        return 1;
+    }
+    if (strcmp(command->key, "spill") == 0) {
+        uint64_t spilled = htTierStep(ht, UINT64_MAX, 1);
+        malloc_trim(0);
+        sprintf(commandResult, "{spilled: %lu}", spilled);
+    } else if (strcmp(command->key, "compact") == 0) {
+        uint64_t before = ht->vlog->size;
+        if (htTierCompact(ht) != 0) {
+            sprintf(commandResult, "Error compacting the value log");
+            return 1;
+        }
+        sprintf(commandResult, "{log_bytes_before: %lu, log_bytes_after: %lu}", before, ht->vlog->size);
+    } else {
+        sprintf(commandResult, "Malformed query");
+        return 1;
+    }
+    return 0;
+}
+
+// use <db> switches the client to another database
+int executeUseCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    int64_t db;
+    if (parseInt64(command->key, &db) != 0 || db < 0 || db >= NUM_DATABASES) {
+        sprintf(commandResult, "Invalid database, there are %d", NUM_DATABASES);
+        return 1;
+    }
+    if (cluster != NULL && db != 0) {
+        sprintf(commandResult, "Cluster mode only has database 0");
+        return 1;
+    }
+    if (getDb(db) == NULL) {
+        sprintf(commandResult, "Error opening database %ld", db);
+        return 1;
+    }
+    *currentDb = db;
+    sprintf(commandResult, "Database %ld selected", db);
+    return 0;
+}
+
+// flush <db|all> drops every key of a database, or of all of them
+int executeFlushCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    int64_t db = -1;
+    if (strcmp(command->key, "all") != 0 && (parseInt64(command->key, &db) != 0 || db < 0 || db >= NUM_DATABASES)) {
+        sprintf(commandResult, "Invalid database, there are %d", NUM_DATABASES);
+        return 1;
+    }
+    uint64_t flushed = 0;
+    for (int i = 0; i < NUM_DATABASES; i++) {
+        if (dbs[i] == NULL || (db != -1 && i != db)) {
+            continue;
+        }
+        flushed += dbs[i]->len;
+        // the keys are freed in the background, the database is empty right away
+        htDeleteTableLazy(dbs[i]);
+        dbs[i] = openDb(i, 1);
+        if (dbs[i] == NULL && i == 0) {
+            // database 0 must exist
+            logShutdown();
+            exit(1);
+        }
+    }
+    if (flushed > 0) {
+        invalidateAllTracking();
+    }
+    sprintf(commandResult, "{flushed_keys: %lu}", flushed);
+    return 0;
+}
+
+static int parseDbCommand(char *statement, int statementSize, Command_t *command, char *commandResult);
+static int dispatchCommand(int idx, Command_t *command, int asking, const char *data, int size, uint64_t parsed,
+                           char *commandResult);
+
+int executeMultiCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    if (currentClient == NULL) {
+        sprintf(commandResult, "Transactions need a client");
+        return 1;
+    }
+    if (currentClient->multi != NULL) {
+        sprintf(commandResult, "Already in a transaction");
+        return 1;
+    }
+    currentClient->multi = calloc(1, sizeof(Transaction_t) + BUFFER_SIZE);
+    if (currentClient->multi == NULL) {
+        sprintf(commandResult, "Error starting transaction");
+        return 1;
+    }
+    currentClient->multi->cap = BUFFER_SIZE;
+    sprintf(commandResult, "Transaction started");
+    return 0;
+}
+
+// exec runs every queued command in this turn of the event loop, so no other client's command comes in between
+int executeExecCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    Transaction_t *tx = currentClient != NULL ? currentClient->multi : NULL;
+    if (tx == NULL) {
+        sprintf(commandResult, "Not in a transaction");
+        return 1;
+    }
+    currentClient->multi = NULL;
+    if (tx->failed) {
+        free(tx);
+        sprintf(commandResult, "Transaction discarded because a command couldn't be queued");
+        return 1;
+    }
+    InfoResult_t res = {commandResult, 1, BUFFER_SIZE};
+    commandResult[0] = '{';
+    appendInfo(&res, "results: [");
+    char reply[BUFFER_SIZE + 1];
+    char *line = tx->commands;
+    for (int i = 0; i < tx->count; i++) {
+        char *end = memchr(line, '\n', tx->commands + tx->len - line);
+        int size = end - line;
+        char statement[size + 1];
+        memcpy(statement, line, size);
+        statement[size] = '\0';
+        Command_t queued;
+        reply[0] = '\0';
+        int asking = size > 7 && strncmp(line, "asking ", 7) == 0;
+        int idx = parseDbCommand(statement + 7 * asking, size - 7 * asking, &queued, reply);
+        if (idx != -1) {
+            dispatchCommand(idx, &queued, asking, line + 7 * asking, size - 7 * asking, statsNow(), reply);
+        }
+        // the replies that don't fit are dropped, the commands still run
+        appendInfo(&res, "%s%s", i > 0 ? ", " : "", reply);
+        line = end + 1;
+    }
+    free(tx);
+    strcpy(commandResult + res.len, "]}");
+    return 0;
+}
+
+int executeDiscardCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    if (currentClient == NULL || currentClient->multi == NULL) {
+        sprintf(commandResult, "Not in a transaction");
+        return 1;
+    }
+    free(currentClient->multi);
+    currentClient->multi = NULL;
+    sprintf(commandResult, "Transaction discarded");
+    return 0;
+}
+
+int executeSubscribeCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    if (currentClient == NULL) {
+        sprintf(commandResult, "Subscriptions need a client");
+        return 1;
+    }
+    if (pubsubSubscribe(pubsub, command->key, strlen(command->key), currentClientFd) == 2) {
+        sprintf(commandResult, "Error subscribing");
+        return 1;
+    }
+    snprintf(commandResult, BUFFER_SIZE, "{subscribed: %s, subscriptions: %d}", command->key,
+             pubsubSubscriptions(pubsub, currentClientFd));
+    return 0;
+}
+
+int executeUnsubscribeCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    if (currentClient == NULL || pubsubUnsubscribe(pubsub, command->key, strlen(command->key), currentClientFd) != 0) {
+        snprintf(commandResult, BUFFER_SIZE, "Not subscribed to %s", command->key);
+        return 1;
+    }
+    snprintf(commandResult, BUFFER_SIZE, "{unsubscribed: %s, subscriptions: %d}", command->key,
+             pubsubSubscriptions(pubsub, currentClientFd));
+    return 0;
+}
+
+// publish <channel> <message>, the message is everything after the channel
+int executePublishCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    char buf[BUFFER_SIZE];
+    if (command->type == NULL) {
+        sprintf(commandResult, "Malformed query");
+        return 1;
+    }
+    uint64_t receivers = publishMessage(command->key, strlen(command->key), commandElement(command, buf));
+    sprintf(commandResult, "{receivers: %lu}", receivers);
+    return 0;
+}
+
+// notify on|off publishes every change to a key to __keyspace@<db>__:<key>
+int executeNotifyCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    if (strcmp(command->key, "on") == 0) {
+        notifyKeyspace = 1;
+    } else if (strcmp(command->key, "off") == 0) {
+        notifyKeyspace = 0;
+    } else {
+        sprintf(commandResult, "Malformed query");
+        return 1;
+    }
+    sprintf(commandResult, "Keyspace notifications %s", command->key);
+    return 0;
+}
+
+// tracking on|off, or tracking prefix <prefix> to hear about every key starting with it instead
+int executeTrackingCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    if (currentClient == NULL) {
+        sprintf(commandResult, "Tracking needs a client");
+        return 1;
+    }
+    int mode;
+    if (strcmp(command->key, "on") == 0) {
+        mode = TRACKING_READS;
+    } else if (strcmp(command->key, "off") == 0) {
+        mode = TRACKING_OFF;
+    } else if (strcmp(command->key, "prefix") == 0 && command->type != NULL) {
+        mode = TRACKING_PREFIXES;
+    } else {
+        sprintf(commandResult, "Malformed query");
+        return 1;
+    }
+    // switching modes starts over, the client drops its cache
+    if (mode != currentClient->tracking || mode == TRACKING_OFF) {
+        trackingForget(tracking, currentClientFd);
+    }
+    currentClient->tracking = mode;
+    if (mode != TRACKING_PREFIXES) {
+        sprintf(commandResult, "Tracking %s", command->key);
+        return 0;
+    }
+    int retval = trackingAddPrefix(tracking, command->type, strlen(command->type), currentClientFd);
+    if (retval == 1) {
+        sprintf(commandResult, "Too many prefixes, at most %d", TRACKING_MAX_PREFIXES);
+    } else if (retval == 2) {
+        sprintf(commandResult, "Error tracking prefix");
+    } else {
+        snprintf(commandResult, BUFFER_SIZE, "Tracking keys starting with %s", command->type);
+    }
+    return retval != 0;
+}
+
+// script load <source> | exists <digest> | flush
+int executeScriptCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    char buf[BUFFER_SIZE];
+    if (strcmp(command->key, "load") == 0 && command->type != NULL) {
+        Script_t *script = scriptCacheLoad(scripts, commandElement(command, buf), commandResult, BUFFER_SIZE);
+        if (script == NULL) {
+            return 1;
+        }
+        sprintf(commandResult, "{digest: %016lx}", script->digest);
+        return 0;
+    } else if (strcmp(command->key, "exists") == 0 && command->type != NULL) {
+        char *end;
+        uint64_t digest = strtoull(command->type, &end, 16);
+        sprintf(commandResult, "{exists: %d}", *end == '\0' && scriptCacheFind(scripts, digest) != NULL);
+        return 0;
+    } else if (strcmp(command->key, "flush") == 0) {
+        uint64_t flushed = scripts->numScripts;
+        scriptCacheFlush(scripts);
+        sprintf(commandResult, "{flushed_scripts: %lu}", flushed);
+        return 0;
+    }
+    sprintf(commandResult, "Malformed query");
+    return 1;
+}
+
+// longest line feedScriptWrite sends besides the key, a script never holds a longer value than SCRIPT_MAX_STRING
+#define SCRIPT_WRITE_OVERHEAD (sizeof("replace  string \n") - 1 + SCRIPT_MAX_STRING)
+
+// keys a script touches must be served here, and only the keyspace of a primary changes
+static int checkScriptAccess(void *ctx, const char *key, size_t keylen, int write, char *err, size_t errlen) {
+    if (write && repl->state != REPL_NONE) {
+        snprintf(err, errlen, "Replica is read only");
+        return 1;
+    }
+    if (write && keylen + SCRIPT_WRITE_OVERHEAD >= BUFFER_SIZE) {
+        // the write is fed to the replicas as a command, which has to fit in their buffer
+        snprintf(err, errlen, "Key too long for a script to write");
+        return 1;
+    }
+    if (cluster != NULL) {
+        const char *addr;
+        int exists = htFind(dbs[(intptr_t)ctx], key, keylen).entryType != NONE;
+        if (clusterRoute(cluster, clusterKeySlot(key, keylen), exists, 0, &addr) != CLUSTER_ROUTE_LOCAL) {
+            snprintf(err, errlen, "Key %.*s is not served by this node", (int)keylen, key);
+            return 1;
+        }
+    }
+    if (!write && currentClient != NULL && currentClient->tracking == TRACKING_READS) {
+        trackingRead(tracking, key, keylen, currentClientFd, sendInvalidation, NULL);
+    }
+    return 0;
+}
+
+// the replicas get the value a script left, not the script, so they never need the script cached
+static void feedScriptWrite(void *ctx, const char *key, size_t keylen) {
+    int db = (intptr_t)ctx;
+    char line[BUFFER_SIZE];
+    int len;
+    HashtableValue_t htv = htFind(dbs[db], key, keylen);
+    switch (htv.entryType) {
+    case NONE:
+        len = snprintf(line, sizeof(line), "delete %.*s\n", (int)keylen, key);
+        break;
+    case STRING:
+        len = snprintf(line, sizeof(line), "replace %.*s string %s\n", (int)keylen, key, (char *)htv.v.val);
+        break;
+    case SIGNED_INT:
+        len = snprintf(line, sizeof(line), "replace %.*s int %ld\n", (int)keylen, key, htv.v.s64);
+        break;
+    case UNSIGNED_INT:
+        len = snprintf(line, sizeof(line), "replace %.*s uint %lu\n", (int)keylen, key, htv.v.u64);
+        break;
+    case DOUBLE:
+        len = snprintf(line, sizeof(line), "replace %.*s double %.17g\n", (int)keylen, key, htv.v.d);
+        break;
+    default:
+        return;
+    }
+    if (len >= (int)sizeof(line)) {
+        // checkScriptAccess keeps this from happening, a cut off line would run into the next command
+        LOG_ERROR("Script write to %.*s is too long to replicate", (int)keylen, key);
+        return;
+    }
+    feedStream(db, line, len);
+    serverWakeReplicas(server);
+}
+
+// evalsha <digest> [args], the arguments are split on spaces
+int executeEvalshaCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    char *end;
+    uint64_t digest = strtoull(command->key, &end, 16);
+    Script_t *script = *end == '\0' ? scriptCacheFind(scripts, digest) : NULL;
+    if (script == NULL) {
+        sprintf(commandResult, "Script not found, load it with script load");
+        return 1;
+    }
+    char buf[BUFFER_SIZE];
+    const char *args[SCRIPT_MAX_ARGS];
+    int numArgs = 0;
+    if (command->type != NULL) {
+        char *saveptr;
+        const char *element = commandElement(command, buf);
+        if (element != buf) {
+            strcpy(buf, element);
+        }
+        for (char *arg = strtok_r(buf, " ", &saveptr); arg != NULL; arg = strtok_r(NULL, " ", &saveptr)) {
+            if (numArgs == SCRIPT_MAX_ARGS) {
+                sprintf(commandResult, "Too many arguments, at most %d", SCRIPT_MAX_ARGS);
+                return 1;
+            }
+            args[numArgs++] = arg;
+        }
+    }
+    ScriptHooks_t hooks = {checkScriptAccess, feedScriptWrite, (void *)(intptr_t)*currentDb};
+    // leaves room for wrapping the result in the reply
+    char result[BUFFER_SIZE - sizeof("Script error: ")];
+    scripts->runs++;
+    if (scriptRun(script, ht, args, numArgs, &hooks, result, sizeof(result)) != 0) {
+        scripts->errors++;
+        snprintf(commandResult, BUFFER_SIZE, "Script error: %s", result);
+        return 1;
+    }
+    snprintf(commandResult, BUFFER_SIZE, "{result: %s}", result);
+    return 0;
+}
+
+// config get <name> | config get * | config set <name> <value>, only the settings with an apply function
+// can be set while the server runs
+int executeConfigCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    char value[BUFFER_SIZE];
+    if (command->type == NULL) {
+        sprintf(commandResult, "Malformed query");
+        return 1;
+    }
+    if (strcmp(command->key, "get") == 0) {
+        InfoResult_t res = {commandResult, 0, BUFFER_SIZE};
+        appendInfo(&res, "{");
+        int found = 0;
+        for (int i = 0; i < NUM_CONFIG_PARAMS; i++) {
+            if (strcmp(command->type, "*") != 0 && strcmp(command->type, configParams[i].name) != 0) {
+                continue;
+            }
+            configFormat(&configParams[i], value, sizeof(value));
+            if (appendInfo(&res, "%s%s: %s", found > 0 ? ", " : "", configParams[i].name, value) != 0) {
+                break;
+            }
+            found++;
+        }
+        if (found == 0) {
+            snprintf(commandResult, BUFFER_SIZE, "Unknown setting %s", command->type);
+            return 1;
+        }
+        strcpy(commandResult + res.len, "}");
+    } else if (strcmp(command->key, "set") == 0) {
+        ConfigParam_t *param = configFind(configParams, NUM_CONFIG_PARAMS, command->type);
+        if (param == NULL) {
+            snprintf(commandResult, BUFFER_SIZE, "Unknown setting %s", command->type);
+            return 1;
+        }
+        if (param->apply == NULL) {
+            snprintf(commandResult, BUFFER_SIZE, "%s can only be set at startup", param->name);
+            return 1;
+        }
+        if (command->value[0] == '\0' || configSet(param, command->value) != 0) {
+            snprintf(commandResult, BUFFER_SIZE, "Invalid value for %s", param->name);
+            return 1;
+        }
+        param->apply();
+        LOG_INFO("Config %s set to %s", param->name, command->value);
+        sprintf(commandResult, "Config set successfully");
+    } else {
+        sprintf(commandResult, "Unknown config command");
+        return 1;
+    }
+    return 0;
+}
+
+// sync <replid> <offset>, sent by a replica of this server
+int executeSyncCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    int64_t offset;
+    if (command->type == NULL || parseInt64(command->type, &offset) != 0 || offset < 0) {
+        sprintf(commandResult, "Malformed query");
+        return 1;
+    }
+    ReplicaCursor_t cursor;
+    if (replSync(repl, dbs, NUM_DATABASES, streamDb, command->key, offset, &cursor, commandResult) == -1) {
+        sprintf(commandResult, "Error creating snapshot");
+        return 1;
+    }
+    if (serverAddReplica(server, currentClientFd, cursor) != 0) {
+        free(cursor.snapshot);
+        sprintf(commandResult, "Too many replicas");
+        return 1;
+    }
+    LOG_INFO("Replica fd=%d synced %s from offset %lu", currentClientFd,
+             cursor.snapshot != NULL ? "with a snapshot" : "from the backlog", cursor.offset);
+    return 0;
+}
+
+static void onUpstreamData(int clientFd, const char *data, int size, struct sockaddr *addr, socklen_t addrLen);
+
+// connect to the primary, asking for the stream from where this server is
+static void connectToPrimary() {
+    char hello[BUFFER_SIZE];
+    int len = replHandshake(repl, hello);
+    if (serverConnectUpstream(server, repl->primaryHost, repl->primaryPort, hello, len, onUpstreamData) != 0) {
+        replConnectionLost(repl);
+    }
+}
+
+// replicaof <host> <port> | replicaof no one
+int executeReplicaofCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    int64_t port;
+    if (strcmp(command->key, "no") == 0 && command->type != NULL && strcmp(command->type, "one") == 0) {
+        serverCloseUpstream(server);
+        replSetPrimary(repl, NULL, 0);
+        sprintf(commandResult, "Replication stopped");
+        return 0;
+    }
+    if (command->type == NULL || parseInt64(command->type, &port) != 0 || port <= 0 || port > 65535 ||
+        strlen(command->key) >= REPL_MAX_HOST_LEN) {
+        sprintf(commandResult, "Malformed query");
+        return 1;
+    }
+    replSetPrimary(repl, command->key, port);
+    connectToPrimary();
+    sprintf(commandResult, "Replicating %s:%ld", command->key, port);
+    return 0;
+}
+
+// keys of a slot, and the commands moving up to limit of them to another node
+typedef struct SlotKeys {
+    Hashtable_t *ht;
+    int slot;
+    uint64_t limit;
+    uint64_t found;     /* Keys in the slot */
+    char *moves;        /* Commands recreating the moved keys on the target */
+    uint64_t movesLen;
+    int numMoves;
+    char *deletes;      /* Commands deleting the moved keys here */
+    uint64_t deletesLen;
+    int failed;
+} SlotKeys_t;
+
+// append to a growing buffer, returns -1 if it couldn't grow
+static int appendBuffer(char **buf, uint64_t *len, const char *data, uint64_t n) {
+    char *grown = realloc(*buf, *len + n);
+    if (grown == NULL) {
+        return -1;
+    }
+    memcpy(grown + *len, data, n);
+    *buf = grown;
+    *len += n;
+    return 0;
+}
+
+static int collectSlotKey(HashtableEntry_t *hte, void *ctx) {
+    SlotKeys_t *keys = ctx;
+    if (clusterKeySlot(hte->key, hte->keylen) != keys->slot || keys->found++ >= keys->limit) {
+        return 0;
+    }
+    char del[BUFFER_SIZE];
+    uint64_t len;
+    // replace whatever an earlier failed migration left on the target
+    int dellen = snprintf(del, sizeof(del), "asking delete %.*s\n", (int)hte->keylen, hte->key);
+    char *commands = replSerializeEntry(keys->ht, hte, "asking ", &len);
+    if (commands == NULL) {
+        keys->failed = 1;
+        return 1;
+    }
+    if (appendBuffer(&keys->moves, &keys->movesLen, del, dellen) != 0 ||
+        appendBuffer(&keys->moves, &keys->movesLen, commands, len) != 0 ||
+        appendBuffer(&keys->deletes, &keys->deletesLen, del + 7, dellen - 7) != 0) {
+        keys->failed = 1;
+    }
+    keys->numMoves++;
+    for (uint64_t i = 0; i < len; i++) {
+        keys->numMoves += commands[i] == '\n';
+    }
+    free(commands);
+    return keys->failed;
+}
+
+// move up to limit keys of a migrating slot to the node it is migrating to
+static int migrateSlotKeys(int slot, uint64_t limit, char *commandResult) {
+    // cluster mode only has database 0
+    Hashtable_t *ht = dbs[0];
+    SlotKeys_t keys = {ht, slot, limit, 0, NULL, 0, 0, NULL, 0, 0};
+    htForEach(ht, collectSlotKey, &keys);
+    int retval = 0;
+    const char *target = cluster->nodes[cluster->migrating[slot]];
+    if (keys.failed) {
+        sprintf(commandResult, "Error serializing keys");
+        retval = 1;
+    } else if (keys.numMoves > 0 && clusterSendCommands(target, keys.moves, keys.movesLen, keys.numMoves) != 0) {
+        sprintf(commandResult, "Error migrating keys to %s", target);
+        retval = 1;
+    } else {
+        uint64_t moved = 0;
+        for (uint64_t start = 0; start < keys.deletesLen; moved++) {
+            char *end = memchr(keys.deletes + start, '\n', keys.deletesLen - start);
+            int len = end - (keys.deletes + start);
+            // "delete " is followed by the key
+            htRemove(ht, keys.deletes + start + 7, len - 7);
+            replFeed(repl, keys.deletes + start, len + 1);
+            start += len + 1;
+        }
+        serverWakeReplicas(server);
+        sprintf(commandResult, "{migrated: %lu, remaining: %lu}", moved, keys.found - moved);
+        LOG_INFO("Migrated %lu keys of slot %d to %s", moved, slot, target);
+    }
+    free(keys.moves);
+    free(keys.deletes);
+    return retval;
+}
+
+// parse a slot number, returns -1 if it is not one
+static int parseSlot(const char *str) {
+    int64_t slot;
+    if (str == NULL || parseInt64(str, &slot) != 0 || slot < 0 || slot >= CLUSTER_SLOTS) {
+        return -1;
+    }
+    return slot;
+}
+
+/*
+ * cluster keyslot <key> | info | slots | assign <first> <last> <host:port> | countkeysinslot <slot> |
+ * setslot <slot> migrating|importing|node <host:port> | setslot <slot> stable | migrate <slot> [count]
+ */
+int executeClusterCommand(Hashtable_t *ht, Command_t *command, char *commandResult) {
+    char addr[CLUSTER_MAX_ADDR_LEN];
+    char action[16];
+    int64_t n;
+    int slot = parseSlot(command->type);
+    if (strcmp(command->key, "keyslot") == 0 && command->type != NULL) {
+        sprintf(commandResult, "{%s: %d}", command->type, clusterKeySlot(command->type, strlen(command->type)));
+        return 0;
+    }
+    if (cluster == NULL) {
+        sprintf(commandResult, "Cluster mode not enabled");
+        return 1;
+    }
+    if (strcmp(command->key, "info") == 0) {
+        int assigned = 0, served = 0, migrating = 0, importing = 0;
+        for (int i = 0; i < CLUSTER_SLOTS; i++) {
+            assigned += cluster->owner[i] != -1;
+            served += cluster->owner[i] == cluster->myself;
+            migrating += cluster->migrating[i] != -1;
+            importing += cluster->importing[i] != -1;
+        }
+        sprintf(commandResult,
+                "{myself: %s, nodes: %d, slots_assigned: %d, slots_served: %d, migrating: %d, importing: %d}",
+                cluster->nodes[cluster->myself], cluster->numNodes, assigned, served, migrating, importing);
+    } else if (strcmp(command->key, "slots") == 0) {
+        if (clusterFormatSlots(cluster, commandResult, BUFFER_SIZE) == -1) {
+            sprintf(commandResult, "Slot map too large");
+            return 1;
+        }
+    } else if (strcmp(command->key, "assign") == 0) {
+        if (slot == -1 || sscanf(command->value, "%ld %63s", &n, addr) != 2 || n < slot || n >= CLUSTER_SLOTS ||
+            clusterAssign(cluster, slot, n, addr) != 0) {
+            sprintf(commandResult, "Malformed query");
+            return 1;
+        }
+        sprintf(commandResult, "Slots assigned successfully");
+    } else if (strcmp(command->key, "countkeysinslot") == 0) {
+        if (slot == -1) {
+            sprintf(commandResult, "Malformed query");
+            return 1;
+        }
+        SlotKeys_t keys = {ht, slot, 0, 0, NULL, 0, 0, NULL, 0, 0};
+        htForEach(ht, collectSlotKey, &keys);
+        sprintf(commandResult, "{%d: %lu}", slot, keys.found);
+    } else if (strcmp(command->key, "setslot") == 0) {
+        int args = slot == -1 ? 0 : sscanf(command->value, "%15s %63s", action, addr);
+        if (args == 1 && strcmp(action, "stable") == 0) {
+            cluster->migrating[slot] = -1;
+            cluster->importing[slot] = -1;
+        } else if (args != 2 ||
+                   (strcmp(action, "migrating") == 0 ? clusterSetMigrating(cluster, slot, addr)
+                    : strcmp(action, "importing") == 0 ? clusterSetImporting(cluster, slot, addr)
+                    : strcmp(action, "node") == 0      ? clusterAssign(cluster, slot, slot, addr)
+                                                       : -1) != 0) {
+            sprintf(commandResult, "Malformed query");
+            return 1;
+        }
+        sprintf(commandResult, "Slot set successfully");
+    } else if (strcmp(command->key, "migrate") == 0) {
+        n = 100;
+        if (slot == -1 || (command->value[0] != '\0' && (parseInt64(command->value, &n) != 0 || n <= 0))) {
+            sprintf(commandResult, "Malformed query");
+            return 1;
+        }
+        if (cluster->migrating[slot] == -1) {
+            sprintf(commandResult, "Slot %d is not migrating", slot);
+            return 1;
+        }
+        return migrateSlotKeys(slot, n, commandResult);
+    } else {
+        sprintf(commandResult, "Unknown cluster command");
+        return 1;
+    }
+    return 0;
+}
+
+// reply with a redirection if another node serves the key, returns 1 if it did
+static int clusterRedirect(Command_t *command, int asking, char *commandResult) {
+    const char *addr;
+    size_t keylen = strlen(command->key);
+    int slot = clusterKeySlot(command->key, keylen);
+    // whether the key is still here only matters while its slot is migrating
+    int exists = cluster->migrating[slot] != -1 && htFind(dbs[0], command->key, keylen).entryType != NONE;
+    switch (clusterRoute(cluster, slot, exists, asking, &addr)) {
+    case CLUSTER_ROUTE_MOVED:
+        sprintf(commandResult, "MOVED %d %s", slot, addr);
+        return 1;
+    case CLUSTER_ROUTE_ASK:
+        sprintf(commandResult, "ASK %d %s", slot, addr);
+        return 1;
+    case CLUSTER_ROUTE_DOWN:
+        sprintf(commandResult, "CLUSTERDOWN Hash slot not served");
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Split a statement into its query, key, type and value in place. Returns the index of the command
+ * in commandTable, or -1 with the error in commandResult if the statement is malformed or not supported
+ */
+static int parseDbCommand(char *statement, int statementSize, Command_t *command, char *commandResult) {
+    char *saveptr;
+    if (statementSize > 0 && statement[statementSize - 1] == '\n') {
+        // make sure statement is null terminated
+        statement[statementSize - 1] = '\0';
+    }
+    command->query = strtok_r(statement, " ", &saveptr);
+    command->key = command->query != NULL ? strtok_r(NULL, " ", &saveptr) : NULL;
+    if (command->key == NULL && command->query != NULL &&
+        (strcmp(command->query, "multi") == 0 || strcmp(command->query, "exec") == 0 ||
+         strcmp(command->query, "discard") == 0)) {
+        // the transaction commands take no key
+        command->key = "";
+    }
+    if (command->key == NULL) {
+        command->type = NULL;
+        command->value = NULL;
+        sprintf(commandResult, "Malformed query");
+        return -1;
+    }
+    command->type = strtok_r(NULL, " ", &saveptr);
+    if (command->type != NULL) {
+        // get end of input as value, or an empty value if the type was the last token
+        command->value = command->type + strlen(command->type);
+        if (command->value < statement + statementSize) {
+            command->value++;
+        }
+    } else {
+        command->value = NULL;
+        if (strncmp(command->query, "insert", 6) == 0 || strncmp(command->query, "replace", 7) == 0) {
+            sprintf(commandResult, "Malformed query");
+            return -1;
+        }
+    }
+    int idx = lookupCommand(command->query);
+    if (idx == -1) {
+        sprintf(commandResult, "Query not supported");
+    }
+    return idx;
+}
+
+// run a parsed command in the database of the current client, and feed it to the replicas if it is a write
+static int dispatchCommand(int idx, Command_t *command, int asking, const char *data, int size, uint64_t parsed,
+                           char *commandResult) {
+    if (cluster != NULL && commandTable[idx].keyed && clusterRedirect(command, asking, commandResult)) {
+        // the client sends the command again to the node in the reply
+        return 1;
+    }
+    if (commandTable[idx].write && repl->state != REPL_NONE) {
+        // the keyspace of a replica only changes through its primary
+        sprintf(commandResult, "Replica is read only");
+        return 1;
+    }
+    if (getDb(*currentDb) == NULL) {
+        sprintf(commandResult, "Error opening database %d", *currentDb);
+        return 1;
+    }
+    TRACE1(execute__start, command->query);
+    int db = *currentDb;
+    streamRewriteLen = 0;
+    int retval = commandTable[idx].handler(dbs[db], command, commandResult);
+    TRACE3(execute__done, command->query, retval, statsNow() - parsed);
+    if (retval == 0 && commandTable[idx].write) {
+        if (streamRewriteLen > 0) {
+            feedStream(db, streamRewrite, streamRewriteLen);
+        } else {
+            feedStream(db, data, size);
+        }
+        serverWakeReplicas(server);
+    }
+    if (retval == 0 && currentClient != NULL && currentClient->tracking == TRACKING_READS && commandTable[idx].keyed &&
+        !commandTable[idx].write) {
+        // remembered after the read, so a change made by the command itself doesn't count
+        trackingRead(tracking, command->key, strlen(command->key), currentClientFd, sendInvalidation, NULL);
+    }
+    return retval;
+}
+
+static int isTransactionCommand(int idx) {
+    return idx != -1 && (commandTable[idx].handler == executeMultiCommand ||
+                         commandTable[idx].handler == executeExecCommand ||
+                         commandTable[idx].handler == executeDiscardCommand);
+}
+
+// queue a command of a client in a transaction, a malformed one fails the whole transaction
+static int queueCommand(int idx, const char *data, int size, char *commandResult) {
+    Transaction_t *tx = currentClient->multi;
+    if (idx == -1) {
+        // commandResult holds the parse error
+        tx->failed = 1;
+        return 1;
+    }
+    if (tx->count == MULTI_MAX_COMMANDS) {
+        tx->failed = 1;
+        sprintf(commandResult, "Too many queued commands, at most %d", MULTI_MAX_COMMANDS);
+        return 1;
+    }
+    if (size > 0 && (data[size - 1] == '\n' || data[size - 1] == '\0')) {
+        size--;
+    }
+    if (tx->len + size + 1 > tx->cap) {
+        size_t cap = tx->cap * 2 > tx->len + size + 1 ? tx->cap * 2 : tx->len + size + 1;
+        Transaction_t *grown = realloc(tx, sizeof(Transaction_t) + cap);
+        if (grown == NULL) {
+            tx->failed = 1;
+            sprintf(commandResult, "Error queuing command");
+            return 1;
+        }
+        tx = grown;
+        tx->cap = cap;
+        currentClient->multi = tx;
+    }
+    memcpy(tx->commands + tx->len, data, size);
+    tx->commands[tx->len + size] = '\n';
+    tx->len += size + 1;
+    tx->count++;
+    sprintf(commandResult, "Queued");
+    return 0;
+}
+
+void onData(int clientFd, const char *data, int size, struct sockaddr *addr, socklen_t addrLen) {
+    uint64_t phaseNs[NUM_PHASES];
+    uint64_t start = statsNow();
+    // leave room to terminate the reply with a newline
+    char commandResult[BUFFER_SIZE + 1];
+    memset(commandResult, 0, BUFFER_SIZE);
+    char statement[size + 1];
+    memcpy(statement, data, size);
+    statement[size] = '\0';
+
+    Command_t command;
+    currentClientFd = clientFd;
+    currentClient = serverGetClient(server, clientFd);
+    currentDb = currentClient != NULL ? &currentClient->db : &streamDb;
+    TRACE2(parse, data, size);
+    // asking lets a node serve a single command for a slot it is importing
+    int asking = size > 7 && strncmp(data, "asking ", 7) == 0;
+    int idx = parseDbCommand(statement + 7 * asking, size - 7 * asking, &command, commandResult);
+    uint64_t parsed = statsNow();
+    int retval = 1;
+    if (currentClient != NULL && currentClient->multi != NULL && !isTransactionCommand(idx)) {
+        retval = queueCommand(idx, data, size, commandResult);
+    } else if (idx != -1) {
+        retval = dispatchCommand(idx, &command, asking, data + 7 * asking, size - 7 * asking, parsed, commandResult);
+    }
+    uint64_t executed = statsNow();
+
+    int resultLen = strlen(commandResult);
+    if (data[size - 1] == '\n') {
+        // newline terminated commands get newline terminated replies so pipelining clients can split them
+        commandResult[resultLen++] = '\n';
+    }
+    sendClientData(server, clientFd, commandResult, resultLen);
+
+    phaseNs[PHASE_PARSE] = parsed - start;
+    phaseNs[PHASE_EXECUTE] = executed - parsed;
+    phaseNs[PHASE_SEND] = statsNow() - executed;
+    LOG_DEBUG("Command %s query=%s execute_ns=%lu", retval == 0 ? "completed" : "failed",
+              idx != -1 ? commandTable[idx].name : "unknown", phaseNs[PHASE_EXECUTE]);
+    statsRecordCommand(stats, idx, retval != 0, phaseNs);
+    statsRecordTraffic(stats, size, resultLen);
+    slowlogRecord(slowlog, data, size, addr, phaseNs);
+}
+
+// a client that goes away takes its subscriptions and the keys it tracked with it
+static void onClientClose(Server_t *server, int clientFd) {
+    pubsubUnsubscribeAll(pubsub, clientFd);
+    trackingForget(tracking, clientFd);
+}
+
+// start over with an empty keyspace, before loading a snapshot
+static void resetKeyspace() {
+    for (int i = 0; i < NUM_DATABASES; i++) {
+        if (dbs[i] != NULL) {
+            htDeleteTableLazy(dbs[i]);
+            dbs[i] = NULL;
+        }
+        if (i > 0 && mmapPath != NULL) {
+            // so the database isn't mapped again with the keys it had
+            char path[PATH_MAX];
+            dbFilePath(mmapPath, i, path);
+            unlink(path);
+        }
+    }
+    invalidateAllTracking();
+    streamDb = 0;
+    dbs[0] = openDb(0, 1);
+    if (dbs[0] == NULL) {
+        logShutdown();
+        exit(1);
+    }
+}
+
+// apply a command received from the primary, its reply goes nowhere
+static void applyCommand(const char *data, int size) {
+    char commandResult[BUFFER_SIZE + 1];
+    char statement[size + 1];
+    memcpy(statement, data, size);
+    statement[size] = '\0';
+    Command_t command;
+    int idx = parseDbCommand(statement, size, &command, commandResult);
+    currentClient = NULL;
+    currentDb = &streamDb;
+    if (idx != -1 && getDb(streamDb) != NULL) {
+        commandTable[idx].handler(dbs[streamDb], &command, commandResult);
+    }
+}
+
+static void onUpstreamData(int clientFd, const char *data, int size, struct sockaddr *addr, socklen_t addrLen) {
+    switch (replProcessLine(repl, data, size)) {
+    case REPL_LINE_FLUSH:
+        LOG_INFO("Full resync from %s:%d", repl->primaryHost, repl->primaryPort);
+        resetKeyspace();
+        // the replicas of this server have a stream that no longer exists
+        serverCloseReplicas(server);
+        break;
+    case REPL_LINE_APPLY:
+        applyCommand(data, size);
+        break;
+    case REPL_LINE_ERROR:
+        LOG_WARN("Unexpected reply from %s:%d: %.*s", repl->primaryHost, repl->primaryPort, size, data);
+        serverCloseUpstream(server);
+        replConnectionLost(repl);
+        break;
+    default:
+        break;
+    }
+    if (repl->state == REPL_STREAMING) {
+        // pass the stream on to the replicas of this replica
+        serverWakeReplicas(server);
+    }
+}
+
+// heartbeats to the replicas, offsets to the primary, reconnecting when the primary was lost and
+// shrinking the table and moving cold values out of memory when there are no writes to do it
+static void onTimer(Server_t *server) {
+    for (int i = 0; i < NUM_DATABASES; i++) {
+        if (dbs[i] != NULL) {
+            htShrinkStep(dbs[i], HASHTABLE_SHRINK_IDLE_STEP);
+            htTierStep(dbs[i], HASHTABLE_TIER_IDLE_STEP, 0);
+        }
+    }
+    if (repl->state == REPL_NONE) {
+        if (serverNumReplicas(server) > 0) {
+            replHeartbeat(repl);
+            serverWakeReplicas(server);
+        }
+    } else if (server->upstream.clientFd == -1) {
+        if (replNowMs() - repl->lastConnectMs >= REPL_RECONNECT_INTERVAL_MS) {
+            replConnectionLost(repl);
+            connectToPrimary();
+        }
+    } else if (repl->state == REPL_STREAMING) {
+        char ack[64];
+        if (serverSendUpstream(server, ack, replAck(repl, ack)) != 0) {
+            LOG_WARN("Error reporting the offset to %s:%d", repl->primaryHost, repl->primaryPort);
+            serverCloseUpstream(server);
+        }
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -C, --config PATH        read settings from PATH, the other options override them\n"
+            "  -p, --port PORT          port to serve commands on (default %d), 0 to only serve on --unix\n"
+            "      --bind ADDR          address to serve commands and metrics on (default 127.0.0.1)\n"
+            "  -u, --unix PATH          also serve commands on a unix socket at PATH, or @NAME in the abstract namespace\n"
+            "      --max-clients N      clients served at once (default %d)\n"
+            "      --tcp-backlog N      connections queued before they are accepted (default %d)\n"
+            "      --tcp-nodelay yes|no  send replies without waiting to fill a packet (default yes)\n"
+            "      --socket-rcvbuf BYTES  SO_RCVBUF of the client sockets (default the kernel's)\n"
+            "      --socket-sndbuf BYTES  SO_SNDBUF of the client sockets (default the kernel's)\n"
+            "      --client-output-limit BYTES  disconnect clients with more output waiting (default %d)\n"
+            "      --db-initial-buckets N  buckets each database starts with, rounded up to a power of two (default %d)\n"
+            "  -m, --metrics-port PORT  serve Prometheus metrics over HTTP on this port (default off)\n"
+            "  -l, --log-level LEVEL    debug, info, warn, error or off (default info)\n"
+            "      --log-file PATH      append the log to this file instead of stdout\n"
+            "  -r, --replicaof HOST:PORT  replicate the server at HOST:PORT\n"
+            "  -c, --cluster HOST:PORT  run in cluster mode, reachable by clients at HOST:PORT\n"
+            "      --mmap PATH          keep the keyspace in a file mapped in memory, serving it again after a restart\n"
+            "      --tier PATH          move cold values to a log at PATH, reading them back when needed\n"
+            "      --tier-threshold BYTES  only move values of at least BYTES bytes (default %d)\n"
+            "      --tracking-max-keys N  keys remembered for client side caches (default %d)\n"
+            "Every option but --config is also a setting of the config file, written without the dashes.\n"
+            "tcp-nodelay, socket-rcvbuf, socket-sndbuf, client-output-limit, log-level and tracking-max-keys\n"
+            "can be changed while the server runs with config set.\n",
+            prog, SERVER_DEFAULT_PORT, SERVER_DEFAULT_MAX_CLIENTS, SERVER_DEFAULT_BACKLOG, CLIENT_DEFAULT_OUTPUT_LIMIT,
+            1 << HASHTABLE_DEFAULTCAP, HASHTABLE_TIER_DEFAULT_THRESHOLD, TRACKING_DEFAULT_MAX_KEYS);
+}
+
+// the settings with a short option too
+static const struct {
+    int opt;
+    const char *name;
+} shortOptions[] = {{'p', "port"}, {'u', "unix"}, {'m', "metrics-port"}, {'l', "log-level"}, {'r', "replicaof"},
+                    {'c', "cluster"}};
+
+// long options of the settings are numbered after every character
+#define CONFIG_OPTION_BASE 256
+
+/*
+ * Read the config file, then the rest of the command line over it. Returns 0 if successful, 1 after
+ * printing what is wrong
+ */
+static int parseOptions(int argc, char *argv[]) {
+    struct option options[NUM_CONFIG_PARAMS + 3];
+    for (int i = 0; i < NUM_CONFIG_PARAMS; i++) {
+        options[i] = (struct option){configParams[i].name, required_argument, NULL, CONFIG_OPTION_BASE + i};
+    }
+    options[NUM_CONFIG_PARAMS] = (struct option){"config", required_argument, NULL, 'C'};
+    options[NUM_CONFIG_PARAMS + 1] = (struct option){"help", no_argument, NULL, 'h'};
+    options[NUM_CONFIG_PARAMS + 2] = (struct option){NULL, 0, NULL, 0};
+    const char *shortopts = "C:p:u:m:l:r:c:h";
+
+    // the file first, wherever it is on the command line, so the options override it
+    char err[CONFIG_MAX_LINE + PATH_MAX];
+    int opt;
+    opterr = 0;
+    while ((opt = getopt_long(argc, argv, shortopts, options, NULL)) != -1) {
+        if (opt == 'C' && configLoad(configParams, NUM_CONFIG_PARAMS, optarg, err, sizeof(err)) != 0) {
+            fprintf(stderr, "%s\n", err);
+            return 1;
+        }
+    }
+    opterr = 1;
+    // 0 makes getopt start over
+    optind = 0;
+    while ((opt = getopt_long(argc, argv, shortopts, options, NULL)) != -1) {
+        ConfigParam_t *param = NULL;
+        if (opt >= CONFIG_OPTION_BASE && opt < CONFIG_OPTION_BASE + NUM_CONFIG_PARAMS) {
+            param = &configParams[opt - CONFIG_OPTION_BASE];
+        }
+        for (int i = 0; i < (int)(sizeof(shortOptions) / sizeof(shortOptions[0])); i++) {
+            if (shortOptions[i].opt == opt) {
+                param = configFind(configParams, NUM_CONFIG_PARAMS, shortOptions[i].name);
+            }
+        }
+        if (opt == 'C') {
+            continue;
+        }
+        if (param == NULL) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (configSet(param, optarg) != 0) {
+            fprintf(stderr, "Invalid value for --%s: %s\n", param->name, optarg);
+            return 1;
+        }
+    }
+    if (optind < argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (parseOptions(argc, argv) != 0) {
+        return 1;
+    }
+    char *primary = NULL;
+    int primaryPort = 0;
+    if (config.replicaof != NULL) {
+        const char *colon = strrchr(config.replicaof, ':');
+        if (colon == NULL || (primaryPort = atoi(colon + 1)) <= 0) {
+            fprintf(stderr, "Invalid replicaof %s, expected HOST:PORT\n", config.replicaof);
+            return 1;
+        }
+        primary = strndup(config.replicaof, colon - config.replicaof);
+    }
+    if (mmapPath != NULL && tierPath != NULL) {
+        fprintf(stderr, "--mmap and --tier can't be used together\n");
+        return 1;
+    }
+    if (config.port == 0 && config.unixPath == NULL) {
+        fprintf(stderr, "--port 0 needs --unix\n");
+        return 1;
+    }
+
+    if (logInit(config.logFile, config.logLevel) != 0) {
+        fprintf(stderr, "Error opening log %s\n", config.logFile != NULL ? config.logFile : "stdout");
+        return 1;
+    }
+    struct rlimit nofile;
+    if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 && (rlim_t)config.maxClients + 64 > nofile.rlim_cur) {
+        // the clients past the limit are turned away by accept, not by the server
+        LOG_WARN("max-clients %ld is close to the open file limit %lu", config.maxClients, (uint64_t)nofile.rlim_cur);
+    }
+    if (lazyfreeInit() != 0) {
+        // deleted keys and databases are freed right away instead
+        LOG_WARN("Error starting the reclaimer thread");
+    }
+
+    // close program on Ctrl-C
+    signal(SIGINT, closeDb);
+    signal(SIGTERM, closeDb);
+
+    ServerOptions_t serverOptions = configuredServerOptions();
+    server = createServer(config.port, &serverOptions);
+    if (server != NULL) {
+        dbs[0] = openDb(0, 0);
+        if (dbs[0] == NULL) {
+            logShutdown();
+            return 1;
+        }
+        stats = statsCreate(NUM_COMMANDS);
+        slowlog = slowlogCreate(SLOWLOG_DEFAULT_MAX_LEN, SLOWLOG_DEFAULT_THRESHOLD_US);
+        static const char *commandNames[NUM_COMMANDS];
+        for (int i = 0; i < NUM_COMMANDS; i++) {
+            commandNames[i] = commandTable[i].name;
+        }
+        metricsSource = (MetricsSource_t){stats, dbs, NUM_DATABASES, server, commandNames};
+        if (config.unixPath != NULL && serverEnableUnix(server, config.unixPath) != 0) {
+            LOG_ERROR("Error serving on unix socket %s", config.unixPath);
+            logShutdown();
+            return 1;
+        }
+        if (config.metricsPort != 0 &&
+            serverEnableMetrics(server, config.metricsPort, metricsRender, &metricsSource) != 0) {
+            LOG_ERROR("Error serving metrics on port %ld", config.metricsPort);
+            logShutdown();
+            return 1;
+        }
+        pubsub = pubsubCreate();
+        scripts = scriptCacheCreate();
+        tracking = trackingCreate(config.trackingMaxKeys);
+        serverSetClientCloseHandler(server, onClientClose);
+        repl = replCreate(REPL_DEFAULT_BACKLOG_SIZE);
+        serverSetReplicaFeeder(server, replFeeder, replReader, repl);
+        serverSetTimer(server, REPL_TIMER_INTERVAL_MS, onTimer);
+        if (config.cluster != NULL && (cluster = clusterCreate(config.cluster)) == NULL) {
+            LOG_ERROR("Invalid cluster address %s", config.cluster);
+            logShutdown();
+            return 1;
+        }
+        if (primary != NULL) {
+            replSetPrimary(repl, primary, primaryPort);
+            connectToPrimary();
+        }
+        if (config.port != 0) {
+            LOG_INFO("Serving on %s port %ld, up to %ld clients", config.bind != NULL ? config.bind : "127.0.0.1",
+                     config.port, config.maxClients);
+        }
+        if (config.unixPath != NULL) {
+            LOG_INFO("Serving on unix socket %s", config.unixPath);
+        }
         runServer(server, onData);
     }
+    logShutdown();
     // if we return here, we must have encountered an error from runServer() or the server couldn't be created
     // so we will return error
     return 1;
@@ -0,0 +1,237 @@
+#include "metrics.h"
+#include "lazyfree.h"
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// the lines of a section are numbered by item, a section returns 0 once it has no more items
+typedef int (*metricsSection_t)(MetricsSource_t *src, int item, char *buf, int cap);
+
+typedef enum ScalarType {
+    COUNTER,
+    GAUGE,
+} ScalarType_t;
+
+// write a line if it fits, returns its length or -1
+static int emit(char *buf, int cap, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf, cap, fmt, args);
+    va_end(args);
+    return n < 0 || n >= cap ? -1 : n;
+}
+
+void metricsMemory(uint64_t *rss, uint64_t *vsz) {
+    char statm[128];
+    *rss = 0;
+    *vsz = 0;
+    int fd = open("/proc/self/statm", O_RDONLY);
+    if (fd == -1) {
+        return;
+    }
+    int n = read(fd, statm, sizeof(statm) - 1);
+    close(fd);
+    if (n <= 0) {
+        return;
+    }
+    statm[n] = '\0';
+    unsigned long pages, residentPages;
+    if (sscanf(statm, "%lu %lu", &pages, &residentPages) == 2) {
+        long pageSize = sysconf(_SC_PAGESIZE);
+        *vsz = pages * pageSize;
+        *rss = residentPages * pageSize;
+    }
+}
+
+static int emitScalar(char *buf, int cap, const char *name, ScalarType_t type, const char *help, uint64_t value) {
+    return emit(buf, cap, "# HELP %s %s\n# TYPE %s %s\n%s %lu\n", name, help, name,
+                type == COUNTER ? "counter" : "gauge", name, value);
+}
+
+// totals of the tables of all databases
+typedef struct TableTotals {
+    uint64_t keys;
+    uint64_t buckets;
+    uint64_t rehashes;
+    uint64_t shrinks;
+    uint64_t compressedValues;
+} TableTotals_t;
+
+static TableTotals_t tableTotals(MetricsSource_t *src) {
+    TableTotals_t totals = {0};
+    for (int i = 0; i < src->numDbs; i++) {
+        Hashtable_t *ht = src->dbs[i];
+        if (ht != NULL) {
+            totals.keys += ht->len;
+            totals.buckets += (uint64_t)1 << ht->exp;
+            totals.rehashes += ht->rehashes;
+            totals.shrinks += ht->shrinks;
+            totals.compressedValues += ht->compressedValues;
+        }
+    }
+    return totals;
+}
+
+static int scalarsSection(MetricsSource_t *src, int item, char *buf, int cap) {
+    Stats_t *stats = src->stats;
+    TableTotals_t totals = tableTotals(src);
+    uint64_t rss, vsz;
+    switch (item) {
+    case 0:
+        return emitScalar(buf, cap, "simpledb_requests_total", COUNTER, "Requests received, including malformed ones.",
+                          statsRead(&stats->commands));
+    case 1:
+        return emitScalar(buf, cap, "simpledb_request_errors_total", COUNTER, "Requests that failed.",
+                          statsRead(&stats->errors));
+    case 2:
+        return emitScalar(buf, cap, "simpledb_net_input_bytes_total", COUNTER, "Bytes of commands received.",
+                          statsRead(&stats->bytesIn));
+    case 3:
+        return emitScalar(buf, cap, "simpledb_net_output_bytes_total", COUNTER, "Bytes of replies sent.",
+                          statsRead(&stats->bytesOut));
+    case 4:
+        return emitScalar(buf, cap, "simpledb_connected_clients", GAUGE, "Clients currently connected.",
+                          serverNumClients(src->server));
+    case 5:
+        return emitScalar(buf, cap, "simpledb_connections_total", COUNTER, "Clients accepted since the start.",
+                          src->server->totalConnections);
+    case 6:
+        return emitScalar(buf, cap, "simpledb_keys", GAUGE, "Keys in all databases.", totals.keys);
+    case 7:
+        return emitScalar(buf, cap, "simpledb_table_buckets", GAUGE, "Buckets of the hashtables of all databases.",
+                          totals.buckets);
+    case 8:
+        return emitScalar(buf, cap, "simpledb_table_rehashes_total", COUNTER, "Times a hashtable was expanded.",
+                          totals.rehashes);
+    case 9:
+        return emitScalar(buf, cap, "simpledb_table_shrinks_total", COUNTER, "Times a hashtable was shrunk.",
+                          totals.shrinks);
+    case 10:
+        return emitScalar(buf, cap, "simpledb_compressed_values", GAUGE, "Values stored compressed.",
+                          totals.compressedValues);
+    case 11:
+        metricsMemory(&rss, &vsz);
+        return emitScalar(buf, cap, "simpledb_memory_rss_bytes", GAUGE, "Resident memory of the process.", rss);
+    case 12:
+        metricsMemory(&rss, &vsz);
+        return emitScalar(buf, cap, "simpledb_memory_virtual_bytes", GAUGE, "Virtual memory of the process.", vsz);
+    case 13:
+        return emitScalar(buf, cap, "simpledb_uptime_seconds", GAUGE, "Seconds since the server started.",
+                          (statsNow() - stats->startTime) / 1000000000);
+    case 14:
+        return emitScalar(buf, cap, "simpledb_lazyfree_pending", GAUGE,
+                          "Deleted values and databases waiting to be freed in the background.", lazyfreePending());
+    default:
+        return 0;
+    }
+}
+
+static int databasesSection(MetricsSource_t *src, int item, char *buf, int cap) {
+    if (item == 0) {
+        return emit(buf, cap, "# HELP simpledb_db_keys Keys in each database.\n"
+                              "# TYPE simpledb_db_keys gauge\n");
+    }
+    // skip the databases that weren't created
+    int db = -1;
+    for (int seen = 0; seen < item && ++db < src->numDbs;) {
+        seen += src->dbs[db] != NULL;
+    }
+    if (db >= src->numDbs) {
+        return 0;
+    }
+    return emit(buf, cap, "simpledb_db_keys{db=\"%d\"} %lu\n", db, src->dbs[db]->len);
+}
+
+static int commandsSection(MetricsSource_t *src, int item, char *buf, int cap) {
+    if (item == 0) {
+        return emit(buf, cap, "# HELP simpledb_commands_total Commands executed by verb.\n"
+                              "# TYPE simpledb_commands_total counter\n");
+    }
+    if (item > src->stats->numCommands) {
+        return 0;
+    }
+    return emit(buf, cap, "simpledb_commands_total{verb=\"%s\"} %lu\n", src->commandNames[item - 1],
+                statsRead(&src->stats->commandStats[item - 1].calls));
+}
+
+static int commandErrorsSection(MetricsSource_t *src, int item, char *buf, int cap) {
+    if (item == 0) {
+        return emit(buf, cap, "# HELP simpledb_command_errors_total Commands that failed by verb.\n"
+                              "# TYPE simpledb_command_errors_total counter\n");
+    }
+    if (item > src->stats->numCommands) {
+        return 0;
+    }
+    return emit(buf, cap, "simpledb_command_errors_total{verb=\"%s\"} %lu\n", src->commandNames[item - 1],
+                statsRead(&src->stats->commandStats[item - 1].errors));
+}
+
+// recorded values of at most bound
+static uint64_t cumulativeCount(Histogram_t *h, uint64_t bound) {
+    uint64_t count = 0;
+    for (int i = 0; i < HISTOGRAM_SLOTS && histogramSlotMax(i) <= bound; i++) {
+        count += statsRead(&h->counts[i]);
+    }
+    return count;
+}
+
+// every phase has its buckets, the +Inf bucket, the sum and the count
+#define LATENCY_LINES_PER_PHASE (METRICS_LATENCY_BUCKETS + 3)
+
+static int latencySection(MetricsSource_t *src, int item, char *buf, int cap) {
+    static const char *phaseNames[NUM_PHASES] = {"parse", "execute", "send"};
+    if (item == 0) {
+        return emit(buf, cap, "# HELP simpledb_request_duration_seconds Time spent in each phase of a request.\n"
+                              "# TYPE simpledb_request_duration_seconds histogram\n");
+    }
+    int phase = (item - 1) / LATENCY_LINES_PER_PHASE;
+    int line = (item - 1) % LATENCY_LINES_PER_PHASE;
+    if (phase >= NUM_PHASES) {
+        return 0;
+    }
+    Histogram_t *h = &src->stats->phases[phase];
+    if (line < METRICS_LATENCY_BUCKETS) {
+        uint64_t boundUs = (uint64_t)1 << line;
+        return emit(buf, cap, "simpledb_request_duration_seconds_bucket{phase=\"%s\",le=\"%g\"} %lu\n",
+                    phaseNames[phase], boundUs / 1e6, cumulativeCount(h, boundUs * 1000));
+    } else if (line == METRICS_LATENCY_BUCKETS) {
+        return emit(buf, cap, "simpledb_request_duration_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %lu\n",
+                    phaseNames[phase], statsRead(&h->count));
+    } else if (line == METRICS_LATENCY_BUCKETS + 1) {
+        return emit(buf, cap, "simpledb_request_duration_seconds_sum{phase=\"%s\"} %.9f\n", phaseNames[phase],
+                    statsRead(&h->sum) / 1e9);
+    }
+    return emit(buf, cap, "simpledb_request_duration_seconds_count{phase=\"%s\"} %lu\n", phaseNames[phase],
+                statsRead(&h->count));
+}
+
+static const metricsSection_t sections[] = {scalarsSection, databasesSection, commandsSection, commandErrorsSection,
+                                            latencySection};
+
+#define NUM_SECTIONS ((int)(sizeof(sections) / sizeof(sections[0])))
+
+int metricsRender(void *ctx, MetricsCursor_t *cursor, char *buf, int cap) {
+    MetricsSource_t *src = ctx;
+    int len = 0;
+    while (cursor->section < NUM_SECTIONS) {
+        int n = sections[cursor->section](src, cursor->item, buf + len, cap - len);
+        if (n == 0) {
+            cursor->section++;
+            cursor->item = 0;
+        } else if (n < 0) {
+            if (len == 0) {
+                // a line that never fits the buffer is skipped
+                cursor->item++;
+                continue;
+            }
+            break;
+        } else {
+            len += n;
+            cursor->item++;
+        }
+    }
+    return len;
+}
@@ -0,0 +1,47 @@
+/*
+ * Prometheus text exposition of the server statistics, served on the metrics port
+ * https://prometheus.io/docs/instrumenting/exposition_formats/
+ *
+ */
+
+#pragma once
+
+#include "hashtable.h"
+#include "network.h"
+#include "stats.h"
+
+#ifndef __METRICS_H
+#define __METRICS_H
+
+// latency histogram buckets are exported for 1us, 2us, 4us... up to 2^(METRICS_LATENCY_BUCKETS - 1)us
+#define METRICS_LATENCY_BUCKETS 24
+
+typedef struct MetricsSource {
+    Stats_t *stats;
+    Hashtable_t **dbs; /* The databases, NULL for those not created yet */
+    int numDbs;
+    Server_t *server;
+    const char **commandNames; /* Name of every command counted in stats */
+} MetricsSource_t;
+
+/**
+ * Render the next lines of the metrics page, a metrics_renderer_t for serverEnableMetrics
+ *
+ * @param ctx The MetricsSource_t to render
+ * @param cursor Where to resume rendering, starts zeroed
+ * @param buf The output buffer
+ * @param cap The size of buf
+ *
+ * @returns The number of bytes written, 0 once every line was rendered
+ * */
+int metricsRender(void *ctx, MetricsCursor_t *cursor, char *buf, int cap);
+
+/**
+ * Read the resident and virtual memory of the process without allocating, both are 0 if unknown
+ *
+ * @param rss Set to the resident set size in bytes
+ * @param vsz Set to the virtual memory size in bytes
+ * */
+void metricsMemory(uint64_t *rss, uint64_t *vsz);
+
+#endif /* __METRICS_H */
@@ -1,73 +1,252 @@
+#define _GNU_SOURCE
 #include "network.h"
+#include "log.h"
+#include "trace.h"
 #include <arpa/inet.h>
 #include <errno.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
 #include <poll.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
-Server_t *createServer(int port) {
-    int socketFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+// create a non-blocking socket listening on host, the loopback interface if it is NULL
+static int listenOnPort(const char *host, int port, int backlog) {
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE};
+    struct addrinfo *res;
+    char service[16];
+    sprintf(service, "%d", port);
+    if (getaddrinfo(host != NULL ? host : "127.0.0.1", service, &hints, &res) != 0) {
+        LOG_ERROR("Error resolving bind address %s", host);
+        return -1;
+    }
+    int socketFd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
     if (socketFd < 0) {
-        printf("Error creating socket\n");
-        return NULL;
+        LOG_ERROR("Error creating socket errno=%d", errno);
+        freeaddrinfo(res);
+        return -1;
     }
+    // the server closes metrics connections itself, their TIME_WAIT must not block a restart
+    int reuse = 1;
+    setsockopt(socketFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 
-    struct sockaddr_in serverAddr;
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(port);
-    serverAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-    if (bind(socketFd, (const struct sockaddr *)&serverAddr, sizeof(serverAddr)) < 0) {
-        printf("Error binding socket %d\n", errno);
+    int rc = bind(socketFd, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    if (rc < 0) {
+        LOG_ERROR("Error binding socket to port %d errno=%d", port, errno);
         close(socketFd);
-        return NULL;
+        return -1;
+    }
+
+    if (listen(socketFd, backlog) < 0) {
+        LOG_ERROR("Error listening on port %d errno=%d", port, errno);
+        close(socketFd);
+        return -1;
     }
+    return socketFd;
+}
 
-    if (listen(socketFd, SERVER_BACKLOG) < 0) {
-        printf("Error listening on socket\n");
+// create a non-blocking unix socket listening on path, in the abstract namespace if path starts with @
+static int listenOnUnix(const char *path, int backlog) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    size_t len = strlen(path);
+    if (len == 0 || len >= sizeof(addr.sun_path)) {
+        LOG_ERROR("Invalid unix socket path %s", path);
+        return -1;
+    }
+    int socketFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (socketFd < 0) {
+        LOG_ERROR("Error creating unix socket errno=%d", errno);
+        return -1;
+    }
+    memcpy(addr.sun_path, path, len);
+    if (path[0] == '@') {
+        // an abstract name starts with a NUL byte and isn't NUL terminated
+        addr.sun_path[0] = '\0';
+    } else {
+        // a socket left behind by a server that didn't stop cleanly
+        unlink(path);
+    }
+    if (bind(socketFd, (const struct sockaddr *)&addr, offsetof(struct sockaddr_un, sun_path) + len) < 0) {
+        LOG_ERROR("Error binding unix socket %s errno=%d", path, errno);
         close(socketFd);
+        return -1;
+    }
+    if (listen(socketFd, backlog) < 0) {
+        LOG_ERROR("Error listening on unix socket %s errno=%d", path, errno);
+        close(socketFd);
+        return -1;
+    }
+    return socketFd;
+}
+
+// size the kernel buffers of a socket as configured, listening sockets pass theirs on to the clients they accept
+static void setSocketBuffers(int fd, const ServerOptions_t *options) {
+    if (options->rcvbuf > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &options->rcvbuf, sizeof(options->rcvbuf));
+    }
+    if (options->sndbuf > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &options->sndbuf, sizeof(options->sndbuf));
+    }
+}
+
+ServerOptions_t serverDefaultOptions() {
+    ServerOptions_t options = {NULL, SERVER_DEFAULT_MAX_CLIENTS, SERVER_DEFAULT_BACKLOG, 1, 0, 0,
+                               CLIENT_DEFAULT_OUTPUT_LIMIT};
+    return options;
+}
+
+// slots of the sockets in pollFds, the clients come last as their number is only known at runtime
+#define SERVER_POLL_IDX 0
+#define METRICS_LISTEN_POLL_IDX 1
+#define UNIX_POLL_IDX 2
+#define UPSTREAM_POLL_IDX 3
+#define METRICS_POLL_IDX 4
+#define REPLICA_POLL_IDX (METRICS_POLL_IDX + MAX_METRICS_CONN)
+#define CLIENT_POLL_IDX (REPLICA_POLL_IDX + MAX_REPLICA_CONN)
+
+Server_t *createServer(int port, const ServerOptions_t *options) {
+    ServerOptions_t defaults = serverDefaultOptions();
+    options = options != NULL ? options : &defaults;
+    if (options->maxClients < 1) {
+        return NULL;
+    }
+    int socketFd = port != 0 ? listenOnPort(options->bind, port, options->backlog) : -1;
+    if (port != 0 && socketFd < 0) {
         return NULL;
     }
     Server_t *server = malloc(sizeof(Server_t));
+    ClientConnection_t *clients = calloc(options->maxClients, sizeof(ClientConnection_t));
+    struct pollfd *pollFds = malloc((CLIENT_POLL_IDX + options->maxClients) * sizeof(struct pollfd));
+    if (server == NULL || clients == NULL || pollFds == NULL) {
+        LOG_ERROR("Error allocating room for %d clients", options->maxClients);
+        free(server);
+        free(clients);
+        free(pollFds);
+        if (socketFd != -1) {
+            close(socketFd);
+        }
+        return NULL;
+    }
+    if (socketFd != -1) {
+        setSocketBuffers(socketFd, options);
+    }
     server->serverFd = socketFd;
     server->port = port;
-    for (int i = 0; i < MAX_SERVER_CONN; i++) {
+    server->unixFd = -1;
+    server->unixPath[0] = '\0';
+    server->options = *options;
+    server->clients = clients;
+    for (int i = 0; i < options->maxClients; i++) {
         server->clients[i].clientFd = -1;
-        server->clients[i].addr = NULL;
-        server->clients[i].addrLen = 0;
     }
-    memset(server->pollFds, -1, (MAX_SERVER_CONN + 1) * sizeof(struct pollfd));
+    server->metricsFd = -1;
+    server->metricsRenderer = NULL;
+    server->metricsCtx = NULL;
+    for (int i = 0; i < MAX_METRICS_CONN; i++) {
+        server->metricsClients[i].fd = -1;
+    }
+    server->totalConnections = 0;
+    server->replicaFeeder = NULL;
+    server->replicaReader = NULL;
+    server->replicaCtx = NULL;
+    for (int i = 0; i < MAX_REPLICA_CONN; i++) {
+        server->replicas[i].fd = -1;
+    }
+    server->upstream.clientFd = -1;
+    server->upstreamHandler = NULL;
+    server->timerIntervalMs = -1;
+    server->onTimer = NULL;
+    server->onClientClose = NULL;
+    server->slowClientsClosed = 0;
+    server->pollFds = pollFds;
+    server->numPollFds = CLIENT_POLL_IDX + options->maxClients;
+    memset(server->pollFds, -1, server->numPollFds * sizeof(struct pollfd));
     return server;
 }
 
+void serverSetOptions(Server_t *server, const ServerOptions_t *options) {
+    server->options.tcpNoDelay = options->tcpNoDelay;
+    server->options.rcvbuf = options->rcvbuf;
+    server->options.sndbuf = options->sndbuf;
+    server->options.outputLimit = options->outputLimit;
+}
+
+int serverEnableUnix(Server_t *server, const char *path) {
+    int socketFd = listenOnUnix(path, server->options.backlog);
+    if (socketFd < 0) {
+        return -1;
+    }
+    setSocketBuffers(socketFd, &server->options);
+    server->unixFd = socketFd;
+    strcpy(server->unixPath, path);
+    return 0;
+}
+
+int serverEnableMetrics(Server_t *server, int port, metrics_renderer_t renderer, void *ctx) {
+    int socketFd = listenOnPort(server->options.bind, port, server->options.backlog);
+    if (socketFd < 0) {
+        return -1;
+    }
+    server->metricsFd = socketFd;
+    server->metricsRenderer = renderer;
+    server->metricsCtx = ctx;
+    return 0;
+}
+
 void destroyServer(Server_t *server) {
     if (server != NULL) {
-        close(server->serverFd);
-        for (int i = 0; i < MAX_SERVER_CONN; i++) {
+        if (server->serverFd != -1) {
+            close(server->serverFd);
+        }
+        if (server->unixFd != -1) {
+            close(server->unixFd);
+            if (server->unixPath[0] != '@') {
+                unlink(server->unixPath);
+            }
+        }
+        for (int i = 0; i < server->options.maxClients; i++) {
             ClientConnection_t client = server->clients[i];
             if (client.clientFd != -1) {
                 free(client.addr);
+                free(client.multi);
+                free(client.outBuffer);
                 close(client.clientFd);
             }
         }
+        if (server->metricsFd != -1) {
+            close(server->metricsFd);
+        }
+        for (int i = 0; i < MAX_METRICS_CONN; i++) {
+            if (server->metricsClients[i].fd != -1) {
+                close(server->metricsClients[i].fd);
+            }
+        }
+        serverCloseReplicas(server);
+        serverCloseUpstream(server);
+        free(server->clients);
+        free(server->pollFds);
         free(server);
     }
 }
 
-int acceptClientConnections(Server_t *server) {
+int acceptClientConnections(Server_t *server, int listenFd) {
     int numAccept = 0;
     while (1) {
         int clientIdx = -1;
-        for (int i = 0; i < MAX_SERVER_CONN; i++) {
+        for (int i = 0; i < server->options.maxClients; i++) {
             if (server->clients[i].clientFd == -1) {
                 clientIdx = i;
             }
         }
         if (clientIdx == -1) {
             // Max connections reached, accept and then close the socket
-            int closeFd = accept(server->serverFd, NULL, NULL);
+            int closeFd = accept(listenFd, NULL, NULL);
             if (closeFd == -1) {
                 // accept will return -1 when there are no more clients to accept
                 return numAccept;
@@ -75,62 +254,635 @@ int acceptClientConnections(Server_t *server) {
             close(closeFd);
             return -1;
         }
-        server->clients[clientIdx].addr = malloc(sizeof(struct sockaddr_in));
-        int clientFd = accept(server->serverFd, server->clients[clientIdx].addr, &server->clients[clientIdx].addrLen);
+        server->clients[clientIdx].addr = malloc(sizeof(struct sockaddr_storage));
+        server->clients[clientIdx].addrLen = sizeof(struct sockaddr_storage);
+        int clientFd = accept(listenFd, server->clients[clientIdx].addr, &server->clients[clientIdx].addrLen);
         if (clientFd == -1) {
             // accept will return -1 when there are no more clients to accept
+            free(server->clients[clientIdx].addr);
+            server->clients[clientIdx].addr = NULL;
             break;
         }
+        if (listenFd == server->serverFd && server->options.tcpNoDelay) {
+            // pipelined commands get one small reply each, don't let Nagle hold them back
+            int nodelay = 1;
+            setsockopt(clientFd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+        }
+        // the options may have changed since the listening socket was set up
+        setSocketBuffers(clientFd, &server->options);
         server->clients[clientIdx].clientFd = clientFd;
+        server->clients[clientIdx].db = 0;
+        server->clients[clientIdx].tracking = 0;
+        server->clients[clientIdx].closing = 0;
+        server->totalConnections++;
+        LOG_DEBUG("Client connected fd=%d", clientFd);
         // also set up client in pollFds to listen for incoming data
-        // offset clientIdx by 1 to account for the first slot being taken by the server socket
-        server->pollFds[clientIdx + 1].fd = clientFd;
-        server->pollFds[clientIdx + 1].events = POLLIN;
+        server->pollFds[CLIENT_POLL_IDX + clientIdx].fd = clientFd;
+        server->pollFds[CLIENT_POLL_IDX + clientIdx].events = POLLIN;
     }
     return numAccept;
 }
 
+static void closeClient(Server_t *server, int i) {
+    ClientConnection_t *client = &server->clients[i];
+    LOG_DEBUG("Client disconnected fd=%d", client->clientFd);
+    if (server->onClientClose != NULL) {
+        server->onClientClose(server, client->clientFd);
+    }
+    close(client->clientFd);
+    client->clientFd = -1;
+    client->inLen = 0;
+    client->framed = 0;
+    client->discarding = 0;
+    client->closing = 0;
+    server->pollFds[CLIENT_POLL_IDX + i].fd = -1;
+    free(client->addr);
+    client->addr = NULL;
+    free(client->multi);
+    client->multi = NULL;
+    free(client->outBuffer);
+    client->outBuffer = NULL;
+    client->outLen = 0;
+    client->outCap = 0;
+}
+
+// send as much of the output buffer as the socket takes, returns -1 if the connection failed
+static int flushClientOutput(Server_t *server, int i) {
+    ClientConnection_t *client = &server->clients[i];
+    int sent = send(client->clientFd, client->outBuffer, client->outLen, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+    memmove(client->outBuffer, client->outBuffer + sent, client->outLen - sent);
+    client->outLen -= sent;
+    if (client->outLen == 0) {
+        server->pollFds[CLIENT_POLL_IDX + i].events = POLLIN;
+    }
+    return 0;
+}
+
+// answer a command too long for the input buffer with an error and skip the rest of it
+static void rejectLongCommand(Server_t *server, ClientConnection_t *client) {
+    client->discarding = 1;
+    if (client == &server->upstream) {
+        LOG_ERROR("Dropped a command from the upstream longer than %d bytes", BUFFER_SIZE);
+        return;
+    }
+    char reply[64];
+    int len = snprintf(reply, sizeof(reply), "Command too long, at most %d bytes%s", BUFFER_SIZE - 1,
+                       client->framed ? "\n" : "");
+    sendClientData(server, client->clientFd, reply, len);
+}
+
+// call onData for every complete command received from the client and keep the rest for later
+static void processClientInput(Server_t *server, ClientConnection_t *client, data_handler_t onData) {
+    int start = 0;
+    for (int end = 0; end < client->inLen; end++) {
+        char c = client->inBuffer[end];
+        if (c != '\n' && c != '\0') {
+            continue;
+        }
+        if (c == '\n') {
+            client->framed = 1;
+        }
+        if (client->discarding) {
+            // the end of a command that was too long, it was already answered
+            client->discarding = 0;
+        } else if (end > start) {
+            onData(client->clientFd, client->inBuffer + start, end - start + 1, client->addr, client->addrLen);
+            if (client->clientFd == -1) {
+                // the client became a replica, anything else it sent is dropped
+                client->inLen = 0;
+                return;
+            }
+        }
+        start = end + 1;
+    }
+    if (start < client->inLen && client->discarding) {
+        // still in a command that was too long, the message of a client that never pipelined ends with the read
+        client->discarding = client->framed || client->inLen == BUFFER_SIZE;
+        start = client->inLen;
+    } else if (start == 0 && client->inLen == BUFFER_SIZE) {
+        rejectLongCommand(server, client);
+        start = client->inLen;
+    } else if (start < client->inLen && !client->framed) {
+        // an unterminated message from a client that never pipelined
+        onData(client->clientFd, client->inBuffer + start, client->inLen - start, client->addr, client->addrLen);
+        start = client->inLen;
+    }
+    memmove(client->inBuffer, client->inBuffer + start, client->inLen - start);
+    client->inLen -= start;
+}
+
+static void closeMetricsClient(Server_t *server, int i) {
+    close(server->metricsClients[i].fd);
+    server->metricsClients[i].fd = -1;
+    server->pollFds[METRICS_POLL_IDX + i].fd = -1;
+}
+
+static void acceptMetricsClients(Server_t *server) {
+    while (1) {
+        int fd = accept4(server->metricsFd, NULL, NULL, SOCK_NONBLOCK);
+        if (fd == -1) {
+            return;
+        }
+        int idx = -1;
+        for (int i = 0; i < MAX_METRICS_CONN; i++) {
+            if (server->metricsClients[i].fd == -1) {
+                idx = i;
+                break;
+            }
+        }
+        if (idx == -1) {
+            // too many concurrent scrapes
+            close(fd);
+            continue;
+        }
+        MetricsConnection_t *mc = &server->metricsClients[idx];
+        mc->fd = fd;
+        mc->state = METRICS_READING;
+        mc->len = 0;
+        server->pollFds[METRICS_POLL_IDX + idx].fd = fd;
+        server->pollFds[METRICS_POLL_IDX + idx].events = POLLIN;
+    }
+}
+
+// start the response once the request headers are complete, returns -1 to drop the connection
+static int startMetricsResponse(Server_t *server, MetricsConnection_t *mc) {
+    mc->buffer[mc->len] = '\0';
+    if (strstr(mc->buffer, "\r\n\r\n") == NULL && strstr(mc->buffer, "\n\n") == NULL) {
+        // wait for the rest of the request, unless it will never fit
+        return mc->len < METRICS_BUFFER_SIZE - 1 ? 0 : -1;
+    }
+    mc->state = METRICS_WRITING;
+    mc->sent = 0;
+    mc->done = 1;
+    if (strncmp(mc->buffer, "GET ", 4) != 0) {
+        mc->len = sprintf(mc->buffer, "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET\r\nContent-Length: 0\r\n"
+                                      "Connection: close\r\n\r\n");
+    } else if (strncmp(mc->buffer + 4, "/metrics ", 9) != 0 && strncmp(mc->buffer + 4, "/metrics?", 9) != 0) {
+        mc->len = sprintf(mc->buffer, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+    } else {
+        // the body is streamed until the connection closes, so no Content-Length
+        mc->len = sprintf(mc->buffer, "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                      "Connection: close\r\n\r\n");
+        mc->cursor.section = 0;
+        mc->cursor.item = 0;
+        mc->done = 0;
+    }
+    return 0;
+}
+
+static void handleMetricsClient(Server_t *server, int i, short revents) {
+    MetricsConnection_t *mc = &server->metricsClients[i];
+    if (mc->state == METRICS_READING && (revents & (POLLIN | POLLHUP | POLLERR))) {
+        int size = recv(mc->fd, mc->buffer + mc->len, METRICS_BUFFER_SIZE - 1 - mc->len, 0);
+        if (size <= 0) {
+            closeMetricsClient(server, i);
+            return;
+        }
+        mc->len += size;
+        if (startMetricsResponse(server, mc) != 0) {
+            closeMetricsClient(server, i);
+            return;
+        }
+        if (mc->state != METRICS_WRITING) {
+            return;
+        }
+        server->pollFds[METRICS_POLL_IDX + i].events = POLLOUT;
+    }
+    // send as much as the socket takes, rendering the next chunk whenever the previous one is out
+    while (mc->state == METRICS_WRITING) {
+        if (mc->sent == mc->len) {
+            int n = mc->done ? 0 : server->metricsRenderer(server->metricsCtx, &mc->cursor, mc->buffer, METRICS_BUFFER_SIZE);
+            if (n == 0) {
+                closeMetricsClient(server, i);
+                return;
+            }
+            mc->len = n;
+            mc->sent = 0;
+        }
+        int size = send(mc->fd, mc->buffer + mc->sent, mc->len - mc->sent, MSG_NOSIGNAL);
+        if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (size <= 0) {
+            closeMetricsClient(server, i);
+            return;
+        }
+        mc->sent += size;
+    }
+}
+
+void serverSetReplicaFeeder(Server_t *server, replica_feeder_t feeder, replica_reader_t reader, void *ctx) {
+    server->replicaFeeder = feeder;
+    server->replicaReader = reader;
+    server->replicaCtx = ctx;
+}
+
+int serverAddReplica(Server_t *server, int clientFd, ReplicaCursor_t cursor) {
+    int clientIdx = -1;
+    for (int i = 0; i < server->options.maxClients; i++) {
+        if (server->clients[i].clientFd == clientFd) {
+            clientIdx = i;
+            break;
+        }
+    }
+    int idx = -1;
+    for (int i = 0; i < MAX_REPLICA_CONN; i++) {
+        if (server->replicas[i].fd == -1) {
+            idx = i;
+            break;
+        }
+    }
+    if (clientIdx == -1 || idx == -1) {
+        return -1;
+    }
+    ClientConnection_t *client = &server->clients[clientIdx];
+    ReplicaConnection_t *replica = &server->replicas[idx];
+    if (server->onClientClose != NULL) {
+        server->onClientClose(server, clientFd);
+    }
+    if (client->outLen > 0) {
+        // the replies before sync go out before the stream, a replica catching up can wait for them
+        send(clientFd, client->outBuffer, client->outLen, MSG_NOSIGNAL);
+        client->outLen = 0;
+    }
+    replica->fd = clientFd;
+    replica->addr = client->addr;
+    replica->addrLen = client->addrLen;
+    replica->len = 0;
+    replica->sent = 0;
+    replica->inLen = 0;
+    replica->cursor = cursor;
+    client->clientFd = -1;
+    client->addr = NULL;
+    client->framed = 0;
+    client->discarding = 0;
+    free(client->multi);
+    client->multi = NULL;
+    free(client->outBuffer);
+    client->outBuffer = NULL;
+    client->outCap = 0;
+    server->pollFds[CLIENT_POLL_IDX + clientIdx].fd = -1;
+    // keep reading to notice the replica going away
+    server->pollFds[REPLICA_POLL_IDX + idx].fd = clientFd;
+    server->pollFds[REPLICA_POLL_IDX + idx].events = POLLIN | POLLOUT;
+    return 0;
+}
+
+static void closeReplica(Server_t *server, int i) {
+    ReplicaConnection_t *replica = &server->replicas[i];
+    LOG_INFO("Replica disconnected fd=%d", replica->fd);
+    close(replica->fd);
+    free(replica->addr);
+    free(replica->cursor.snapshot);
+    replica->fd = -1;
+    replica->addr = NULL;
+    replica->cursor.snapshot = NULL;
+    server->pollFds[REPLICA_POLL_IDX + i].fd = -1;
+}
+
+void serverWakeReplicas(Server_t *server) {
+    for (int i = 0; i < MAX_REPLICA_CONN; i++) {
+        if (server->replicas[i].fd != -1) {
+            server->pollFds[REPLICA_POLL_IDX + i].events = POLLIN | POLLOUT;
+        }
+    }
+}
+
+void serverCloseReplicas(Server_t *server) {
+    for (int i = 0; i < MAX_REPLICA_CONN; i++) {
+        if (server->replicas[i].fd != -1) {
+            closeReplica(server, i);
+        }
+    }
+}
+
+int serverNumReplicas(Server_t *server) {
+    int numReplicas = 0;
+    for (int i = 0; i < MAX_REPLICA_CONN; i++) {
+        if (server->replicas[i].fd != -1) {
+            numReplicas++;
+        }
+    }
+    return numReplicas;
+}
+
+// pass every complete line the replica sent to the reader, returns -1 to drop the replica
+static int readReplica(Server_t *server, ReplicaConnection_t *replica) {
+    int size = recv(replica->fd, replica->inBuffer + replica->inLen, REPLICA_INPUT_SIZE - replica->inLen, MSG_DONTWAIT);
+    if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 0;
+    }
+    if (size <= 0) {
+        return -1;
+    }
+    replica->inLen += size;
+    int start = 0;
+    for (int end = 0; end < replica->inLen; end++) {
+        if (replica->inBuffer[end] == '\n') {
+            const char *line = replica->inBuffer + start;
+            if (server->replicaReader(server->replicaCtx, &replica->cursor, line, end - start + 1) != 0) {
+                return -1;
+            }
+            start = end + 1;
+        }
+    }
+    if (start == 0 && replica->inLen == REPLICA_INPUT_SIZE) {
+        // a line that will never fit
+        return -1;
+    }
+    memmove(replica->inBuffer, replica->inBuffer + start, replica->inLen - start);
+    replica->inLen -= start;
+    return 0;
+}
+
+static void handleReplica(Server_t *server, int i, short revents) {
+    ReplicaConnection_t *replica = &server->replicas[i];
+    if ((revents & (POLLIN | POLLHUP | POLLERR)) && readReplica(server, replica) != 0) {
+        closeReplica(server, i);
+        return;
+    }
+    if (!(revents & POLLOUT)) {
+        return;
+    }
+    // send as much as the socket takes, asking the feeder for more whenever the buffer is out
+    while (1) {
+        if (replica->sent == replica->len) {
+            int n = server->replicaFeeder(server->replicaCtx, &replica->cursor, replica->buffer, REPLICA_BUFFER_SIZE);
+            if (n < 0) {
+                LOG_WARN("Replica fd=%d fell behind the replication backlog", replica->fd);
+                closeReplica(server, i);
+                return;
+            }
+            if (n == 0) {
+                // up to date, wait for serverWakeReplicas
+                server->pollFds[REPLICA_POLL_IDX + i].events = POLLIN;
+                return;
+            }
+            replica->len = n;
+            replica->sent = 0;
+        }
+        // the socket stays blocking for the reply to the sync command, never block here
+        int size = send(replica->fd, replica->buffer + replica->sent, replica->len - replica->sent,
+                        MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (size <= 0) {
+            closeReplica(server, i);
+            return;
+        }
+        replica->sent += size;
+    }
+}
+
+int serverConnectUpstream(Server_t *server, const char *host, int port, const char *hello, int hellolen,
+                          data_handler_t handler) {
+    serverCloseUpstream(server);
+    if (hellolen > BUFFER_SIZE) {
+        return -1;
+    }
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *res;
+    char service[16];
+    sprintf(service, "%d", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0) {
+        LOG_ERROR("Error resolving %s", host);
+        return -1;
+    }
+    int fd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        freeaddrinfo(res);
+        return -1;
+    }
+    int rc = connect(fd, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    if (rc < 0 && errno != EINPROGRESS) {
+        LOG_WARN("Error connecting to %s:%d errno=%d", host, port, errno);
+        close(fd);
+        return -1;
+    }
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    server->upstream.clientFd = fd;
+    server->upstream.addr = NULL;
+    server->upstream.addrLen = 0;
+    server->upstream.inLen = 0;
+    // the upstream only ever sends whole lines
+    server->upstream.framed = 1;
+    server->upstream.discarding = 0;
+    server->upstreamConnecting = 1;
+    memcpy(server->upstreamHello, hello, hellolen);
+    server->upstreamHelloLen = hellolen;
+    server->upstreamHandler = handler;
+    server->pollFds[UPSTREAM_POLL_IDX].fd = fd;
+    server->pollFds[UPSTREAM_POLL_IDX].events = POLLOUT;
+    return 0;
+}
+
+int serverSendUpstream(Server_t *server, const char *data, int size) {
+    if (server->upstream.clientFd == -1 || server->upstreamConnecting) {
+        return -1;
+    }
+    return send(server->upstream.clientFd, data, size, MSG_DONTWAIT | MSG_NOSIGNAL) == size ? 0 : -1;
+}
+
+void serverCloseUpstream(Server_t *server) {
+    if (server->upstream.clientFd != -1) {
+        close(server->upstream.clientFd);
+        server->upstream.clientFd = -1;
+        server->pollFds[UPSTREAM_POLL_IDX].fd = -1;
+    }
+}
+
+static void handleUpstream(Server_t *server, short revents) {
+    ClientConnection_t *upstream = &server->upstream;
+    if (server->upstreamConnecting) {
+        int err = 0;
+        socklen_t errLen = sizeof(err);
+        getsockopt(upstream->clientFd, SOL_SOCKET, SO_ERROR, &err, &errLen);
+        if (err != 0 || send(upstream->clientFd, server->upstreamHello, server->upstreamHelloLen, MSG_NOSIGNAL) !=
+                            server->upstreamHelloLen) {
+            LOG_WARN("Error connecting to upstream errno=%d", err != 0 ? err : errno);
+            serverCloseUpstream(server);
+            return;
+        }
+        server->upstreamConnecting = 0;
+        server->pollFds[UPSTREAM_POLL_IDX].events = POLLIN;
+        return;
+    }
+    int size = recv(upstream->clientFd, upstream->inBuffer + upstream->inLen, BUFFER_SIZE - upstream->inLen, 0);
+    if (size == 0 || (size < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        LOG_WARN("Lost the connection to the upstream");
+        serverCloseUpstream(server);
+        return;
+    }
+    if (size > 0) {
+        upstream->inLen += size;
+        processClientInput(server, upstream, server->upstreamHandler);
+    }
+}
+
+void serverSetTimer(Server_t *server, int intervalMs, timer_handler_t onTimer) {
+    server->timerIntervalMs = intervalMs;
+    server->onTimer = onTimer;
+    server->lastTimerMs = 0;
+}
+
+void serverSetClientCloseHandler(Server_t *server, client_close_handler_t onClose) {
+    server->onClientClose = onClose;
+}
+
+static uint64_t nowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 void runServer(Server_t *server, data_handler_t onData) {
     // set up server socket to listen for new connections to the server
-    server->pollFds[0].fd = server->serverFd;
-    server->pollFds[0].events = POLLIN;
+    server->pollFds[SERVER_POLL_IDX].fd = server->serverFd;
+    server->pollFds[SERVER_POLL_IDX].events = POLLIN;
+    server->pollFds[METRICS_LISTEN_POLL_IDX].fd = server->metricsFd;
+    server->pollFds[METRICS_LISTEN_POLL_IDX].events = POLLIN;
+    server->pollFds[UNIX_POLL_IDX].fd = server->unixFd;
+    server->pollFds[UNIX_POLL_IDX].events = POLLIN;
 
     while (1) {
-        int numReady = poll(server->pollFds, MAX_SERVER_CONN + 1, -1);
+        int numReady = poll(server->pollFds, server->numPollFds, server->timerIntervalMs);
         if (numReady == -1) {
-            printf("Error in poll()\n");
+            LOG_ERROR("Error in poll() errno=%d", errno);
             break;
         }
+        if (server->onTimer != NULL && nowMs() - server->lastTimerMs >= (uint64_t)server->timerIntervalMs) {
+            server->lastTimerMs = nowMs();
+            server->onTimer(server);
+        }
         // check for new client connections
-        if (server->pollFds[0].revents & POLLIN) {
-            if (acceptClientConnections(server) < 0) {
+        if (server->pollFds[SERVER_POLL_IDX].revents & POLLIN) {
+            if (acceptClientConnections(server, server->serverFd) < 0) {
                 // Reached max client connections
-                printf("Max connections reached\n");
+                LOG_WARN("Max connections reached, new client closed");
             }
         }
-        for (int i = 0; i < MAX_SERVER_CONN; i++) {
-            if (server->pollFds[i + 1].revents & POLLIN) {
+        if (server->pollFds[UNIX_POLL_IDX].revents & POLLIN) {
+            if (acceptClientConnections(server, server->unixFd) < 0) {
+                LOG_WARN("Max connections reached, new client closed");
+            }
+        }
+        for (int i = 0; i < server->options.maxClients; i++) {
+            ClientConnection_t *client = &server->clients[i];
+            short revents = server->pollFds[CLIENT_POLL_IDX + i].revents;
+            if (client->clientFd != -1 && (revents & POLLOUT) && flushClientOutput(server, i) != 0) {
+                closeClient(server, i);
+                continue;
+            }
+            if (revents & POLLIN) {
                 // data to read from client
-                char buffer[BUFFER_SIZE];
-                int size = recv(server->clients[i].clientFd, buffer, BUFFER_SIZE, 0);
+                int size = recv(client->clientFd, client->inBuffer + client->inLen, BUFFER_SIZE - client->inLen, 0);
                 if (size <= 0) {
                     // The client disconnected
-                    close(server->clients[i].clientFd);
-                    server->clients[i].clientFd = -1;
-                    server->pollFds[i + 1].fd = -1;
-                    free(server->clients[i].addr);
-                } else {
-                    onData(server->clients[i].clientFd, buffer, size, server->clients[i].addr, server->clients[i].addrLen);
+                    closeClient(server, i);
+                    continue;
                 }
+                client->inLen += size;
+                processClientInput(server, client, onData);
             }
         }
+        // clients that went over their output limit, possibly while another client's command ran
+        for (int i = 0; i < server->options.maxClients; i++) {
+            if (server->clients[i].clientFd != -1 && server->clients[i].closing) {
+                closeClient(server, i);
+            }
+        }
+        if (server->metricsFd != -1) {
+            for (int i = 0; i < MAX_METRICS_CONN; i++) {
+                short revents = server->pollFds[METRICS_POLL_IDX + i].revents;
+                if (server->metricsClients[i].fd != -1 && revents != 0) {
+                    handleMetricsClient(server, i, revents);
+                }
+            }
+            if (server->pollFds[METRICS_LISTEN_POLL_IDX].revents & POLLIN) {
+                acceptMetricsClients(server);
+            }
+        }
+        for (int i = 0; i < MAX_REPLICA_CONN; i++) {
+            short revents = server->pollFds[REPLICA_POLL_IDX + i].revents;
+            if (server->replicas[i].fd != -1 && revents != 0) {
+                handleReplica(server, i, revents);
+            }
+        }
+        if (server->upstream.clientFd != -1 && server->pollFds[UPSTREAM_POLL_IDX].revents != 0) {
+            handleUpstream(server, server->pollFds[UPSTREAM_POLL_IDX].revents);
+        }
     }
     destroyServer(server);
 }
 
-int sendClientData(int clientFd, const char *data, int size) {
-    if (send(clientFd, data, size, 0) < 0) {
+ClientConnection_t *serverGetClient(Server_t *server, int clientFd) {
+    for (int i = 0; i < server->options.maxClients; i++) {
+        if (server->clients[i].clientFd == clientFd) {
+            return &server->clients[i];
+        }
+    }
+    return NULL;
+}
+
+int serverNumClients(Server_t *server) {
+    int numClients = 0;
+    for (int i = 0; i < server->options.maxClients; i++) {
+        if (server->clients[i].clientFd != -1) {
+            numClients++;
+        }
+    }
+    return numClients;
+}
+
+int sendClientData(Server_t *server, int clientFd, const char *data, int size) {
+    TRACE2(send, clientFd, size);
+    ClientConnection_t *client = serverGetClient(server, clientFd);
+    if (client == NULL) {
+        // the reply to sync, sent before the replica starts streaming
+        return send(clientFd, data, size, MSG_NOSIGNAL) < 0 ? -1 : 0;
+    }
+    if (client->closing) {
         return -1;
     }
+    int sent = 0;
+    if (client->outLen == 0) {
+        // nothing is waiting, so the data can go straight to the socket
+        sent = send(clientFd, data, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            client->closing = 1;
+            return -1;
+        }
+        sent = sent < 0 ? 0 : sent;
+        if (sent == size) {
+            return 0;
+        }
+    }
+    int left = size - sent;
+    if (client->outLen + left > server->options.outputLimit) {
+        LOG_WARN("Client fd=%d has more than %d bytes of output waiting, disconnecting", clientFd,
+                 server->options.outputLimit);
+        client->closing = 1;
+        server->slowClientsClosed++;
+        return -1;
+    }
+    if (client->outLen + left > client->outCap) {
+        int cap = client->outCap * 2 > client->outLen + left ? client->outCap * 2 : client->outLen + left;
+        char *buf = realloc(client->outBuffer, cap);
+        if (buf == NULL) {
+            client->closing = 1;
+            return -1;
+        }
+        client->outBuffer = buf;
+        client->outCap = cap;
+    }
+    memcpy(client->outBuffer + client->outLen, data + sent, left);
+    client->outLen += left;
+    server->pollFds[CLIENT_POLL_IDX + (client - server->clients)].events = POLLIN | POLLOUT;
     return 0;
 }
\ No newline at end of file
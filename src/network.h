@@ -1,36 +1,285 @@
 #pragma once
 
 #include <poll.h>
+#include <stdint.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 
 #define SERVER_DEFAULT_PORT 1337
-#define MAX_SERVER_CONN 20
-#define SERVER_BACKLOG 20
+#define SERVER_DEFAULT_MAX_CLIENTS 20
+#define SERVER_DEFAULT_BACKLOG 20
+// longest command and reply, a protocol limit rather than a tunable
 #define BUFFER_SIZE 1024
+#define MAX_METRICS_CONN 4
+#define METRICS_BUFFER_SIZE 4096
+#define MAX_REPLICA_CONN 4
+#define REPLICA_BUFFER_SIZE 16384
+#define REPLICA_INPUT_SIZE 128
+// a client with more output than this waiting to be sent is disconnected, unless configured otherwise
+#define CLIENT_DEFAULT_OUTPUT_LIMIT (1024 * 1024)
 
+/*
+ * Commands are terminated by a newline or a NUL byte, so clients can pipeline several commands in a
+ * single message. Until a client sends its first newline, a message without a terminator is treated as
+ * one complete command. A command that doesn't fit in the input buffer is answered with an error and
+ * skipped, never run in part.
+ *
+ * Output the socket doesn't take right away waits in the output buffer of the client until the socket
+ * is writable again, so a client that doesn't read never blocks the event loop. A client whose output
+ * grows past the output limit of the server is disconnected.
+ */
 typedef struct ClientConnection_t {
     int clientFd;
     struct sockaddr *addr;
     socklen_t addrLen;
+    char inBuffer[BUFFER_SIZE]; /* Received data that doesn't form a complete command yet */
+    int inLen;
+    int framed; /* Set once the client terminated a command with a newline */
+    int discarding; /* Set while skipping the rest of a command that was too long */
+    int db;     /* Database the client chose, 0 when it connects */
+    int tracking; /* TrackingMode_t of the client, off (0) when it connects */
+    struct Transaction *multi; /* Commands queued since multi, NULL outside of a transaction. Freed with the client */
+    char *outBuffer;           /* Output not sent yet */
+    int outLen;
+    int outCap;
+    int closing; /* Set once the client went over the output limit, it is closed after its input is processed */
 } ClientConnection_t;
 
+// Position of a metrics renderer in the page it is rendering
+typedef struct MetricsCursor {
+    int section;
+    int item;
+} MetricsCursor_t;
+
+/**
+ * Render the next part of the metrics page into buf, starting at the cursor and advancing it
+ *
+ * @returns The number of bytes written, 0 once the page is complete
+ */
+typedef int (*metrics_renderer_t)(void *ctx, MetricsCursor_t *cursor, char *buf, int cap);
+
+typedef enum MetricsState {
+    METRICS_READING, /* Waiting for the whole HTTP request */
+    METRICS_WRITING, /* Sending the response as it is rendered */
+} MetricsState_t;
+
+/*
+ * An HTTP connection to the metrics port. The response is rendered into buffer a chunk at a time as
+ * the socket becomes writable, so a scrape never allocates.
+ */
+typedef struct MetricsConnection {
+    int fd;
+    MetricsState_t state;
+    char buffer[METRICS_BUFFER_SIZE];
+    int len;  /* Bytes of the request read, or of the response chunk rendered */
+    int sent; /* Bytes of the response chunk already sent */
+    int done; /* Set once the last chunk was rendered */
+    MetricsCursor_t cursor;
+} MetricsConnection_t;
+
+// Position of a replica in the replication stream
+typedef struct ReplicaCursor {
+    char *snapshot;        /* Sent before the stream and freed once sent, NULL if there is none */
+    uint64_t snapshotLen;
+    uint64_t snapshotSent;
+    uint64_t offset;       /* Replication offset of the next byte of the stream to send */
+    uint64_t ackOffset;    /* Offset the replica last reported it applied */
+    uint64_t ackTimeMs;    /* Wall clock time of that report, 0 if there was none */
+} ReplicaCursor_t;
+
+/**
+ * Copy the next bytes for a replica into buf, starting at the cursor and advancing it
+ *
+ * @returns The number of bytes copied, 0 if the replica is up to date, or -1 if it fell so far
+ * behind that it must be dropped
+ */
+typedef int (*replica_feeder_t)(void *ctx, ReplicaCursor_t *cursor, char *buf, int cap);
+
+/**
+ * Handle a line sent by a replica, including its newline
+ *
+ * @returns 0 if successful, -1 if the replica must be dropped
+ */
+typedef int (*replica_reader_t)(void *ctx, ReplicaCursor_t *cursor, const char *line, int len);
+
+/*
+ * A client that asked to replicate this server. Whatever the feeder has for it is sent as the socket
+ * becomes writable, so a slow replica never holds up the other clients.
+ */
+typedef struct ReplicaConnection {
+    int fd;
+    struct sockaddr *addr;
+    socklen_t addrLen;
+    char buffer[REPLICA_BUFFER_SIZE];
+    int len;  /* Bytes in buffer */
+    int sent; /* Bytes of buffer already sent */
+    char inBuffer[REPLICA_INPUT_SIZE]; /* Received data that doesn't form a complete line yet */
+    int inLen;
+    ReplicaCursor_t cursor;
+} ReplicaConnection_t;
+
+struct Server_t;
+
+typedef void (*timer_handler_t)(struct Server_t *server);
+
+typedef void (*client_close_handler_t)(struct Server_t *server, int clientFd);
+
+typedef void (*data_handler_t)(int clientFd, const char *data, int size, struct sockaddr *addr, socklen_t addrLen);
+
+/*
+ * How the server listens and treats the sockets of its clients. bind, maxClients and backlog are only
+ * read by createServer. The others can be changed while the server runs, the socket options apply to the
+ * clients accepted afterwards and the output limit to every client right away.
+ */
+typedef struct ServerOptions {
+    const char *bind; /* Address TCP clients and scrapes connect to, NULL for the loopback interface */
+    int maxClients;   /* Clients served at once, further clients are closed right after being accepted */
+    int backlog;      /* Connections the kernel queues before they are accepted */
+    int tcpNoDelay;   /* Set to send small replies right away instead of letting Nagle hold them back */
+    int rcvbuf;       /* SO_RCVBUF of the client sockets, 0 for the kernel default */
+    int sndbuf;       /* SO_SNDBUF of the client sockets, 0 for the kernel default */
+    int outputLimit;  /* Bytes of output a client can have waiting before it is disconnected */
+} ServerOptions_t;
+
 typedef struct Server_t {
-    int serverFd;
+    int serverFd; /* -1 if the server only listens on a unix socket */
     int port;
-    ClientConnection_t clients[MAX_SERVER_CONN];
-    struct pollfd pollFds[MAX_SERVER_CONN + 1];
+    int unixFd; /* -1 unless enabled with serverEnableUnix */
+    char unixPath[sizeof(((struct sockaddr_un *)0)->sun_path)]; /* Removed when the server stops, unless abstract */
+    ServerOptions_t options;
+    ClientConnection_t *clients; /* options.maxClients of them */
+    int metricsFd; /* -1 unless enabled with serverEnableMetrics */
+    metrics_renderer_t metricsRenderer;
+    void *metricsCtx;
+    MetricsConnection_t metricsClients[MAX_METRICS_CONN];
+    uint64_t totalConnections; /* Clients accepted since the server started */
+    replica_feeder_t replicaFeeder;
+    replica_reader_t replicaReader;
+    void *replicaCtx;
+    ReplicaConnection_t replicas[MAX_REPLICA_CONN];
+    ClientConnection_t upstream; /* Connection to the server this one replicates, clientFd is -1 if none */
+    int upstreamConnecting;      /* Set until the non-blocking connect to the upstream completes */
+    char upstreamHello[BUFFER_SIZE]; /* Sent to the upstream once connected */
+    int upstreamHelloLen;
+    data_handler_t upstreamHandler;
+    int timerIntervalMs; /* -1 unless set with serverSetTimer */
+    timer_handler_t onTimer;
+    uint64_t lastTimerMs;
+    client_close_handler_t onClientClose;
+    uint64_t slowClientsClosed; /* Clients disconnected because they went over the output limit */
+    struct pollfd *pollFds; /* The listening sockets, upstream, metrics clients and replicas, then the clients */
+    int numPollFds;
 } Server_t;
 
-typedef void (*data_handler_t)(int clientFd, const char *data, int size, struct sockaddr *addr, socklen_t addrLen);
+/**
+ * @returns The options of a server nobody configured
+ */
+ServerOptions_t serverDefaultOptions();
 
 /**
  * Creates the server represented by the parameter server
  *
- * @param port The port to listen on
+ * @param port The port to listen on, 0 to only listen on a unix socket enabled with serverEnableUnix
+ * @param options How to listen and treat the clients, NULL for serverDefaultOptions()
  *
  * @returns The struct representing the server, or NULL on error
  */
-Server_t *createServer(int port);
+Server_t *createServer(int port, const ServerOptions_t *options);
+
+/**
+ * Change the options that can change while the server runs, bind, maxClients and backlog are left alone
+ */
+void serverSetOptions(Server_t *server, const ServerOptions_t *options);
+
+/**
+ * Also accept clients on a unix socket, which skips the TCP stack for clients on the same host. They are
+ * served like the clients connecting over TCP
+ *
+ * @param server The server
+ * @param path The path of the socket, or @name for a socket in the abstract namespace that leaves no
+ * file behind
+ *
+ * @returns 0 if successful, -1 if the socket couldn't be listened on
+ */
+int serverEnableUnix(Server_t *server, const char *path);
+
+/**
+ * Serve HTTP GET /metrics on a second port from the same event loop
+ *
+ * @param server The server
+ * @param port The port to listen on for scrapes
+ * @param renderer Renders the body of the response
+ * @param ctx Passed to the renderer
+ *
+ * @returns 0 if successful, -1 if the port couldn't be listened on
+ */
+int serverEnableMetrics(Server_t *server, int port, metrics_renderer_t renderer, void *ctx);
+
+/**
+ * Set the feeder that produces the bytes sent to replicas and the reader of what they send back
+ */
+void serverSetReplicaFeeder(Server_t *server, replica_feeder_t feeder, replica_reader_t reader, void *ctx);
+
+/**
+ * Turn a connected client into a replica. The client stops being served commands and from now on is
+ * sent whatever the feeder produces for the cursor. The caller can still reply on the socket with
+ * sendClientData before returning to the event loop.
+ *
+ * @param server The server
+ * @param clientFd The socket of the client
+ * @param cursor The position of the replica, its snapshot is owned by the server from now on
+ *
+ * @returns 0 if successful, -1 if the client is unknown or there is no room for another replica
+ */
+int serverAddReplica(Server_t *server, int clientFd, ReplicaCursor_t cursor);
+
+/**
+ * Let the replicas know more of the stream is available
+ */
+void serverWakeReplicas(Server_t *server);
+
+/**
+ * Disconnect all replicas
+ */
+void serverCloseReplicas(Server_t *server);
+
+/**
+ * @returns The number of replicas connected to the server
+ */
+int serverNumReplicas(Server_t *server);
+
+/**
+ * Connect to another server without blocking, send it hello once connected and then call handler
+ * for every line it sends, including the newline. Any previous upstream is closed. If the connection
+ * fails or is lost, upstream.clientFd is set back to -1.
+ *
+ * @returns 0 if the connection is under way, -1 on error
+ */
+int serverConnectUpstream(Server_t *server, const char *host, int port, const char *hello, int hellolen,
+                          data_handler_t handler);
+
+/**
+ * Send data to the upstream without blocking
+ *
+ * @returns 0 if all of it was sent, -1 otherwise
+ */
+int serverSendUpstream(Server_t *server, const char *data, int size);
+
+/**
+ * Close the connection to the upstream, if any
+ */
+void serverCloseUpstream(Server_t *server);
+
+/**
+ * Call onTimer from the event loop about every intervalMs milliseconds
+ */
+void serverSetTimer(Server_t *server, int intervalMs, timer_handler_t onTimer);
+
+/**
+ * Call onClose whenever a client disconnects, is disconnected or becomes a replica, while its clientFd
+ * still identifies it
+ */
+void serverSetClientCloseHandler(Server_t *server, client_close_handler_t onClose);
 
 /**
  * Destroy server
@@ -40,9 +289,25 @@ void destroyServer(Server_t *server);
 /**
  * Run the server.
  * Blocks and waits for some client requests to come in and then calls the callback function
- * with the data sent by the client.
+ * once for every command sent by the client, including its terminator.
  * Will also accept new clients if a new client is connecting to the server.
  */
 void runServer(Server_t *server, data_handler_t onData);
 
-int sendClientData(int clientFd, const char *data, int size);
\ No newline at end of file
+/**
+ * @returns The connection of a client, or NULL if no client is connected on clientFd
+ */
+ClientConnection_t *serverGetClient(Server_t *server, int clientFd);
+
+/**
+ * @returns The number of clients connected to the server
+ */
+int serverNumClients(Server_t *server);
+
+/**
+ * Send data to a client, keeping what the socket doesn't take in its output buffer. A clientFd that just
+ * became a replica gets the data right away
+ *
+ * @returns 0 if the data was sent or buffered, -1 if the client is gone or went over the output limit
+ */
+int sendClientData(Server_t *server, int clientFd, const char *data, int size);
\ No newline at end of file
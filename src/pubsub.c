@@ -0,0 +1,207 @@
+#include "pubsub.h"
+#include "hashtable.h"
+#include <stdlib.h>
+#include <string.h>
+
+static uint64_t pubsubBucket(PubSub_t *ps, const char *channel, size_t len) {
+    return htHashFunction(channel, len) & (((uint64_t)1 << ps->exp) - 1);
+}
+
+static Channel_t *pubsubFind(PubSub_t *ps, const char *channel, size_t len) {
+    Channel_t *ch = ps->buckets[pubsubBucket(ps, channel, len)];
+    while (ch != NULL && (ch->len != len || memcmp(ch->name, channel, len) != 0)) {
+        ch = ch->next;
+    }
+    return ch;
+}
+
+// double the buckets once there are as many channels, a failed grow only makes the chains longer
+static void pubsubGrow(PubSub_t *ps) {
+    uint64_t size = (uint64_t)1 << ps->exp;
+    Channel_t **buckets = calloc(size * 2, sizeof(Channel_t *));
+    if (buckets == NULL) {
+        return;
+    }
+    Channel_t **old = ps->buckets;
+    ps->buckets = buckets;
+    ps->exp++;
+    for (uint64_t i = 0; i < size; i++) {
+        Channel_t *ch = old[i];
+        while (ch != NULL) {
+            Channel_t *next = ch->next;
+            uint64_t idx = pubsubBucket(ps, ch->name, ch->len);
+            ch->next = buckets[idx];
+            buckets[idx] = ch;
+            ch = next;
+        }
+    }
+    free(old);
+}
+
+// unlink and free a channel that lost its last subscriber
+static void pubsubRemoveChannel(PubSub_t *ps, Channel_t *ch) {
+    Channel_t **link = &ps->buckets[pubsubBucket(ps, ch->name, ch->len)];
+    while (*link != ch) {
+        link = &(*link)->next;
+    }
+    *link = ch->next;
+    free(ch->name);
+    free(ch->subscribers);
+    free(ch);
+    ps->numChannels--;
+}
+
+// remove a subscriber from a channel, returns 0 if it was subscribed
+static int pubsubRemoveSubscriber(PubSub_t *ps, Channel_t *ch, int fd) {
+    for (int i = 0; i < ch->numSubscribers; i++) {
+        if (ch->subscribers[i] == fd) {
+            ch->subscribers[i] = ch->subscribers[--ch->numSubscribers];
+            ps->numSubscriptions--;
+            if (ch->numSubscribers == 0) {
+                pubsubRemoveChannel(ps, ch);
+            }
+            return 0;
+        }
+    }
+    return 1;
+}
+
+PubSub_t *pubsubCreate() {
+    PubSub_t *ps = calloc(1, sizeof(PubSub_t));
+    if (ps == NULL) {
+        return NULL;
+    }
+    ps->exp = PUBSUB_INITIAL_EXP;
+    ps->buckets = calloc((size_t)1 << ps->exp, sizeof(Channel_t *));
+    if (ps->buckets == NULL) {
+        free(ps);
+        return NULL;
+    }
+    return ps;
+}
+
+void pubsubDelete(PubSub_t *ps) {
+    for (uint64_t i = 0; i < ((uint64_t)1 << ps->exp); i++) {
+        Channel_t *ch = ps->buckets[i];
+        while (ch != NULL) {
+            Channel_t *next = ch->next;
+            free(ch->name);
+            free(ch->subscribers);
+            free(ch);
+            ch = next;
+        }
+    }
+    free(ps->buckets);
+    free(ps);
+}
+
+int pubsubSubscribe(PubSub_t *ps, const char *channel, size_t len, int fd) {
+    Channel_t *ch = pubsubFind(ps, channel, len);
+    if (ch == NULL) {
+        ch = calloc(1, sizeof(Channel_t));
+        if (ch == NULL || (ch->name = malloc(len)) == NULL) {
+            free(ch);
+            return 2;
+        }
+        memcpy(ch->name, channel, len);
+        ch->len = len;
+        if (ps->numChannels == ((uint64_t)1 << ps->exp)) {
+            pubsubGrow(ps);
+        }
+        uint64_t idx = pubsubBucket(ps, channel, len);
+        ch->next = ps->buckets[idx];
+        ps->buckets[idx] = ch;
+        ps->numChannels++;
+    }
+    for (int i = 0; i < ch->numSubscribers; i++) {
+        if (ch->subscribers[i] == fd) {
+            return 1;
+        }
+    }
+    if (ch->numSubscribers == ch->cap) {
+        int cap = ch->cap > 0 ? ch->cap * 2 : 4;
+        int *subscribers = realloc(ch->subscribers, cap * sizeof(int));
+        if (subscribers == NULL) {
+            if (ch->numSubscribers == 0) {
+                pubsubRemoveChannel(ps, ch);
+            }
+            return 2;
+        }
+        ch->subscribers = subscribers;
+        ch->cap = cap;
+    }
+    ch->subscribers[ch->numSubscribers++] = fd;
+    ps->numSubscriptions++;
+    return 0;
+}
+
+int pubsubUnsubscribe(PubSub_t *ps, const char *channel, size_t len, int fd) {
+    Channel_t *ch = pubsubFind(ps, channel, len);
+    return ch != NULL ? pubsubRemoveSubscriber(ps, ch, fd) : 1;
+}
+
+int pubsubUnsubscribeAll(PubSub_t *ps, int fd) {
+    int removed = 0;
+    for (uint64_t i = 0; i < ((uint64_t)1 << ps->exp); i++) {
+        Channel_t *ch = ps->buckets[i];
+        while (ch != NULL) {
+            // the channel may be freed when its last subscriber goes
+            Channel_t *next = ch->next;
+            removed += pubsubRemoveSubscriber(ps, ch, fd) == 0;
+            ch = next;
+        }
+    }
+    return removed;
+}
+
+int pubsubDrop(PubSub_t *ps, const char *channel, size_t len) {
+    Channel_t *ch = pubsubFind(ps, channel, len);
+    if (ch == NULL) {
+        return 0;
+    }
+    int dropped = ch->numSubscribers;
+    ps->numSubscriptions -= dropped;
+    pubsubRemoveChannel(ps, ch);
+    return dropped;
+}
+
+Channel_t *pubsubNext(PubSub_t *ps, uint64_t *cursor) {
+    uint64_t size = (uint64_t)1 << ps->exp;
+    for (uint64_t i = 0; ps->numChannels > 0 && i < size; i++) {
+        uint64_t idx = (*cursor + i) & (size - 1);
+        if (ps->buckets[idx] != NULL) {
+            *cursor = idx + 1;
+            return ps->buckets[idx];
+        }
+    }
+    return NULL;
+}
+
+int pubsubSubscriptions(PubSub_t *ps, int fd) {
+    int count = 0;
+    for (uint64_t i = 0; i < ((uint64_t)1 << ps->exp); i++) {
+        for (Channel_t *ch = ps->buckets[i]; ch != NULL; ch = ch->next) {
+            for (int j = 0; j < ch->numSubscribers; j++) {
+                count += ch->subscribers[j] == fd;
+            }
+        }
+    }
+    return count;
+}
+
+int pubsubHasSubscribers(PubSub_t *ps, const char *channel, size_t len) {
+    return ps->numChannels > 0 && pubsubFind(ps, channel, len) != NULL;
+}
+
+uint64_t pubsubPublish(PubSub_t *ps, const char *channel, size_t len, pubsubDeliver_t deliver, void *ctx) {
+    ps->published++;
+    Channel_t *ch = ps->numChannels > 0 ? pubsubFind(ps, channel, len) : NULL;
+    if (ch == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < ch->numSubscribers; i++) {
+        deliver(ch->subscribers[i], ctx);
+    }
+    ps->delivered += ch->numSubscribers;
+    return ch->numSubscribers;
+}
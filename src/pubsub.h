@@ -0,0 +1,107 @@
+/*
+ * Channels clients subscribe to by name. A message published to a channel goes to every client
+ * subscribed to it at that moment, nothing is kept for clients that subscribe later.
+ *
+ * Subscribers are the descriptors of their connections, so a client that goes away must be removed with
+ * pubsubUnsubscribeAll before its descriptor can be reused.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef __PUBSUB_H
+#define __PUBSUB_H
+
+// 2^4 buckets before the first channel is added
+#define PUBSUB_INITIAL_EXP 4
+
+typedef struct Channel {
+    char *name;
+    size_t len;
+    int *subscribers;
+    int numSubscribers;
+    int cap;
+    struct Channel *next;
+} Channel_t;
+
+typedef struct PubSub {
+    Channel_t **buckets; /* 1 << exp chains of channels with at least one subscriber */
+    unsigned char exp;
+    uint64_t numChannels;
+    uint64_t numSubscriptions;
+    uint64_t published; /* Messages published, whether or not anyone received them */
+    uint64_t delivered; /* Messages sent to subscribers */
+} PubSub_t;
+
+/**
+ * Called by pubsubPublish for every subscriber of the channel
+ *
+ * @param fd The connection of the subscriber
+ * @param ctx The context pointer passed to pubsubPublish
+ * */
+typedef void (*pubsubDeliver_t)(int fd, void *ctx);
+
+/**
+ * @returns An empty registry or NULL on error
+ * */
+PubSub_t *pubsubCreate();
+
+void pubsubDelete(PubSub_t *ps);
+
+/**
+ * @returns 0 if fd is now subscribed, 1 if it already was, 2 on allocation failure
+ * */
+int pubsubSubscribe(PubSub_t *ps, const char *channel, size_t len, int fd);
+
+/**
+ * @returns 0 if fd was unsubscribed, 1 if it wasn't subscribed
+ * */
+int pubsubUnsubscribe(PubSub_t *ps, const char *channel, size_t len, int fd);
+
+/**
+ * Remove every subscription of a connection
+ *
+ * @returns The number of channels fd was subscribed to
+ * */
+int pubsubUnsubscribeAll(PubSub_t *ps, int fd);
+
+/**
+ * @returns The number of channels fd is subscribed to
+ * */
+int pubsubSubscriptions(PubSub_t *ps, int fd);
+
+/**
+ * @returns 1 if a channel has subscribers, so a caller can skip building a message nobody receives
+ * */
+int pubsubHasSubscribers(PubSub_t *ps, const char *channel, size_t len);
+
+/**
+ * Remove a channel with all its subscribers
+ *
+ * @returns The number of subscribers it had
+ * */
+int pubsubDrop(PubSub_t *ps, const char *channel, size_t len);
+
+/**
+ * Walk the channels a bucket at a time, for callers that need to pick any channel
+ *
+ * @param cursor The bucket to start looking in, set to the bucket after the one the channel is in
+ *
+ * @returns A channel or NULL if there are none
+ * */
+Channel_t *pubsubNext(PubSub_t *ps, uint64_t *cursor);
+
+/**
+ * Deliver a message to every subscriber of a channel
+ *
+ * @param deliver Called with the descriptor of each subscriber
+ * @param ctx Passed to deliver, usually the message
+ *
+ * @returns The number of subscribers that got the message
+ * */
+uint64_t pubsubPublish(PubSub_t *ps, const char *channel, size_t len, pubsubDeliver_t deliver, void *ctx);
+
+#endif /* __PUBSUB_H */
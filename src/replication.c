@@ -0,0 +1,404 @@
+#include "replication.h"
+#include "collections.h"
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// a new random replication id, for a stream with no history
+static void replNewId(char *replid) {
+    unsigned char bytes[REPL_ID_LEN / 2];
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd == -1 || read(fd, bytes, sizeof(bytes)) != sizeof(bytes)) {
+        srand(time(NULL) ^ getpid());
+        for (size_t i = 0; i < sizeof(bytes); i++) {
+            bytes[i] = rand();
+        }
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    for (size_t i = 0; i < sizeof(bytes); i++) {
+        sprintf(replid + 2 * i, "%02x", bytes[i]);
+    }
+}
+
+Replication_t *replCreate(uint64_t backlogSize) {
+    Replication_t *repl = calloc(1, sizeof(Replication_t));
+    if (repl == NULL) {
+        return NULL;
+    }
+    repl->backlog = malloc(backlogSize);
+    if (repl->backlog == NULL) {
+        free(repl);
+        return NULL;
+    }
+    repl->backlogSize = backlogSize;
+    repl->state = REPL_NONE;
+    replNewId(repl->replid);
+    return repl;
+}
+
+void replDelete(Replication_t *repl) {
+    if (repl != NULL) {
+        free(repl->backlog);
+        free(repl);
+    }
+}
+
+static void replAppend(Replication_t *repl, const char *data, size_t len) {
+    if (len >= repl->backlogSize) {
+        // only the end of the data fits
+        data += len - repl->backlogSize;
+        repl->offset += len - repl->backlogSize;
+        len = repl->backlogSize;
+    }
+    size_t pos = repl->offset % repl->backlogSize;
+    size_t first = len < repl->backlogSize - pos ? len : repl->backlogSize - pos;
+    memcpy(repl->backlog + pos, data, first);
+    memcpy(repl->backlog, data + first, len - first);
+    repl->offset += len;
+    repl->backlogLen = repl->backlogLen + len < repl->backlogSize ? repl->backlogLen + len : repl->backlogSize;
+}
+
+void replFeed(Replication_t *repl, const char *command, size_t len) {
+    if (len > 0 && (command[len - 1] == '\n' || command[len - 1] == '\0')) {
+        len--;
+    }
+    replAppend(repl, command, len);
+    replAppend(repl, "\n", 1);
+}
+
+int replRead(Replication_t *repl, uint64_t offset, char *buf, int cap) {
+    if (offset > repl->offset || offset < repl->offset - repl->backlogLen) {
+        return -1;
+    }
+    uint64_t avail = repl->offset - offset;
+    size_t pos = offset % repl->backlogSize;
+    // stop at the end of the circular buffer, the rest comes with the next read
+    size_t n = avail < repl->backlogSize - pos ? avail : repl->backlogSize - pos;
+    n = n < (size_t)cap ? n : (size_t)cap;
+    memcpy(buf, repl->backlog + pos, n);
+    return n;
+}
+
+typedef struct Snapshot {
+    char *buf;
+    uint64_t len;
+    uint64_t cap;
+    const char *key; /* Key of the collection being serialized */
+    size_t keylen;
+    const char *prefix; /* Put before every command */
+    int failed;
+} Snapshot_t;
+
+// append a command to the snapshot, growing it as needed
+static void snapshotAppend(Snapshot_t *snap, const char *fmt, ...) {
+    va_list args;
+    while (!snap->failed) {
+        va_start(args, fmt);
+        int n = vsnprintf(snap->buf + snap->len, snap->cap - snap->len, fmt, args);
+        va_end(args);
+        if (n < 0) {
+            snap->failed = 1;
+        } else if (snap->len + n < snap->cap) {
+            snap->len += n;
+            return;
+        } else {
+            char *buf = realloc(snap->buf, (snap->cap + n) * 2);
+            if (buf == NULL) {
+                snap->failed = 1;
+            } else {
+                snap->buf = buf;
+                snap->cap = (snap->cap + n) * 2;
+            }
+        }
+    }
+}
+
+static int snapshotListElement(const char *s, size_t len, void *ctx) {
+    Snapshot_t *snap = ctx;
+    snapshotAppend(snap, "%srpush %.*s %.*s\n", snap->prefix, (int)snap->keylen, snap->key, (int)len, s);
+    return snap->failed;
+}
+
+static int snapshotSetMember(const char *s, size_t len, void *ctx) {
+    Snapshot_t *snap = ctx;
+    snapshotAppend(snap, "%ssadd %.*s %.*s\n", snap->prefix, (int)snap->keylen, snap->key, (int)len, s);
+    return snap->failed;
+}
+
+static int snapshotHashField(const char *field, size_t fieldlen, const char *val, size_t vallen, void *ctx) {
+    Snapshot_t *snap = ctx;
+    snapshotAppend(snap, "%shset %.*s %.*s %.*s\n", snap->prefix, (int)snap->keylen, snap->key, (int)fieldlen,
+                   field, (int)vallen, val);
+    return snap->failed;
+}
+
+typedef struct SnapshotEntries {
+    Snapshot_t *snap;
+    Hashtable_t *ht;
+} SnapshotEntries_t;
+
+static int snapshotEntry(HashtableEntry_t *hte, void *ctx) {
+    SnapshotEntries_t *entries = ctx;
+    Snapshot_t *snap = entries->snap;
+    HashtableValue_t htv = htEntryValue(entries->ht, hte);
+    int keylen = hte->keylen;
+    snap->key = hte->key;
+    snap->keylen = hte->keylen;
+    switch (htv.entryType) {
+    case STRING:
+        snapshotAppend(snap, "%sinsert %.*s string %s\n", snap->prefix, keylen, hte->key, htv.v.val);
+        break;
+    case UNSIGNED_INT:
+        snapshotAppend(snap, "%sinsert %.*s uint %lu\n", snap->prefix, keylen, hte->key, htv.v.u64);
+        break;
+    case SIGNED_INT:
+        snapshotAppend(snap, "%sinsert %.*s int %ld\n", snap->prefix, keylen, hte->key, htv.v.s64);
+        break;
+    case DOUBLE:
+        // enough digits to parse back to the same double
+        snapshotAppend(snap, "%sinsert %.*s double %.17g\n", snap->prefix, keylen, hte->key, htv.v.d);
+        break;
+    case LIST:
+        listRange(htv.v.list, 0, -1, snapshotListElement, snap);
+        break;
+    case HASH:
+        hashForEach(htv.v.hash, snapshotHashField, snap);
+        break;
+    case SET:
+        setForEach(htv.v.set, snapshotSetMember, snap);
+        break;
+    default:
+        break;
+    }
+    return snap->failed;
+}
+
+char *replSnapshot(Hashtable_t **dbs, int numDbs, int streamDb, uint64_t *len) {
+    Snapshot_t snap = {malloc(BUFFER_SIZE), 0, BUFFER_SIZE, NULL, 0, "", 0};
+    if (snap.buf == NULL) {
+        return NULL;
+    }
+    // a replica loads the snapshot starting in database 0
+    int selected = 0;
+    for (int db = 0; db < numDbs; db++) {
+        Hashtable_t *ht = dbs[db];
+        if (ht == NULL) {
+            continue;
+        }
+        if (db != selected) {
+            snapshotAppend(&snap, "use %d\n", db);
+            selected = db;
+        }
+        // the settings first, so the keys are stored and indexed the same way on the replica
+        if (ht->compressThreshold > 0) {
+            snapshotAppend(&snap, "compression %lu %u\n", ht->compressThreshold, ht->compressMinSavings);
+        }
+        if (ht->keyIndex != NULL) {
+            snapshotAppend(&snap, "keyindex enable\n");
+        }
+        for (HashtableIndex_t *index = ht->indexes; index != NULL; index = index->next) {
+            snapshotAppend(&snap, "index %.*s\n", (int)index->prefixlen, index->prefix);
+        }
+        SnapshotEntries_t entries = {&snap, ht};
+        htForEach(ht, snapshotEntry, &entries);
+    }
+    // the stream goes on in the database it was in
+    if (selected != streamDb) {
+        snapshotAppend(&snap, "use %d\n", streamDb);
+    }
+    if (snap.failed) {
+        free(snap.buf);
+        return NULL;
+    }
+    *len = snap.len;
+    return snap.buf;
+}
+
+char *replSerializeEntry(Hashtable_t *ht, HashtableEntry_t *hte, const char *prefix, uint64_t *len) {
+    Snapshot_t snap = {malloc(BUFFER_SIZE), 0, BUFFER_SIZE, NULL, 0, prefix, 0};
+    if (snap.buf == NULL) {
+        return NULL;
+    }
+    SnapshotEntries_t entries = {&snap, ht};
+    snapshotEntry(hte, &entries);
+    if (snap.failed) {
+        free(snap.buf);
+        return NULL;
+    }
+    *len = snap.len;
+    return snap.buf;
+}
+
+int replSync(Replication_t *repl, Hashtable_t **dbs, int numDbs, int streamDb, const char *replid, uint64_t offset,
+             ReplicaCursor_t *cursor, char *reply) {
+    if (strcmp(replid, repl->replid) == 0 && offset <= repl->offset && offset >= repl->offset - repl->backlogLen) {
+        cursor->snapshot = NULL;
+        cursor->snapshotLen = 0;
+        cursor->snapshotSent = 0;
+        cursor->offset = offset;
+        cursor->ackOffset = offset;
+        cursor->ackTimeMs = 0;
+        repl->partialSyncs++;
+        sprintf(reply, "+CONTINUE %s %lu", repl->replid, offset);
+        return 0;
+    }
+    uint64_t len;
+    char *snapshot = replSnapshot(dbs, numDbs, streamDb, &len);
+    if (snapshot == NULL) {
+        return -1;
+    }
+    cursor->snapshot = snapshot;
+    cursor->snapshotLen = len;
+    cursor->snapshotSent = 0;
+    cursor->offset = repl->offset;
+    cursor->ackOffset = 0;
+    cursor->ackTimeMs = 0;
+    repl->fullSyncs++;
+    sprintf(reply, "+FULLRESYNC %s %lu %lu", repl->replid, repl->offset, len);
+    return 1;
+}
+
+int replFeeder(void *ctx, ReplicaCursor_t *cursor, char *buf, int cap) {
+    Replication_t *repl = ctx;
+    if (cursor->snapshot != NULL) {
+        uint64_t left = cursor->snapshotLen - cursor->snapshotSent;
+        int n = left < (uint64_t)cap ? left : (uint64_t)cap;
+        memcpy(buf, cursor->snapshot + cursor->snapshotSent, n);
+        cursor->snapshotSent += n;
+        if (cursor->snapshotSent == cursor->snapshotLen) {
+            free(cursor->snapshot);
+            cursor->snapshot = NULL;
+        }
+        if (n > 0) {
+            return n;
+        }
+    }
+    int n = replRead(repl, cursor->offset, buf, cap);
+    if (n > 0) {
+        cursor->offset += n;
+    }
+    return n;
+}
+
+uint64_t replNowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void replHeartbeat(Replication_t *repl) {
+    char ping[64];
+    int len = sprintf(ping, "ping %lu\n", replNowMs());
+    replFeed(repl, ping, len);
+}
+
+int replAck(Replication_t *repl, char *buf) {
+    return sprintf(buf, "replack %lu\n", repl->offset);
+}
+
+int replReader(void *ctx, ReplicaCursor_t *cursor, const char *line, int len) {
+    uint64_t offset;
+    if (sscanf(line, "replack %lu", &offset) != 1) {
+        return -1;
+    }
+    cursor->ackOffset = offset;
+    cursor->ackTimeMs = replNowMs();
+    return 0;
+}
+
+int64_t replLagMs(Replication_t *repl) {
+    if (repl->state == REPL_NONE) {
+        return 0;
+    }
+    if (repl->primaryTimeMs == 0) {
+        return -1;
+    }
+    uint64_t now = replNowMs();
+    return now > repl->primaryTimeMs ? now - repl->primaryTimeMs : 0;
+}
+
+void replSetPrimary(Replication_t *repl, const char *host, int port) {
+    if (host == NULL) {
+        repl->state = REPL_NONE;
+        return;
+    }
+    snprintf(repl->primaryHost, REPL_MAX_HOST_LEN, "%s", host);
+    repl->primaryPort = port;
+    repl->primaryTimeMs = 0;
+    repl->state = REPL_CONNECT;
+}
+
+int replHandshake(Replication_t *repl, char *buf) {
+    repl->state = REPL_HANDSHAKE;
+    repl->lastConnectMs = replNowMs();
+    return sprintf(buf, "sync %s %lu\n", repl->replid, repl->offset);
+}
+
+// the keyspace is now the one of the primary at the offset the stream starts from
+static void replSnapshotLoaded(Replication_t *repl) {
+    strcpy(repl->replid, repl->pendingReplid);
+    repl->offset = repl->pendingOffset;
+    repl->backlogLen = 0;
+    repl->state = REPL_STREAMING;
+}
+
+ReplLine_t replProcessLine(Replication_t *repl, const char *line, int len) {
+    char replid[REPL_ID_LEN + 1];
+    uint64_t offset, snapshotLen, pingMs;
+    switch (repl->state) {
+    case REPL_HANDSHAKE:
+        if (sscanf(line, "+CONTINUE %40s %lu", replid, &offset) == 2 && strcmp(replid, repl->replid) == 0 &&
+            offset == repl->offset) {
+            repl->state = REPL_STREAMING;
+            return REPL_LINE_SKIP;
+        }
+        if (sscanf(line, "+FULLRESYNC %40s %lu %lu", replid, &offset, &snapshotLen) == 3 &&
+            strlen(replid) == REPL_ID_LEN) {
+            strcpy(repl->pendingReplid, replid);
+            repl->pendingOffset = offset;
+            repl->snapshotRemaining = snapshotLen;
+            repl->state = REPL_SNAPSHOT;
+            // until the snapshot is loaded the keyspace matches no stream
+            replNewId(repl->replid);
+            if (snapshotLen == 0) {
+                replSnapshotLoaded(repl);
+            }
+            return REPL_LINE_FLUSH;
+        }
+        return REPL_LINE_ERROR;
+    case REPL_SNAPSHOT:
+        if ((uint64_t)len > repl->snapshotRemaining) {
+            return REPL_LINE_ERROR;
+        }
+        repl->snapshotRemaining -= len;
+        if (repl->snapshotRemaining == 0) {
+            replSnapshotLoaded(repl);
+        }
+        return REPL_LINE_APPLY;
+    case REPL_STREAMING:
+        replFeed(repl, line, len);
+        if (sscanf(line, "ping %lu", &pingMs) == 1) {
+            repl->primaryTimeMs = pingMs;
+            return REPL_LINE_SKIP;
+        }
+        return REPL_LINE_APPLY;
+    default:
+        return REPL_LINE_ERROR;
+    }
+}
+
+void replConnectionLost(Replication_t *repl) {
+    if (repl->state == REPL_SNAPSHOT) {
+        // the keyspace is half loaded, it matches no stream
+        replNewId(repl->replid);
+    }
+    if (repl->state != REPL_NONE) {
+        repl->state = REPL_CONNECT;
+    }
+}
@@ -0,0 +1,232 @@
+/*
+ * Primary/replica replication in the spirit of redis. Every command that modifies the keyspace is
+ * appended, as the client sent it, to the replication stream. The position in the stream is its
+ * offset, and the last bytes of the stream are kept in a circular backlog.
+ *
+ * A replica connects to its primary like any client and sends
+ *
+ *   sync <replid> <offset>
+ *
+ * with the id of the stream it has and the offset of the next byte it needs. If the primary has the
+ * same stream and the offset is still in its backlog it replies
+ *
+ *   +CONTINUE <replid> <offset>
+ *
+ * and streams the commands from there on. Otherwise it replies
+ *
+ *   +FULLRESYNC <replid> <offset> <snapshotlen>
+ *
+ * followed by a snapshot of snapshotlen bytes, which is a sequence of commands recreating the keyspace
+ * as it was at offset, and then the stream from offset. A replica applies the stream to its own
+ * keyspace and appends it to its own backlog with the same offsets, so it can feed replicas of its own
+ * and keep the history when it is promoted.
+ *
+ * Commands apply to the database their client switched to with use. The stream switches databases the
+ * same way, a primary adds
+ *
+ *   use <db>
+ *
+ * before a write to another database than the previous write.
+ *
+ * While it has replicas, a primary adds a heartbeat to the stream every REPL_TIMER_INTERVAL_MS
+ *
+ *   ping <wall clock ms>
+ *
+ * and the replicas report the offset they applied with
+ *
+ *   replack <offset>
+ *
+ * A replica that applied a heartbeat has every write the primary made before it, so the age of the
+ * last heartbeat bounds how stale the replica is. Comparing it across hosts assumes their clocks are
+ * in sync. Replicas reject writes from their own clients.
+ *
+ */
+
+#pragma once
+
+#include "hashtable.h"
+#include "network.h"
+#include <stdint.h>
+
+#ifndef __REPLICATION_H
+#define __REPLICATION_H
+
+#define REPL_DEFAULT_BACKLOG_SIZE (1024 * 1024)
+#define REPL_ID_LEN 40
+#define REPL_MAX_HOST_LEN 256
+// how often a replica that lost its primary tries to connect again
+#define REPL_RECONNECT_INTERVAL_MS 1000
+// how often a primary sends heartbeats and its replicas report their offset
+#define REPL_TIMER_INTERVAL_MS 100
+
+typedef enum ReplState {
+    REPL_NONE,      /* Not replicating anyone */
+    REPL_CONNECT,   /* Waiting to connect to the primary */
+    REPL_HANDSHAKE, /* Waiting for the reply to sync */
+    REPL_SNAPSHOT,  /* Loading the snapshot */
+    REPL_STREAMING, /* Applying the stream */
+} ReplState_t;
+
+typedef enum ReplLine {
+    REPL_LINE_SKIP,  /* Nothing to do */
+    REPL_LINE_APPLY, /* Apply the line to the keyspace */
+    REPL_LINE_FLUSH, /* Empty the keyspace before the snapshot */
+    REPL_LINE_ERROR, /* The primary sent something unexpected, drop the connection */
+} ReplLine_t;
+
+typedef struct Replication {
+    char replid[REPL_ID_LEN + 1]; /* Identifies the stream, shared by a primary and its replicas */
+    uint64_t offset;              /* Bytes of the stream so far */
+    char *backlog;                /* Circular buffer holding the end of the stream */
+    uint64_t backlogSize;
+    uint64_t backlogLen;          /* Bytes of the stream in the backlog, at most backlogSize */
+    uint64_t fullSyncs;           /* Syncs served with a snapshot */
+    uint64_t partialSyncs;        /* Syncs served from the backlog */
+    /* Replica side */
+    ReplState_t state;
+    char primaryHost[REPL_MAX_HOST_LEN];
+    int primaryPort;
+    char pendingReplid[REPL_ID_LEN + 1]; /* The stream announced by the primary, adopted once the snapshot is loaded */
+    uint64_t pendingOffset;
+    uint64_t snapshotRemaining;          /* Bytes of the snapshot still to load */
+    uint64_t lastConnectMs;              /* When the last connection to the primary was attempted */
+    uint64_t primaryTimeMs;              /* Time in the last heartbeat applied, 0 if there was none */
+} Replication_t;
+
+/**
+ * Create the replication state of a server with a new random replication id and an empty backlog
+ *
+ * @param backlogSize The number of bytes of the stream kept for partial resyncs
+ *
+ * @returns The replication state or NULL on error
+ * */
+Replication_t *replCreate(uint64_t backlogSize);
+
+/**
+ * Free the replication state
+ * */
+void replDelete(Replication_t *repl);
+
+/**
+ * Append a command to the stream. A command not terminated by a newline gets one
+ *
+ * @param repl The replication state
+ * @param command The command as sent by the client
+ * @param len The length of the command
+ * */
+void replFeed(Replication_t *repl, const char *command, size_t len);
+
+/**
+ * Copy the stream from an offset that is still in the backlog
+ *
+ * @returns The number of bytes copied, 0 if offset is the end of the stream, -1 if it is no longer
+ * or not yet in the backlog
+ * */
+int replRead(Replication_t *repl, uint64_t offset, char *buf, int cap);
+
+/**
+ * Serialize the keyspace as the commands that recreate it, switching to every database but the first
+ * with use before its commands
+ *
+ * @param dbs The databases, NULL for those that don't exist
+ * @param numDbs The number of databases
+ * @param streamDb The database the stream is in at the end of the snapshot, the snapshot ends in it too
+ * @param len Set to the length of the snapshot
+ *
+ * @returns The snapshot, which must be freed by the caller, or NULL on error
+ * */
+char *replSnapshot(Hashtable_t **dbs, int numDbs, int streamDb, uint64_t *len);
+
+/**
+ * Serialize a single entry as the commands that recreate it, as a snapshot would
+ *
+ * @param ht The keyspace holding the entry
+ * @param hte The entry
+ * @param prefix Put before every command
+ * @param len Set to the length of the commands
+ *
+ * @returns The commands, which must be freed by the caller, or NULL on error
+ * */
+char *replSerializeEntry(Hashtable_t *ht, HashtableEntry_t *hte, const char *prefix, uint64_t *len);
+
+/**
+ * Answer a sync request from a replica
+ *
+ * @param repl The replication state
+ * @param dbs The databases, serialized if a full resync is needed
+ * @param numDbs The number of databases
+ * @param streamDb The database the stream is in, see replSnapshot
+ * @param replid The replication id the replica has
+ * @param offset The offset of the next byte the replica needs
+ * @param cursor Set to where the replica starts
+ * @param reply Set to the reply to send before the stream, at least BUFFER_SIZE bytes
+ *
+ * @returns 1 for a full resync, 0 for a partial resync, -1 on error
+ * */
+int replSync(Replication_t *repl, Hashtable_t **dbs, int numDbs, int streamDb, const char *replid, uint64_t offset,
+             ReplicaCursor_t *cursor, char *reply);
+
+/**
+ * Feeder of the replica connections of the server, see replica_feeder_t
+ * */
+int replFeeder(void *ctx, ReplicaCursor_t *cursor, char *buf, int cap);
+
+/**
+ * Replicate another server from now on, or stop replicating with a NULL host. The keyspace and the
+ * stream are kept either way
+ * */
+void replSetPrimary(Replication_t *repl, const char *host, int port);
+
+/**
+ * Write the sync request a replica sends once connected
+ *
+ * @returns The length of the request
+ * */
+int replHandshake(Replication_t *repl, char *buf);
+
+/**
+ * Process a line received from the primary, advancing the offset and feeding the backlog with the
+ * lines of the stream
+ *
+ * @param repl The replication state
+ * @param line The line including its newline
+ * @param len The length of the line
+ *
+ * @returns What to do with the line
+ * */
+ReplLine_t replProcessLine(Replication_t *repl, const char *line, int len);
+
+/**
+ * Add a heartbeat to the stream
+ * */
+void replHeartbeat(Replication_t *repl);
+
+/**
+ * Write the report of the offset a replica applied
+ *
+ * @returns The length of the report
+ * */
+int replAck(Replication_t *repl, char *buf);
+
+/**
+ * Reader of the replica connections of the server, see replica_reader_t
+ * */
+int replReader(void *ctx, ReplicaCursor_t *cursor, const char *line, int len);
+
+/**
+ * @returns How many milliseconds behind its primary the replica may be, 0 for a primary and -1 if
+ * the replica has not applied a heartbeat yet
+ * */
+int64_t replLagMs(Replication_t *repl);
+
+/**
+ * @returns The wall clock time in milliseconds, as used in heartbeats
+ * */
+uint64_t replNowMs();
+
+/**
+ * Forget the primary stream after the connection to the primary was lost half way through a snapshot
+ * */
+void replConnectionLost(Replication_t *repl);
+
+#endif /* __REPLICATION_H */
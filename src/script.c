@@ -0,0 +1,727 @@
+#include "script.h"
+#include "siphash.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// fixed, so a digest stays the same across restarts and on every node
+static const uint8_t scriptDigestKey[16] = {0};
+
+typedef enum ScriptType {
+    SCRIPT_NIL,
+    SCRIPT_INT,
+    SCRIPT_DOUBLE,
+    SCRIPT_STRING,
+} ScriptType_t;
+
+typedef struct ScriptValue {
+    ScriptType_t type;
+    union {
+        int64_t i;
+        double d;
+        struct {
+            const char *s; /* NUL terminated */
+            size_t len;
+        } str;
+    } v;
+} ScriptValue_t;
+
+typedef struct ScriptRun {
+    Script_t *script;
+    Hashtable_t *ht;
+    const ScriptHooks_t *hooks;
+    ScriptValue_t stack[SCRIPT_MAX_STACK];
+    int sp;
+    char arena[SCRIPT_ARENA_SIZE];
+    size_t used;
+    char *err; /* Where the error goes */
+    size_t errlen;
+} ScriptRun_t;
+
+static const struct {
+    const char *word;
+    ScriptOp_t op;
+} scriptWords[] = {
+    {"nil", SCRIPT_OP_NIL},
+    {"get", SCRIPT_OP_GET},
+    {"set", SCRIPT_OP_SET},
+    {"del", SCRIPT_OP_DEL},
+    {"exists", SCRIPT_OP_EXISTS},
+    {"incrby", SCRIPT_OP_INCRBY},
+    {"+", SCRIPT_OP_ADD},
+    {"-", SCRIPT_OP_SUB},
+    {"*", SCRIPT_OP_MUL},
+    {"/", SCRIPT_OP_DIV},
+    {"%", SCRIPT_OP_MOD},
+    {"=", SCRIPT_OP_EQ},
+    {"<", SCRIPT_OP_LT},
+    {">", SCRIPT_OP_GT},
+    {"not", SCRIPT_OP_NOT},
+    {"..", SCRIPT_OP_CONCAT},
+    {"dup", SCRIPT_OP_DUP},
+    {"drop", SCRIPT_OP_DROP},
+    {"swap", SCRIPT_OP_SWAP},
+    {"over", SCRIPT_OP_OVER},
+    {"return", SCRIPT_OP_RETURN},
+    {"error", SCRIPT_OP_ERROR},
+};
+
+#define SCRIPT_NUM_WORDS ((int)(sizeof(scriptWords) / sizeof(scriptWords[0])))
+
+uint64_t scriptDigest(const char *source, size_t len) {
+    uint64_t digest;
+    siphash(source, len, scriptDigestKey, (uint8_t *)&digest, sizeof(digest));
+    return digest;
+}
+
+// parse a whole word as a number, returns 0 if it is one
+static int scriptParseNumber(const char *word, ScriptValue_t *out) {
+    char *end;
+    errno = 0;
+    long long i = strtoll(word, &end, 10);
+    if (end != word && *end == '\0' && errno == 0) {
+        out->type = SCRIPT_INT;
+        out->v.i = i;
+        return 0;
+    }
+    double d = strtod(word, &end);
+    if (end != word && *end == '\0') {
+        out->type = SCRIPT_DOUBLE;
+        out->v.d = d;
+        return 0;
+    }
+    return 1;
+}
+
+static int scriptEmit(Script_t *script, ScriptOp_t op, char *err, size_t errlen) {
+    if (script->numInstrs == SCRIPT_MAX_INSTRS) {
+        snprintf(err, errlen, "Script longer than %d instructions", SCRIPT_MAX_INSTRS);
+        return -1;
+    }
+    script->code[script->numInstrs].op = op;
+    return script->numInstrs++;
+}
+
+Script_t *scriptCompile(const char *source, char *err, size_t errlen) {
+    Script_t *script = calloc(1, sizeof(Script_t));
+    size_t srclen = strlen(source);
+    // the literals are never longer than the source
+    char *strings = script != NULL ? malloc(srclen + 1) : NULL;
+    char *copy = strings != NULL ? strdup(source) : NULL;
+    if (copy == NULL) {
+        free(strings);
+        free(script);
+        snprintf(err, errlen, "Error compiling script");
+        return NULL;
+    }
+    script->strings = strings;
+    script->digest = scriptDigest(source, srclen);
+    // the if or else waiting for its jump target, innermost last
+    int pending[SCRIPT_MAX_NESTING];
+    int nesting = 0;
+    size_t used = 0;
+    char *saveptr;
+    for (char *word = strtok_r(copy, " ", &saveptr); word != NULL; word = strtok_r(NULL, " ", &saveptr)) {
+        int idx;
+        ScriptValue_t num;
+        if (word[0] == '\'') {
+            if ((idx = scriptEmit(script, SCRIPT_OP_STRING, err, errlen)) == -1) {
+                goto error;
+            }
+            size_t len = strlen(word + 1);
+            memcpy(strings + used, word + 1, len + 1);
+            script->code[idx].arg.s.off = used;
+            script->code[idx].arg.s.len = len;
+            used += len + 1;
+        } else if (word[0] == '$') {
+            char *end;
+            long arg = strtol(word + 1, &end, 10);
+            if (end == word + 1 || *end != '\0' || arg < 1 || arg > SCRIPT_MAX_ARGS) {
+                snprintf(err, errlen, "Invalid argument %s", word);
+                goto error;
+            }
+            if ((idx = scriptEmit(script, SCRIPT_OP_ARG, err, errlen)) == -1) {
+                goto error;
+            }
+            script->code[idx].arg.i = arg - 1;
+        } else if (strcmp(word, "if") == 0) {
+            if (nesting == SCRIPT_MAX_NESTING) {
+                snprintf(err, errlen, "Script nests more than %d ifs", SCRIPT_MAX_NESTING);
+                goto error;
+            }
+            if ((idx = scriptEmit(script, SCRIPT_OP_JUMP_IF_NOT, err, errlen)) == -1) {
+                goto error;
+            }
+            pending[nesting++] = idx;
+        } else if (strcmp(word, "else") == 0) {
+            if (nesting == 0 || script->code[pending[nesting - 1]].op != SCRIPT_OP_JUMP_IF_NOT) {
+                snprintf(err, errlen, "else without if");
+                goto error;
+            }
+            if ((idx = scriptEmit(script, SCRIPT_OP_JUMP, err, errlen)) == -1) {
+                goto error;
+            }
+            // a false condition skips to the instruction after the jump over the else branch
+            script->code[pending[nesting - 1]].arg.target = idx + 1;
+            pending[nesting - 1] = idx;
+        } else if (strcmp(word, "then") == 0) {
+            if (nesting == 0) {
+                snprintf(err, errlen, "then without if");
+                goto error;
+            }
+            script->code[pending[--nesting]].arg.target = script->numInstrs;
+        } else if (scriptParseNumber(word, &num) == 0) {
+            if ((idx = scriptEmit(script, num.type == SCRIPT_INT ? SCRIPT_OP_INT : SCRIPT_OP_DOUBLE, err, errlen)) ==
+                -1) {
+                goto error;
+            }
+            if (num.type == SCRIPT_INT) {
+                script->code[idx].arg.i = num.v.i;
+            } else {
+                script->code[idx].arg.d = num.v.d;
+            }
+        } else {
+            int i = 0;
+            while (i < SCRIPT_NUM_WORDS && strcmp(word, scriptWords[i].word) != 0) {
+                i++;
+            }
+            if (i == SCRIPT_NUM_WORDS) {
+                snprintf(err, errlen, "Unknown word %s", word);
+                goto error;
+            }
+            if (scriptEmit(script, scriptWords[i].op, err, errlen) == -1) {
+                goto error;
+            }
+        }
+    }
+    if (nesting > 0) {
+        snprintf(err, errlen, "if without then");
+        goto error;
+    }
+    free(copy);
+    return script;
+error:
+    free(copy);
+    scriptFree(script);
+    return NULL;
+}
+
+void scriptFree(Script_t *script) {
+    free(script->strings);
+    free(script);
+}
+
+static int scriptFail(ScriptRun_t *run, const char *msg) {
+    snprintf(run->err, run->errlen, "%s", msg);
+    return 1;
+}
+
+static int scriptPush(ScriptRun_t *run, ScriptValue_t v) {
+    if (run->sp == SCRIPT_MAX_STACK) {
+        return scriptFail(run, "Stack overflow");
+    }
+    run->stack[run->sp++] = v;
+    return 0;
+}
+
+static int scriptPop(ScriptRun_t *run, ScriptValue_t *v) {
+    if (run->sp == 0) {
+        return scriptFail(run, "Stack underflow");
+    }
+    *v = run->stack[--run->sp];
+    return 0;
+}
+
+// room for a string of len characters in the arena of the run, NULL if it is full
+static char *scriptAlloc(ScriptRun_t *run, size_t len) {
+    if (len > SCRIPT_MAX_STRING || run->used + len + 1 > SCRIPT_ARENA_SIZE) {
+        scriptFail(run, "Out of string memory");
+        return NULL;
+    }
+    char *s = run->arena + run->used;
+    run->used += len + 1;
+    return s;
+}
+
+static int scriptPushString(ScriptRun_t *run, const char *s, size_t len) {
+    char *copy = scriptAlloc(run, len);
+    if (copy == NULL) {
+        return 1;
+    }
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    ScriptValue_t v = {.type = SCRIPT_STRING, .v.str = {copy, len}};
+    return scriptPush(run, v);
+}
+
+// the value as a string, numbers are formatted into the arena
+static int scriptToString(ScriptRun_t *run, ScriptValue_t *v, const char **s, size_t *len) {
+    char buf[64];
+    int n;
+    switch (v->type) {
+    case SCRIPT_STRING:
+        *s = v->v.str.s;
+        *len = v->v.str.len;
+        return 0;
+    case SCRIPT_INT:
+        n = sprintf(buf, "%ld", v->v.i);
+        break;
+    case SCRIPT_DOUBLE:
+        n = sprintf(buf, "%lf", v->v.d);
+        break;
+    default:
+        return scriptFail(run, "Expected a string, got nil");
+    }
+    char *copy = scriptAlloc(run, n);
+    if (copy == NULL) {
+        return 1;
+    }
+    memcpy(copy, buf, n + 1);
+    *s = copy;
+    *len = n;
+    return 0;
+}
+
+// the value as a number, strings holding one are parsed
+static int scriptToNumber(ScriptRun_t *run, ScriptValue_t *v) {
+    if (v->type == SCRIPT_INT || v->type == SCRIPT_DOUBLE) {
+        return 0;
+    }
+    if (v->type == SCRIPT_STRING && scriptParseNumber(v->v.str.s, v) == 0) {
+        return 0;
+    }
+    return scriptFail(run, "Expected a number");
+}
+
+static double scriptDouble(ScriptValue_t *v) {
+    return v->type == SCRIPT_INT ? (double)v->v.i : v->v.d;
+}
+
+static int scriptTruthy(ScriptValue_t *v) {
+    switch (v->type) {
+    case SCRIPT_NIL:
+        return 0;
+    case SCRIPT_INT:
+        return v->v.i != 0;
+    case SCRIPT_DOUBLE:
+        return v->v.d != 0;
+    default:
+        return 1;
+    }
+}
+
+// pop a key, checking it with the access hook. Keys can't hold spaces, they must fit in a command
+static int scriptPopKey(ScriptRun_t *run, int write, const char **key, size_t *keylen) {
+    ScriptValue_t v;
+    if (scriptPop(run, &v) != 0 || scriptToString(run, &v, key, keylen) != 0) {
+        return 1;
+    }
+    if (*keylen == 0 || memchr(*key, ' ', *keylen) != NULL) {
+        return scriptFail(run, "Invalid key");
+    }
+    const ScriptHooks_t *hooks = run->hooks;
+    if (hooks != NULL && hooks->access != NULL &&
+        hooks->access(hooks->ctx, *key, *keylen, write, run->err, run->errlen) != 0) {
+        return 1;
+    }
+    return 0;
+}
+
+static void scriptWritten(ScriptRun_t *run, const char *key, size_t keylen) {
+    if (run->hooks != NULL && run->hooks->written != NULL) {
+        run->hooks->written(run->hooks->ctx, key, keylen);
+    }
+}
+
+static int scriptGet(ScriptRun_t *run) {
+    const char *key;
+    size_t keylen;
+    if (scriptPopKey(run, 0, &key, &keylen) != 0) {
+        return 1;
+    }
+    HashtableValue_t htv = htFind(run->ht, key, keylen);
+    ScriptValue_t v = {.type = SCRIPT_NIL};
+    switch (htv.entryType) {
+    case NONE:
+        break;
+    case STRING:
+        // the value may be freed or moved by the next write, so the run gets its own copy
+        return scriptPushString(run, htv.v.val, strlen(htv.v.val));
+    case SIGNED_INT:
+        v.type = SCRIPT_INT;
+        v.v.i = htv.v.s64;
+        break;
+    case UNSIGNED_INT:
+        v.type = SCRIPT_INT;
+        v.v.i = (int64_t)htv.v.u64;
+        break;
+    case DOUBLE:
+        v.type = SCRIPT_DOUBLE;
+        v.v.d = htv.v.d;
+        break;
+    default:
+        return scriptFail(run, "Scripts can't read collections");
+    }
+    return scriptPush(run, v);
+}
+
+static int scriptSet(ScriptRun_t *run) {
+    ScriptValue_t v;
+    const char *key;
+    size_t keylen;
+    if (scriptPop(run, &v) != 0 || scriptPopKey(run, 1, &key, &keylen) != 0) {
+        return 1;
+    }
+    HashtableValue_t htv;
+    switch (v.type) {
+    case SCRIPT_INT:
+        htv.entryType = SIGNED_INT;
+        htv.v.s64 = v.v.i;
+        break;
+    case SCRIPT_DOUBLE:
+        htv.entryType = DOUBLE;
+        htv.v.d = v.v.d;
+        break;
+    case SCRIPT_STRING:
+        htv.entryType = STRING;
+        htv.v.val = (char *)v.v.str.s;
+        break;
+    default:
+        return scriptFail(run, "Can't set a key to nil, use del");
+    }
+    if (htReplace(run->ht, key, keylen, htv) != 0) {
+        return scriptFail(run, "Error replacing key");
+    }
+    scriptWritten(run, key, keylen);
+    return 0;
+}
+
+static int scriptIncrBy(ScriptRun_t *run) {
+    ScriptValue_t delta;
+    const char *key;
+    size_t keylen;
+    if (scriptPop(run, &delta) != 0 || scriptToNumber(run, &delta) != 0) {
+        return 1;
+    }
+    if (delta.type != SCRIPT_INT) {
+        return scriptFail(run, "Invalid increment");
+    }
+    if (scriptPopKey(run, 1, &key, &keylen) != 0) {
+        return 1;
+    }
+    HashtableValue_t result;
+    int retval = htIncrBy(run->ht, key, keylen, delta.v.i, &result);
+    if (retval == 1) {
+        return scriptFail(run, "Value is not an integer");
+    } else if (retval == 2) {
+        return scriptFail(run, "Increment would overflow");
+    } else if (retval == 3) {
+        return scriptFail(run, "Error inserting key");
+    }
+    scriptWritten(run, key, keylen);
+    ScriptValue_t v = {.type = SCRIPT_INT};
+    v.v.i = result.entryType == UNSIGNED_INT ? (int64_t)result.v.u64 : result.v.s64;
+    return scriptPush(run, v);
+}
+
+static int scriptArith(ScriptRun_t *run, ScriptOp_t op) {
+    ScriptValue_t a, b;
+    if (scriptPop(run, &b) != 0 || scriptPop(run, &a) != 0 || scriptToNumber(run, &a) != 0 ||
+        scriptToNumber(run, &b) != 0) {
+        return 1;
+    }
+    ScriptValue_t r;
+    if (a.type == SCRIPT_INT && b.type == SCRIPT_INT) {
+        r.type = SCRIPT_INT;
+        int overflow = 0;
+        switch (op) {
+        case SCRIPT_OP_ADD:
+            overflow = __builtin_add_overflow(a.v.i, b.v.i, &r.v.i);
+            break;
+        case SCRIPT_OP_SUB:
+            overflow = __builtin_sub_overflow(a.v.i, b.v.i, &r.v.i);
+            break;
+        case SCRIPT_OP_MUL:
+            overflow = __builtin_mul_overflow(a.v.i, b.v.i, &r.v.i);
+            break;
+        default:
+            if (b.v.i == 0) {
+                return scriptFail(run, "Division by zero");
+            }
+            overflow = a.v.i == INT64_MIN && b.v.i == -1;
+            if (!overflow) {
+                r.v.i = op == SCRIPT_OP_DIV ? a.v.i / b.v.i : a.v.i % b.v.i;
+            }
+        }
+        if (overflow) {
+            return scriptFail(run, "Integer overflow");
+        }
+        return scriptPush(run, r);
+    }
+    double x = scriptDouble(&a), y = scriptDouble(&b);
+    r.type = SCRIPT_DOUBLE;
+    switch (op) {
+    case SCRIPT_OP_ADD:
+        r.v.d = x + y;
+        break;
+    case SCRIPT_OP_SUB:
+        r.v.d = x - y;
+        break;
+    case SCRIPT_OP_MUL:
+        r.v.d = x * y;
+        break;
+    case SCRIPT_OP_DIV:
+        if (y == 0) {
+            return scriptFail(run, "Division by zero");
+        }
+        r.v.d = x / y;
+        break;
+    default:
+        return scriptFail(run, "Modulo needs integers");
+    }
+    return scriptPush(run, r);
+}
+
+static int scriptCompare(ScriptRun_t *run, ScriptOp_t op) {
+    ScriptValue_t a, b;
+    if (scriptPop(run, &b) != 0 || scriptPop(run, &a) != 0) {
+        return 1;
+    }
+    ScriptValue_t r = {.type = SCRIPT_INT};
+    if (op == SCRIPT_OP_EQ && (a.type == SCRIPT_NIL || b.type == SCRIPT_NIL)) {
+        r.v.i = a.type == b.type;
+    } else if (op == SCRIPT_OP_EQ && a.type == SCRIPT_STRING && b.type == SCRIPT_STRING) {
+        r.v.i = a.v.str.len == b.v.str.len && memcmp(a.v.str.s, b.v.str.s, a.v.str.len) == 0;
+    } else {
+        if (scriptToNumber(run, &a) != 0 || scriptToNumber(run, &b) != 0) {
+            return 1;
+        }
+        if (a.type == SCRIPT_INT && b.type == SCRIPT_INT) {
+            r.v.i = op == SCRIPT_OP_EQ ? a.v.i == b.v.i : op == SCRIPT_OP_LT ? a.v.i < b.v.i : a.v.i > b.v.i;
+        } else {
+            double x = scriptDouble(&a), y = scriptDouble(&b);
+            r.v.i = op == SCRIPT_OP_EQ ? x == y : op == SCRIPT_OP_LT ? x < y : x > y;
+        }
+    }
+    return scriptPush(run, r);
+}
+
+static int scriptConcat(ScriptRun_t *run) {
+    ScriptValue_t a, b;
+    const char *s1, *s2;
+    size_t len1, len2;
+    if (scriptPop(run, &b) != 0 || scriptPop(run, &a) != 0 || scriptToString(run, &a, &s1, &len1) != 0 ||
+        scriptToString(run, &b, &s2, &len2) != 0) {
+        return 1;
+    }
+    char *s = scriptAlloc(run, len1 + len2);
+    if (s == NULL) {
+        return 1;
+    }
+    memcpy(s, s1, len1);
+    memcpy(s + len1, s2, len2);
+    s[len1 + len2] = '\0';
+    ScriptValue_t v = {.type = SCRIPT_STRING, .v.str = {s, len1 + len2}};
+    return scriptPush(run, v);
+}
+
+// run a single instruction, returns 1 if the script failed
+static int scriptStep(ScriptRun_t *run, ScriptInstr_t *instr, const char **args, int numArgs) {
+    ScriptValue_t a, b;
+    const char *key;
+    size_t keylen;
+    switch (instr->op) {
+    case SCRIPT_OP_INT:
+        a.type = SCRIPT_INT;
+        a.v.i = instr->arg.i;
+        return scriptPush(run, a);
+    case SCRIPT_OP_DOUBLE:
+        a.type = SCRIPT_DOUBLE;
+        a.v.d = instr->arg.d;
+        return scriptPush(run, a);
+    case SCRIPT_OP_STRING:
+        a.type = SCRIPT_STRING;
+        a.v.str.s = run->script->strings + instr->arg.s.off;
+        a.v.str.len = instr->arg.s.len;
+        return scriptPush(run, a);
+    case SCRIPT_OP_NIL:
+        a.type = SCRIPT_NIL;
+        return scriptPush(run, a);
+    case SCRIPT_OP_ARG:
+        a.type = SCRIPT_NIL;
+        if (instr->arg.i < numArgs) {
+            a.type = SCRIPT_STRING;
+            a.v.str.s = args[instr->arg.i];
+            a.v.str.len = strlen(args[instr->arg.i]);
+        }
+        return scriptPush(run, a);
+    case SCRIPT_OP_GET:
+        return scriptGet(run);
+    case SCRIPT_OP_SET:
+        return scriptSet(run);
+    case SCRIPT_OP_DEL:
+        if (scriptPopKey(run, 1, &key, &keylen) != 0) {
+            return 1;
+        }
+        a.type = SCRIPT_INT;
+        a.v.i = htRemove(run->ht, key, keylen) == 0;
+        if (a.v.i) {
+            scriptWritten(run, key, keylen);
+        }
+        return scriptPush(run, a);
+    case SCRIPT_OP_EXISTS:
+        if (scriptPopKey(run, 0, &key, &keylen) != 0) {
+            return 1;
+        }
+        a.type = SCRIPT_INT;
+        a.v.i = htFind(run->ht, key, keylen).entryType != NONE;
+        return scriptPush(run, a);
+    case SCRIPT_OP_INCRBY:
+        return scriptIncrBy(run);
+    case SCRIPT_OP_ADD:
+    case SCRIPT_OP_SUB:
+    case SCRIPT_OP_MUL:
+    case SCRIPT_OP_DIV:
+    case SCRIPT_OP_MOD:
+        return scriptArith(run, instr->op);
+    case SCRIPT_OP_EQ:
+    case SCRIPT_OP_LT:
+    case SCRIPT_OP_GT:
+        return scriptCompare(run, instr->op);
+    case SCRIPT_OP_NOT:
+        if (scriptPop(run, &a) != 0) {
+            return 1;
+        }
+        b.type = SCRIPT_INT;
+        b.v.i = !scriptTruthy(&a);
+        return scriptPush(run, b);
+    case SCRIPT_OP_CONCAT:
+        return scriptConcat(run);
+    case SCRIPT_OP_DUP:
+        if (scriptPop(run, &a) != 0) {
+            return 1;
+        }
+        return scriptPush(run, a) || scriptPush(run, a);
+    case SCRIPT_OP_DROP:
+        return scriptPop(run, &a);
+    case SCRIPT_OP_SWAP:
+        if (scriptPop(run, &b) != 0 || scriptPop(run, &a) != 0) {
+            return 1;
+        }
+        return scriptPush(run, b) || scriptPush(run, a);
+    case SCRIPT_OP_OVER:
+        if (scriptPop(run, &b) != 0 || scriptPop(run, &a) != 0) {
+            return 1;
+        }
+        return scriptPush(run, a) || scriptPush(run, b) || scriptPush(run, a);
+    case SCRIPT_OP_ERROR:
+        if (scriptPop(run, &a) != 0 || scriptToString(run, &a, &key, &keylen) != 0) {
+            return 1;
+        }
+        return scriptFail(run, key);
+    default:
+        return scriptFail(run, "Invalid instruction");
+    }
+}
+
+int scriptRun(Script_t *script, Hashtable_t *ht, const char **args, int numArgs, const ScriptHooks_t *hooks,
+              char *result, size_t resultlen) {
+    // too big for the stack of the event loop
+    ScriptRun_t *run = malloc(sizeof(ScriptRun_t));
+    if (run == NULL) {
+        snprintf(result, resultlen, "Error running script");
+        return 1;
+    }
+    run->script = script;
+    run->ht = ht;
+    run->hooks = hooks;
+    run->sp = 0;
+    run->used = 0;
+    run->err = result;
+    run->errlen = resultlen;
+    int pc = 0;
+    // every jump goes forward, so this runs at most numInstrs times
+    while (pc < script->numInstrs) {
+        ScriptInstr_t *instr = &script->code[pc++];
+        if (instr->op == SCRIPT_OP_RETURN) {
+            break;
+        } else if (instr->op == SCRIPT_OP_JUMP) {
+            pc = instr->arg.target;
+        } else if (instr->op == SCRIPT_OP_JUMP_IF_NOT) {
+            ScriptValue_t cond;
+            if (scriptPop(run, &cond) != 0) {
+                free(run);
+                return 1;
+            }
+            if (!scriptTruthy(&cond)) {
+                pc = instr->arg.target;
+            }
+        } else if (scriptStep(run, instr, args, numArgs) != 0) {
+            free(run);
+            return 1;
+        }
+    }
+    ScriptValue_t *top = run->sp > 0 ? &run->stack[run->sp - 1] : NULL;
+    if (top == NULL || top->type == SCRIPT_NIL) {
+        snprintf(result, resultlen, "nil");
+    } else if (top->type == SCRIPT_INT) {
+        snprintf(result, resultlen, "%ld", top->v.i);
+    } else if (top->type == SCRIPT_DOUBLE) {
+        snprintf(result, resultlen, "%lf", top->v.d);
+    } else {
+        snprintf(result, resultlen, "%s", top->v.str.s);
+    }
+    free(run);
+    return 0;
+}
+
+ScriptCache_t *scriptCacheCreate() {
+    return calloc(1, sizeof(ScriptCache_t));
+}
+
+void scriptCacheDelete(ScriptCache_t *cache) {
+    scriptCacheFlush(cache);
+    free(cache);
+}
+
+Script_t *scriptCacheFind(ScriptCache_t *cache, uint64_t digest) {
+    Script_t *script = cache->buckets[digest % SCRIPT_CACHE_BUCKETS];
+    while (script != NULL && script->digest != digest) {
+        script = script->next;
+    }
+    return script;
+}
+
+Script_t *scriptCacheLoad(ScriptCache_t *cache, const char *source, char *err, size_t errlen) {
+    Script_t *script = scriptCacheFind(cache, scriptDigest(source, strlen(source)));
+    if (script != NULL) {
+        return script;
+    }
+    if (cache->numScripts == SCRIPT_CACHE_MAX) {
+        snprintf(err, errlen, "Script cache full, at most %d scripts", SCRIPT_CACHE_MAX);
+        return NULL;
+    }
+    script = scriptCompile(source, err, errlen);
+    if (script == NULL) {
+        return NULL;
+    }
+    uint64_t idx = script->digest % SCRIPT_CACHE_BUCKETS;
+    script->next = cache->buckets[idx];
+    cache->buckets[idx] = script;
+    cache->numScripts++;
+    return script;
+}
+
+void scriptCacheFlush(ScriptCache_t *cache) {
+    for (int i = 0; i < SCRIPT_CACHE_BUCKETS; i++) {
+        Script_t *script = cache->buckets[i];
+        while (script != NULL) {
+            Script_t *next = script->next;
+            scriptFree(script);
+            script = next;
+        }
+        cache->buckets[i] = NULL;
+    }
+    cache->numScripts = 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * Stored procedures. A script is a single line of space separated words in postfix order, compiled once
+ * to bytecode and cached by the digest of its source, so a client loads it once and runs it by digest
+ * with evalsha. A script reads, computes and writes several keys in one request, and since the server
+ * runs it to completion before serving anything else no other command comes in between its steps.
+ *
+ *   'stock: $1 ..   dup get 1 -   dup 0 < if 'out-of-stock error then   set
+ *
+ * The words are
+ *
+ *   12 -3 1.5        push a number
+ *   'word            push the string word
+ *   $1 .. $16        push an argument of evalsha, nil if it wasn't given
+ *   nil              push nil
+ *   get              key -> value, nil if the key doesn't exist
+ *   set              key value ->
+ *   del              key -> 1 if the key was removed, 0 if it didn't exist
+ *   exists           key -> 1 or 0
+ *   incrby           key delta -> new value
+ *   + - * / %        a b -> a op b, integers stay integers unless one side is a double
+ *   = < >            a b -> 1 or 0
+ *   not              a -> 1 if a is nil or zero, 0 otherwise
+ *   ..               a b -> a and b joined as strings
+ *   dup drop swap over
+ *   if ... else ... then   run the first branch if the popped value is true, nil and zero are false
+ *   return           stop, the top of the stack is the result
+ *   error            stop with the popped value as the error
+ *
+ * A script only reaches the table it is run on, through the hashtable API. There are no loops, every
+ * jump goes forward, so a script runs at most as many instructions as it has, and the stack and the
+ * strings it builds have fixed limits. A script that fails keeps the writes it made before the error.
+ *
+ */
+
+#pragma once
+
+#include "hashtable.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef __SCRIPT_H
+#define __SCRIPT_H
+
+#define SCRIPT_MAX_INSTRS 256
+#define SCRIPT_MAX_STACK 32
+#define SCRIPT_MAX_ARGS 16
+#define SCRIPT_MAX_NESTING 16
+// longest string a script can build or read, so every write it makes fits in a command
+#define SCRIPT_MAX_STRING 512
+// memory for the strings built by one run
+#define SCRIPT_ARENA_SIZE 4096
+#define SCRIPT_CACHE_BUCKETS 64
+#define SCRIPT_CACHE_MAX 1024
+
+typedef enum ScriptOp {
+    SCRIPT_OP_INT,
+    SCRIPT_OP_DOUBLE,
+    SCRIPT_OP_STRING,
+    SCRIPT_OP_NIL,
+    SCRIPT_OP_ARG,
+    SCRIPT_OP_GET,
+    SCRIPT_OP_SET,
+    SCRIPT_OP_DEL,
+    SCRIPT_OP_EXISTS,
+    SCRIPT_OP_INCRBY,
+    SCRIPT_OP_ADD,
+    SCRIPT_OP_SUB,
+    SCRIPT_OP_MUL,
+    SCRIPT_OP_DIV,
+    SCRIPT_OP_MOD,
+    SCRIPT_OP_EQ,
+    SCRIPT_OP_LT,
+    SCRIPT_OP_GT,
+    SCRIPT_OP_NOT,
+    SCRIPT_OP_CONCAT,
+    SCRIPT_OP_DUP,
+    SCRIPT_OP_DROP,
+    SCRIPT_OP_SWAP,
+    SCRIPT_OP_OVER,
+    SCRIPT_OP_JUMP_IF_NOT,
+    SCRIPT_OP_JUMP,
+    SCRIPT_OP_RETURN,
+    SCRIPT_OP_ERROR,
+} ScriptOp_t;
+
+typedef struct ScriptInstr {
+    ScriptOp_t op;
+    union {
+        int64_t i;       /* Number pushed by SCRIPT_OP_INT, argument of SCRIPT_OP_ARG */
+        double d;        /* Number pushed by SCRIPT_OP_DOUBLE */
+        uint32_t target; /* Instruction the jumps go to */
+        struct {
+            uint32_t off; /* Offset of the string in strings */
+            uint32_t len;
+        } s;
+    } arg;
+} ScriptInstr_t;
+
+typedef struct Script {
+    uint64_t digest;
+    int numInstrs;
+    ScriptInstr_t code[SCRIPT_MAX_INSTRS];
+    char *strings; /* The string literals, NUL terminated */
+    struct Script *next;
+} Script_t;
+
+typedef struct ScriptCache {
+    Script_t *buckets[SCRIPT_CACHE_BUCKETS];
+    uint64_t numScripts;
+    uint64_t runs;
+    uint64_t errors;
+} ScriptCache_t;
+
+/**
+ * Hooks into the server running a script
+ * */
+typedef struct ScriptHooks {
+    /**
+     * Called before a script touches a key, may be NULL
+     *
+     * @param write Set if the script changes the key
+     * @param err Set to the error to stop the script with
+     *
+     * @returns 0 to allow the access
+     * */
+    int (*access)(void *ctx, const char *key, size_t keylen, int write, char *err, size_t errlen);
+    /**
+     * Called after a script changed a key, may be NULL
+     * */
+    void (*written)(void *ctx, const char *key, size_t keylen);
+    void *ctx;
+} ScriptHooks_t;
+
+/**
+ * @returns The digest scripts are cached by
+ * */
+uint64_t scriptDigest(const char *source, size_t len);
+
+/**
+ * Compile the source of a script
+ *
+ * @param source The NUL terminated source
+ * @param err Set to the reason if the source doesn't compile
+ *
+ * @returns The script or NULL on error
+ * */
+Script_t *scriptCompile(const char *source, char *err, size_t errlen);
+
+void scriptFree(Script_t *script);
+
+/**
+ * Run a script on a table
+ *
+ * @param args The NUL terminated arguments, $1 is args[0]
+ * @param hooks Called on every key the script touches
+ * @param result Set to the result, or the error if the script fails
+ *
+ * @returns 0 if successful, 1 if the script failed
+ * */
+int scriptRun(Script_t *script, Hashtable_t *ht, const char **args, int numArgs, const ScriptHooks_t *hooks,
+              char *result, size_t resultlen);
+
+/**
+ * @returns An empty cache or NULL on error
+ * */
+ScriptCache_t *scriptCacheCreate();
+
+void scriptCacheDelete(ScriptCache_t *cache);
+
+/**
+ * Compile a script and add it to the cache, unless it is already there
+ *
+ * @param err Set to the reason if the script can't be added
+ *
+ * @returns The cached script or NULL on error
+ * */
+Script_t *scriptCacheLoad(ScriptCache_t *cache, const char *source, char *err, size_t errlen);
+
+/**
+ * @returns The script with the digest or NULL if it isn't cached
+ * */
+Script_t *scriptCacheFind(ScriptCache_t *cache, uint64_t digest);
+
+/**
+ * Remove every script from the cache
+ * */
+void scriptCacheFlush(ScriptCache_t *cache);
+
+#endif /* __SCRIPT_H */
@@ -0,0 +1,190 @@
+#include "skiplist.h"
+#include <stdlib.h>
+#include <string.h>
+
+// compare two (score, key) pairs, returns <0, 0 or >0 like memcmp
+static int cmpNode(double score1, const char *key1, size_t keylen1, double score2, const char *key2, size_t keylen2) {
+    if (score1 < score2) {
+        return -1;
+    } else if (score1 > score2) {
+        return 1;
+    }
+    size_t minlen = keylen1 < keylen2 ? keylen1 : keylen2;
+    int cmp = memcmp(key1, key2, minlen);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return (keylen1 > keylen2) - (keylen1 < keylen2);
+}
+
+static SkiplistNode_t *slCreateNode(int level, double score, const char *key, size_t keylen) {
+    SkiplistNode_t *node = malloc(sizeof(SkiplistNode_t) + level * sizeof(struct SkiplistLevel));
+    if (node == NULL) {
+        return NULL;
+    }
+    node->score = score;
+    node->keylen = keylen;
+    node->key = NULL;
+    if (key != NULL) {
+        node->key = malloc(keylen);
+        if (node->key == NULL) {
+            free(node);
+            return NULL;
+        }
+        memcpy(node->key, key, keylen);
+    }
+    node->backward = NULL;
+    for (int i = 0; i < level; i++) {
+        node->level[i].forward = NULL;
+    }
+    return node;
+}
+
+// returns a random level between 1 and SKIPLIST_MAXLEVEL, higher levels being exponentially less likely
+static int slRandomLevel() {
+    int level = 1;
+    while ((random() & 0xFFFF) < (SKIPLIST_P * 0xFFFF) && level < SKIPLIST_MAXLEVEL) {
+        level++;
+    }
+    return level;
+}
+
+Skiplist_t *slCreate() {
+    Skiplist_t *sl = malloc(sizeof(Skiplist_t));
+    if (sl) {
+        sl->header = slCreateNode(SKIPLIST_MAXLEVEL, 0, NULL, 0);
+        if (sl->header == NULL) {
+            free(sl);
+            return NULL;
+        }
+        sl->tail = NULL;
+        sl->len = 0;
+        sl->level = 1;
+    }
+    return sl;
+}
+
+void slDelete(Skiplist_t *sl) {
+    SkiplistNode_t *node = sl->header->level[0].forward;
+    while (node != NULL) {
+        SkiplistNode_t *next = node->level[0].forward;
+        free(node->key);
+        free(node);
+        node = next;
+    }
+    free(sl->header);
+    free(sl);
+}
+
+int slInsert(Skiplist_t *sl, double score, const char *key, size_t keylen) {
+    SkiplistNode_t *update[SKIPLIST_MAXLEVEL];
+    SkiplistNode_t *x = sl->header;
+
+    // find the last node on every level that orders before the new node
+    for (int i = sl->level - 1; i >= 0; i--) {
+        while (x->level[i].forward != NULL &&
+               cmpNode(x->level[i].forward->score, x->level[i].forward->key, x->level[i].forward->keylen, score, key,
+                       keylen) < 0) {
+            x = x->level[i].forward;
+        }
+        update[i] = x;
+    }
+
+    int level = slRandomLevel();
+    x = slCreateNode(level, score, key, keylen);
+    if (x == NULL) {
+        return 1;
+    }
+    // only raised once the node exists, so a failed insert leaves the list as it was
+    if (level > sl->level) {
+        for (int i = sl->level; i < level; i++) {
+            update[i] = sl->header;
+        }
+        sl->level = level;
+    }
+    for (int i = 0; i < level; i++) {
+        x->level[i].forward = update[i]->level[i].forward;
+        update[i]->level[i].forward = x;
+    }
+
+    x->backward = (update[0] == sl->header) ? NULL : update[0];
+    if (x->level[0].forward != NULL) {
+        x->level[0].forward->backward = x;
+    } else {
+        sl->tail = x;
+    }
+    sl->len++;
+    return 0;
+}
+
+int slRemove(Skiplist_t *sl, double score, const char *key, size_t keylen) {
+    SkiplistNode_t *update[SKIPLIST_MAXLEVEL];
+    SkiplistNode_t *x = sl->header;
+
+    for (int i = sl->level - 1; i >= 0; i--) {
+        while (x->level[i].forward != NULL &&
+               cmpNode(x->level[i].forward->score, x->level[i].forward->key, x->level[i].forward->keylen, score, key,
+                       keylen) < 0) {
+            x = x->level[i].forward;
+        }
+        update[i] = x;
+    }
+
+    x = x->level[0].forward;
+    if (x == NULL || cmpNode(x->score, x->key, x->keylen, score, key, keylen) != 0) {
+        return 1; // nothing to remove
+    }
+    // unlink the node from every level it is part of
+    for (int i = 0; i < sl->level; i++) {
+        if (update[i]->level[i].forward == x) {
+            update[i]->level[i].forward = x->level[i].forward;
+        }
+    }
+    if (x->level[0].forward != NULL) {
+        x->level[0].forward->backward = x->backward;
+    } else {
+        sl->tail = x->backward;
+    }
+    while (sl->level > 1 && sl->header->level[sl->level - 1].forward == NULL) {
+        sl->level--;
+    }
+    free(x->key);
+    free(x);
+    sl->len--;
+    return 0;
+}
+
+uint64_t slRangeByScore(Skiplist_t *sl, double min, double max, slVisitor_t visitor, void *ctx) {
+    SkiplistNode_t *x = sl->header;
+
+    // find the last node with a score lower than min
+    for (int i = sl->level - 1; i >= 0; i--) {
+        while (x->level[i].forward != NULL && x->level[i].forward->score < min) {
+            x = x->level[i].forward;
+        }
+    }
+
+    uint64_t visited = 0;
+    x = x->level[0].forward;
+    while (x != NULL && x->score <= max) {
+        visited++;
+        if (visitor(x->key, x->keylen, x->score, ctx) != 0) {
+            break;
+        }
+        x = x->level[0].forward;
+    }
+    return visited;
+}
+
+uint64_t slTop(Skiplist_t *sl, uint64_t n, slVisitor_t visitor, void *ctx) {
+    uint64_t visited = 0;
+    SkiplistNode_t *x = sl->tail;
+    while (x != NULL && visited < n) {
+        visited++;
+        if (visitor(x->key, x->keylen, x->score, ctx) != 0) {
+            break;
+        }
+        x = x->backward;
+    }
+    return visited;
+}
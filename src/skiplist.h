@@ -0,0 +1,111 @@
+/*
+ * Taken inspiration from the redis implementation of the sorted set skiplist
+ * https://github.com/redis/redis/blob/3.2.6/src/t_zset.c
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef __SKIPLIST_H
+#define __SKIPLIST_H
+
+#define SKIPLIST_MAXLEVEL 32
+#define SKIPLIST_P 0.25
+
+typedef struct SkiplistNode {
+    char *key;
+    size_t keylen;
+    double score;
+    struct SkiplistNode *backward; /* Previous node on level 0, used for reverse traversal */
+    struct SkiplistLevel {
+        struct SkiplistNode *forward;
+    } level[];
+} SkiplistNode_t;
+
+typedef struct Skiplist {
+    SkiplistNode_t *header;
+    SkiplistNode_t *tail;
+    uint64_t len; /* number of nodes in the skiplist */
+    int level;    /* highest level currently in use */
+} Skiplist_t;
+
+/**
+ * Callback invoked for every node visited by a range query
+ *
+ * @param key The key of the node
+ * @param keylen The length of the key
+ * @param score The score of the node
+ * @param ctx The context pointer passed to the query
+ *
+ * @returns 0 to continue visiting, non-zero to stop the traversal
+ * */
+typedef int (*slVisitor_t)(const char *key, size_t keylen, double score, void *ctx);
+
+/**
+ * Create an empty skiplist
+ *
+ * @returns The empty skiplist or NULL on error
+ * */
+Skiplist_t *slCreate();
+
+/**
+ * Free the skiplist and all of its nodes
+ *
+ * @param sl The skiplist to free
+ * */
+void slDelete(Skiplist_t *sl);
+
+/**
+ * Insert a node into the skiplist. Nodes are ordered by score, then by key.
+ * The caller must make sure the same (score, key) pair is not inserted twice.
+ *
+ * @param sl The skiplist to insert into
+ * @param score The score to order the node by
+ * @param key The key of the node, copied into the skiplist
+ * @param keylen The length of the key
+ *
+ * @returns 0 if successful, 1 otherwise
+ * */
+int slInsert(Skiplist_t *sl, double score, const char *key, size_t keylen);
+
+/**
+ * Remove a node from the skiplist
+ *
+ * @param sl The skiplist to remove from
+ * @param score The score of the node
+ * @param key The key of the node
+ * @param keylen The length of the key
+ *
+ * @returns 0 if successful, 1 if the node was not found
+ * */
+int slRemove(Skiplist_t *sl, double score, const char *key, size_t keylen);
+
+/**
+ * Visit every node with min <= score <= max in ascending order. Runs in O(log n + k)
+ *
+ * @param sl The skiplist to search
+ * @param min The lower bound of the range
+ * @param max The upper bound of the range
+ * @param visitor Called for every node in the range
+ * @param ctx Passed through to the visitor
+ *
+ * @returns The number of nodes visited
+ * */
+uint64_t slRangeByScore(Skiplist_t *sl, double min, double max, slVisitor_t visitor, void *ctx);
+
+/**
+ * Visit the n nodes with the highest score in descending order. Runs in O(k)
+ *
+ * @param sl The skiplist to search
+ * @param n The maximum number of nodes to visit
+ * @param visitor Called for every node visited
+ * @param ctx Passed through to the visitor
+ *
+ * @returns The number of nodes visited
+ * */
+uint64_t slTop(Skiplist_t *sl, uint64_t n, slVisitor_t visitor, void *ctx);
+
+#endif /* __SKIPLIST_H */
@@ -0,0 +1,95 @@
+#include "slowlog.h"
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+// format the address of the client as address:port
+static void slowlogFormatClient(const struct sockaddr *addr, char *buf) {
+    char ip[INET6_ADDRSTRLEN];
+    if (addr != NULL && addr->sa_family == AF_INET) {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+        inet_ntop(AF_INET, &in->sin_addr, ip, sizeof(ip));
+        snprintf(buf, SLOWLOG_MAX_CLIENT_LEN, "%s:%u", ip, ntohs(in->sin_port));
+    } else if (addr != NULL && addr->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)addr;
+        inet_ntop(AF_INET6, &in6->sin6_addr, ip, sizeof(ip));
+        snprintf(buf, SLOWLOG_MAX_CLIENT_LEN, "[%s]:%u", ip, ntohs(in6->sin6_port));
+    } else if (addr != NULL && addr->sa_family == AF_UNIX) {
+        snprintf(buf, SLOWLOG_MAX_CLIENT_LEN, "unix");
+    } else {
+        snprintf(buf, SLOWLOG_MAX_CLIENT_LEN, "unknown");
+    }
+}
+
+Slowlog_t *slowlogCreate(uint64_t maxLen, int64_t thresholdUs) {
+    Slowlog_t *sl = malloc(sizeof(Slowlog_t));
+    if (sl == NULL) {
+        return NULL;
+    }
+    sl->entries = malloc(maxLen * sizeof(SlowlogEntry_t));
+    if (sl->entries == NULL) {
+        free(sl);
+        return NULL;
+    }
+    sl->maxLen = maxLen;
+    sl->len = 0;
+    sl->head = 0;
+    sl->nextId = 0;
+    slowlogSetThreshold(sl, thresholdUs);
+    return sl;
+}
+
+void slowlogDelete(Slowlog_t *sl) {
+    if (sl != NULL) {
+        free(sl->entries);
+        free(sl);
+    }
+}
+
+int slowlogRecord(Slowlog_t *sl, const char *command, int commandlen, const struct sockaddr *addr,
+                  const uint64_t phaseNs[NUM_PHASES]) {
+    if (sl->thresholdNs < 0 || sl->maxLen == 0 || phaseNs[PHASE_EXECUTE] < (uint64_t)sl->thresholdNs) {
+        return 0;
+    }
+    SlowlogEntry_t *entry = &sl->entries[sl->head];
+    sl->head = (sl->head + 1) % sl->maxLen;
+    if (sl->len < sl->maxLen) {
+        sl->len++;
+    }
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    entry->id = sl->nextId++;
+    entry->timestamp = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    memcpy(entry->phaseNs, phaseNs, sizeof(entry->phaseNs));
+    slowlogFormatClient(addr, entry->client);
+    // drop the terminator the client sent
+    while (commandlen > 0 && (command[commandlen - 1] == '\n' || command[commandlen - 1] == '\0')) {
+        commandlen--;
+    }
+    if (commandlen > SLOWLOG_MAX_COMMAND_LEN) {
+        commandlen = SLOWLOG_MAX_COMMAND_LEN;
+    }
+    memcpy(entry->command, command, commandlen);
+    entry->command[commandlen] = '\0';
+    return 1;
+}
+
+SlowlogEntry_t *slowlogGet(Slowlog_t *sl, uint64_t i) {
+    if (i >= sl->len) {
+        return NULL;
+    }
+    // walk back from the last written entry
+    return &sl->entries[(sl->head + sl->maxLen - 1 - i) % sl->maxLen];
+}
+
+void slowlogReset(Slowlog_t *sl) {
+    sl->len = 0;
+    sl->head = 0;
+}
+
+void slowlogSetThreshold(Slowlog_t *sl, int64_t thresholdUs) {
+    sl->thresholdNs = thresholdUs < 0 ? -1 : thresholdUs * 1000;
+}
@@ -0,0 +1,89 @@
+/*
+ * Bounded in-memory log of the commands that took longest to execute, in the spirit of the redis
+ * SLOWLOG. Once full, the oldest entry is overwritten.
+ *
+ */
+
+#pragma once
+
+#include "stats.h"
+#include <stdint.h>
+#include <sys/socket.h>
+
+#ifndef __SLOWLOG_H
+#define __SLOWLOG_H
+
+#define SLOWLOG_DEFAULT_MAX_LEN 128
+#define SLOWLOG_DEFAULT_THRESHOLD_US 10000
+// longer commands are cut
+#define SLOWLOG_MAX_COMMAND_LEN 128
+// address and port of an IPv6 client
+#define SLOWLOG_MAX_CLIENT_LEN 56
+
+typedef struct SlowlogEntry {
+    uint64_t id;        /* Increasing for every logged command */
+    uint64_t timestamp; /* Wall clock time the command was logged in microseconds since the epoch */
+    uint64_t phaseNs[NUM_PHASES];
+    char client[SLOWLOG_MAX_CLIENT_LEN];
+    char command[SLOWLOG_MAX_COMMAND_LEN + 1];
+} SlowlogEntry_t;
+
+typedef struct Slowlog {
+    SlowlogEntry_t *entries; /* Circular buffer of maxLen entries */
+    uint64_t maxLen;
+    uint64_t len;         /* Number of entries in use */
+    uint64_t head;        /* Position the next entry is written to */
+    uint64_t nextId;
+    int64_t thresholdNs;  /* Commands executing at least this long are logged, -1 disables the log */
+} Slowlog_t;
+
+/**
+ * Create an empty slowlog
+ *
+ * @param maxLen The number of entries kept
+ * @param thresholdUs Commands executing at least this many microseconds are logged, -1 to log none
+ *
+ * @returns The slowlog or NULL on error
+ * */
+Slowlog_t *slowlogCreate(uint64_t maxLen, int64_t thresholdUs);
+
+/**
+ * Free the slowlog
+ * */
+void slowlogDelete(Slowlog_t *sl);
+
+/**
+ * Log a command if its execute phase reached the threshold
+ *
+ * @param sl The slowlog
+ * @param command The command as sent by the client
+ * @param commandlen The length of the command
+ * @param addr The address of the client, may be NULL
+ * @param phaseNs The time spent in each phase of the request in nanoseconds
+ *
+ * @returns 1 if the command was logged, 0 otherwise
+ * */
+int slowlogRecord(Slowlog_t *sl, const char *command, int commandlen, const struct sockaddr *addr,
+                  const uint64_t phaseNs[NUM_PHASES]);
+
+/**
+ * Get a logged command
+ *
+ * @param sl The slowlog
+ * @param i The position of the entry, 0 is the most recent
+ *
+ * @returns The entry, or NULL if there are not that many entries
+ * */
+SlowlogEntry_t *slowlogGet(Slowlog_t *sl, uint64_t i);
+
+/**
+ * Remove all the entries
+ * */
+void slowlogReset(Slowlog_t *sl);
+
+/**
+ * Change the threshold of the commands logged from now on, -1 to log none
+ * */
+void slowlogSetThreshold(Slowlog_t *sl, int64_t thresholdUs);
+
+#endif /* __SLOWLOG_H */
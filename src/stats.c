@@ -0,0 +1,58 @@
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+uint64_t statsNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+Stats_t *statsCreate(int numCommands) {
+    Stats_t *stats = malloc(sizeof(Stats_t) + numCommands * sizeof(CommandStats_t));
+    if (stats == NULL) {
+        return NULL;
+    }
+    memset(stats, 0, sizeof(Stats_t) + numCommands * sizeof(CommandStats_t));
+    stats->startTime = statsNow();
+    stats->numCommands = numCommands;
+    for (int i = 0; i < NUM_PHASES; i++) {
+        histogramInit(&stats->phases[i]);
+    }
+    for (int i = 0; i < numCommands; i++) {
+        histogramInit(&stats->commandStats[i].latency);
+    }
+    return stats;
+}
+
+void statsDelete(Stats_t *stats) {
+    free(stats);
+}
+
+void statsRecordCommand(Stats_t *stats, int command, int failed, const uint64_t phaseNs[NUM_PHASES]) {
+    __atomic_fetch_add(&stats->commands, 1, __ATOMIC_RELAXED);
+    if (failed) {
+        __atomic_fetch_add(&stats->errors, 1, __ATOMIC_RELAXED);
+    }
+    for (int i = 0; i < NUM_PHASES; i++) {
+        histogramRecordAtomic(&stats->phases[i], phaseNs[i]);
+    }
+    if (command >= 0 && command < stats->numCommands) {
+        CommandStats_t *cs = &stats->commandStats[command];
+        __atomic_fetch_add(&cs->calls, 1, __ATOMIC_RELAXED);
+        if (failed) {
+            __atomic_fetch_add(&cs->errors, 1, __ATOMIC_RELAXED);
+        }
+        histogramRecordAtomic(&cs->latency, phaseNs[PHASE_EXECUTE]);
+    }
+}
+
+void statsRecordTraffic(Stats_t *stats, uint64_t bytesIn, uint64_t bytesOut) {
+    __atomic_fetch_add(&stats->bytesIn, bytesIn, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->bytesOut, bytesOut, __ATOMIC_RELAXED);
+}
+
+uint64_t statsRead(const uint64_t *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,79 @@
+/*
+ * Server statistics: per-command counters and latency histograms of the parse, execute and send
+ * phases of every request. Counters are updated with relaxed atomic operations so they can be read
+ * from other threads without locks.
+ *
+ */
+
+#pragma once
+
+#include "histogram.h"
+#include <stdint.h>
+
+#ifndef __STATS_H
+#define __STATS_H
+
+typedef enum StatsPhase {
+    PHASE_PARSE,
+    PHASE_EXECUTE,
+    PHASE_SEND,
+    NUM_PHASES,
+} StatsPhase_t;
+
+typedef struct CommandStats {
+    uint64_t calls;
+    uint64_t errors;
+    Histogram_t latency; /* Execute time of the command in nanoseconds */
+} CommandStats_t;
+
+typedef struct Stats {
+    uint64_t startTime; /* statsNow() when the stats were created */
+    uint64_t commands;  /* Requests received, including unknown and malformed ones */
+    uint64_t errors;
+    uint64_t bytesIn;   /* Bytes of commands received */
+    uint64_t bytesOut;  /* Bytes of replies sent */
+    Histogram_t phases[NUM_PHASES]; /* Time spent in each phase of a request in nanoseconds */
+    int numCommands;
+    CommandStats_t commandStats[];
+} Stats_t;
+
+/**
+ * @returns A monotonic timestamp in nanoseconds
+ * */
+uint64_t statsNow();
+
+/**
+ * Create the statistics of a server
+ *
+ * @param numCommands The number of commands the server supports, identified by their index
+ *
+ * @returns The statistics or NULL on error
+ * */
+Stats_t *statsCreate(int numCommands);
+
+/**
+ * Free the statistics
+ * */
+void statsDelete(Stats_t *stats);
+
+/**
+ * Record a request
+ *
+ * @param stats The statistics
+ * @param command The index of the command, -1 if the request didn't name a supported command
+ * @param failed Non-zero if the command failed
+ * @param phaseNs The time spent in each phase of the request in nanoseconds
+ * */
+void statsRecordCommand(Stats_t *stats, int command, int failed, const uint64_t phaseNs[NUM_PHASES]);
+
+/**
+ * Count the bytes of a command and its reply
+ * */
+void statsRecordTraffic(Stats_t *stats, uint64_t bytesIn, uint64_t bytesOut);
+
+/**
+ * @returns The value of a counter, safe to call while other threads update it
+ * */
+uint64_t statsRead(const uint64_t *counter);
+
+#endif /* __STATS_H */
@@ -0,0 +1,356 @@
+#include "store.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define STORE_PTR(store, off) ((void *)((store)->base + (off)))
+#define STORE_ENTRY(store, off) ((StoreEntry_t *)STORE_PTR(store, off))
+
+// bytes of the block of a size class
+static uint64_t storeBlockSize(int sizeClass) {
+    return (uint64_t)STORE_MIN_BLOCK << sizeClass;
+}
+
+// smallest size class holding size bytes, -1 if there is none
+static int storeSizeClass(uint64_t size) {
+    for (int i = 0; i < STORE_SIZE_CLASSES; i++) {
+        if (storeBlockSize(i) >= size) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// make the file at least size bytes long by doubling it, returns 0 if successful
+static int storeGrow(Store_t *store, uint64_t size) {
+    uint64_t fileSize = store->hdr->fileSize;
+    while (fileSize < size) {
+        fileSize *= 2;
+    }
+    if (fileSize > STORE_MAX_SIZE || ftruncate(store->fd, fileSize) != 0) {
+        return 1;
+    }
+    store->hdr->fileSize = fileSize;
+    return 0;
+}
+
+// offset of a free block of a size class, 0 if the file can't grow
+static uint64_t storeAlloc(Store_t *store, int sizeClass) {
+    StoreHeader_t *hdr = store->hdr;
+    uint64_t off = hdr->freeLists[sizeClass];
+    if (off != 0) {
+        // free blocks are linked through their first 8 bytes
+        hdr->freeLists[sizeClass] = *(uint64_t *)STORE_PTR(store, off);
+        return off;
+    }
+    uint64_t size = storeBlockSize(sizeClass);
+    if (hdr->top + size > hdr->fileSize && storeGrow(store, hdr->top + size) != 0) {
+        return 0;
+    }
+    off = hdr->top;
+    hdr->top += size;
+    return off;
+}
+
+static void storeFree(Store_t *store, uint64_t off, int sizeClass) {
+    *(uint64_t *)STORE_PTR(store, off) = store->hdr->freeLists[sizeClass];
+    store->hdr->freeLists[sizeClass] = off;
+}
+
+static uint64_t *storeBuckets(Store_t *store) {
+    return STORE_PTR(store, store->hdr->buckets);
+}
+
+// size class of a bucket array of 1 << exp buckets
+static int storeBucketsClass(unsigned char exp) {
+    return storeSizeClass(sizeof(uint64_t) << exp);
+}
+
+// bytes of an entry holding a key and a value
+static uint64_t storeEntrySize(size_t keylen, HashtableValue_t htv) {
+    return sizeof(StoreEntry_t) + keylen + (htv.entryType == STRING ? strlen(htv.v.val) + 1 : 0);
+}
+
+static int storeSupported(EntryType_t type) {
+    return type == STRING || type == UNSIGNED_INT || type == SIGNED_INT || type == DOUBLE;
+}
+
+// write a value to an entry big enough to hold it
+static void storeSetValue(StoreEntry_t *se, HashtableValue_t htv) {
+    se->entryType = htv.entryType;
+    se->vallen = 0;
+    if (htv.entryType == STRING) {
+        se->vallen = strlen(htv.v.val);
+        // the value may be the one stored here already
+        memmove(se->data + se->keylen, htv.v.val, se->vallen + 1);
+    } else {
+        storeSetNumber(se, htv);
+    }
+}
+
+// initialize an empty store in a mapping of at least STORE_INITIAL_SIZE bytes
+static int storeInit(Store_t *store) {
+    StoreHeader_t *hdr = store->hdr;
+    memset(hdr, 0, sizeof(StoreHeader_t));
+    memcpy(hdr->magic, STORE_MAGIC, sizeof(hdr->magic));
+    hdr->version = STORE_VERSION;
+    hdr->fileSize = STORE_INITIAL_SIZE;
+    hdr->top = STORE_HEADER_SIZE;
+    hdr->exp = STORE_INITIAL_EXP;
+    hdr->buckets = storeAlloc(store, storeBucketsClass(STORE_INITIAL_EXP));
+    if (hdr->buckets == 0) {
+        return 1;
+    }
+    memset(storeBuckets(store), 0, sizeof(uint64_t) << STORE_INITIAL_EXP);
+    return 0;
+}
+
+// check the header of a file that was mapped before
+static int storeValid(Store_t *store, uint64_t fileSize) {
+    StoreHeader_t *hdr = store->hdr;
+    return memcmp(hdr->magic, STORE_MAGIC, sizeof(hdr->magic)) == 0 && hdr->version == STORE_VERSION &&
+           hdr->fileSize == fileSize && hdr->top <= fileSize && hdr->exp < 64 && hdr->buckets >= STORE_HEADER_SIZE &&
+           hdr->buckets + (sizeof(uint64_t) << hdr->exp) <= hdr->top;
+}
+
+Store_t *storeOpen(const char *path, int truncate) {
+    Store_t *store = calloc(1, sizeof(Store_t));
+    if (store == NULL) {
+        return NULL;
+    }
+    store->fd = open(path, O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+    if (store->fd == -1) {
+        free(store);
+        return NULL;
+    }
+    struct stat st;
+    // a second server mapping the same file would corrupt it
+    if (flock(store->fd, LOCK_EX | LOCK_NB) != 0 || fstat(store->fd, &st) != 0 ||
+        (st.st_size == 0 && ftruncate(store->fd, STORE_INITIAL_SIZE) != 0)) {
+        close(store->fd);
+        free(store);
+        return NULL;
+    }
+    // reserve room for the file to grow, so the mapping never moves
+    store->base = mmap(NULL, STORE_MAX_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, store->fd, 0);
+    if (store->base == MAP_FAILED) {
+        close(store->fd);
+        free(store);
+        return NULL;
+    }
+    store->hdr = (StoreHeader_t *)store->base;
+    int failed = st.st_size == 0 ? storeInit(store) : !storeValid(store, st.st_size);
+    if (failed) {
+        munmap(store->base, STORE_MAX_SIZE);
+        close(store->fd);
+        free(store);
+        return NULL;
+    }
+    store->recovered = st.st_size != 0 && !store->hdr->clean;
+    store->hdr->clean = 0;
+    return store;
+}
+
+void storeClose(Store_t *store) {
+    store->hdr->clean = 1;
+    msync(store->base, store->hdr->fileSize, MS_SYNC);
+    munmap(store->base, STORE_MAX_SIZE);
+    close(store->fd);
+    free(store);
+}
+
+StoreEntry_t *storeFind(Store_t *store, const char *key, size_t keylen) {
+    uint64_t idx = htHashFunction(key, keylen) & (((uint64_t)1 << store->hdr->exp) - 1);
+    for (uint64_t off = storeBuckets(store)[idx]; off != 0;) {
+        StoreEntry_t *se = STORE_ENTRY(store, off);
+        if (se->keylen == keylen && memcmp(se->data, key, keylen) == 0) {
+            return se;
+        }
+        off = se->next;
+    }
+    return NULL;
+}
+
+int storeAdd(Store_t *store, const char *key, size_t keylen, HashtableValue_t htv) {
+    if (!storeSupported(htv.entryType) || keylen > UINT32_MAX) {
+        return 1;
+    }
+    StoreHeader_t *hdr = store->hdr;
+    if (hdr->len == ((uint64_t)1 << hdr->exp) && storeRehash(store, hdr->exp + 1) != 0) {
+        return 2;
+    }
+    int sizeClass = storeSizeClass(storeEntrySize(keylen, htv));
+    uint64_t off = sizeClass == -1 ? 0 : storeAlloc(store, sizeClass);
+    if (off == 0) {
+        return 2;
+    }
+    StoreEntry_t *se = STORE_ENTRY(store, off);
+    se->keylen = keylen;
+    se->sizeClass = sizeClass;
+    memcpy(se->data, key, keylen);
+    storeSetValue(se, htv);
+
+    // add the entry at the top of the list
+    uint64_t idx = htHashFunction(key, keylen) & (((uint64_t)1 << hdr->exp) - 1);
+    se->next = storeBuckets(store)[idx];
+    storeBuckets(store)[idx] = off;
+    hdr->len++;
+    return 0;
+}
+
+// link pointing at the entry of a key, NULL if there is none
+static uint64_t *storeFindLink(Store_t *store, const char *key, size_t keylen) {
+    uint64_t idx = htHashFunction(key, keylen) & (((uint64_t)1 << store->hdr->exp) - 1);
+    uint64_t *link = &storeBuckets(store)[idx];
+    while (*link != 0) {
+        StoreEntry_t *se = STORE_ENTRY(store, *link);
+        if (se->keylen == keylen && memcmp(se->data, key, keylen) == 0) {
+            return link;
+        }
+        link = &se->next;
+    }
+    return NULL;
+}
+
+int storeReplace(Store_t *store, const char *key, size_t keylen, HashtableValue_t htv) {
+    uint64_t *link = storeFindLink(store, key, keylen);
+    if (link == NULL) {
+        return storeAdd(store, key, keylen, htv);
+    }
+    if (!storeSupported(htv.entryType)) {
+        return 1;
+    }
+    StoreEntry_t *se = STORE_ENTRY(store, *link);
+    uint64_t size = storeEntrySize(keylen, htv);
+    if (size <= storeBlockSize(se->sizeClass)) {
+        storeSetValue(se, htv);
+        return 0;
+    }
+    // fill a bigger block before freeing the old one, the new value may point into it
+    int sizeClass = storeSizeClass(size);
+    uint64_t off = sizeClass == -1 ? 0 : storeAlloc(store, sizeClass);
+    if (off == 0) {
+        return 2;
+    }
+    StoreEntry_t *newse = STORE_ENTRY(store, off);
+    newse->keylen = keylen;
+    newse->sizeClass = sizeClass;
+    memcpy(newse->data, key, keylen);
+    storeSetValue(newse, htv);
+    newse->next = se->next;
+    uint64_t old = *link;
+    *link = off;
+    storeFree(store, old, se->sizeClass);
+    return 0;
+}
+
+int storeRemove(Store_t *store, const char *key, size_t keylen) {
+    uint64_t *link = storeFindLink(store, key, keylen);
+    if (link == NULL) {
+        return 1;
+    }
+    uint64_t off = *link;
+    StoreEntry_t *se = STORE_ENTRY(store, off);
+    *link = se->next;
+    storeFree(store, off, se->sizeClass);
+    store->hdr->len--;
+    return 0;
+}
+
+HashtableValue_t storeValue(StoreEntry_t *se) {
+    HashtableValue_t htv;
+    htv.entryType = se->entryType;
+    switch (se->entryType) {
+    case STRING:
+        htv.v.val = se->data + se->keylen;
+        break;
+    case UNSIGNED_INT:
+        htv.v.u64 = se->v.u64;
+        break;
+    case SIGNED_INT:
+        htv.v.s64 = se->v.s64;
+        break;
+    default:
+        htv.v.d = se->v.d;
+        break;
+    }
+    return htv;
+}
+
+void storeSetNumber(StoreEntry_t *se, HashtableValue_t htv) {
+    switch (htv.entryType) {
+    case UNSIGNED_INT:
+        se->v.u64 = htv.v.u64;
+        break;
+    case SIGNED_INT:
+        se->v.s64 = htv.v.s64;
+        break;
+    default:
+        se->v.d = htv.v.d;
+        break;
+    }
+}
+
+int storeRehash(Store_t *store, unsigned char exp) {
+    StoreHeader_t *hdr = store->hdr;
+    int sizeClass = storeBucketsClass(exp);
+    uint64_t newBuckets = sizeClass == -1 ? 0 : storeAlloc(store, sizeClass);
+    if (newBuckets == 0) {
+        return 1;
+    }
+    uint64_t size = (uint64_t)1 << exp;
+    uint64_t *newTable = STORE_PTR(store, newBuckets);
+    uint64_t *table = storeBuckets(store);
+    memset(newTable, 0, size * sizeof(uint64_t));
+    for (uint64_t i = 0; i < ((uint64_t)1 << hdr->exp); i++) {
+        uint64_t off = table[i];
+        while (off != 0) {
+            StoreEntry_t *se = STORE_ENTRY(store, off);
+            uint64_t next = se->next;
+            uint64_t idx = htHashFunction(se->data, se->keylen) & (size - 1);
+            se->next = newTable[idx];
+            newTable[idx] = off;
+            off = next;
+        }
+    }
+    storeFree(store, hdr->buckets, storeBucketsClass(hdr->exp));
+    hdr->buckets = newBuckets;
+    hdr->exp = exp;
+    return 0;
+}
+
+int storeForEach(Store_t *store, storeVisitor_t visitor, void *ctx) {
+    uint64_t *table = storeBuckets(store);
+    for (uint64_t i = 0; i < ((uint64_t)1 << store->hdr->exp); i++) {
+        for (uint64_t off = table[i]; off != 0;) {
+            StoreEntry_t *se = STORE_ENTRY(store, off);
+            off = se->next;
+            if (visitor(store, se, ctx) != 0) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+void storeChainStats(Store_t *store, uint64_t *usedBuckets, uint64_t *longestChain) {
+    uint64_t *table = storeBuckets(store);
+    *usedBuckets = 0;
+    *longestChain = 0;
+    for (uint64_t i = 0; i < ((uint64_t)1 << store->hdr->exp); i++) {
+        uint64_t chain = 0;
+        for (uint64_t off = table[i]; off != 0; off = STORE_ENTRY(store, off)->next) {
+            chain++;
+        }
+        if (chain > 0) {
+            (*usedBuckets)++;
+        }
+        if (chain > *longestChain) {
+            *longestChain = chain;
+        }
+    }
+}
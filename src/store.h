@@ -0,0 +1,149 @@
+/*
+ * Persistent keyspace in a memory mapped file. The file holds a hashtable laid out like the one in
+ * hashtable.h, but linked with offsets from the start of the file instead of pointers, so it can be
+ * mapped anywhere. A restarted server maps the file and serves at once, the kernel pages the entries
+ * in as they are used and writes the modified pages back.
+ *
+ * The file starts with a header page, followed by blocks of STORE_MIN_BLOCK << class bytes holding the
+ * bucket array and the entries. Freed blocks are kept on a free list per class. The file grows by
+ * doubling inside an address range reserved when it is mapped, so pointers into it stay valid while it
+ * is open.
+ *
+ * Only STRING, UNSIGNED_INT, SIGNED_INT and DOUBLE values are stored. Writes go straight to the shared
+ * mapping, so they survive the server crashing but only reach the disk once the kernel writes them back
+ * or the store is closed.
+ *
+ */
+
+#pragma once
+
+#include "hashtable.h"
+#include <stdint.h>
+
+#ifndef __STORE_H
+#define __STORE_H
+
+#define STORE_MAGIC "SDBSTORE"
+#define STORE_VERSION 1
+#define STORE_HEADER_SIZE 4096
+#define STORE_MIN_BLOCK 32
+#define STORE_SIZE_CLASSES 48
+#define STORE_INITIAL_SIZE (1024 * 1024)
+#define STORE_INITIAL_EXP 5
+// address space reserved for the file, it can't grow past this
+#define STORE_MAX_SIZE (1ULL << 40)
+
+typedef struct StoreHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t clean;    /* Set when the file was closed, cleared while it is open */
+    uint64_t fileSize; /* Size of the file */
+    uint64_t top;      /* Blocks end here, the rest of the file is unused */
+    uint64_t len;      /* Number of entries */
+    uint64_t buckets;  /* Offset of the bucket array, which holds 1 << exp entry offsets */
+    uint64_t exp;
+    uint64_t freeLists[STORE_SIZE_CLASSES]; /* Offset of the first free block of every class, 0 if none */
+} StoreHeader_t;
+
+typedef struct StoreEntry {
+    uint64_t next;     /* Offset of the next entry of the bucket, 0 if none */
+    uint32_t keylen;
+    uint32_t vallen;   /* Length of a STRING value */
+    uint8_t entryType; /* An EntryType_t */
+    uint8_t sizeClass; /* Class of the block holding the entry */
+    uint8_t pad[6];
+    union {
+        uint64_t u64;
+        int64_t s64;
+        double d;
+    } v;               /* Value of the numeric types */
+    char data[];       /* The key, then the NUL terminated value of a STRING */
+} StoreEntry_t;
+
+typedef struct Store {
+    int fd;
+    char *base;          /* Start of the mapping */
+    StoreHeader_t *hdr;
+    int recovered;       /* Set if the file wasn't closed by the last server that mapped it */
+} Store_t;
+
+/**
+ * Callback invoked for every entry visited by storeForEach
+ *
+ * @returns 0 to continue iterating, non-zero to stop
+ * */
+typedef int (*storeVisitor_t)(Store_t *store, StoreEntry_t *se, void *ctx);
+
+/**
+ * Map a store file, creating it if it doesn't exist
+ *
+ * @param path The file
+ * @param truncate Set to start over with an empty store
+ *
+ * @returns The store or NULL if the file can't be created, mapped or isn't a store, or another server has
+ *          it open
+ * */
+Store_t *storeOpen(const char *path, int truncate);
+
+/**
+ * Write the store back to the file and unmap it
+ * */
+void storeClose(Store_t *store);
+
+/**
+ * @returns The entry of a key or NULL if there is none
+ * */
+StoreEntry_t *storeFind(Store_t *store, const char *key, size_t keylen);
+
+/**
+ * Add an entry for a key that is not in the store yet, growing the bucket array when it is full
+ *
+ * @returns 0 if successful, 1 if the type of the value can't be stored, 2 if the file can't grow
+ * */
+int storeAdd(Store_t *store, const char *key, size_t keylen, HashtableValue_t htv);
+
+/**
+ * Replace the value of a key, adding an entry if there is none. The entry is rewritten in place if the
+ * value fits its block
+ *
+ * @returns 0 if successful, 1 if the type of the value can't be stored, 2 if the file can't grow
+ * */
+int storeReplace(Store_t *store, const char *key, size_t keylen, HashtableValue_t htv);
+
+/**
+ * Remove the entry of a key
+ *
+ * @returns 0 if successful, 1 if there is no entry to remove
+ * */
+int storeRemove(Store_t *store, const char *key, size_t keylen);
+
+/**
+ * @returns The value of an entry, a STRING points into the mapping and is valid until the entry changes
+ * */
+HashtableValue_t storeValue(StoreEntry_t *se);
+
+/**
+ * Overwrite the value of an entry holding a number with another number
+ * */
+void storeSetNumber(StoreEntry_t *se, HashtableValue_t htv);
+
+/**
+ * Move every entry to a bucket array of 1 << exp buckets
+ *
+ * @returns 0 if successful, 1 if the file can't grow
+ * */
+int storeRehash(Store_t *store, unsigned char exp);
+
+/**
+ * Visit every entry. The store must not be modified while iterating
+ *
+ * @returns 0 if every entry was visited, 1 if the visitor stopped the iteration
+ * */
+int storeForEach(Store_t *store, storeVisitor_t visitor, void *ctx);
+
+/**
+ * Count the used buckets and the longest chain, walks every bucket
+ * */
+void storeChainStats(Store_t *store, uint64_t *usedBuckets, uint64_t *longestChain);
+
+#endif /* __STORE_H */
@@ -0,0 +1,49 @@
+/*
+ * Static tracepoints on the hot path of the server. When <sys/sdt.h> from systemtap is available at
+ * build time they are USDT probes under the simpledb provider, which cost a single nop until a tracer
+ * like bpftrace attaches to them:
+ *
+ *   bpftrace -e 'usdt:./build/db:simpledb:rehash__done { printf("%d\n", arg1); }'
+ *
+ * Otherwise, or when built with -DDB_DISABLE_TRACE, they compile to nothing.
+ *
+ * Probes:
+ *   parse(const char *statement, int size)
+ *   execute__start(const char *query)
+ *   execute__done(const char *query, int retval, uint64_t ns)
+ *   rehash__start(uint64_t len, int exp)
+ *   rehash__done(uint64_t len, int exp, uint64_t ns)
+ *   shrink__done(uint64_t len, int exp)
+ *   send(int clientFd, int size)
+ *
+ */
+
+#pragma once
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#if !defined(DB_DISABLE_TRACE) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRACE_ENABLED 1
+#endif
+#endif
+
+#ifdef TRACE_ENABLED
+#define TRACE1(name, a) DTRACE_PROBE1(simpledb, name, a)
+#define TRACE2(name, a, b) DTRACE_PROBE2(simpledb, name, a, b)
+#define TRACE3(name, a, b, c) DTRACE_PROBE3(simpledb, name, a, b, c)
+#else
+#define TRACE1(name, a) \
+    do {                \
+    } while (0)
+#define TRACE2(name, a, b) \
+    do {                   \
+    } while (0)
+#define TRACE3(name, a, b, c) \
+    do {                      \
+    } while (0)
+#endif
+
+#endif /* __TRACE_H */
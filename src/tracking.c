@@ -0,0 +1,135 @@
+#include "tracking.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct TrackingMessage {
+    trackingDeliver_t deliver;
+    void *ctx;
+    const char *key;
+    size_t keylen;
+} TrackingMessage_t;
+
+static void trackingDeliverKey(int fd, void *ctx) {
+    TrackingMessage_t *msg = ctx;
+    msg->deliver(fd, msg->key, msg->keylen, msg->ctx);
+}
+
+// tell the readers of a key it changed and forget them
+static void trackingNotifyReaders(Tracking_t *t, const char *key, size_t keylen, trackingDeliver_t deliver,
+                                  void *ctx) {
+    TrackingMessage_t msg = {deliver, ctx, key, keylen};
+    t->invalidations += pubsubPublish(t->keys, key, keylen, trackingDeliverKey, &msg);
+    pubsubDrop(t->keys, key, keylen);
+}
+
+Tracking_t *trackingCreate(uint64_t maxKeys) {
+    Tracking_t *t = calloc(1, sizeof(Tracking_t));
+    if (t == NULL) {
+        return NULL;
+    }
+    t->keys = pubsubCreate();
+    if (t->keys == NULL) {
+        free(t);
+        return NULL;
+    }
+    t->maxKeys = maxKeys;
+    return t;
+}
+
+void trackingDelete(Tracking_t *t) {
+    pubsubDelete(t->keys);
+    for (int i = 0; i < t->numPrefixes; i++) {
+        free(t->prefixes[i].prefix);
+    }
+    free(t->prefixes);
+    free(t);
+}
+
+void trackingRead(Tracking_t *t, const char *key, size_t keylen, int fd, trackingDeliver_t deliver, void *ctx) {
+    if (t->keys->numChannels >= t->maxKeys && !pubsubHasSubscribers(t->keys, key, keylen)) {
+        Channel_t *ch = pubsubNext(t->keys, &t->cursor);
+        if (ch == NULL) {
+            return;
+        }
+        // the channel is freed with its name
+        char name[ch->len];
+        size_t len = ch->len;
+        memcpy(name, ch->name, len);
+        trackingNotifyReaders(t, name, len, deliver, ctx);
+        t->evictions++;
+    }
+    // on allocation failure the key isn't tracked, only its reader can tell
+    pubsubSubscribe(t->keys, key, keylen, fd);
+}
+
+int trackingAddPrefix(Tracking_t *t, const char *prefix, size_t len, int fd) {
+    if (t->numPrefixes == TRACKING_MAX_PREFIXES) {
+        return 1;
+    }
+    if (t->numPrefixes == t->cap) {
+        int cap = t->cap > 0 ? t->cap * 2 : 8;
+        TrackingPrefix_t *prefixes = realloc(t->prefixes, cap * sizeof(TrackingPrefix_t));
+        if (prefixes == NULL) {
+            return 2;
+        }
+        t->prefixes = prefixes;
+        t->cap = cap;
+    }
+    TrackingPrefix_t *p = &t->prefixes[t->numPrefixes];
+    p->prefix = malloc(len + 1);
+    if (p->prefix == NULL) {
+        return 2;
+    }
+    memcpy(p->prefix, prefix, len);
+    p->prefix[len] = '\0';
+    p->len = len;
+    p->fd = fd;
+    t->numPrefixes++;
+    return 0;
+}
+
+void trackingInvalidate(Tracking_t *t, const char *key, size_t keylen, trackingDeliver_t deliver, void *ctx) {
+    if (t->keys->numChannels > 0) {
+        trackingNotifyReaders(t, key, keylen, deliver, ctx);
+    }
+    for (int i = 0; i < t->numPrefixes; i++) {
+        TrackingPrefix_t *p = &t->prefixes[i];
+        if (p->len > keylen || memcmp(p->prefix, key, p->len) != 0) {
+            continue;
+        }
+        // a client with several matching prefixes is told once
+        int told = 0;
+        for (int j = 0; j < i && !told; j++) {
+            TrackingPrefix_t *q = &t->prefixes[j];
+            told = q->fd == p->fd && q->len <= keylen && memcmp(q->prefix, key, q->len) == 0;
+        }
+        if (!told) {
+            deliver(p->fd, key, keylen, ctx);
+            t->invalidations++;
+        }
+    }
+}
+
+void trackingInvalidateAll(Tracking_t *t, const int *fds, int numFds, trackingDeliver_t deliver, void *ctx) {
+    for (int i = 0; i < numFds; i++) {
+        deliver(fds[i], NULL, 0, ctx);
+    }
+    t->invalidations += numFds;
+    Channel_t *ch;
+    while ((ch = pubsubNext(t->keys, &t->cursor)) != NULL) {
+        pubsubDrop(t->keys, ch->name, ch->len);
+    }
+}
+
+void trackingForget(Tracking_t *t, int fd) {
+    pubsubUnsubscribeAll(t->keys, fd);
+    int kept = 0;
+    for (int i = 0; i < t->numPrefixes; i++) {
+        if (t->prefixes[i].fd == fd) {
+            free(t->prefixes[i].prefix);
+        } else {
+            t->prefixes[kept++] = t->prefixes[i];
+        }
+    }
+    t->numPrefixes = kept;
+}
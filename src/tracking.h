@@ -0,0 +1,99 @@
+/*
+ * Invalidation tracking for clients that cache the values they read. A client either has the keys it
+ * reads remembered, and is told once when one of them changes, or registers prefixes and is told about
+ * every change to a key starting with one of them, without anything being remembered per key.
+ *
+ * The readers of a key are forgotten once they were told it changed, the client reads it again before
+ * caching it again. The number of keys remembered is bounded, when it is reached the readers of some
+ * key are told it changed although it didn't, so a client never keeps a value nobody tracks anymore.
+ *
+ * Keys are tracked by name only, a change to a key in any database invalidates it, which at worst
+ * makes a client read a value again.
+ *
+ */
+
+#pragma once
+
+#include "pubsub.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef __TRACKING_H
+#define __TRACKING_H
+
+#define TRACKING_DEFAULT_MAX_KEYS 65536
+#define TRACKING_MAX_PREFIXES 1024
+
+typedef enum TrackingMode {
+    TRACKING_OFF,
+    TRACKING_READS,   /* Told about changes to the keys it read */
+    TRACKING_PREFIXES /* Told about changes to keys starting with the prefixes it registered */
+} TrackingMode_t;
+
+typedef struct TrackingPrefix {
+    char *prefix;
+    size_t len;
+    int fd;
+} TrackingPrefix_t;
+
+typedef struct Tracking {
+    PubSub_t *keys; /* Readers of every key, as the subscribers of a channel named by the key */
+    uint64_t maxKeys;
+    uint64_t cursor; /* Where the next key to forget is looked for */
+    TrackingPrefix_t *prefixes;
+    int numPrefixes;
+    int cap;
+    uint64_t invalidations; /* Messages sent */
+    uint64_t evictions;     /* Keys forgotten because maxKeys was reached */
+} Tracking_t;
+
+/**
+ * Tell a client a key changed
+ *
+ * @param fd The connection of the client
+ * @param key The key, NULL if every key changed
+ * @param ctx The context pointer passed to the tracking function
+ * */
+typedef void (*trackingDeliver_t)(int fd, const char *key, size_t keylen, void *ctx);
+
+/**
+ * @param maxKeys The most keys remembered at once
+ *
+ * @returns An empty tracking table or NULL on error
+ * */
+Tracking_t *trackingCreate(uint64_t maxKeys);
+
+void trackingDelete(Tracking_t *t);
+
+/**
+ * Remember a client read a key. A key is forgotten to make room if needed
+ *
+ * @param deliver Called for the readers of the key forgotten
+ * */
+void trackingRead(Tracking_t *t, const char *key, size_t keylen, int fd, trackingDeliver_t deliver, void *ctx);
+
+/**
+ * Tell a client about every change to keys starting with prefix
+ *
+ * @returns 0 if successful, 1 if there are TRACKING_MAX_PREFIXES already, 2 on allocation failure
+ * */
+int trackingAddPrefix(Tracking_t *t, const char *prefix, size_t len, int fd);
+
+/**
+ * Tell the clients that read a key or registered a prefix of it that it changed, and forget its readers
+ * */
+void trackingInvalidate(Tracking_t *t, const char *key, size_t keylen, trackingDeliver_t deliver, void *ctx);
+
+/**
+ * Tell every tracking client that every key changed, and forget every reader
+ *
+ * @param fds The connections of the clients with tracking on
+ * */
+void trackingInvalidateAll(Tracking_t *t, const int *fds, int numFds, trackingDeliver_t deliver, void *ctx);
+
+/**
+ * Forget everything a client read and its prefixes, when it turns tracking off or goes away
+ * */
+void trackingForget(Tracking_t *t, int fd);
+
+#endif /* __TRACKING_H */
@@ -0,0 +1,173 @@
+#include "vlog.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define VLOG_COPY_CHUNK 4096
+
+// path of the log written by a compaction
+static void vlogCompactPath(ValueLog_t *vlog, char *buf, size_t cap) {
+    snprintf(buf, cap, "%s.compact", vlog->path);
+}
+
+static VlogCacheSlot_t *vlogCacheSlot(ValueLog_t *vlog, uint64_t offset) {
+    // offsets are spread by the length of the values, mix them before picking a slot
+    uint64_t h = offset * 0x9E3779B97F4A7C15ULL;
+    return &vlog->cache[(h >> 32) % VLOG_CACHE_SLOTS];
+}
+
+static void vlogCacheClear(ValueLog_t *vlog) {
+    for (int i = 0; i < VLOG_CACHE_SLOTS; i++) {
+        free(vlog->cache[i].data);
+        vlog->cache[i].data = NULL;
+        vlog->cache[i].offset = UINT64_MAX;
+    }
+}
+
+// write a whole buffer at an offset, returns 0 if successful
+static int vlogWriteAt(int fd, const char *buf, uint64_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, offset);
+        if (n <= 0) {
+            return 1;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+static int vlogReadAt(int fd, char *buf, uint64_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t n = pread(fd, buf, len, offset);
+        if (n <= 0) {
+            return 1;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+ValueLog_t *vlogOpen(const char *path) {
+    ValueLog_t *vlog = calloc(1, sizeof(ValueLog_t));
+    if (vlog == NULL) {
+        return NULL;
+    }
+    vlog->path = strdup(path);
+    vlog->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (vlog->path == NULL || vlog->fd == -1) {
+        if (vlog->fd != -1) {
+            close(vlog->fd);
+        }
+        free(vlog->path);
+        free(vlog);
+        return NULL;
+    }
+    vlog->compactFd = -1;
+    for (int i = 0; i < VLOG_CACHE_SLOTS; i++) {
+        vlog->cache[i].offset = UINT64_MAX;
+    }
+    return vlog;
+}
+
+void vlogClose(ValueLog_t *vlog) {
+    if (vlog->compactFd != -1) {
+        vlogCompactEnd(vlog, 1);
+    }
+    vlogCacheClear(vlog);
+    close(vlog->fd);
+    unlink(vlog->path);
+    free(vlog->path);
+    free(vlog);
+}
+
+int vlogAppend(ValueLog_t *vlog, const char *val, uint32_t len, uint64_t *offset) {
+    if (vlogWriteAt(vlog->fd, val, len, vlog->size) != 0) {
+        return 1;
+    }
+    *offset = vlog->size;
+    vlog->size += len;
+    return 0;
+}
+
+int vlogRead(ValueLog_t *vlog, uint64_t offset, uint32_t len, char *buf) {
+    VlogCacheSlot_t *slot = vlogCacheSlot(vlog, offset);
+    if (slot->offset == offset && slot->len == len) {
+        vlog->cacheHits++;
+        memcpy(buf, slot->data, len);
+        return 0;
+    }
+    vlog->cacheMisses++;
+    if (vlogReadAt(vlog->fd, buf, len, offset) != 0) {
+        return 1;
+    }
+    if (len <= VLOG_CACHE_MAX_VALUE) {
+        char *data = realloc(slot->data, len > 0 ? len : 1);
+        if (data != NULL) {
+            memcpy(data, buf, len);
+            slot->data = data;
+            slot->offset = offset;
+            slot->len = len;
+        }
+    }
+    return 0;
+}
+
+void vlogRelease(ValueLog_t *vlog, uint64_t offset, uint32_t len) {
+    VlogCacheSlot_t *slot = vlogCacheSlot(vlog, offset);
+    if (slot->offset == offset) {
+        slot->offset = UINT64_MAX;
+    }
+    vlog->deadBytes += len;
+}
+
+int vlogShouldCompact(ValueLog_t *vlog) {
+    return vlog->size >= VLOG_COMPACT_MIN_BYTES && vlog->deadBytes * 2 > vlog->size;
+}
+
+int vlogCompactBegin(ValueLog_t *vlog) {
+    char path[strlen(vlog->path) + sizeof(".compact")];
+    vlogCompactPath(vlog, path, sizeof(path));
+    vlog->compactFd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    vlog->compactSize = 0;
+    return vlog->compactFd == -1;
+}
+
+int vlogCompactCopy(ValueLog_t *vlog, uint64_t offset, uint32_t len) {
+    char chunk[VLOG_COPY_CHUNK];
+    for (uint32_t copied = 0; copied < len;) {
+        uint32_t n = len - copied < VLOG_COPY_CHUNK ? len - copied : VLOG_COPY_CHUNK;
+        if (vlogReadAt(vlog->fd, chunk, n, offset + copied) != 0 ||
+            vlogWriteAt(vlog->compactFd, chunk, n, vlog->compactSize + copied) != 0) {
+            return 1;
+        }
+        copied += n;
+    }
+    vlog->compactSize += len;
+    return 0;
+}
+
+int vlogCompactEnd(ValueLog_t *vlog, int failed) {
+    char path[strlen(vlog->path) + sizeof(".compact")];
+    vlogCompactPath(vlog, path, sizeof(path));
+    if (failed || rename(path, vlog->path) != 0) {
+        close(vlog->compactFd);
+        unlink(path);
+        vlog->compactFd = -1;
+        return 1;
+    }
+    close(vlog->fd);
+    vlog->fd = vlog->compactFd;
+    vlog->compactFd = -1;
+    vlog->size = vlog->compactSize;
+    vlog->deadBytes = 0;
+    vlog->compactions++;
+    // every value moved
+    vlogCacheClear(vlog);
+    return 0;
+}
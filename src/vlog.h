@@ -0,0 +1,110 @@
+/*
+ * Append-only log of values moved out of memory by the tiered hashtable, see htEnableTiering. The table
+ * keeps the key and where the value is in the log, the log only holds the bytes of the values.
+ *
+ * A value that is replaced or removed leaves dead bytes behind. Compaction copies the live values to a
+ * new log, which then takes the place of the old one. The log only means something to the table that
+ * wrote it, so it starts empty and is removed once closed.
+ *
+ * Reads go through a small direct mapped cache of recently read values, so a value read over and over
+ * doesn't cost a read from the file every time.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#ifndef __VLOG_H
+#define __VLOG_H
+
+#define VLOG_CACHE_SLOTS 256
+// values longer than this are not cached
+#define VLOG_CACHE_MAX_VALUE 4096
+// logs smaller than this are not compacted however many dead bytes they hold
+#define VLOG_COMPACT_MIN_BYTES (1024 * 1024)
+
+typedef struct VlogCacheSlot {
+    uint64_t offset; /* Offset of the cached value, UINT64_MAX if the slot is empty */
+    uint32_t len;
+    char *data;
+} VlogCacheSlot_t;
+
+typedef struct ValueLog {
+    int fd;
+    char *path;
+    uint64_t size;      /* Bytes appended, the next value goes here */
+    uint64_t deadBytes; /* Bytes of values no longer referenced */
+    int compactFd;      /* Log being written by a compaction, -1 if none */
+    uint64_t compactSize;
+    uint64_t compactions;
+    uint64_t cacheHits;
+    uint64_t cacheMisses;
+    VlogCacheSlot_t cache[VLOG_CACHE_SLOTS];
+} ValueLog_t;
+
+/**
+ * Create an empty log, replacing any file at path
+ *
+ * @returns The log or NULL if the file can't be created
+ * */
+ValueLog_t *vlogOpen(const char *path);
+
+/**
+ * Close the log and remove its file
+ * */
+void vlogClose(ValueLog_t *vlog);
+
+/**
+ * Append a value to the log
+ *
+ * @param offset Set to where the value was written
+ *
+ * @returns 0 if successful, 1 if the value couldn't be written
+ * */
+int vlogAppend(ValueLog_t *vlog, const char *val, uint32_t len, uint64_t *offset);
+
+/**
+ * Read a value written by vlogAppend into buf, which holds at least len bytes
+ *
+ * @returns 0 if successful, 1 if the value couldn't be read
+ * */
+int vlogRead(ValueLog_t *vlog, uint64_t offset, uint32_t len, char *buf);
+
+/**
+ * Account for a value that is no longer referenced
+ * */
+void vlogRelease(ValueLog_t *vlog, uint64_t offset, uint32_t len);
+
+/**
+ * @returns 1 if enough of the log is dead bytes to be worth compacting, 0 otherwise
+ * */
+int vlogShouldCompact(ValueLog_t *vlog);
+
+/**
+ * Start writing a compacted log next to the current one. Every live value must then be copied with
+ * vlogCompactCopy before vlogCompactEnd. The values are written back to back in the order they are
+ * copied, so the first value copied is at offset 0 of the compacted log and every other one follows
+ * the one before it
+ *
+ * @returns 0 if successful, 1 if the new log can't be created
+ * */
+int vlogCompactBegin(ValueLog_t *vlog);
+
+/**
+ * Copy a live value to the compacted log
+ *
+ * @returns 0 if successful, 1 if the value couldn't be copied
+ * */
+int vlogCompactCopy(ValueLog_t *vlog, uint64_t offset, uint32_t len);
+
+/**
+ * Replace the log with the compacted one, or drop the compacted one if a copy failed
+ *
+ * @param failed Set if a value couldn't be copied
+ *
+ * @returns 0 if the log was replaced, 1 otherwise
+ * */
+int vlogCompactEnd(ValueLog_t *vlog, int failed);
+
+#endif /* __VLOG_H */
@@ -1,17 +1,49 @@
+#include "../src/cluster.h"
+#include "../src/collections.h"
+#include "../src/config.h"
 #include "../src/hashtable.h"
+#include "../src/histogram.h"
+#include "../src/lazyfree.h"
+#include "../src/log.h"
+#include "../src/lz4.h"
+#include "../src/metrics.h"
 #include "../src/network.h"
+#include "../src/pubsub.h"
+#include "../src/replication.h"
+#include "../src/script.h"
+#include "../src/slowlog.h"
+#include "../src/stats.h"
+#include "../src/tracking.h"
+#include "../src/store.h"
+#include "../src/vlog.h"
 #include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/prctl.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#define TEST_METRICS_PORT "1338"
+#define TEST_REPLICA_PORT "1339"
+#define TEST_CLUSTER_PORT_A "1340"
+#define TEST_CLUSTER_PORT_B "1341"
+#define TEST_MAPPED_PORT "1342"
+#define TEST_MAPPED_FILE "test_keyspace.sdb"
+#define TEST_CONFIG_PORT "1343"
+#define TEST_CONFIG_FILE "test_db.conf"
+#define TEST_VLOG_FILE "test_values.vlog"
+#define TEST_UNIX_SOCKET "test_db.sock"
+#define TEST_ABSTRACT_SOCKET "@simpledb-test"
+
 pid_t serverPid = -1;
 
 /* Helper functions*/
@@ -24,7 +56,7 @@ void createServerProcess() {
     if (serverPid == 0) {
         // in child process
         prctl(PR_SET_PDEATHSIG, SIGHUP);
-        char *argv[2] = {"db", NULL};
+        char *argv[6] = {"db", "--metrics-port", TEST_METRICS_PORT, "--unix", TEST_UNIX_SOCKET, NULL};
         if (execv("./db", argv) == -1) {
             printf("Error executing server on created process: %d\n", errno);
             exit(EXIT_FAILURE);
@@ -34,6 +66,23 @@ void createServerProcess() {
     }
 }
 
+// start another server with the given arguments, it is killed along with the tests
+pid_t spawnServer(char *const argv[]) {
+    pid_t pid = fork();
+    if (pid == -1) {
+        printf("Error creating server process %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        prctl(PR_SET_PDEATHSIG, SIGHUP);
+        if (execv("./db", argv) == -1) {
+            printf("Error executing server on created process: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+    }
+    return pid;
+}
+
 void killServerProcess() {
     if (kill(serverPid, SIGTERM) == -1) {
         printf("Error killing server process %d\n", errno);
@@ -41,7 +90,7 @@ void killServerProcess() {
     }
 }
 
-int createSocketToServer() {
+int createSocketToPort(int port) {
     int socketFd = socket(AF_INET, SOCK_STREAM, 0);
     if (socketFd == -1) {
         printf("Error creating socket\n");
@@ -51,7 +100,7 @@ int createSocketToServer() {
     struct sockaddr_in localServer;
 
     localServer.sin_family = AF_INET;
-    localServer.sin_port = htons(SERVER_DEFAULT_PORT);
+    localServer.sin_port = htons(port);
     localServer.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
     if (connect(socketFd, (const struct sockaddr *)&localServer, sizeof(localServer)) < 0) {
         printf("Error conecting socket to server: %d\n", errno);
@@ -60,6 +109,39 @@ int createSocketToServer() {
     return socketFd;
 }
 
+int createSocketToServer() {
+    return createSocketToPort(SERVER_DEFAULT_PORT);
+}
+
+// connect to a unix socket at path, or in the abstract namespace if path starts with @
+int createSocketToUnix(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    size_t len = strlen(path);
+    memcpy(addr.sun_path, path, len);
+    if (path[0] == '@') {
+        addr.sun_path[0] = '\0';
+    }
+    int socketFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socketFd == -1 || connect(socketFd, (struct sockaddr *)&addr, offsetof(struct sockaddr_un, sun_path) + len) < 0) {
+        close(socketFd);
+        return -1;
+    }
+    return socketFd;
+}
+
+// send a NUL terminated command over the socket and wait for the reply of the server
+void sendCommand(int socketFd, const char *command, char *serverReply) {
+    memset(serverReply, 0, BUFFER_SIZE);
+    if (send(socketFd, command, strlen(command) + 1, 0) < 0) {
+        printf("Sending data over socket failed %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    if (recv(socketFd, serverReply, BUFFER_SIZE, 0) < 0) {
+        printf("Receiving data over socket failed %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
 /* Tests*/
 void testCreateHashtable() {
     Hashtable_t *ht = htCreateTable();
@@ -472,11 +554,1439 @@ void testReplaceNonExistent() {
     htDeleteTable(ht);
 }
 
+void testIncrBy() {
+    Hashtable_t *ht = htCreateTable();
+    HashtableValue_t htv;
+
+    // missing keys are created as signed integers
+    assert(htIncrBy(ht, "counter", 7, 5, &htv) == 0);
+    assert(htv.entryType == SIGNED_INT);
+    assert(htv.v.s64 == 5);
+    assert(htIncrBy(ht, "counter", 7, -8, &htv) == 0);
+    assert(htFind(ht, "counter", 7).v.s64 == -3);
+
+    htv.entryType = SIGNED_INT;
+    htv.v.s64 = INT64_MAX - 1;
+    assert(htReplace(ht, "counter", 7, htv) == 0);
+    assert(htIncrBy(ht, "counter", 7, 1, NULL) == 0);
+    assert(htIncrBy(ht, "counter", 7, 1, NULL) == 2);
+    assert(htFind(ht, "counter", 7).v.s64 == INT64_MAX);
+
+    htv.entryType = UNSIGNED_INT;
+    htv.v.u64 = 3;
+    assert(htAdd(ht, "ucounter", 8, htv) == 0);
+    assert(htIncrBy(ht, "ucounter", 8, -3, &htv) == 0);
+    assert(htv.entryType == UNSIGNED_INT);
+    assert(htv.v.u64 == 0);
+    assert(htIncrBy(ht, "ucounter", 8, -1, NULL) == 2);
+    assert(htIncrBy(ht, "ucounter", 8, INT64_MIN, NULL) == 2);
+    assert(htFind(ht, "ucounter", 8).v.u64 == 0);
+
+    htv.entryType = STRING;
+    htv.v.val = "abc";
+    assert(htAdd(ht, "string", 6, htv) == 0);
+    assert(htIncrBy(ht, "string", 6, 1, NULL) == 1);
+    assert(htIncrByFloat(ht, "string", 6, 1.5, NULL) == 1);
+    assert(htIncrByFloat(ht, "counter", 7, 1.5, NULL) == 1);
+
+    assert(htIncrByFloat(ht, "float", 5, 1.5, &htv) == 0);
+    assert(htIncrByFloat(ht, "float", 5, 0.25, &htv) == 0);
+    assert(htv.entryType == DOUBLE);
+    assert(htv.v.d == 1.75);
+    assert(htIncrByFloat(ht, "float", 5, 1e308, NULL) == 0);
+    assert(htIncrByFloat(ht, "float", 5, 1e308, NULL) == 2);
+    htDeleteTable(ht);
+}
+
+void testIncrByUpdatesIndex() {
+    Hashtable_t *ht = htCreateTable();
+    assert(htCreateIndex(ht, "hits:", 5) == 0);
+    assert(htIncrBy(ht, "hits:a", 6, 10, NULL) == 0);
+    assert(htIncrBy(ht, "hits:b", 6, 5, NULL) == 0);
+    assert(htIncrBy(ht, "hits:b", 6, 10, NULL) == 0);
+    HashtableIndex_t *idx = htGetIndex(ht, "hits:", 5);
+    assert(idx->sl->len == 2);
+    assert(idx->sl->tail->score == 15);
+    assert(memcmp(idx->sl->tail->key, "hits:b", 6) == 0);
+    htDeleteTable(ht);
+}
+
+typedef struct ChangeLog {
+    char keys[8][16];
+    HashtableChange_t changes[8];
+    int count;
+} ChangeLog_t;
+
+static void logChange(void *ctx, const char *key, size_t keylen, HashtableChange_t change) {
+    ChangeLog_t *log = ctx;
+    snprintf(log->keys[log->count], sizeof(log->keys[0]), "%.*s", (int)keylen, key);
+    log->changes[log->count++] = change;
+}
+
+void testChangeHandler() {
+    Hashtable_t *ht = htCreateTable();
+    ChangeLog_t log = {0};
+    HashtableValue_t htv;
+    htv.entryType = SIGNED_INT;
+    htv.v.s64 = 1;
+    htSetChangeHandler(ht, logChange, &log);
+    htAdd(ht, "a", 1, htv);
+    htReplace(ht, "a", 1, htv);
+    htIncrBy(ht, "a", 1, 2, NULL);
+    htRemove(ht, "a", 1);
+    // nothing happened to a missing key
+    htRemove(ht, "a", 1);
+    assert(log.count == 4 && strcmp(log.keys[0], "a") == 0 && strcmp(log.keys[3], "a") == 0);
+    assert(log.changes[0] == HT_CHANGE_ADD && log.changes[1] == HT_CHANGE_UPDATE);
+    assert(log.changes[2] == HT_CHANGE_UPDATE && log.changes[3] == HT_CHANGE_REMOVE);
+    htSetChangeHandler(ht, NULL, NULL);
+    htAdd(ht, "b", 1, htv);
+    assert(log.count == 4);
+    htDeleteTable(ht);
+}
+
+void testVersions() {
+    Hashtable_t *ht = htCreateTable();
+    HashtableValue_t htv;
+    htv.entryType = STRING;
+    htv.v.val = "first";
+    assert(htVersion(ht, "key", 3) == 0);
+    assert(htAdd(ht, "key", 3, htv) == 0);
+    uint64_t first = htVersion(ht, "key", 3);
+    assert(first > 0);
+    // a write with a stale version is refused
+    htv.v.val = "second";
+    assert(htReplace(ht, "key", 3, htv) == 0);
+    uint64_t second = htVersion(ht, "key", 3);
+    assert(second > first);
+    htv.v.val = "lost";
+    assert(htReplaceIfVersion(ht, "key", 3, htv, first) == 1);
+    assert(strcmp(htFind(ht, "key", 3).v.val, "second") == 0);
+    htv.v.val = "third";
+    assert(htReplaceIfVersion(ht, "key", 3, htv, second) == 0);
+    assert(strcmp(htFind(ht, "key", 3).v.val, "third") == 0 && htVersion(ht, "key", 3) > second);
+    // version 0 only adds
+    assert(htReplaceIfVersion(ht, "key", 3, htv, 0) == 1);
+    assert(htReplaceIfVersion(ht, "other", 5, htv, 0) == 0 && htVersion(ht, "other", 5) > 0);
+
+    // a key added again never gets a version it had before
+    uint64_t before = htVersion(ht, "key", 3);
+    assert(htRemove(ht, "key", 3) == 0 && htVersion(ht, "key", 3) == 0);
+    assert(htAdd(ht, "key", 3, htv) == 0 && htVersion(ht, "key", 3) > before);
+    before = htVersion(ht, "key", 3);
+    assert(htTouch(ht, "key", 3) == 0 && htVersion(ht, "key", 3) > before);
+    assert(htTouch(ht, "missing", 7) == 1);
+    assert(htIncrBy(ht, "counter", 7, 1, NULL) == 0);
+    before = htVersion(ht, "counter", 7);
+    assert(htIncrBy(ht, "counter", 7, 1, NULL) == 0 && htVersion(ht, "counter", 7) > before);
+    htDeleteTable(ht);
+}
+
+// collect the keys visited by a skiplist query into a space separated string
+static int collectKeys(const char *key, size_t keylen, double score, void *ctx) {
+    char *out = ctx;
+    if (strlen(out) > 0) {
+        strcat(out, " ");
+    }
+    strncat(out, key, keylen);
+    return 0;
+}
+
+void testIndexRange() {
+    Hashtable_t *ht = htCreateTable();
+    HashtableValue_t htv;
+    htv.entryType = SIGNED_INT;
+    htv.v.s64 = -5;
+    assert(htAdd(ht, "score:a", 7, htv) == 0);
+    htv.entryType = UNSIGNED_INT;
+    htv.v.u64 = 10;
+    assert(htAdd(ht, "score:b", 7, htv) == 0);
+    htv.entryType = DOUBLE;
+    htv.v.d = 2.5;
+    assert(htAdd(ht, "score:c", 7, htv) == 0);
+    htv.entryType = STRING;
+    htv.v.val = "not a number";
+    assert(htAdd(ht, "score:d", 7, htv) == 0);
+    htv.entryType = SIGNED_INT;
+    htv.v.s64 = 3;
+    assert(htAdd(ht, "other:a", 7, htv) == 0);
+
+    // existing keys are indexed when the index is created
+    assert(htCreateIndex(ht, "score:", 6) == 0);
+    assert(htCreateIndex(ht, "score:", 6) == 1);
+    HashtableIndex_t *idx = htGetIndex(ht, "score:", 6);
+    assert(idx != NULL);
+    assert(idx->sl->len == 3);
+
+    char keys[256] = "";
+    assert(slRangeByScore(idx->sl, -10, 5, collectKeys, keys) == 2);
+    assert(strcmp("score:a score:c", keys) == 0);
+
+    keys[0] = '\0';
+    assert(slTop(idx->sl, 2, collectKeys, keys) == 2);
+    assert(strcmp("score:b score:c", keys) == 0);
+
+    assert(htDropIndex(ht, "score:", 6) == 0);
+    assert(htGetIndex(ht, "score:", 6) == NULL);
+    assert(htDropIndex(ht, "score:", 6) == 1);
+    htDeleteTable(ht);
+}
+
+void testIndexMaintained() {
+    Hashtable_t *ht = htCreateTable();
+    assert(htCreateIndex(ht, "cnt:", 4) == 0);
+    HashtableIndex_t *idx = htGetIndex(ht, "cnt:", 4);
+    for (int i = 0; i < 100; i++) {
+        char key[16];
+        sprintf(key, "cnt:%d", i);
+        HashtableValue_t htv;
+        htv.entryType = SIGNED_INT;
+        htv.v.s64 = i;
+        assert(htAdd(ht, key, strlen(key), htv) == 0);
+    }
+    assert(idx->sl->len == 100);
+
+    // replacing a value moves it in the index, replacing with a string removes it from the index
+    HashtableValue_t htv;
+    htv.entryType = DOUBLE;
+    htv.v.d = 1000.5;
+    assert(htReplace(ht, "cnt:3", 5, htv) == 0);
+    htv.entryType = STRING;
+    htv.v.val = "gone";
+    assert(htReplace(ht, "cnt:99", 6, htv) == 0);
+    assert(htRemove(ht, "cnt:98", 6) == 0);
+    assert(idx->sl->len == 98);
+
+    char keys[256] = "";
+    assert(slTop(idx->sl, 3, collectKeys, keys) == 3);
+    assert(strcmp("cnt:3 cnt:97 cnt:96", keys) == 0);
+
+    keys[0] = '\0';
+    assert(slRangeByScore(idx->sl, 2, 5, collectKeys, keys) == 3);
+    assert(strcmp("cnt:2 cnt:4 cnt:5", keys) == 0);
+    htDeleteTable(ht);
+}
+
+static int cmpTestKeys(const void *a, const void *b) {
+    return strcmp(*(const char **)a, *(const char **)b);
+}
+
+// check the scanned keys arrive in the same order as the sorted reference keys
+typedef struct ArtScanCheck {
+    const char **expected;
+    size_t next;
+} ArtScanCheck_t;
+
+static int checkScanKey(const char *key, size_t keylen, void *ctx) {
+    ArtScanCheck_t *check = ctx;
+    const char *expected = check->expected[check->next++];
+    assert(keylen == strlen(expected));
+    assert(memcmp(key, expected, keylen) == 0);
+    return 0;
+}
+
+void testClusterSlots() {
+    // the check value of CRC16/XMODEM and the slots redis cluster gives these keys
+    assert(clusterCrc16("123456789", 9) == 0x31C3);
+    assert(clusterKeySlot("foo", 3) == 12182);
+    assert(clusterKeySlot("user1000", 8) == 3443);
+    // only a non empty hash tag is hashed
+    assert(clusterKeySlot("{user1000}.following", 20) == 3443);
+    assert(clusterKeySlot("x{user1000}{y}", 14) == 3443);
+    assert(clusterKeySlot("{}foo", 5) == clusterCrc16("{}foo", 5) % CLUSTER_SLOTS);
+    assert(clusterKeySlot("foo{", 4) == clusterCrc16("foo{", 4) % CLUSTER_SLOTS);
+
+    Cluster_t *cluster = clusterCreate("127.0.0.1:7000");
+    assert(cluster != NULL && clusterCreate("no port") == NULL);
+    const char *addr = NULL;
+    char buf[BUFFER_SIZE];
+    assert(clusterRoute(cluster, 0, 0, 0, &addr) == CLUSTER_ROUTE_DOWN);
+    assert(clusterAssign(cluster, 0, 8191, "127.0.0.1:7000") == 0);
+    assert(clusterAssign(cluster, 8192, 16383, "127.0.0.1:7001") == 0);
+    assert(clusterAssign(cluster, 10, 5, "127.0.0.1:7001") == -1);
+    assert(clusterAssign(cluster, 0, CLUSTER_SLOTS, "127.0.0.1:7001") == -1);
+    assert(clusterFormatSlots(cluster, buf, sizeof(buf)) > 0);
+    assert(strcmp("{0-8191: 127.0.0.1:7000, 8192-16383: 127.0.0.1:7001}", buf) == 0);
+    assert(clusterFormatSlots(cluster, buf, 10) == -1);
+    assert(clusterRoute(cluster, 100, 0, 0, &addr) == CLUSTER_ROUTE_LOCAL);
+    assert(clusterRoute(cluster, 9000, 0, 0, &addr) == CLUSTER_ROUTE_MOVED && strcmp("127.0.0.1:7001", addr) == 0);
+
+    // a migrating slot still serves the keys it has, an importing slot serves asking clients
+    assert(clusterSetMigrating(cluster, 9000, "127.0.0.1:7002") == -1);
+    assert(clusterSetMigrating(cluster, 100, "127.0.0.1:7000") == -1);
+    assert(clusterSetMigrating(cluster, 100, "127.0.0.1:7002") == 0);
+    assert(clusterRoute(cluster, 100, 1, 0, &addr) == CLUSTER_ROUTE_LOCAL);
+    assert(clusterRoute(cluster, 100, 0, 0, &addr) == CLUSTER_ROUTE_ASK && strcmp("127.0.0.1:7002", addr) == 0);
+    assert(clusterSetImporting(cluster, 100, "127.0.0.1:7001") == -1);
+    assert(clusterSetImporting(cluster, 9000, "127.0.0.1:7001") == 0);
+    assert(clusterRoute(cluster, 9000, 0, 0, &addr) == CLUSTER_ROUTE_MOVED);
+    assert(clusterRoute(cluster, 9000, 0, 1, &addr) == CLUSTER_ROUTE_LOCAL);
+    // assigning a slot ends its migration
+    assert(clusterAssign(cluster, 100, 100, "127.0.0.1:7002") == 0);
+    assert(cluster->migrating[100] == -1 && clusterRoute(cluster, 100, 1, 0, &addr) == CLUSTER_ROUTE_MOVED);
+    assert(clusterFormatSlots(cluster, buf, sizeof(buf)) > 0);
+    assert(strcmp("{0-99: 127.0.0.1:7000, 100-100: 127.0.0.1:7002, 101-8191: 127.0.0.1:7000, "
+                  "8192-16383: 127.0.0.1:7001}",
+                  buf) == 0);
+
+    char host[CLUSTER_MAX_ADDR_LEN];
+    int port;
+    assert(clusterParseAddr("localhost:1337", host, sizeof(host), &port) == 0);
+    assert(strcmp("localhost", host) == 0 && port == 1337);
+    assert(clusterParseAddr(":1337", host, sizeof(host), &port) == -1);
+    assert(clusterParseAddr("localhost:0", host, sizeof(host), &port) == -1);
+    assert(clusterParseAddr("localhost:1x", host, sizeof(host), &port) == -1);
+    clusterDelete(cluster);
+}
+
+void testArtInsertRemoveScan() {
+    Art_t *art = artCreate();
+    const int numKeys = 3000;
+    char *keys[numKeys];
+    // keys share long prefixes, are prefixes of each other and fan out wide enough to use every node type
+    for (int i = 0; i < numKeys; i++) {
+        keys[i] = malloc(32);
+        int suffix = (i / 300) % 3;
+        sprintf(keys[i], "user:%d:%s", i % 300, suffix == 0 ? "" : (suffix == 1 ? "session" : "sessions"));
+    }
+    for (int i = 0; i < numKeys; i++) {
+        int dupe = 0;
+        for (int j = 0; j < i; j++) {
+            dupe |= strcmp(keys[i], keys[j]) == 0;
+        }
+        assert(artInsert(art, keys[i], strlen(keys[i])) == dupe);
+    }
+    assert(art->len == 900);
+    assert(artSearch(art, "user:42:session", 15) == 1);
+    assert(artSearch(art, "user:42:sess", 12) == 0);
+    assert(artSearch(art, "user:", 5) == 0);
+
+    const char *sorted[900];
+    int numSorted = 0;
+    for (int i = 0; i < 900; i++) {
+        sorted[numSorted++] = keys[i];
+    }
+    qsort(sorted, numSorted, sizeof(char *), cmpTestKeys);
+    ArtScanCheck_t check = {sorted, 0};
+    assert(artScan(art, NULL, 0, 0, checkScanKey, &check) == 900);
+
+    // remove every other key, the remaining keys must still be found and scanned in order
+    numSorted = 0;
+    for (int i = 0; i < 900; i++) {
+        if (i % 2 == 0) {
+            assert(artRemove(art, keys[i], strlen(keys[i])) == 0);
+            assert(artRemove(art, keys[i], strlen(keys[i])) == 1);
+        } else {
+            sorted[numSorted++] = keys[i];
+        }
+    }
+    assert(art->len == 450);
+    qsort(sorted, numSorted, sizeof(char *), cmpTestKeys);
+    check.next = 0;
+    assert(artScan(art, NULL, 0, 0, checkScanKey, &check) == 450);
+
+    // scanning from a lower bound starts at the first key not smaller than the bound
+    int first = 0;
+    while (strcmp(sorted[first], "user:15") < 0) {
+        first++;
+    }
+    check.next = first;
+    assert(artScan(art, "user:15", 7, 0, checkScanKey, &check) == 450 - first);
+    check.next = first + 1;
+    assert(artScan(art, sorted[first], strlen(sorted[first]), 1, checkScanKey, &check) == 450 - first - 1);
+
+    for (int i = 0; i < numKeys; i++) {
+        free(keys[i]);
+    }
+    artDelete(art);
+}
+
+void testKeyIndexMaintained() {
+    Hashtable_t *ht = htCreateTable();
+    HashtableValue_t htv;
+    htv.entryType = SIGNED_INT;
+    htv.v.s64 = 1;
+    assert(htAdd(ht, "b", 1, htv) == 0);
+    assert(htEnableKeyIndex(ht) == 0);
+    assert(htEnableKeyIndex(ht) == 1);
+    assert(htAdd(ht, "a", 1, htv) == 0);
+    assert(htAdd(ht, "c", 1, htv) == 0);
+    assert(htRemove(ht, "b", 1) == 0);
+    assert(htReplace(ht, "d", 1, htv) == 0);
+    assert(ht->keyIndex->len == 3);
+
+    const char *expected[] = {"a", "c", "d"};
+    ArtScanCheck_t check = {expected, 0};
+    assert(artScan(ht->keyIndex, NULL, 0, 0, checkScanKey, &check) == 3);
+    assert(htDisableKeyIndex(ht) == 0);
+    assert(ht->keyIndex == NULL);
+    htDeleteTable(ht);
+}
+
+// count the elements visited and remember the last one
+typedef struct ElementCheck {
+    uint64_t count;
+    char last[64];
+} ElementCheck_t;
+
+static int checkElement(const char *s, size_t len, void *ctx) {
+    ElementCheck_t *check = ctx;
+    check->count++;
+    memcpy(check->last, s, len);
+    check->last[len] = '\0';
+    return 0;
+}
+
+void testListPushPop() {
+    List_t *list = listCreate();
+    char element[32];
+    // push enough elements to span several listpack nodes
+    for (int i = 0; i < 1000; i++) {
+        sprintf(element, "%d", i);
+        assert(listPush(list, i % 2 == 0 ? LIST_TAIL : LIST_HEAD, element, strlen(element)) == i + 1);
+    }
+    assert(list->head != list->tail);
+
+    ElementCheck_t check = {0};
+    assert(listRange(list, 0, -1, checkElement, &check) == 1000);
+    assert(strcmp("998", check.last) == 0);
+    check.count = 0;
+    assert(listRange(list, 0, 0, checkElement, &check) == 1);
+    assert(strcmp("999", check.last) == 0);
+    check.count = 0;
+    assert(listRange(list, 499, 500, checkElement, &check) == 2);
+    assert(strcmp("0", check.last) == 0);
+    assert(listRange(list, 5, 2, checkElement, &check) == 0);
+
+    char *out;
+    size_t outlen;
+    assert(listPop(list, LIST_HEAD, &out, &outlen) == 0);
+    assert(strcmp("999", out) == 0);
+    free(out);
+    assert(listPop(list, LIST_TAIL, &out, &outlen) == 0);
+    assert(strcmp("998", out) == 0);
+    free(out);
+    while (list->len > 0) {
+        assert(listPop(list, LIST_TAIL, &out, &outlen) == 0);
+        free(out);
+    }
+    assert(list->head == NULL && list->tail == NULL);
+    assert(listPop(list, LIST_HEAD, &out, &outlen) == 1);
+    listDelete(list);
+}
+
+void testHashUpgrade() {
+    Hash_t *h = hashCreate();
+    const char *val;
+    size_t vallen;
+    assert(hashSet(h, "field", 5, "value", 5) == 1);
+    assert(hashSet(h, "field", 5, "other", 5) == 0);
+    assert(h->encoding == ENCODING_LISTPACK);
+    assert(hashGet(h, "field", 5, &val, &vallen) == 0);
+    assert(vallen == 5 && memcmp(val, "other", 5) == 0);
+    // replacing a value with one of another length keeps the fields after it
+    assert(hashSet(h, "second", 6, "2", 1) == 1);
+    assert(hashSet(h, "field", 5, "longer", 6) == 0);
+    assert(hashSet(h, "field", 5, "other", 5) == 0);
+    assert(hashLen(h) == 2);
+    assert(hashGet(h, "second", 6, &val, &vallen) == 0);
+    assert(vallen == 1 && memcmp(val, "2", 1) == 0);
+    assert(hashDel(h, "second", 6) == 0);
+
+    // a large value upgrades the hash to a hashtable, existing fields are kept
+    char big[HASH_MAX_LISTPACK_VALUE + 2];
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    assert(hashSet(h, "big", 3, big, strlen(big)) == 1);
+    assert(h->encoding == ENCODING_HASHTABLE);
+    assert(hashLen(h) == 2);
+    assert(hashGet(h, "field", 5, &val, &vallen) == 0);
+    assert(vallen == 5 && memcmp(val, "other", 5) == 0);
+    assert(hashDel(h, "field", 5) == 0);
+    assert(hashDel(h, "field", 5) == 1);
+    assert(hashGet(h, "field", 5, &val, &vallen) == 1);
+    hashDelete(h);
+
+    // so do many fields
+    h = hashCreate();
+    char field[16];
+    for (int i = 0; i <= HASH_MAX_LISTPACK_ENTRIES; i++) {
+        sprintf(field, "f%d", i);
+        assert(hashSet(h, field, strlen(field), "v", 1) == 1);
+    }
+    assert(h->encoding == ENCODING_HASHTABLE);
+    assert(hashLen(h) == HASH_MAX_LISTPACK_ENTRIES + 1);
+    hashDelete(h);
+}
+
+void testSetEncodings() {
+    Set_t *set = setCreate();
+    assert(setAdd(set, "100000", 6) == 1);
+    assert(setAdd(set, "-3", 2) == 1);
+    assert(setAdd(set, "5000000000", 10) == 1);
+    assert(setAdd(set, "-3", 2) == 0);
+    assert(set->encoding == ENCODING_INTSET);
+    assert(set->c.is->encoding == sizeof(int64_t));
+    assert(intsetGet(set->c.is, 0) == -3);
+    assert(setIsMember(set, "100000", 6));
+    assert(!setIsMember(set, "0100000", 7));
+
+    // a member that isn't a canonical integer moves the set to a listpack
+    assert(setAdd(set, "+7", 2) == 1);
+    assert(set->encoding == ENCODING_LISTPACK);
+    assert(setIsMember(set, "5000000000", 10));
+    assert(setIsMember(set, "+7", 2));
+    assert(setRemove(set, "-3", 2) == 1);
+    assert(setRemove(set, "-3", 2) == 0);
+    assert(setLen(set) == 3);
+    setDelete(set);
+
+    set = setCreate();
+    char member[16];
+    for (int i = 0; i <= SET_MAX_INTSET_ENTRIES; i++) {
+        sprintf(member, "%d", i * 7);
+        assert(setAdd(set, member, strlen(member)) == 1);
+    }
+    assert(set->encoding == ENCODING_HASHTABLE);
+    assert(setLen(set) == SET_MAX_INTSET_ENTRIES + 1);
+    assert(setIsMember(set, "70", 2));
+    ElementCheck_t check = {0};
+    assert(setForEach(set, checkElement, &check) == SET_MAX_INTSET_ENTRIES + 1);
+    setDelete(set);
+}
+
+void testCollectionsInHashtable() {
+    Hashtable_t *ht = htCreateTable();
+    HashtableValue_t htv;
+    htv.entryType = LIST;
+    htv.v.list = listCreate();
+    listPush(htv.v.list, LIST_TAIL, "a", 1);
+    assert(htAdd(ht, "list", 4, htv) == 0);
+    htv.entryType = SET;
+    htv.v.set = setCreate();
+    setAdd(htv.v.set, "a", 1);
+    assert(htAdd(ht, "set", 3, htv) == 0);
+
+    // the table owns the collections and frees them on replace, remove and delete
+    assert(htFind(ht, "list", 4).v.list->len == 1);
+    htv.entryType = HASH;
+    htv.v.hash = hashCreate();
+    assert(htReplace(ht, "list", 4, htv) == 0);
+    assert(htFind(ht, "list", 4).entryType == HASH);
+    assert(htRemove(ht, "set", 3) == 0);
+    htDeleteTable(ht);
+}
+
+// a small JSON document repeated, similar to what clients typically store
+static void fillJson(char *buf, size_t len) {
+    size_t off = 0;
+    for (int i = 0; off + 1 < len; i++) {
+        off += snprintf(buf + off, len - off, "{\"id\": %d, \"name\": \"user\", \"active\": true}, ", i % 10);
+    }
+    buf[len - 1] = '\0';
+}
+
+void testLz4RoundTrip() {
+    char src[4096];
+    char comp[LZ4_COMPRESSBOUND(sizeof(src))];
+    char out[sizeof(src)];
+    fillJson(src, sizeof(src));
+    size_t complen = lz4Compress(src, sizeof(src), comp, sizeof(comp));
+    assert(complen > 0 && complen < sizeof(src) / 4);
+    assert(lz4Decompress(comp, complen, out, sizeof(out)) == sizeof(src));
+    assert(memcmp(src, out, sizeof(src)) == 0);
+    // the output buffer must hold the whole value
+    assert(lz4Decompress(comp, complen, out, sizeof(out) - 1) == -1);
+    // truncated input is rejected
+    assert(lz4Decompress(comp, complen / 2, out, sizeof(out)) == -1);
+
+    // incompressible data still round trips within the bound
+    srand(7);
+    for (size_t i = 0; i < sizeof(src); i++) {
+        src[i] = rand();
+    }
+    complen = lz4Compress(src, sizeof(src), comp, sizeof(comp));
+    assert(complen > sizeof(src));
+    assert(lz4Compress(src, sizeof(src), comp, sizeof(src)) == 0);
+    assert(lz4Decompress(comp, complen, out, sizeof(out)) == sizeof(src));
+    assert(memcmp(src, out, sizeof(src)) == 0);
+}
+
+void testCompressedValues() {
+    Hashtable_t *ht = htCreateTable();
+    htSetCompression(ht, 64, 10);
+    char json[1024];
+    fillJson(json, sizeof(json));
+    HashtableValue_t htv;
+    htv.entryType = STRING;
+    htv.v.val = json;
+    assert(htAdd(ht, "json", 4, htv) == 0);
+    htv.v.val = "short";
+    assert(htAdd(ht, "short", 5, htv) == 0);
+    assert(ht->compressedValues == 1);
+    assert(ht->compressionSavedBytes > sizeof(json) / 2);
+
+    htv = htFind(ht, "json", 4);
+    assert(htv.entryType == STRING);
+    assert(strcmp(htv.v.val, json) == 0);
+    assert(strcmp(htFind(ht, "short", 5).v.val, "short") == 0);
+
+    // values that don't compress well enough are kept raw
+    char random[256];
+    for (size_t i = 0; i < sizeof(random) - 1; i++) {
+        random[i] = 'a' + rand() % 26;
+    }
+    random[sizeof(random) - 1] = '\0';
+    htv.v.val = random;
+    assert(htReplace(ht, "json", 4, htv) == 0);
+    assert(ht->compressedValues == 0 && ht->compressionSavedBytes == 0);
+    assert(strcmp(htFind(ht, "json", 4).v.val, random) == 0);
+
+    htv.v.val = json;
+    assert(htReplace(ht, "json", 4, htv) == 0);
+    assert(ht->compressedValues == 1);
+    assert(htRemove(ht, "json", 4) == 0);
+    assert(ht->compressedValues == 0 && ht->compressionSavedBytes == 0);
+    assert(htAdd(ht, "json", 4, htv) == 0);
+    htDeleteTable(ht);
+}
+
+void testHistogram() {
+    Histogram_t h;
+    histogramInit(&h);
+    assert(histogramPercentile(&h, 50) == 0);
+    for (uint64_t v = 1; v <= 1000; v++) {
+        histogramRecord(&h, v * 1000);
+    }
+    assert(h.count == 1000 && h.min == 1000 && h.max == 1000000);
+    // every percentile is within the precision of a sub-bucket
+    uint64_t p50 = histogramPercentile(&h, 50);
+    uint64_t p99 = histogramPercentile(&h, 99);
+    assert(p50 >= 500000 && p50 <= 500000 + 500000 / HISTOGRAM_SUB_BUCKETS);
+    assert(p99 >= 990000 && p99 <= 990000 + 990000 / HISTOGRAM_SUB_BUCKETS);
+    assert(histogramPercentile(&h, 100) == 1000000);
+
+    // small values are exact and slots cover every value without gaps
+    for (uint64_t v = 0; v < 4096; v++) {
+        int slot = histogramSlot(v);
+        assert(v <= histogramSlotMax(slot));
+        assert(slot == 0 || v > histogramSlotMax(slot - 1));
+    }
+    assert(histogramSlot(UINT64_MAX) == HISTOGRAM_SLOTS - 1);
+
+    Histogram_t other;
+    histogramInit(&other);
+    histogramRecord(&other, 5);
+    histogramMerge(&h, &other);
+    assert(h.count == 1001 && h.min == 5);
+    assert(histogramPercentile(&h, 0) == 5);
+}
+
+void testStats() {
+    Stats_t *stats = statsCreate(2);
+    uint64_t phaseNs[NUM_PHASES] = {100, 2000, 300};
+    statsRecordCommand(stats, 1, 0, phaseNs);
+    statsRecordCommand(stats, 1, 1, phaseNs);
+    statsRecordCommand(stats, -1, 1, phaseNs);
+    assert(statsRead(&stats->commands) == 3 && statsRead(&stats->errors) == 2);
+    assert(stats->commandStats[0].calls == 0);
+    assert(stats->commandStats[1].calls == 2 && stats->commandStats[1].errors == 1);
+    assert(stats->commandStats[1].latency.max == 2000);
+    assert(stats->phases[PHASE_SEND].count == 3 && stats->phases[PHASE_SEND].min == 300);
+    statsDelete(stats);
+}
+
+void testSlowlog() {
+    Slowlog_t *sl = slowlogCreate(3, 1000);
+    uint64_t fast[NUM_PHASES] = {10, 999999, 10};
+    uint64_t slow[NUM_PHASES] = {10, 1000000, 10};
+    struct sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(4242);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    assert(slowlogRecord(sl, "select a\n", 9, (struct sockaddr *)&addr, fast) == 0);
+    assert(slowlogRecord(sl, "select a\n", 9, (struct sockaddr *)&addr, slow) == 1);
+    assert(sl->len == 1);
+    SlowlogEntry_t *entry = slowlogGet(sl, 0);
+    assert(strcmp(entry->command, "select a") == 0);
+    assert(strcmp(entry->client, "127.0.0.1:4242") == 0);
+    assert(entry->phaseNs[PHASE_EXECUTE] == 1000000 && entry->timestamp > 0);
+    assert(slowlogGet(sl, 1) == NULL);
+
+    // the oldest entries are overwritten once the log is full
+    char command[16];
+    for (int i = 0; i < 5; i++) {
+        sprintf(command, "cmd%d", i);
+        slowlogRecord(sl, command, strlen(command) + 1, NULL, slow);
+    }
+    assert(sl->len == 3);
+    assert(strcmp(slowlogGet(sl, 0)->command, "cmd4") == 0);
+    assert(strcmp(slowlogGet(sl, 2)->command, "cmd2") == 0);
+    assert(slowlogGet(sl, 0)->id == 5 && strcmp(slowlogGet(sl, 0)->client, "unknown") == 0);
+
+    slowlogSetThreshold(sl, -1);
+    assert(slowlogRecord(sl, "cmd", 3, NULL, slow) == 0);
+    slowlogReset(sl);
+    assert(sl->len == 0 && slowlogGet(sl, 0) == NULL);
+    slowlogDelete(sl);
+}
+
+static void *logFromThread(void *arg) {
+    for (int i = 0; i < 500; i++) {
+        LOG_INFO("thread %ld record %d", (long)arg, i);
+    }
+    return NULL;
+}
+
+void testLog() {
+    char path[] = "/tmp/simpledb-test-log-XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    assert(logParseLevel("warn") == LOG_LEVEL_WARN && logParseLevel("verbose") == -1);
+
+    assert(logInit(path, LOG_LEVEL_INFO) == 0);
+    LOG_DEBUG("filtered out");
+    LOG_INFO("Value is \"%d\"", 42);
+    LOG_ERROR("multi\nline");
+    // every thread logs through its own ring
+    pthread_t threads[2];
+    for (long i = 0; i < 2; i++) {
+        pthread_create(&threads[i], NULL, logFromThread, (void *)i);
+    }
+    for (int i = 0; i < 2; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    logShutdown();
+
+    static char contents[LOG_MAX_MESSAGE_LEN * 2048];
+    int len = 0, n;
+    while ((n = read(fd, contents + len, sizeof(contents) - 1 - len)) > 0) {
+        len += n;
+    }
+    contents[len] = '\0';
+    close(fd);
+    unlink(path);
+
+    int lines = 0;
+    for (int i = 0; i < len; i++) {
+        lines += contents[i] == '\n';
+    }
+    assert(lines == 1002 && logDropped() == 0);
+    assert(strstr(contents, "filtered out") == NULL);
+    assert(strstr(contents, "level=info src=test.c:") != NULL);
+    assert(strstr(contents, "msg=\"Value is \\\"42\\\"\"\n") != NULL);
+    assert(strstr(contents, "level=error") != NULL && strstr(contents, "msg=\"multi line\"") != NULL);
+    assert(strstr(contents, "msg=\"thread 1 record 499\"") != NULL);
+}
+
+void testReplicationBacklog() {
+    Replication_t *repl = replCreate(16);
+    char buf[BUFFER_SIZE];
+    // commands are stored newline terminated
+    replFeed(repl, "insert a int 1", 15);
+    assert(repl->offset == 15 && repl->backlogLen == 15);
+    assert(replRead(repl, 0, buf, sizeof(buf)) == 15 && memcmp(buf, "insert a int 1\n", 15) == 0);
+    assert(replRead(repl, 15, buf, sizeof(buf)) == 0);
+    assert(replRead(repl, 16, buf, sizeof(buf)) == -1);
+
+    // the backlog wraps around and forgets the start of the stream
+    replFeed(repl, "delete a\n", 9);
+    assert(repl->offset == 24 && repl->backlogLen == 16);
+    assert(replRead(repl, 7, buf, sizeof(buf)) == -1);
+    // reads stop at the end of the circular buffer
+    assert(replRead(repl, 9, buf, sizeof(buf)) == 7 && memcmp(buf, "int 1\nd", 7) == 0);
+    assert(replRead(repl, 16, buf, sizeof(buf)) == 8 && memcmp(buf, "elete a\n", 8) == 0);
+
+    // a replica with the same stream continues from the backlog, any other gets a snapshot
+    Hashtable_t *ht = htCreateTable();
+    HashtableValue_t htv = {.entryType = SIGNED_INT, .v.s64 = -3};
+    htAdd(ht, "k", 1, htv);
+    ReplicaCursor_t cursor;
+    char reply[BUFFER_SIZE];
+    assert(replSync(repl, &ht, 1, 0, repl->replid, 10, &cursor, reply) == 0);
+    assert(cursor.snapshot == NULL && cursor.offset == 10 && strncmp(reply, "+CONTINUE ", 10) == 0);
+    assert(replSync(repl, &ht, 1, 0, repl->replid, 2, &cursor, reply) == 1);
+    assert(cursor.offset == 24 && strncmp(reply, "+FULLRESYNC ", 12) == 0);
+    assert(cursor.snapshotLen == 16 && memcmp(cursor.snapshot, "insert k int -3\n", 16) == 0);
+    assert(repl->fullSyncs == 1 && repl->partialSyncs == 1);
+
+    // the snapshot is sent first, then the stream
+    assert(replFeeder(repl, &cursor, buf, 10) == 10 && cursor.snapshot != NULL);
+    assert(replFeeder(repl, &cursor, buf, 10) == 6 && cursor.snapshot == NULL);
+    assert(replFeeder(repl, &cursor, buf, 10) == 0);
+    replFeed(repl, "x y\n", 4);
+    assert(replFeeder(repl, &cursor, buf, 10) == 4 && cursor.offset == 28);
+
+    // a replica loads the snapshot and adopts the stream of the primary
+    Replication_t *replica = replCreate(64);
+    replSetPrimary(replica, "localhost", 1);
+    assert(replHandshake(replica, buf) == 48 && replica->state == REPL_HANDSHAKE);
+    assert(replProcessLine(replica, reply, strlen(reply)) == REPL_LINE_FLUSH && replica->state == REPL_SNAPSHOT);
+    assert(replProcessLine(replica, "insert k int -3\n", 16) == REPL_LINE_APPLY);
+    assert(replica->state == REPL_STREAMING && replica->offset == 24);
+    assert(strcmp(replica->replid, repl->replid) == 0);
+    assert(replProcessLine(replica, "x y\n", 4) == REPL_LINE_APPLY && replica->offset == 28);
+
+    // heartbeats bound the staleness of the replica, acks tell the primary how far behind it is
+    assert(replLagMs(repl) == 0 && replLagMs(replica) == -1);
+    replHeartbeat(repl);
+    int len = sprintf(buf, "ping %lu\n", replNowMs());
+    assert(repl->offset == 28 + len);
+    assert(replProcessLine(replica, buf, len) == REPL_LINE_SKIP && replica->offset == repl->offset);
+    assert(replLagMs(replica) >= 0 && replLagMs(replica) < 1000);
+    len = replAck(replica, buf);
+    assert(replReader(repl, &cursor, buf, len) == 0 && cursor.ackOffset == repl->offset && cursor.ackTimeMs > 0);
+    assert(replReader(repl, &cursor, "what\n", 5) == -1);
+
+    // the snapshot switches to each database that exists, and ends in the database of the stream
+    Hashtable_t *dbs[3] = {ht, NULL, htCreateTable()};
+    htv.v.s64 = 2;
+    htAdd(dbs[2], "j", 1, htv);
+    uint64_t snapshotLen;
+    char *snapshot = replSnapshot(dbs, 3, 1, &snapshotLen);
+    const char *expected = "insert k int -3\nuse 2\ninsert j int 2\nuse 1\n";
+    assert(snapshotLen == strlen(expected) && memcmp(snapshot, expected, snapshotLen) == 0);
+    free(snapshot);
+    snapshot = replSnapshot(dbs, 3, 2, &snapshotLen);
+    assert(snapshotLen == strlen(expected) - 6 && memcmp(snapshot, expected, snapshotLen) == 0);
+    free(snapshot);
+    htDeleteTable(dbs[2]);
+    htDeleteTable(ht);
+    replDelete(replica);
+    replDelete(repl);
+}
+
+void testTableStats() {
+    Hashtable_t *ht = htCreateTable();
+    HashtableStats_t stats;
+    htGetStats(ht, &stats);
+    assert(stats.len == 0 && stats.longestChain == 0 && stats.usedBuckets == 0 && stats.rehashes == 0);
+
+    HashtableValue_t htv;
+    htv.entryType = UNSIGNED_INT;
+    char key[16];
+    for (int i = 0; i < 100; i++) {
+        sprintf(key, "key%d", i);
+        htv.v.u64 = i;
+        htAdd(ht, key, strlen(key), htv);
+    }
+    htGetStats(ht, &stats);
+    assert(stats.len == 100 && stats.size == (1 << ht->exp) && stats.exp == ht->exp);
+    assert(stats.rehashes > 0 && stats.rehashes == ht->rehashes);
+    assert(stats.longestChain >= 1 && stats.usedBuckets <= 100);
+    assert(stats.loadFactor == 100.0 / stats.size);
+    htDeleteTable(ht);
+}
+
+void testTableShrink() {
+    Hashtable_t *ht = htCreateTable();
+    HashtableValue_t htv;
+    htv.entryType = UNSIGNED_INT;
+    char key[16];
+    for (int i = 0; i < 10000; i++) {
+        sprintf(key, "key%d", i);
+        htv.v.u64 = i;
+        htAdd(ht, key, strlen(key), htv);
+    }
+    unsigned char full = ht->exp;
+    // removing most keys starts shrinking, every key stays reachable while buckets are folded
+    for (int i = 0; i < 9900; i++) {
+        sprintf(key, "key%d", i);
+        assert(htRemove(ht, key, strlen(key)) == 0);
+        if (ht->shrinking && i % 97 == 0) {
+            for (int j = i + 1; j < 10000; j += 13) {
+                sprintf(key, "key%d", j);
+                assert(htFind(ht, key, strlen(key)).v.u64 == (uint64_t)j);
+            }
+        }
+    }
+    assert(ht->shrinks > 0 && ht->exp < full);
+    while (htShrinkStep(ht, HASHTABLE_SHRINK_STEP)) {
+    }
+    // shrinking stops once the table is used enough, well before it is full again
+    assert(ht->len * HASHTABLE_SHRINK_RATIO >= ((uint64_t)1 << ht->exp) && ht->len * 2 <= ((uint64_t)1 << ht->exp));
+    unsigned char shrunk = ht->exp;
+    uint64_t rehashes = ht->rehashes;
+    for (int i = 0; i < 9900; i++) {
+        sprintf(key, "key%d", i);
+        htv.v.u64 = i;
+        htAdd(ht, key, strlen(key), htv);
+        sprintf(key, "key%d", i);
+        htRemove(ht, key, strlen(key));
+    }
+    assert(ht->exp == shrunk && ht->rehashes == rehashes);
+
+    // a table filling up while it shrinks finishes shrinking before it grows
+    int removed = 9900;
+    while (!ht->shrinking && removed < 10000) {
+        sprintf(key, "key%d", removed++);
+        htRemove(ht, key, strlen(key));
+    }
+    assert(ht->shrinking);
+    for (int i = 0; i < 1000; i++) {
+        sprintf(key, "key%d", i);
+        htv.v.u64 = i;
+        htAdd(ht, key, strlen(key), htv);
+    }
+    for (int i = 0; i < 1000; i++) {
+        sprintf(key, "key%d", i);
+        assert(htFind(ht, key, strlen(key)).v.u64 == (uint64_t)i);
+    }
+    HashtableStats_t stats;
+    htGetStats(ht, &stats);
+    assert(stats.len == 1000 + 10000 - removed && stats.shrinks == ht->shrinks);
+
+    // resizing at once keeps every entry
+    assert(htResize(ht, 9) == 1);
+    assert(htResize(ht, HASHTABLE_MAX_INITIAL_EXP + 1) == 1 && htResize(ht, 63) == 1);
+    assert(htResize(ht, 16) == 0 && ht->exp == 16 && !ht->shrinking);
+    assert(htResize(ht, 11) == 0 && ht->exp == 11);
+    for (int i = 0; i < 1000; i++) {
+        sprintf(key, "key%d", i);
+        assert(htFind(ht, key, strlen(key)).v.u64 == (uint64_t)i);
+    }
+    htDeleteTable(ht);
+
+    // resizing a table that is shrinking doesn't carry the shrink over to the new size
+    ht = htCreateTable();
+    for (int i = 0; i < 11; i++) {
+        sprintf(key, "key%d", i);
+        htv.v.u64 = i;
+        htAdd(ht, key, strlen(key), htv);
+    }
+    assert(htResize(ht, 20) == 0);
+    assert(htRemove(ht, "key0", 4) == 0 && ht->shrinking);
+    assert(htResize(ht, 5) == 0 && ht->exp == 5 && !ht->shrinking);
+    sprintf(key, "key%d", 11);
+    htAdd(ht, key, strlen(key), htv);
+    assert(ht->exp >= ht->minExp);
+    for (int i = 1; i < 12; i++) {
+        sprintf(key, "key%d", i);
+        assert(htFind(ht, key, strlen(key)).entryType != NONE);
+    }
+    htDeleteTable(ht);
+
+    // a table created large never shrinks below its size on its own
+    assert(htCreateSizedTable(HASHTABLE_DEFAULTCAP - 1) == NULL);
+    assert(htCreateSizedTable(HASHTABLE_MAX_INITIAL_EXP + 1) == NULL);
+    ht = htCreateSizedTable(12);
+    assert(ht != NULL && ht->exp == 12);
+    for (int i = 0; i < 10000; i++) {
+        sprintf(key, "key%d", i);
+        htv.v.u64 = i;
+        htAdd(ht, key, strlen(key), htv);
+    }
+    assert(ht->exp > 12);
+    for (int i = 0; i < 9990; i++) {
+        sprintf(key, "key%d", i);
+        htRemove(ht, key, strlen(key));
+        htShrinkStep(ht, HASHTABLE_SHRINK_STEP);
+    }
+    while (htShrinkStep(ht, HASHTABLE_SHRINK_STEP)) {
+    }
+    assert(ht->exp == 12 && ht->shrinks > 0);
+    htDeleteTable(ht);
+}
+
+static int countMappedEntry(HashtableEntry_t *hte, void *ctx) {
+    uint64_t *count = ctx;
+    assert(hte->keylen > 3 && memcmp(hte->key, "key", 3) == 0);
+    (*count)++;
+    return 0;
+}
+
+void testMappedTable() {
+    Hashtable_t *ht = htCreateMappedTable(TEST_MAPPED_FILE, 1);
+    assert(ht != NULL && ht->store != NULL && ht->len == 0);
+    // a second table can't map the same file
+    assert(htCreateMappedTable(TEST_MAPPED_FILE, 0) == NULL);
+    HashtableValue_t htv;
+    char key[16];
+    char val[64];
+    for (int i = 0; i < 5000; i++) {
+        sprintf(key, "key%d", i);
+        if (i % 2 == 0) {
+            htv.entryType = SIGNED_INT;
+            htv.v.s64 = -i;
+        } else {
+            sprintf(val, "value%d", i);
+            htv.entryType = STRING;
+            htv.v.val = val;
+        }
+        assert(htAdd(ht, key, strlen(key), htv) == 0);
+    }
+    assert(htAdd(ht, "key0", 4, htv) == 1);
+    assert(ht->len == 5000 && ht->rehashes > 0);
+    htv.entryType = LIST;
+    assert(htAdd(ht, "list", 4, htv) == 2);
+    // replacing with a longer value moves the entry to a bigger block
+    sprintf(val, "a value that is much longer than the one before");
+    htv.entryType = STRING;
+    htv.v.val = val;
+    assert(htReplace(ht, "key1", 4, htv) == 0);
+    htv = htFind(ht, "key3", 4);
+    assert(htReplace(ht, "key3", 4, htv) == 0);
+    assert(htIncrBy(ht, "key2", 4, 10, NULL) == 0);
+    assert(htRemove(ht, "key4", 4) == 0 && htRemove(ht, "key4", 4) == 1);
+    htDeleteTable(ht);
+
+    // everything is still there once the file is mapped again
+    ht = htCreateMappedTable(TEST_MAPPED_FILE, 0);
+    assert(ht != NULL && ht->len == 4999 && !ht->store->recovered);
+    assert(strcmp(htFind(ht, "key1", 4).v.val, val) == 0);
+    assert(strcmp(htFind(ht, "key3", 4).v.val, "value3") == 0);
+    assert(htFind(ht, "key2", 4).v.s64 == 8);
+    assert(htFind(ht, "key4", 4).entryType == NONE);
+    for (int i = 5; i < 5000; i++) {
+        sprintf(key, "key%d", i);
+        htv = htFind(ht, key, strlen(key));
+        if (i % 2 == 0) {
+            assert(htv.entryType == SIGNED_INT && htv.v.s64 == -i);
+        } else {
+            sprintf(val, "value%d", i);
+            assert(htv.entryType == STRING && strcmp(htv.v.val, val) == 0);
+        }
+    }
+    uint64_t count = 0;
+    htForEach(ht, countMappedEntry, &count);
+    assert(count == 4999);
+    HashtableStats_t stats;
+    htGetStats(ht, &stats);
+    assert(stats.len == 4999 && stats.usedBuckets > 0 && stats.longestChain > 0);
+    assert(htResize(ht, 16) == 0 && ht->exp == 16);
+    assert(htFind(ht, "key4999", 7).entryType == STRING);
+    htDeleteTable(ht);
+
+    // truncating starts over
+    ht = htCreateMappedTable(TEST_MAPPED_FILE, 1);
+    assert(ht != NULL && ht->len == 0 && htFind(ht, "key1", 4).entryType == NONE);
+    htDeleteTable(ht);
+    unlink(TEST_MAPPED_FILE);
+}
+
+void testTieredValues() {
+    Hashtable_t *ht = htCreateTable();
+    assert(htEnableTiering(ht, TEST_VLOG_FILE, 32) == 0);
+    assert(htEnableTiering(ht, TEST_VLOG_FILE, 32) == 1);
+    HashtableValue_t htv;
+    char key[16];
+    char val[128];
+    for (int i = 0; i < 1000; i++) {
+        sprintf(key, "key%d", i);
+        // every other value is too short to move
+        sprintf(val, i % 2 == 0 ? "a long value of key %d, long enough to be moved to the log" : "short %d", i);
+        htv.entryType = STRING;
+        htv.v.val = val;
+        htAdd(ht, key, strlen(key), htv);
+    }
+    // new values stay in memory for a whole sweep, the second sweep moves those that weren't read
+    uint64_t buckets = (uint64_t)1 << ht->exp;
+    assert(htTierStep(ht, buckets, 0) == 0);
+    htFind(ht, "key0", 4);
+    assert(htTierStep(ht, buckets, 0) == 499);
+    assert(ht->spilledValues == 499 && ht->vlog->size == ht->spilledBytes);
+    for (int i = 0; i < 1000; i++) {
+        sprintf(key, "key%d", i);
+        sprintf(val, i % 2 == 0 ? "a long value of key %d, long enough to be moved to the log" : "short %d", i);
+        htv = htFind(ht, key, strlen(key));
+        assert(htv.entryType == STRING && strcmp(htv.v.val, val) == 0);
+    }
+    // read twice before the next sweep, the value moves back to memory
+    assert(htFind(ht, "key2", 4).entryType == STRING && ht->promotions == 1 && ht->spilledValues == 498);
+    // key0 was read before the second sweep, so it stayed in memory too
+    assert(htTierStep(ht, buckets, 1) == 2);
+    // compacting drops the values that were replaced or removed
+    for (int i = 0; i < 500; i += 2) {
+        sprintf(key, "key%d", i);
+        htRemove(ht, key, strlen(key));
+    }
+    htv.v.val = "replaced";
+    assert(htReplace(ht, "key500", 6, htv) == 0);
+    uint64_t before = ht->vlog->size;
+    assert(ht->vlog->deadBytes > 0 && htTierCompact(ht) == 0);
+    assert(ht->vlog->size < before && ht->vlog->size == ht->spilledBytes && ht->vlog->deadBytes == 0);
+    assert(ht->spilledValues == 249 && ht->vlog->compactions == 1);
+    for (int i = 502; i < 1000; i += 2) {
+        sprintf(key, "key%d", i);
+        sprintf(val, "a long value of key %d, long enough to be moved to the log", i);
+        assert(strcmp(htFind(ht, key, strlen(key)).v.val, val) == 0);
+    }
+    assert(strcmp(htFind(ht, "key500", 6).v.val, "replaced") == 0);
+    assert(htIncrBy(ht, "key502", 6, 1, NULL) == 1);
+    htDeleteTable(ht);
+    assert(access(TEST_VLOG_FILE, F_OK) != 0);
+}
+
+void testLazyFree() {
+    assert(lazyfreeInit() == 0);
+    assert(lazyfreeInit() == -1);
+    uint64_t done = lazyfreeDone();
+    Hashtable_t *ht = htCreateTable();
+    HashtableValue_t htv;
+    size_t biglen = HASHTABLE_LAZYFREE_EFFORT * 4096 * 2;
+    char *big = malloc(biglen + 1);
+    memset(big, 'x', biglen);
+    big[biglen] = '\0';
+    htv.entryType = STRING;
+    htv.v.val = big;
+    htAdd(ht, "big", 3, htv);
+    htv.v.val = "small";
+    htAdd(ht, "small", 5, htv);
+    // only the value that takes long to free is handed to the reclaimer
+    assert(htRemove(ht, "big", 3) == 0 && htRemove(ht, "small", 5) == 0);
+    assert(htFind(ht, "big", 3).entryType == NONE && ht->len == 0);
+    htv.entryType = LIST;
+    htv.v.list = listCreate();
+    for (int i = 0; i < 1000; i++) {
+        listPush(htv.v.list, LIST_TAIL, "element", 7);
+    }
+    htAdd(ht, "list", 4, htv);
+    htv.entryType = STRING;
+    htv.v.val = big;
+    htAdd(ht, "big", 3, htv);
+    htv.v.val = "replaced";
+    assert(htReplace(ht, "big", 3, htv) == 0);
+
+    // a lazily deleted table gives up its value log right away
+    assert(htEnableTiering(ht, TEST_VLOG_FILE, 32) == 0);
+    htDeleteTableLazy(ht);
+    assert(access(TEST_VLOG_FILE, F_OK) == -1);
+    ht = htCreateTable();
+    assert(htEnableTiering(ht, TEST_VLOG_FILE, 32) == 0);
+    htDeleteTableLazy(ht);
+
+    // every pending job runs before the reclaimer stops
+    lazyfreeShutdown();
+    assert(lazyfreePending() == 0 && lazyfreeDone() - done == 4);
+    // without the reclaimer everything is freed right away
+    ht = htCreateTable();
+    htDeleteTableLazy(ht);
+    assert(lazyfreeDone() - done == 4);
+    free(big);
+}
+
+static void countDelivery(int fd, void *ctx) {
+    int *delivered = ctx;
+    delivered[fd]++;
+}
+
+void testPubSub() {
+    PubSub_t *ps = pubsubCreate();
+    int delivered[8] = {0};
+    assert(pubsubSubscribe(ps, "news", 4, 3) == 0);
+    assert(pubsubSubscribe(ps, "news", 4, 3) == 1);
+    assert(pubsubSubscribe(ps, "news", 4, 4) == 0);
+    assert(pubsubSubscribe(ps, "sport", 5, 3) == 0);
+    assert(ps->numChannels == 2 && ps->numSubscriptions == 3 && pubsubSubscriptions(ps, 3) == 2);
+    assert(pubsubPublish(ps, "news", 4, countDelivery, delivered) == 2);
+    assert(pubsubPublish(ps, "sport", 5, countDelivery, delivered) == 1);
+    assert(pubsubPublish(ps, "weather", 7, countDelivery, delivered) == 0);
+    assert(delivered[3] == 2 && delivered[4] == 1);
+    assert(ps->published == 3 && ps->delivered == 3);
+
+    // a channel goes away with its last subscriber
+    assert(pubsubUnsubscribe(ps, "sport", 5, 4) == 1);
+    assert(pubsubUnsubscribe(ps, "sport", 5, 3) == 0);
+    assert(ps->numChannels == 1 && !pubsubHasSubscribers(ps, "sport", 5));
+    assert(pubsubUnsubscribeAll(ps, 3) == 1 && pubsubHasSubscribers(ps, "news", 4));
+    assert(pubsubUnsubscribeAll(ps, 4) == 1 && ps->numChannels == 0 && ps->numSubscriptions == 0);
+
+    // more channels than buckets
+    char channel[16];
+    for (int i = 0; i < 100; i++) {
+        sprintf(channel, "channel%d", i);
+        assert(pubsubSubscribe(ps, channel, strlen(channel), i % 8) == 0);
+    }
+    assert(ps->exp > PUBSUB_INITIAL_EXP && ps->numChannels == 100);
+    for (int i = 0; i < 100; i++) {
+        sprintf(channel, "channel%d", i);
+        assert(pubsubHasSubscribers(ps, channel, strlen(channel)));
+    }
+    assert(pubsubUnsubscribeAll(ps, 0) == 13 && ps->numChannels == 87);
+    pubsubDelete(ps);
+}
+
+static int denyScriptWrite(void *ctx, const char *key, size_t keylen, int write, char *err, size_t errlen) {
+    if (write) {
+        snprintf(err, errlen, "read only");
+    }
+    return write;
+}
+
+static void countScriptWrite(void *ctx, const char *key, size_t keylen) {
+    (*(int *)ctx)++;
+}
+
+// compile and run a script, returns what scriptRun returned
+static int runScript(Hashtable_t *ht, const char *source, const char **args, int numArgs, ScriptHooks_t *hooks,
+                     char *result) {
+    Script_t *script = scriptCompile(source, result, BUFFER_SIZE);
+    assert(script != NULL);
+    int retval = scriptRun(script, ht, args, numArgs, hooks, result, BUFFER_SIZE);
+    scriptFree(script);
+    return retval;
+}
+
+void testScripts() {
+    Hashtable_t *ht = htCreateTable();
+    char result[BUFFER_SIZE];
+    int writes = 0;
+    ScriptHooks_t hooks = {NULL, countScriptWrite, &writes};
+
+    assert(runScript(ht, "1 2 + 3 *", NULL, 0, NULL, result) == 0 && strcmp(result, "9") == 0);
+    assert(runScript(ht, "7 2 / 7 2 % ..", NULL, 0, NULL, result) == 0 && strcmp(result, "31") == 0);
+    assert(runScript(ht, "1 0.5 +", NULL, 0, NULL, result) == 0 && strcmp(result, "1.500000") == 0);
+    assert(runScript(ht, "'a 'b swap ..", NULL, 0, NULL, result) == 0 && strcmp(result, "ba") == 0);
+    assert(runScript(ht, "", NULL, 0, NULL, result) == 0 && strcmp(result, "nil") == 0);
+    assert(runScript(ht, "1 if 'yes else 'no then", NULL, 0, NULL, result) == 0 && strcmp(result, "yes") == 0);
+    assert(runScript(ht, "nil if 'yes else 'no then", NULL, 0, NULL, result) == 0 && strcmp(result, "no") == 0);
+    assert(runScript(ht, "0 if 1 if 'a then then 'b", NULL, 0, NULL, result) == 0 && strcmp(result, "b") == 0);
+    assert(runScript(ht, "'first return 'second", NULL, 0, NULL, result) == 0 && strcmp(result, "first") == 0);
+
+    // read, compute and write several keys in one run
+    const char *args[] = {"acct:a", "acct:b", "30"};
+    assert(runScript(ht, "$1 100 set $2 5 set", args, 3, &hooks, result) == 0 && writes == 2);
+    const char *transfer = "$1 get $3 < if 'insufficient error then $1 0 $3 - incrby drop $2 $3 incrby";
+    assert(runScript(ht, transfer, args, 3, &hooks, result) == 0 && strcmp(result, "35") == 0);
+    assert(htFind(ht, "acct:a", 6).v.s64 == 70 && writes == 4);
+    args[2] = "80";
+    assert(runScript(ht, transfer, args, 3, &hooks, result) == 1 && strcmp(result, "insufficient") == 0);
+    assert(htFind(ht, "acct:a", 6).v.s64 == 70 && writes == 4);
+    assert(runScript(ht, "$1 get $9 =", args, 3, NULL, result) == 0 && strcmp(result, "0") == 0);
+    assert(runScript(ht, "'missing get nil =", NULL, 0, NULL, result) == 0 && strcmp(result, "1") == 0);
+    assert(runScript(ht, "'s 'text set 's get 's del 's exists ..", NULL, 0, &hooks, result) == 0);
+    assert(strcmp(result, "10") == 0 && writes == 6);
+    // the string read stays valid after the key is gone
+    assert(runScript(ht, "'s 'text set 's get 's del drop", NULL, 0, NULL, result) == 0);
+    assert(strcmp(result, "text") == 0);
+
+    // the hooks decide what a script may touch
+    ScriptHooks_t readOnly = {denyScriptWrite, NULL, NULL};
+    assert(runScript(ht, "$1 get", args, 1, &readOnly, result) == 0 && strcmp(result, "70") == 0);
+    assert(runScript(ht, "$1 1 set", args, 1, &readOnly, result) == 1 && strcmp(result, "read only") == 0);
+
+    // failures at run time
+    assert(runScript(ht, "drop", NULL, 0, NULL, result) == 1 && strcmp(result, "Stack underflow") == 0);
+    assert(runScript(ht, "1 0 /", NULL, 0, NULL, result) == 1 && strcmp(result, "Division by zero") == 0);
+    assert(runScript(ht, "'x 1 +", NULL, 0, NULL, result) == 1 && strcmp(result, "Expected a number") == 0);
+    assert(runScript(ht, "9223372036854775807 1 +", NULL, 0, NULL, result) == 1);
+    assert(runScript(ht, "'k nil set", NULL, 0, NULL, result) == 1);
+    char source[BUFFER_SIZE] = "1";
+    for (int i = 0; i < SCRIPT_MAX_STACK; i++) {
+        strcat(source, " dup");
+    }
+    assert(runScript(ht, source, NULL, 0, NULL, result) == 1 && strcmp(result, "Stack overflow") == 0);
+    strcpy(source, "'0123456789012345678901234567890123456789012345678901234567890123");
+    for (int i = 0; i < 4; i++) {
+        strcat(source, " dup ..");
+    }
+    assert(runScript(ht, source, NULL, 0, NULL, result) == 1 && strcmp(result, "Out of string memory") == 0);
+
+    // failures at compile time
+    assert(scriptCompile("1 if 2", result, BUFFER_SIZE) == NULL && strcmp(result, "if without then") == 0);
+    assert(scriptCompile("then", result, BUFFER_SIZE) == NULL);
+    assert(scriptCompile("1 else", result, BUFFER_SIZE) == NULL);
+    assert(scriptCompile("$0", result, BUFFER_SIZE) == NULL);
+    assert(scriptCompile("loop", result, BUFFER_SIZE) == NULL && strcmp(result, "Unknown word loop") == 0);
+
+    // scripts are cached by the digest of their source
+    ScriptCache_t *cache = scriptCacheCreate();
+    Script_t *script = scriptCacheLoad(cache, "1 2 +", result, BUFFER_SIZE);
+    assert(script != NULL && script->digest == scriptDigest("1 2 +", 5));
+    assert(scriptCacheLoad(cache, "1 2 +", result, BUFFER_SIZE) == script && cache->numScripts == 1);
+    assert(scriptCacheLoad(cache, "1 +2", result, BUFFER_SIZE) != script && cache->numScripts == 2);
+    assert(scriptCacheLoad(cache, "bad", result, BUFFER_SIZE) == NULL && cache->numScripts == 2);
+    assert(scriptCacheFind(cache, script->digest) == script);
+    scriptCacheFlush(cache);
+    assert(cache->numScripts == 0 && scriptCacheFind(cache, scriptDigest("1 2 +", 5)) == NULL);
+    scriptCacheDelete(cache);
+    htDeleteTable(ht);
+}
+
+typedef struct Invalidations {
+    int count[8];
+    char last[8][16];
+} Invalidations_t;
+
+static void recordInvalidation(int fd, const char *key, size_t keylen, void *ctx) {
+    Invalidations_t *inv = ctx;
+    inv->count[fd]++;
+    snprintf(inv->last[fd], sizeof(inv->last[fd]), "%.*s", key != NULL ? (int)keylen : 1, key != NULL ? key : "*");
+}
+
+void testTracking() {
+    Tracking_t *t = trackingCreate(4);
+    Invalidations_t inv = {0};
+    trackingRead(t, "a", 1, 1, recordInvalidation, &inv);
+    trackingRead(t, "a", 1, 2, recordInvalidation, &inv);
+    trackingRead(t, "b", 1, 1, recordInvalidation, &inv);
+    trackingInvalidate(t, "a", 1, recordInvalidation, &inv);
+    assert(inv.count[1] == 1 && inv.count[2] == 1 && strcmp(inv.last[2], "a") == 0);
+    // the readers are told once, until they read the key again
+    trackingInvalidate(t, "a", 1, recordInvalidation, &inv);
+    assert(inv.count[1] == 1 && t->keys->numChannels == 1 && t->invalidations == 2);
+
+    // prefixes hear about every matching key, and a client only once per change
+    assert(trackingAddPrefix(t, "user:", 5, 3) == 0 && trackingAddPrefix(t, "user:1", 6, 3) == 0);
+    assert(trackingAddPrefix(t, "user:1", 6, 4) == 0);
+    trackingInvalidate(t, "user:12", 7, recordInvalidation, &inv);
+    trackingInvalidate(t, "user:12", 7, recordInvalidation, &inv);
+    trackingInvalidate(t, "user:2", 6, recordInvalidation, &inv);
+    trackingInvalidate(t, "use", 3, recordInvalidation, &inv);
+    assert(inv.count[3] == 3 && inv.count[4] == 2 && strcmp(inv.last[3], "user:2") == 0);
+
+    // the table is bounded, a key is forgotten with its readers told to drop it
+    for (int i = 0; i < 10; i++) {
+        char key[8];
+        sprintf(key, "k%d", i);
+        trackingRead(t, key, strlen(key), 5, recordInvalidation, &inv);
+    }
+    assert(t->keys->numChannels == 4 && t->evictions == 7 && inv.count[5] == 6 && inv.count[1] == 2);
+    int fds[] = {5, 6};
+    trackingInvalidateAll(t, fds, 2, recordInvalidation, &inv);
+    assert(t->keys->numChannels == 0 && inv.count[5] == 7 && strcmp(inv.last[6], "*") == 0);
+
+    trackingRead(t, "c", 1, 3, recordInvalidation, &inv);
+    trackingForget(t, 3);
+    assert(t->keys->numChannels == 0 && t->numPrefixes == 1);
+    trackingInvalidate(t, "user:12", 7, recordInvalidation, &inv);
+    assert(inv.count[3] == 3 && inv.count[4] == 3);
+    trackingDelete(t);
+}
+
+void testConfig() {
+    int64_t port = 1337, limit = 0;
+    int nodelay = 1, level = 1;
+    char *path = NULL;
+    const char *levels[] = {"debug", "info", "warn", NULL};
+    ConfigParam_t params[] = {
+        {"port", CONFIG_INT, &port, 0, 65535, NULL, NULL},
+        {"output-limit", CONFIG_INT, &limit, 1024, INT64_MAX, NULL, NULL},
+        {"nodelay", CONFIG_BOOL, &nodelay, 0, 1, NULL, NULL},
+        {"level", CONFIG_ENUM, &level, 0, 0, levels, NULL},
+        {"path", CONFIG_STRING, &path, 0, 0, NULL, NULL},
+    };
+    char buf[64];
+    assert(configFind(params, 5, "level") == &params[3] && configFind(params, 5, "levels") == NULL);
+    assert(configSet(&params[0], "6379") == 0 && port == 6379);
+    // out of range or not a whole number leaves the value alone
+    assert(configSet(&params[0], "65536") == 1 && configSet(&params[0], "12ab") == 1);
+    assert(configSet(&params[0], "") == 1 && port == 6379);
+    assert(configSet(&params[1], "4m") == 0 && limit == 4 << 20);
+    assert(configSet(&params[1], "1K") == 0 && limit == 1024);
+    assert(configSet(&params[1], "1") == 1 && configSet(&params[1], "99999999999g") == 1 && limit == 1024);
+    assert(configSet(&params[2], "no") == 0 && nodelay == 0 && configSet(&params[2], "maybe") == 1);
+    assert(configSet(&params[3], "warn") == 0 && level == 2 && configSet(&params[3], "trace") == 1);
+    assert(configSet(&params[4], "a b") == 0 && configSet(&params[4], "c") == 0 && strcmp(path, "c") == 0);
+    configFormat(&params[1], buf, sizeof(buf));
+    assert(strcmp(buf, "1024") == 0);
+    configFormat(&params[2], buf, sizeof(buf));
+    assert(strcmp(buf, "no") == 0);
+    configFormat(&params[3], buf, sizeof(buf));
+    assert(strcmp(buf, "warn") == 0);
+
+    char err[256];
+    FILE *f = fopen("test_config.conf", "w");
+    fprintf(f, "# a comment\n\n  port   7000  \nnodelay yes\npath /tmp/with space\n");
+    fclose(f);
+    assert(configLoad(params, 5, "test_config.conf", err, sizeof(err)) == 0);
+    assert(port == 7000 && nodelay == 1 && strcmp(path, "/tmp/with space") == 0);
+    f = fopen("test_config.conf", "w");
+    fprintf(f, "port 7001\nlevel info\nbogus 1\nport 7002\n");
+    fclose(f);
+    // the lines before the error are applied
+    assert(configLoad(params, 5, "test_config.conf", err, sizeof(err)) == -1);
+    assert(strcmp(err, "test_config.conf:3: Unknown setting bogus") == 0 && port == 7001 && level == 1);
+    f = fopen("test_config.conf", "w");
+    fprintf(f, "port\n");
+    fclose(f);
+    assert(configLoad(params, 5, "test_config.conf", err, sizeof(err)) == -1);
+    assert(strcmp(err, "test_config.conf:1: Invalid value for port") == 0);
+    unlink("test_config.conf");
+    assert(configLoad(params, 5, "test_config.conf", err, sizeof(err)) == -1);
+    free(path);
+}
+
+void testMetricsRender() {
+    Server_t *server = createServer(12346, NULL);
+    Hashtable_t *ht = htCreateTable();
+    Stats_t *stats = statsCreate(2);
+    const char *names[2] = {"select", "insert"};
+    MetricsSource_t src = {stats, &ht, 1, server, names};
+    uint64_t phaseNs[NUM_PHASES] = {1500, 3000, 1000000};
+    statsRecordCommand(stats, 1, 0, phaseNs);
+
+    // render the page in one go, then in chunks too small for most sections
+    static char page[65536];
+    MetricsCursor_t cursor = {0, 0};
+    int len = 0, n;
+    while ((n = metricsRender(&src, &cursor, page + len, sizeof(page) - len)) > 0) {
+        len += n;
+    }
+    page[len] = '\0';
+    static char chunked[65536];
+    char chunk[256];
+    int chunkedLen = 0;
+    cursor = (MetricsCursor_t){0, 0};
+    while ((n = metricsRender(&src, &cursor, chunk, sizeof(chunk))) > 0) {
+        memcpy(chunked + chunkedLen, chunk, n);
+        chunkedLen += n;
+    }
+    chunked[chunkedLen] = '\0';
+
+    // memory and uptime may change between the two renders, everything else is the same
+    const char *pages[2] = {page, chunked};
+    int lines[2] = {0, 0};
+    for (int i = 0; i < 2; i++) {
+        for (const char *c = pages[i]; *c; c++) {
+            lines[i] += *c == '\n';
+        }
+        assert(strstr(pages[i], "simpledb_commands_total{verb=\"insert\"} 1\n") != NULL);
+        assert(strstr(pages[i], "simpledb_commands_total{verb=\"select\"} 0\n") != NULL);
+        assert(strstr(pages[i], "simpledb_keys 0\n") != NULL);
+        // 3us of execute time lands in the 4us bucket but not the 2us one
+        assert(strstr(pages[i], "simpledb_request_duration_seconds_bucket{phase=\"execute\",le=\"2e-06\"} 0\n") != NULL);
+        assert(strstr(pages[i], "simpledb_request_duration_seconds_bucket{phase=\"execute\",le=\"4e-06\"} 1\n") != NULL);
+        assert(strstr(pages[i], "simpledb_request_duration_seconds_count{phase=\"send\"} 1\n") != NULL);
+    }
+    assert(lines[0] == lines[1]);
+
+    statsDelete(stats);
+    htDeleteTable(ht);
+    destroyServer(server);
+}
+
 void testCreateServer() {
-    Server_t *server = createServer(12345);
+    Server_t *server = createServer(12345, NULL);
     assert(server->serverFd > 0);
     assert(server->port == 12345);
+    assert(server->unixFd == -1);
+    assert(server->options.maxClients == SERVER_DEFAULT_MAX_CLIENTS);
+    destroyServer(server);
+
+    ServerOptions_t options = serverDefaultOptions();
+    options.bind = "0.0.0.0";
+    options.maxClients = 2;
+    server = createServer(12345, &options);
+    assert(server != NULL && server->options.maxClients == 2);
+    assert(server->clients[0].clientFd == -1 && server->clients[1].clientFd == -1);
+    // only the options that can change while the server runs are changed
+    options.maxClients = 5;
+    options.outputLimit = 4096;
+    serverSetOptions(server, &options);
+    assert(server->options.maxClients == 2 && server->options.outputLimit == 4096);
+    destroyServer(server);
+    options.maxClients = 0;
+    assert(createServer(12345, &options) == NULL);
+
+    // the socket file goes away with the server
+    server = createServer(0, NULL);
+    assert(server->serverFd == -1);
+    assert(serverEnableUnix(server, "test_server.sock") == 0 && server->unixFd > 0);
+    assert(access("test_server.sock", F_OK) == 0);
     destroyServer(server);
+    assert(access("test_server.sock", F_OK) == -1);
 }
 
 void testServerInsertString() {
@@ -1388,6 +2898,1026 @@ void testServerReplaceMultiple() {
     close(socketFd);
 }
 
+void testServerRangeQueries() {
+    int socketFd = createSocketToServer();
+    if (socketFd == -1) {
+        exit(EXIT_FAILURE);
+    }
+    char serverReply[BUFFER_SIZE];
+
+    sendCommand(socketFd, "insert rq:a int -7", serverReply);
+    sendCommand(socketFd, "insert rq:b uint 42", serverReply);
+    sendCommand(socketFd, "insert rq:c double 3.5", serverReply);
+    sendCommand(socketFd, "range rq: 0 100", serverReply);
+    assert(strcmp("Index not found", serverReply) == 0);
+
+    sendCommand(socketFd, "index rq:", serverReply);
+    assert(strcmp("Index created successfully", serverReply) == 0);
+    sendCommand(socketFd, "insert rq:d int 8", serverReply);
+
+    sendCommand(socketFd, "range rq: 0 100", serverReply);
+    assert(strcmp("{rq:c: 3.500000, rq:d: 8, rq:b: 42}", serverReply) == 0);
+    sendCommand(socketFd, "range rq: -inf 0", serverReply);
+    assert(strcmp("{rq:a: -7}", serverReply) == 0);
+    sendCommand(socketFd, "top rq: 2", serverReply);
+    assert(strcmp("{rq:b: 42, rq:d: 8}", serverReply) == 0);
+    sendCommand(socketFd, "range rq: 0", serverReply);
+    assert(strcmp("Malformed query", serverReply) == 0);
+
+    sendCommand(socketFd, "dropindex rq:", serverReply);
+    assert(strcmp("Index dropped successfully", serverReply) == 0);
+    close(socketFd);
+}
+
+void testServerPrefixQueries() {
+    int socketFd = createSocketToServer();
+    if (socketFd == -1) {
+        exit(EXIT_FAILURE);
+    }
+    char serverReply[BUFFER_SIZE];
+    char command[BUFFER_SIZE];
+
+    sendCommand(socketFd, "prefix pq:", serverReply);
+    assert(strcmp("Key index not enabled", serverReply) == 0);
+    sendCommand(socketFd, "keyindex enable", serverReply);
+    assert(strcmp("Key index enabled", serverReply) == 0);
+
+    for (int i = 0; i < 150; i++) {
+        sprintf(command, "insert pq:%03d int %d", i, i);
+        sendCommand(socketFd, command, serverReply);
+    }
+    sendCommand(socketFd, "insert pr:000 int 0", serverReply);
+
+    // the first page is full, the second page resumes after the cursor
+    sendCommand(socketFd, "prefix pq:", serverReply);
+    assert(strncmp("{cursor: >pq:099, keys: [pq:000, pq:001, ", serverReply, 41) == 0);
+    sendCommand(socketFd, "prefix pq: >pq:099", serverReply);
+    assert(strncmp("{cursor: 0, keys: [pq:100, ", serverReply, 27) == 0);
+    assert(strcmp("pq:148, pq:149]}", serverReply + strlen(serverReply) - 16) == 0);
+
+    sendCommand(socketFd, "keyrange pq:010 pq:013", serverReply);
+    assert(strcmp("{cursor: 0, keys: [pq:010, pq:011, pq:012, pq:013]}", serverReply) == 0);
+    sendCommand(socketFd, "keyrange pq:149 pr:999", serverReply);
+    assert(strcmp("{cursor: 0, keys: [pq:149, pr:000]}", serverReply) == 0);
+    sendCommand(socketFd, "prefix pq: pq:099", serverReply);
+    assert(strcmp("Invalid cursor", serverReply) == 0);
+
+    // a key named 0 can be resumed after like any other
+    sendCommand(socketFd, "insert 0 int 0", serverReply);
+    sendCommand(socketFd, "insert 00 int 0", serverReply);
+    sendCommand(socketFd, "keyrange 0 00 >0", serverReply);
+    assert(strcmp("{cursor: 0, keys: [00]}", serverReply) == 0);
+    sendCommand(socketFd, "keyrange 0 00 0", serverReply);
+    assert(strcmp("{cursor: 0, keys: [0, 00]}", serverReply) == 0);
+    sendCommand(socketFd, "delete 0", serverReply);
+    sendCommand(socketFd, "delete 00", serverReply);
+
+    sendCommand(socketFd, "keyindex disable", serverReply);
+    assert(strcmp("Key index disabled", serverReply) == 0);
+    close(socketFd);
+}
+
+void testServerIncr() {
+    int socketFd = createSocketToServer();
+    if (socketFd == -1) {
+        exit(EXIT_FAILURE);
+    }
+    char serverReply[BUFFER_SIZE];
+
+    sendCommand(socketFd, "incr testServerIncr", serverReply);
+    assert(strcmp("{testServerIncr: 1}", serverReply) == 0);
+    sendCommand(socketFd, "incrby testServerIncr 41", serverReply);
+    assert(strcmp("{testServerIncr: 42}", serverReply) == 0);
+    sendCommand(socketFd, "decrby testServerIncr 50", serverReply);
+    assert(strcmp("{testServerIncr: -8}", serverReply) == 0);
+    sendCommand(socketFd, "decr testServerIncr", serverReply);
+    assert(strcmp("{testServerIncr: -9}", serverReply) == 0);
+    sendCommand(socketFd, "incrby testServerIncr abc", serverReply);
+    assert(strcmp("Invalid increment", serverReply) == 0);
+    sendCommand(socketFd, "incrby testServerIncr 9223372036854775807", serverReply);
+    assert(strcmp("{testServerIncr: 9223372036854775798}", serverReply) == 0);
+    sendCommand(socketFd, "incrby testServerIncr 10", serverReply);
+    assert(strcmp("Increment would overflow", serverReply) == 0);
+
+    sendCommand(socketFd, "insert testServerIncrUint uint 5", serverReply);
+    sendCommand(socketFd, "decrby testServerIncrUint 5", serverReply);
+    assert(strcmp("{testServerIncrUint: 0}", serverReply) == 0);
+    sendCommand(socketFd, "decr testServerIncrUint", serverReply);
+    assert(strcmp("Increment would overflow", serverReply) == 0);
+
+    sendCommand(socketFd, "incrbyfloat testServerIncrFloat 2.5", serverReply);
+    assert(strcmp("{testServerIncrFloat: 2.500000}", serverReply) == 0);
+    sendCommand(socketFd, "incrbyfloat testServerIncrFloat -0.25", serverReply);
+    assert(strcmp("{testServerIncrFloat: 2.250000}", serverReply) == 0);
+    sendCommand(socketFd, "incr testServerIncrFloat", serverReply);
+    assert(strcmp("Value is not an integer", serverReply) == 0);
+    sendCommand(socketFd, "incrbyfloat testServerIncr 1.0", serverReply);
+    assert(strcmp("Value is not a double", serverReply) == 0);
+    close(socketFd);
+}
+
+void testServerCollections() {
+    int socketFd = createSocketToServer();
+    if (socketFd == -1) {
+        exit(EXIT_FAILURE);
+    }
+    char serverReply[BUFFER_SIZE];
+
+    sendCommand(socketFd, "rpush testServerList b", serverReply);
+    assert(strcmp("{testServerList: 1}", serverReply) == 0);
+    sendCommand(socketFd, "rpush testServerList c with spaces", serverReply);
+    sendCommand(socketFd, "lpush testServerList a", serverReply);
+    assert(strcmp("{testServerList: 3}", serverReply) == 0);
+    sendCommand(socketFd, "lrange testServerList 0 -1", serverReply);
+    assert(strcmp("{testServerList: [a, b, c with spaces]}", serverReply) == 0);
+    sendCommand(socketFd, "rpop testServerList", serverReply);
+    assert(strcmp("{testServerList: c with spaces}", serverReply) == 0);
+    sendCommand(socketFd, "llen testServerList", serverReply);
+    assert(strcmp("{testServerList: 2}", serverReply) == 0);
+    sendCommand(socketFd, "select testServerList", serverReply);
+    assert(strcmp("{testServerList: list(2)}", serverReply) == 0);
+    sendCommand(socketFd, "lpop testServerList", serverReply);
+    sendCommand(socketFd, "lpop testServerList", serverReply);
+    assert(strcmp("{testServerList: b}", serverReply) == 0);
+    // popping the last element removes the key
+    sendCommand(socketFd, "lpop testServerList", serverReply);
+    assert(strcmp("Key not found", serverReply) == 0);
+
+    sendCommand(socketFd, "hset testServerHash name Jane Doe", serverReply);
+    assert(strcmp("Field set successfully", serverReply) == 0);
+    sendCommand(socketFd, "hset testServerHash age 42", serverReply);
+    sendCommand(socketFd, "hget testServerHash name", serverReply);
+    assert(strcmp("{name: Jane Doe}", serverReply) == 0);
+    sendCommand(socketFd, "hgetall testServerHash", serverReply);
+    assert(strcmp("{name: Jane Doe, age: 42}", serverReply) == 0);
+    sendCommand(socketFd, "hdel testServerHash name", serverReply);
+    assert(strcmp("Field removed successfully", serverReply) == 0);
+    sendCommand(socketFd, "hget testServerHash name", serverReply);
+    assert(strcmp("Field not found", serverReply) == 0);
+    sendCommand(socketFd, "hlen testServerHash", serverReply);
+    assert(strcmp("{testServerHash: 1}", serverReply) == 0);
+
+    sendCommand(socketFd, "sadd testServerSet 5", serverReply);
+    assert(strcmp("Member added successfully", serverReply) == 0);
+    sendCommand(socketFd, "sadd testServerSet 5", serverReply);
+    assert(strcmp("Member already exists", serverReply) == 0);
+    sendCommand(socketFd, "sadd testServerSet 1", serverReply);
+    sendCommand(socketFd, "smembers testServerSet", serverReply);
+    assert(strcmp("{testServerSet: [1, 5]}", serverReply) == 0);
+    sendCommand(socketFd, "sismember testServerSet 5", serverReply);
+    assert(strcmp("Member found", serverReply) == 0);
+    sendCommand(socketFd, "srem testServerSet 5", serverReply);
+    sendCommand(socketFd, "sismember testServerSet 5", serverReply);
+    assert(strcmp("Member not found", serverReply) == 0);
+    sendCommand(socketFd, "scard testServerSet", serverReply);
+    assert(strcmp("{testServerSet: 1}", serverReply) == 0);
+
+    sendCommand(socketFd, "rpush testServerSet x", serverReply);
+    assert(strcmp("Wrong type for key testServerSet", serverReply) == 0);
+    sendCommand(socketFd, "delete testServerSet", serverReply);
+    assert(strcmp("Key removed successfully", serverReply) == 0);
+    close(socketFd);
+}
+
+void testServerCompression() {
+    int socketFd = createSocketToServer();
+    if (socketFd == -1) {
+        exit(EXIT_FAILURE);
+    }
+    char serverReply[BUFFER_SIZE];
+    char command[BUFFER_SIZE];
+    char json[512];
+    fillJson(json, sizeof(json));
+    // values are separated by spaces in queries, so replace them
+    for (char *c = json; *c; c++) {
+        if (*c == ' ') {
+            *c = '_';
+        }
+    }
+
+    sendCommand(socketFd, "compression 64 x", serverReply);
+    assert(strcmp("Invalid compression settings", serverReply) == 0);
+    sendCommand(socketFd, "compression 64 20", serverReply);
+    assert(strcmp("Compression set successfully", serverReply) == 0);
+    sprintf(command, "insert testServerCompression string %s", json);
+    sendCommand(socketFd, command, serverReply);
+    assert(strcmp("Value inserted successfully", serverReply) == 0);
+    sendCommand(socketFd, "select testServerCompression", serverReply);
+    sprintf(command, "{testServerCompression: %s}", json);
+    assert(strcmp(command, serverReply) == 0);
+    sendCommand(socketFd, "compression 0", serverReply);
+    assert(strcmp("Compression set successfully", serverReply) == 0);
+    close(socketFd);
+}
+
+void testServerPipelining() {
+    int socketFd = createSocketToServer();
+    if (socketFd == -1) {
+        exit(EXIT_FAILURE);
+    }
+    // several newline terminated commands in one message, the last one split across two messages
+    char commands[] = "insert testServerPipelining int 7\nselect testServerPipelining\nincr testServer";
+    char rest[] = "Pipelining\n";
+    char expected[] = "Value inserted successfully\n{testServerPipelining: 7}\n{testServerPipelining: 8}\n";
+    char serverReply[BUFFER_SIZE];
+    memset(serverReply, 0, BUFFER_SIZE);
+    if (send(socketFd, commands, strlen(commands), 0) < 0 || send(socketFd, rest, strlen(rest), 0) < 0) {
+        printf("Sending data over socket failed %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    size_t received = 0;
+    while (received < strlen(expected)) {
+        int size = recv(socketFd, serverReply + received, BUFFER_SIZE - received - 1, 0);
+        if (size <= 0) {
+            printf("Receiving data over socket failed %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        received += size;
+    }
+    assert(strcmp(expected, serverReply) == 0);
+
+    // a command longer than the buffer is rejected whole, the command after it still runs
+    char longCommand[3 * BUFFER_SIZE];
+    int len = sprintf(longCommand, "insert testServerPipelining:long string ");
+    memset(longCommand + len, 'x', 2 * BUFFER_SIZE);
+    len += 2 * BUFFER_SIZE;
+    len += sprintf(longCommand + len, "\nselect testServerPipelining:long\n");
+    sprintf(expected, "Command too long, at most %d bytes\nKey not found\n", BUFFER_SIZE - 1);
+    memset(serverReply, 0, BUFFER_SIZE);
+    if (send(socketFd, longCommand, len, 0) < 0) {
+        printf("Sending data over socket failed %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    received = 0;
+    while (received < strlen(expected)) {
+        int size = recv(socketFd, serverReply + received, BUFFER_SIZE - received - 1, 0);
+        if (size <= 0) {
+            printf("Receiving data over socket failed %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        received += size;
+    }
+    assert(strcmp(expected, serverReply) == 0);
+    close(socketFd);
+}
+
+void testServerTransactions() {
+    int socketFd = createSocketToServer();
+    int otherFd = createSocketToServer();
+    if (socketFd == -1 || otherFd == -1) {
+        exit(EXIT_FAILURE);
+    }
+    char serverReply[BUFFER_SIZE];
+    char expected[BUFFER_SIZE];
+
+    // read, modify and write back with the version that was read
+    sendCommand(socketFd, "cas testServerTransactions 0 int 1", serverReply);
+    assert(strncmp("{testServerTransactions: ", serverReply, 25) == 0);
+    sendCommand(socketFd, "version testServerTransactions", serverReply);
+    uint64_t version = strtoull(serverReply + 25, NULL, 10);
+    assert(version > 0);
+    sendCommand(otherFd, "incr testServerTransactions", serverReply);
+    sprintf(expected, "cas testServerTransactions %lu int 2", version);
+    sendCommand(socketFd, expected, serverReply);
+    assert(strcmp("Version mismatch", serverReply) == 0);
+    sendCommand(socketFd, "select testServerTransactions", serverReply);
+    assert(strcmp("{testServerTransactions: 2}", serverReply) == 0);
+    sendCommand(socketFd, "version testServerTransactions", serverReply);
+    version = strtoull(serverReply + 25, NULL, 10);
+    sprintf(expected, "cas testServerTransactions %lu int 3", version);
+    sendCommand(socketFd, expected, serverReply);
+    assert(strncmp("{testServerTransactions: ", serverReply, 25) == 0);
+    assert(strtoull(serverReply + 25, NULL, 10) > version);
+    sendCommand(socketFd, "cas testServerTransactions x int 3", serverReply);
+    assert(strcmp("Malformed query", serverReply) == 0);
+    sendCommand(socketFd, "version testServerTransactions:missing", serverReply);
+    assert(strcmp("Key not found", serverReply) == 0);
+
+    // collections changed in place get a new version too
+    sendCommand(socketFd, "rpush testServerTransactions:l a", serverReply);
+    sendCommand(socketFd, "version testServerTransactions:l", serverReply);
+    version = strtoull(serverReply + 27, NULL, 10);
+    sendCommand(socketFd, "rpush testServerTransactions:l b", serverReply);
+    sendCommand(socketFd, "version testServerTransactions:l", serverReply);
+    assert(strtoull(serverReply + 27, NULL, 10) > version);
+
+    // queued commands run together, other clients see all of them or none
+    sendCommand(socketFd, "exec", serverReply);
+    assert(strcmp("Not in a transaction", serverReply) == 0);
+    sendCommand(socketFd, "multi", serverReply);
+    assert(strcmp("Transaction started", serverReply) == 0);
+    sendCommand(socketFd, "multi", serverReply);
+    assert(strcmp("Already in a transaction", serverReply) == 0);
+    sendCommand(socketFd, "incr testServerTransactions", serverReply);
+    assert(strcmp("Queued", serverReply) == 0);
+    sendCommand(socketFd, "select testServerTransactions", serverReply);
+    assert(strcmp("Queued", serverReply) == 0);
+    sendCommand(otherFd, "select testServerTransactions", serverReply);
+    assert(strcmp("{testServerTransactions: 3}", serverReply) == 0);
+    sendCommand(socketFd, "exec", serverReply);
+    assert(strcmp("{results: [{testServerTransactions: 4}, {testServerTransactions: 4}]}", serverReply) == 0);
+
+    sendCommand(socketFd, "multi", serverReply);
+    sendCommand(socketFd, "incr testServerTransactions", serverReply);
+    sendCommand(socketFd, "discard", serverReply);
+    assert(strcmp("Transaction discarded", serverReply) == 0);
+    // a command that can't be queued discards the whole transaction
+    sendCommand(socketFd, "multi", serverReply);
+    sendCommand(socketFd, "incr testServerTransactions", serverReply);
+    sendCommand(socketFd, "nothing testServerTransactions", serverReply);
+    assert(strcmp("Query not supported", serverReply) == 0);
+    sendCommand(socketFd, "exec", serverReply);
+    assert(strcmp("Transaction discarded because a command couldn't be queued", serverReply) == 0);
+    sendCommand(socketFd, "select testServerTransactions", serverReply);
+    assert(strcmp("{testServerTransactions: 4}", serverReply) == 0);
+    close(otherFd);
+    close(socketFd);
+}
+
+// receive exactly the length of expected, messages to subscribers arrive on their own
+static void receiveMessage(int socketFd, const char *expected) {
+    char buf[BUFFER_SIZE] = {0};
+    size_t received = 0;
+    while (received < strlen(expected)) {
+        ssize_t size = recv(socketFd, buf + received, strlen(expected) - received, 0);
+        if (size <= 0) {
+            printf("Receiving data over socket failed %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        received += size;
+    }
+    assert(strcmp(expected, buf) == 0);
+}
+
+void testServerPubSub() {
+    int subscriberFd = createSocketToServer();
+    int socketFd = createSocketToServer();
+    if (subscriberFd == -1 || socketFd == -1) {
+        exit(EXIT_FAILURE);
+    }
+    char serverReply[BUFFER_SIZE];
+
+    sendCommand(subscriberFd, "subscribe testServerPubSub", serverReply);
+    assert(strcmp("{subscribed: testServerPubSub, subscriptions: 1}", serverReply) == 0);
+    sendCommand(socketFd, "publish testServerPubSub hello subscribers", serverReply);
+    assert(strcmp("{receivers: 1}", serverReply) == 0);
+    receiveMessage(subscriberFd, "{channel: testServerPubSub, message: hello subscribers}\n");
+    sendCommand(socketFd, "publish testServerPubSub:other hello", serverReply);
+    assert(strcmp("{receivers: 0}", serverReply) == 0);
+    sendCommand(socketFd, "publish testServerPubSub", serverReply);
+    assert(strcmp("Malformed query", serverReply) == 0);
+
+    // changes to keys once notifications are on
+    sendCommand(subscriberFd, "subscribe __keyspace@0__:testServerPubSub", serverReply);
+    assert(strcmp("{subscribed: __keyspace@0__:testServerPubSub, subscriptions: 2}", serverReply) == 0);
+    sendCommand(socketFd, "insert testServerPubSub int 1", serverReply);
+    sendCommand(socketFd, "notify on", serverReply);
+    assert(strcmp("Keyspace notifications on", serverReply) == 0);
+    sendCommand(socketFd, "incr testServerPubSub", serverReply);
+    receiveMessage(subscriberFd, "{channel: __keyspace@0__:testServerPubSub, message: update}\n");
+    sendCommand(socketFd, "delete testServerPubSub", serverReply);
+    receiveMessage(subscriberFd, "{channel: __keyspace@0__:testServerPubSub, message: remove}\n");
+    // a change in another database goes to another channel
+    sendCommand(socketFd, "use 1", serverReply);
+    sendCommand(socketFd, "insert testServerPubSub int 1", serverReply);
+    sendCommand(socketFd, "use 0", serverReply);
+    sendCommand(socketFd, "insert testServerPubSub int 1", serverReply);
+    receiveMessage(subscriberFd, "{channel: __keyspace@0__:testServerPubSub, message: add}\n");
+    sendCommand(socketFd, "notify off", serverReply);
+    sendCommand(socketFd, "delete testServerPubSub", serverReply);
+
+    sendCommand(subscriberFd, "unsubscribe testServerPubSub", serverReply);
+    assert(strcmp("{unsubscribed: testServerPubSub, subscriptions: 1}", serverReply) == 0);
+    sendCommand(subscriberFd, "unsubscribe testServerPubSub", serverReply);
+    assert(strcmp("Not subscribed to testServerPubSub", serverReply) == 0);
+    sendCommand(socketFd, "info pubsub", serverReply);
+    assert(strstr(serverReply, "channels: 1, subscriptions: 1, ") != NULL);
+    // subscriptions end with the connection
+    close(subscriberFd);
+    for (int i = 0; i < 200; i++) {
+        sendCommand(socketFd, "info pubsub", serverReply);
+        if (strstr(serverReply, "channels: 0, subscriptions: 0, ") != NULL) {
+            break;
+        }
+        usleep(10000);
+    }
+    assert(strstr(serverReply, "channels: 0, subscriptions: 0, ") != NULL);
+
+    // a subscriber that never reads is disconnected rather than buffered for without bound
+    int slowFd = createSocketToServer();
+    if (slowFd == -1) {
+        exit(EXIT_FAILURE);
+    }
+    sendCommand(slowFd, "subscribe testServerPubSub:slow", serverReply);
+    char command[BUFFER_SIZE];
+    int len = sprintf(command, "publish testServerPubSub:slow ");
+    memset(command + len, 'x', 800);
+    command[len + 800] = '\0';
+    int closed = 0;
+    for (int i = 0; i < 50000 && !closed; i++) {
+        sendCommand(socketFd, command, serverReply);
+        closed = strcmp("{receivers: 0}", serverReply) == 0;
+    }
+    assert(closed);
+    sendCommand(socketFd, "info pubsub", serverReply);
+    assert(strstr(serverReply, "slow_clients_closed: 0") == NULL);
+    close(slowFd);
+    close(socketFd);
+}
+
+void testServerScripts() {
+    int socketFd = createSocketToServer();
+    if (socketFd == -1) {
+        exit(EXIT_FAILURE);
+    }
+    char serverReply[BUFFER_SIZE];
+    char command[BUFFER_SIZE];
+    char digest[17];
+
+    // move an amount between two counters if the first has enough, in one round trip
+    sendCommand(socketFd, "insert testServerScripts:a int 100", serverReply);
+    sendCommand(socketFd,
+                "script load $1 get $3 < if 'insufficient error then $1 0 $3 - incrby drop $2 $3 incrby", serverReply);
+    assert(strncmp("{digest: ", serverReply, 9) == 0 && strlen(serverReply) == 26);
+    memcpy(digest, serverReply + 9, 16);
+    digest[16] = '\0';
+    sprintf(command, "script exists %s", digest);
+    sendCommand(socketFd, command, serverReply);
+    assert(strcmp("{exists: 1}", serverReply) == 0);
+    sprintf(command, "evalsha %s testServerScripts:a testServerScripts:b 30", digest);
+    sendCommand(socketFd, command, serverReply);
+    assert(strcmp("{result: 30}", serverReply) == 0);
+    sendCommand(socketFd, command, serverReply);
+    sendCommand(socketFd, command, serverReply);
+    assert(strcmp("{result: 90}", serverReply) == 0);
+    sendCommand(socketFd, command, serverReply);
+    assert(strcmp("Script error: insufficient", serverReply) == 0);
+    sendCommand(socketFd, "select testServerScripts:a", serverReply);
+    assert(strcmp("{testServerScripts:a: 10}", serverReply) == 0);
+    sendCommand(socketFd, "info scripts", serverReply);
+    assert(strstr(serverReply, "runs: 4, errors: 1") != NULL);
+
+    // a write has to fit in the command the replicas get
+    sendCommand(socketFd, "script load $1 'v set 1", serverReply);
+    assert(strncmp("{digest: ", serverReply, 9) == 0);
+    int len = sprintf(command, "evalsha %.16s ", serverReply + 9);
+    memset(command + len, 'k', 600);
+    command[len + 600] = '\0';
+    sendCommand(socketFd, command, serverReply);
+    assert(strcmp("Script error: Key too long for a script to write", serverReply) == 0);
+    command[len + 400] = '\0';
+    sendCommand(socketFd, command, serverReply);
+    assert(strcmp("{result: 1}", serverReply) == 0);
+
+    sendCommand(socketFd, "script load 1 if", serverReply);
+    assert(strcmp("if without then", serverReply) == 0);
+    sendCommand(socketFd, "script load", serverReply);
+    assert(strcmp("Malformed query", serverReply) == 0);
+    sendCommand(socketFd, "evalsha 0123456789abcdef", serverReply);
+    assert(strcmp("Script not found, load it with script load", serverReply) == 0);
+    sendCommand(socketFd, "script flush", serverReply);
+    assert(strncmp("{flushed_scripts: ", serverReply, 18) == 0);
+    sprintf(command, "evalsha %s testServerScripts:a testServerScripts:b 1", digest);
+    sendCommand(socketFd, command, serverReply);
+    assert(strcmp("Script not found, load it with script load", serverReply) == 0);
+    close(socketFd);
+}
+
+void testServerTracking() {
+    int cacheFd = createSocketToServer();
+    int socketFd = createSocketToServer();
+    if (cacheFd == -1 || socketFd == -1) {
+        exit(EXIT_FAILURE);
+    }
+    char serverReply[BUFFER_SIZE];
+
+    sendCommand(socketFd, "insert testServerTracking:a int 1", serverReply);
+    sendCommand(cacheFd, "tracking on", serverReply);
+    assert(strcmp("Tracking on", serverReply) == 0);
+    sendCommand(cacheFd, "select testServerTracking:a", serverReply);
+    sendCommand(cacheFd, "select testServerTracking:missing", serverReply);
+    sendCommand(socketFd, "incr testServerTracking:a", serverReply);
+    receiveMessage(cacheFd, "{invalidate: testServerTracking:a}\n");
+    // a key that didn't exist when it was read is cached too
+    sendCommand(socketFd, "insert testServerTracking:missing int 1", serverReply);
+    receiveMessage(cacheFd, "{invalidate: testServerTracking:missing}\n");
+    // until it is read again nothing more is sent for it
+    sendCommand(socketFd, "incr testServerTracking:a", serverReply);
+    sendCommand(cacheFd, "select testServerTracking:a", serverReply);
+    assert(strcmp("{testServerTracking:a: 3}", serverReply) == 0);
+    sendCommand(socketFd, "delete testServerTracking:a", serverReply);
+    receiveMessage(cacheFd, "{invalidate: testServerTracking:a}\n");
+    sendCommand(socketFd, "info tracking", serverReply);
+    assert(strncmp("{tracked_keys: 0, prefixes: 0, invalidations: 3, ", serverReply, 48) == 0);
+
+    // prefixes hear about every key starting with them, without reading it first
+    sendCommand(cacheFd, "tracking prefix testServerTracking:p", serverReply);
+    assert(strcmp("Tracking keys starting with testServerTracking:p", serverReply) == 0);
+    sendCommand(socketFd, "insert testServerTracking:p1 int 1", serverReply);
+    receiveMessage(cacheFd, "{invalidate: testServerTracking:p1}\n");
+    sendCommand(socketFd, "insert testServerTracking:q1 int 1", serverReply);
+    sendCommand(socketFd, "flush 3", serverReply);
+    sendCommand(socketFd, "use 3", serverReply);
+    sendCommand(socketFd, "insert testServerTracking:p2 int 1", serverReply);
+    sendCommand(socketFd, "flush 3", serverReply);
+    sendCommand(socketFd, "use 0", serverReply);
+    receiveMessage(cacheFd, "{invalidate: testServerTracking:p2}\n{invalidate_all: 1}\n");
+
+    sendCommand(cacheFd, "tracking off", serverReply);
+    sendCommand(socketFd, "info tracking", serverReply);
+    assert(strncmp("{tracked_keys: 0, prefixes: 0, ", serverReply, 31) == 0);
+    sendCommand(cacheFd, "tracking sideways", serverReply);
+    assert(strcmp("Malformed query", serverReply) == 0);
+    close(cacheFd);
+    close(socketFd);
+}
+
+void testServerInfo() {
+    int socketFd = createSocketToServer();
+    if (socketFd == -1) {
+        exit(EXIT_FAILURE);
+    }
+    char serverReply[BUFFER_SIZE];
+
+    sendCommand(socketFd, "insert testServerInfo int 1", serverReply);
+    sendCommand(socketFd, "info table", serverReply);
+    assert(strncmp("{len: ", serverReply, 6) == 0);
+    assert(strstr(serverReply, "longest_chain: ") != NULL && strstr(serverReply, "rehashes: ") != NULL);
+    assert(strstr(serverReply, "shrinks: ") != NULL);
+    sendCommand(socketFd, "resize 100000", serverReply);
+    assert(strncmp("{exp_before: ", serverReply, 13) == 0 && strstr(serverReply, "exp_after: 17, ") != NULL);
+    assert(strstr(serverReply, "rss_after_bytes: ") != NULL);
+    sendCommand(socketFd, "resize auto", serverReply);
+    assert(strstr(serverReply, "exp_before: 17, ") != NULL && strstr(serverReply, "exp_after: 17") == NULL);
+    sendCommand(socketFd, "resize 1", serverReply);
+    assert(strstr(serverReply, "exp_after: 5, ") != NULL || strncmp("Error resizing", serverReply, 14) == 0);
+    sendCommand(socketFd, "resize many", serverReply);
+    assert(strcmp("Malformed query", serverReply) == 0);
+    sendCommand(socketFd, "resize 4294967296", serverReply);
+    assert(strcmp("Can't resize to more than 1073741824 buckets", serverReply) == 0);
+    sendCommand(socketFd, "info tier", serverReply);
+    assert(strcmp("{enabled: 0}", serverReply) == 0);
+    sendCommand(socketFd, "tier spill", serverReply);
+    assert(strcmp("Tiering is not enabled", serverReply) == 0);
+    sendCommand(socketFd, "info server", serverReply);
+    assert(strncmp("{uptime_s: ", serverReply, 11) == 0 && strstr(serverReply, "connections: ") != NULL);
+    sendCommand(socketFd, "info latency", serverReply);
+    assert(strncmp("{parse: {count: ", serverReply, 16) == 0);
+    assert(strstr(serverReply, "execute: {") != NULL && strstr(serverReply, "send: {") != NULL);
+    sendCommand(socketFd, "info commands", serverReply);
+    assert(strstr(serverReply, "insert: {calls: ") != NULL);
+    assert(strstr(serverReply, "hgetall") == NULL);
+    sendCommand(socketFd, "info nothing", serverReply);
+    assert(strcmp("Unknown info section", serverReply) == 0);
+    close(socketFd);
+}
+
+void testServerDatabases() {
+    int socketFd = createSocketToServer();
+    int otherFd = createSocketToServer();
+    if (socketFd == -1 || otherFd == -1) {
+        exit(EXIT_FAILURE);
+    }
+    char serverReply[BUFFER_SIZE];
+
+    sendCommand(socketFd, "insert testServerDatabases string zero", serverReply);
+    sendCommand(socketFd, "use 3", serverReply);
+    assert(strcmp("Database 3 selected", serverReply) == 0);
+    sendCommand(socketFd, "select testServerDatabases", serverReply);
+    assert(strcmp("Key not found", serverReply) == 0);
+    sendCommand(socketFd, "insert testServerDatabases string three", serverReply);
+    sendCommand(socketFd, "insert testServerDatabases:other int 1", serverReply);
+    sendCommand(socketFd, "info keyspace", serverReply);
+    assert(strncmp("{db: 3, db0: {keys: ", serverReply, 20) == 0);
+    assert(strstr(serverReply, "db3: {keys: 2, ") != NULL);
+
+    // every connection has its own database
+    sendCommand(otherFd, "select testServerDatabases", serverReply);
+    assert(strcmp("{testServerDatabases: zero}", serverReply) == 0);
+    sendCommand(otherFd, "use 3", serverReply);
+    sendCommand(otherFd, "select testServerDatabases", serverReply);
+    assert(strcmp("{testServerDatabases: three}", serverReply) == 0);
+
+    sendCommand(socketFd, "flush 3", serverReply);
+    assert(strcmp("{flushed_keys: 2}", serverReply) == 0);
+    sendCommand(socketFd, "info lazyfree", serverReply);
+    assert(strncmp("{pending: ", serverReply, 10) == 0 && strstr(serverReply, "freed: ") != NULL);
+    sendCommand(otherFd, "select testServerDatabases", serverReply);
+    assert(strcmp("Key not found", serverReply) == 0);
+    sendCommand(otherFd, "use 0", serverReply);
+    sendCommand(otherFd, "select testServerDatabases", serverReply);
+    assert(strcmp("{testServerDatabases: zero}", serverReply) == 0);
+    sendCommand(otherFd, "delete testServerDatabases", serverReply);
+
+    sendCommand(socketFd, "use 16", serverReply);
+    assert(strcmp("Invalid database, there are 16", serverReply) == 0);
+    sendCommand(socketFd, "use -1", serverReply);
+    assert(strcmp("Invalid database, there are 16", serverReply) == 0);
+    sendCommand(socketFd, "flush some", serverReply);
+    assert(strcmp("Invalid database, there are 16", serverReply) == 0);
+    close(otherFd);
+    close(socketFd);
+}
+
+void testServerSlowlog() {
+    int socketFd = createSocketToServer();
+    if (socketFd == -1) {
+        exit(EXIT_FAILURE);
+    }
+    char serverReply[BUFFER_SIZE];
+
+    sendCommand(socketFd, "slowlog threshold x", serverReply);
+    assert(strcmp("Invalid threshold", serverReply) == 0);
+    // log every command
+    sendCommand(socketFd, "slowlog threshold 0", serverReply);
+    assert(strcmp("Slowlog threshold set successfully", serverReply) == 0);
+    sendCommand(socketFd, "insert testServerSlowlog int 3", serverReply);
+    sendCommand(socketFd, "slowlog get 1", serverReply);
+    assert(strncmp("{entries: [{id: ", serverReply, 16) == 0);
+    assert(strstr(serverReply, "client: 127.0.0.1:") != NULL);
+    assert(strstr(serverReply, "command: insert testServerSlowlog int 3}]}") != NULL);
+    sendCommand(socketFd, "slowlog threshold -1", serverReply);
+    sendCommand(socketFd, "slowlog reset", serverReply);
+    assert(strcmp("Slowlog reset successfully", serverReply) == 0);
+    sendCommand(socketFd, "slowlog len", serverReply);
+    assert(strcmp("{len: 0}", serverReply) == 0);
+    sendCommand(socketFd, "slowlog get", serverReply);
+    assert(strcmp("{entries: []}", serverReply) == 0);
+    close(socketFd);
+}
+
+void testServerMetrics() {
+    int socketFd = createSocketToPort(atoi(TEST_METRICS_PORT));
+    if (socketFd == -1) {
+        exit(EXIT_FAILURE);
+    }
+    char request[] = "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    if (send(socketFd, request, strlen(request), 0) < 0) {
+        printf("Sending data over socket failed %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    // the server closes the connection once the whole page is sent
+    static char response[65536];
+    int len = 0, n;
+    while ((n = recv(socketFd, response + len, sizeof(response) - 1 - len, 0)) > 0) {
+        len += n;
+    }
+    response[len] = '\0';
+    close(socketFd);
+    assert(strncmp("HTTP/1.1 200 OK\r\n", response, 17) == 0);
+    assert(strstr(response, "simpledb_commands_total{verb=\"insert\"} ") != NULL);
+    assert(strstr(response, "simpledb_connected_clients ") != NULL);
+    assert(strstr(response, "simpledb_db_keys{db=\"0\"} ") != NULL);
+    assert(strstr(response, "simpledb_lazyfree_pending ") != NULL);
+    assert(strstr(response, "simpledb_request_duration_seconds_bucket{phase=\"send\",le=\"+Inf\"} ") != NULL);
+
+    socketFd = createSocketToPort(atoi(TEST_METRICS_PORT));
+    char other[] = "GET /other HTTP/1.1\r\n\r\n";
+    send(socketFd, other, strlen(other), 0);
+    len = recv(socketFd, response, sizeof(response) - 1, 0);
+    response[len > 0 ? len : 0] = '\0';
+    assert(strncmp("HTTP/1.1 404 Not Found\r\n", response, 24) == 0);
+    close(socketFd);
+}
+
+// send a command until the reply is the expected one, for changes that reach a replica asynchronously
+static void waitForReply(int socketFd, const char *command, const char *expected) {
+    char serverReply[BUFFER_SIZE];
+    for (int i = 0; i < 200; i++) {
+        sendCommand(socketFd, command, serverReply);
+        if (strcmp(expected, serverReply) == 0) {
+            return;
+        }
+        usleep(10000);
+    }
+    printf("Expected %s to %s, got %s\n", expected, command, serverReply);
+    assert(0);
+}
+
+void testServerReplication() {
+    int socketFd = createSocketToServer();
+    if (socketFd == -1) {
+        exit(EXIT_FAILURE);
+    }
+    char serverReply[BUFFER_SIZE];
+    // in the snapshot
+    sendCommand(socketFd, "insert testServerReplication:a string before sync", serverReply);
+    sendCommand(socketFd, "rpush testServerReplication:l x", serverReply);
+
+    char *replicaArgv[] = {"db", "--port", TEST_REPLICA_PORT, "--replicaof", "127.0.0.1:1337", NULL};
+    pid_t replicaPid = spawnServer(replicaArgv);
+    int replicaFd = -1;
+    for (int i = 0; i < 100 && replicaFd == -1; i++) {
+        usleep(10000);
+        replicaFd = createSocketToPort(atoi(TEST_REPLICA_PORT));
+    }
+    assert(replicaFd != -1);
+    waitForReply(replicaFd, "select testServerReplication:a", "{testServerReplication:a: before sync}");
+    sendCommand(replicaFd, "lrange testServerReplication:l 0 -1", serverReply);
+    assert(strcmp("{testServerReplication:l: [x]}", serverReply) == 0);
+
+    // in the stream
+    sendCommand(socketFd, "insert testServerReplication:b int 5", serverReply);
+    sendCommand(socketFd, "incr testServerReplication:b", serverReply);
+    sendCommand(socketFd, "delete testServerReplication:a", serverReply);
+    waitForReply(replicaFd, "select testServerReplication:b", "{testServerReplication:b: 6}");
+    sendCommand(replicaFd, "select testServerReplication:a", serverReply);
+    assert(strcmp("Key not found", serverReply) == 0);
+
+    // writes land in the same database on the replica
+    sendCommand(socketFd, "use 2", serverReply);
+    sendCommand(socketFd, "insert testServerReplication:db string two", serverReply);
+    sendCommand(socketFd, "use 0", serverReply);
+    sendCommand(socketFd, "insert testServerReplication:db string zero", serverReply);
+    waitForReply(replicaFd, "select testServerReplication:db", "{testServerReplication:db: zero}");
+    sendCommand(replicaFd, "use 2", serverReply);
+    sendCommand(replicaFd, "select testServerReplication:db", serverReply);
+    assert(strcmp("{testServerReplication:db: two}", serverReply) == 0);
+    sendCommand(replicaFd, "use 0", serverReply);
+    // a compare and set reaches the replica as the replace it allowed
+    sendCommand(socketFd, "cas testServerReplication:cas 0 string swapped", serverReply);
+    waitForReply(replicaFd, "select testServerReplication:cas", "{testServerReplication:cas: swapped}");
+    sendCommand(replicaFd, "info replication", serverReply);
+    assert(strncmp("{role: replica, ", serverReply, 16) == 0 && strstr(serverReply, "link: streaming") != NULL);
+    // the writes of a script reach the replica, which never saw the script
+    char command[BUFFER_SIZE];
+    sendCommand(socketFd, "script load $1 'moved set $2 del drop $1 get 1.5 +", serverReply);
+    sprintf(command, "evalsha %.16s testServerReplication:s testServerReplication:cas", serverReply + 9);
+    sendCommand(socketFd, command, serverReply);
+    assert(strcmp("Script error: Expected a number", serverReply) == 0);
+    waitForReply(replicaFd, "select testServerReplication:cas", "Key not found");
+    sendCommand(replicaFd, "select testServerReplication:s", serverReply);
+    assert(strcmp("{testServerReplication:s: moved}", serverReply) == 0);
+    sendCommand(replicaFd, "script load 'testServerReplication:s get", serverReply);
+    sprintf(command, "evalsha %.16s", serverReply + 9);
+    sendCommand(replicaFd, command, serverReply);
+    assert(strcmp("{result: moved}", serverReply) == 0);
+    sendCommand(replicaFd, "script load 'testServerReplication:s 1 set", serverReply);
+    sprintf(command, "evalsha %.16s", serverReply + 9);
+    sendCommand(replicaFd, command, serverReply);
+    assert(strcmp("Script error: Replica is read only", serverReply) == 0);
+
+    // replicas serve reads only
+    sendCommand(replicaFd, "insert testServerReplication:d int 1", serverReply);
+    assert(strcmp("Replica is read only", serverReply) == 0);
+    sendCommand(replicaFd, "incr testServerReplication:b", serverReply);
+    assert(strcmp("Replica is read only", serverReply) == 0);
+    sendCommand(replicaFd, "select testServerReplication:b", serverReply);
+    assert(strcmp("{testServerReplication:b: 6}", serverReply) == 0);
+
+    // the lag is known once the replica got a heartbeat and the primary got an ack
+    for (int i = 0; i < 200; i++) {
+        sendCommand(replicaFd, "info replication", serverReply);
+        if (strstr(serverReply, "lag_ms: -1") == NULL) {
+            break;
+        }
+        usleep(10000);
+    }
+    assert(strstr(serverReply, "lag_ms: ") != NULL && strstr(serverReply, "lag_ms: -1") == NULL);
+    for (int i = 0; i < 200; i++) {
+        sendCommand(socketFd, "info replication", serverReply);
+        if (strstr(serverReply, "lag_bytes: -1") == NULL) {
+            break;
+        }
+        usleep(10000);
+    }
+    assert(strstr(serverReply, "ack_offset: ") != NULL && strstr(serverReply, "lag_bytes: -1") == NULL);
+
+    // reconnecting continues from the backlog
+    sendCommand(replicaFd, "replicaof 127.0.0.1 1337", serverReply);
+    assert(strcmp("Replicating 127.0.0.1:1337", serverReply) == 0);
+    sendCommand(socketFd, "insert testServerReplication:c uint 7", serverReply);
+    waitForReply(replicaFd, "select testServerReplication:c", "{testServerReplication:c: 7}");
+    sendCommand(socketFd, "info replication", serverReply);
+    assert(strstr(serverReply, "full_syncs: 1, partial_syncs: 1") != NULL);
+
+    sendCommand(replicaFd, "replicaof no one", serverReply);
+    assert(strcmp("Replication stopped", serverReply) == 0);
+    sendCommand(replicaFd, "info replication", serverReply);
+    assert(strncmp("{role: primary, ", serverReply, 16) == 0);
+    close(replicaFd);
+    close(socketFd);
+    kill(replicaPid, SIGTERM);
+    waitpid(replicaPid, NULL, 0);
+}
+
+// connect to a server started by testServerMapped
+static int connectToMapped() {
+    int fd = -1;
+    for (int i = 0; i < 100 && fd == -1; i++) {
+        usleep(10000);
+        fd = createSocketToPort(atoi(TEST_MAPPED_PORT));
+    }
+    assert(fd != -1);
+    return fd;
+}
+
+void testServerMapped() {
+    char serverReply[BUFFER_SIZE];
+    unlink(TEST_MAPPED_FILE);
+    char *argv[] = {"db", "--port", TEST_MAPPED_PORT, "--mmap", TEST_MAPPED_FILE, NULL};
+    pid_t pid = spawnServer(argv);
+    int fd = connectToMapped();
+    sendCommand(fd, "insert name string mapped", serverReply);
+    assert(strcmp(serverReply, "Value inserted successfully") == 0);
+    sendCommand(fd, "insert count int 41", serverReply);
+    sendCommand(fd, "incr count", serverReply);
+    sendCommand(fd, "lpush list a", serverReply);
+    assert(strcmp(serverReply, "Collections are not supported by the mapped keyspace") == 0);
+    sendCommand(fd, "cas count 0 int 1", serverReply);
+    assert(strcmp(serverReply, "Versions are not supported by the mapped keyspace") == 0);
+    sendCommand(fd, "info table", serverReply);
+    assert(strstr(serverReply, "len: 2,") != NULL && strstr(serverReply, "mapped: 1") != NULL);
+    close(fd);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    // a restarted server serves the keys without loading anything
+    pid = spawnServer(argv);
+    fd = connectToMapped();
+    sendCommand(fd, "select name", serverReply);
+    assert(strcmp(serverReply, "{name: mapped}") == 0);
+    sendCommand(fd, "select count", serverReply);
+    assert(strcmp(serverReply, "{count: 42}") == 0);
+    close(fd);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    unlink(TEST_MAPPED_FILE);
+}
+
+void testServerUnixSocket() {
+    char serverReply[BUFFER_SIZE];
+    // the clients on the unix socket share the keyspace with the clients over TCP
+    int unixFd = createSocketToUnix(TEST_UNIX_SOCKET);
+    int socketFd = createSocketToServer();
+    assert(unixFd != -1 && socketFd != -1);
+    sendCommand(unixFd, "insert testServerUnixSocket string local", serverReply);
+    assert(strcmp("Value inserted successfully", serverReply) == 0);
+    sendCommand(socketFd, "select testServerUnixSocket", serverReply);
+    assert(strcmp("{testServerUnixSocket: local}", serverReply) == 0);
+    sendCommand(unixFd, "multi", serverReply);
+    sendCommand(unixFd, "incr testServerUnixSocket:n", serverReply);
+    sendCommand(unixFd, "exec", serverReply);
+    assert(strcmp("{results: [{testServerUnixSocket:n: 1}]}", serverReply) == 0);
+    close(unixFd);
+    close(socketFd);
+
+    // without a port, in the abstract namespace
+    char *argv[] = {"db", "--port", "0", "--unix", TEST_ABSTRACT_SOCKET, NULL};
+    pid_t pid = spawnServer(argv);
+    int fd = -1;
+    for (int i = 0; i < 100 && fd == -1; i++) {
+        usleep(10000);
+        fd = createSocketToUnix(TEST_ABSTRACT_SOCKET);
+    }
+    assert(fd != -1);
+    sendCommand(fd, "insert testServerUnixSocket int 7", serverReply);
+    sendCommand(fd, "select testServerUnixSocket", serverReply);
+    assert(strcmp("{testServerUnixSocket: 7}", serverReply) == 0);
+    close(fd);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+void testServerConfig() {
+    char serverReply[BUFFER_SIZE];
+    int socketFd = createSocketToServer();
+    assert(socketFd != -1);
+    sendCommand(socketFd, "config get port", serverReply);
+    assert(strcmp("{port: 1337}", serverReply) == 0);
+    sendCommand(socketFd, "config get *", serverReply);
+    const char *settings = "{bind: , port: 1337, unix: " TEST_UNIX_SOCKET ", max-clients: 20, tcp-backlog: 20, ";
+    assert(strncmp(settings, serverReply, strlen(settings)) == 0);
+    sendCommand(socketFd, "config set client-output-limit 2k", serverReply);
+    assert(strcmp("Config set successfully", serverReply) == 0);
+    sendCommand(socketFd, "config get client-output-limit", serverReply);
+    assert(strcmp("{client-output-limit: 2048}", serverReply) == 0);
+    sendCommand(socketFd, "config set client-output-limit 1m", serverReply);
+    sendCommand(socketFd, "config set log-level loud", serverReply);
+    assert(strcmp("Invalid value for log-level", serverReply) == 0);
+    sendCommand(socketFd, "config set max-clients 100", serverReply);
+    assert(strcmp("max-clients can only be set at startup", serverReply) == 0);
+    sendCommand(socketFd, "config set nothing 1", serverReply);
+    assert(strcmp("Unknown setting nothing", serverReply) == 0);
+    sendCommand(socketFd, "config get", serverReply);
+    assert(strcmp("Malformed query", serverReply) == 0);
+    close(socketFd);
+
+    // the command line overrides the file
+    FILE *f = fopen(TEST_CONFIG_FILE, "w");
+    fprintf(f, "# test server\nport " TEST_CONFIG_PORT "\nmax-clients 4\ndb-initial-buckets 1000\ntcp-nodelay no\n");
+    fclose(f);
+    char *argv[] = {"db", "--max-clients", "1", "--config", TEST_CONFIG_FILE, NULL};
+    pid_t pid = spawnServer(argv);
+    int fd = -1;
+    for (int i = 0; i < 100 && fd == -1; i++) {
+        usleep(10000);
+        fd = createSocketToPort(atoi(TEST_CONFIG_PORT));
+    }
+    assert(fd != -1);
+    sendCommand(fd, "config get max-clients", serverReply);
+    assert(strcmp("{max-clients: 1}", serverReply) == 0);
+    sendCommand(fd, "config get tcp-nodelay", serverReply);
+    assert(strcmp("{tcp-nodelay: no}", serverReply) == 0);
+    // the table starts at the next power of two
+    sendCommand(fd, "info table", serverReply);
+    assert(strstr(serverReply, "exp: 10, size: 1024,") != NULL);
+    // a second client is turned away
+    int other = createSocketToPort(atoi(TEST_CONFIG_PORT));
+    assert(other != -1 && recv(other, serverReply, BUFFER_SIZE, 0) == 0);
+    close(other);
+    close(fd);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    unlink(TEST_CONFIG_FILE);
+}
+
+void testServerCluster() {
+    char *argvA[] = {"db", "--port", TEST_CLUSTER_PORT_A, "--cluster", "127.0.0.1:" TEST_CLUSTER_PORT_A, NULL};
+    char *argvB[] = {"db", "--port", TEST_CLUSTER_PORT_B, "--cluster", "127.0.0.1:" TEST_CLUSTER_PORT_B, NULL};
+    pid_t pidA = spawnServer(argvA);
+    pid_t pidB = spawnServer(argvB);
+    int fdA = -1, fdB = -1;
+    for (int i = 0; i < 100 && (fdA == -1 || fdB == -1); i++) {
+        usleep(10000);
+        if (fdA == -1) {
+            fdA = createSocketToPort(atoi(TEST_CLUSTER_PORT_A));
+        }
+        if (fdB == -1) {
+            fdB = createSocketToPort(atoi(TEST_CLUSTER_PORT_B));
+        }
+    }
+    assert(fdA != -1 && fdB != -1);
+    char serverReply[BUFFER_SIZE];
+    sendCommand(fdA, "select foo", serverReply);
+    assert(strcmp("CLUSTERDOWN Hash slot not served", serverReply) == 0);
+    int fds[2] = {fdA, fdB};
+    for (int i = 0; i < 2; i++) {
+        sendCommand(fds[i], "cluster assign 0 8191 127.0.0.1:" TEST_CLUSTER_PORT_A, serverReply);
+        assert(strcmp("Slots assigned successfully", serverReply) == 0);
+        sendCommand(fds[i], "cluster assign 8192 16383 127.0.0.1:" TEST_CLUSTER_PORT_B, serverReply);
+        assert(strcmp("Slots assigned successfully", serverReply) == 0);
+    }
+    sendCommand(fdB, "cluster slots", serverReply);
+    assert(strcmp("{0-8191: 127.0.0.1:" TEST_CLUSTER_PORT_A ", 8192-16383: 127.0.0.1:" TEST_CLUSTER_PORT_B "}",
+                  serverReply) == 0);
+
+    // keys are served by the node of their slot, foo is in slot 12182
+    sendCommand(fdA, "insert foo string bar", serverReply);
+    assert(strcmp("MOVED 12182 127.0.0.1:" TEST_CLUSTER_PORT_B, serverReply) == 0);
+    sendCommand(fdB, "insert foo string bar", serverReply);
+    assert(strcmp("Value inserted successfully", serverReply) == 0);
+    sendCommand(fdB, "rpush {foo}l x", serverReply);
+    sendCommand(fdB, "hset {foo}h f v", serverReply);
+    sendCommand(fdB, "cluster countkeysinslot 12182", serverReply);
+    assert(strcmp("{12182: 3}", serverReply) == 0);
+    // commands without keys run on any node
+    sendCommand(fdA, "info server", serverReply);
+    assert(strncmp("{uptime_s: ", serverReply, 11) == 0);
+
+    // move slot 12182 to the first node
+    sendCommand(fdB, "cluster migrate 12182", serverReply);
+    assert(strcmp("Slot 12182 is not migrating", serverReply) == 0);
+    sendCommand(fdA, "cluster setslot 12182 importing 127.0.0.1:" TEST_CLUSTER_PORT_B, serverReply);
+    assert(strcmp("Slot set successfully", serverReply) == 0);
+    sendCommand(fdB, "cluster setslot 12182 migrating 127.0.0.1:" TEST_CLUSTER_PORT_A, serverReply);
+    assert(strcmp("Slot set successfully", serverReply) == 0);
+    sendCommand(fdB, "cluster migrate 12182 2", serverReply);
+    assert(strcmp("{migrated: 2, remaining: 1}", serverReply) == 0);
+    // the source serves the keys it still has and sends the others to the target
+    int askedA = 0;
+    const char *keys[3] = {"select foo", "lrange {foo}l 0 -1", "hget {foo}h f"};
+    for (int i = 0; i < 3; i++) {
+        sendCommand(fdB, keys[i], serverReply);
+        askedA += strcmp("ASK 12182 127.0.0.1:" TEST_CLUSTER_PORT_A, serverReply) == 0;
+    }
+    assert(askedA == 2);
+    sendCommand(fdA, "select foo", serverReply);
+    assert(strcmp("MOVED 12182 127.0.0.1:" TEST_CLUSTER_PORT_B, serverReply) == 0);
+    sendCommand(fdB, "cluster migrate 12182", serverReply);
+    assert(strcmp("{migrated: 1, remaining: 0}", serverReply) == 0);
+    sendCommand(fdA, "asking select foo", serverReply);
+    assert(strcmp("{foo: bar}", serverReply) == 0);
+    for (int i = 0; i < 2; i++) {
+        sendCommand(fds[i], "cluster setslot 12182 node 127.0.0.1:" TEST_CLUSTER_PORT_A, serverReply);
+        assert(strcmp("Slot set successfully", serverReply) == 0);
+    }
+    sendCommand(fdA, "lrange {foo}l 0 -1", serverReply);
+    assert(strcmp("{{foo}l: [x]}", serverReply) == 0);
+    sendCommand(fdA, "hget {foo}h f", serverReply);
+    assert(strcmp("{f: v}", serverReply) == 0);
+    sendCommand(fdB, "select foo", serverReply);
+    assert(strcmp("MOVED 12182 127.0.0.1:" TEST_CLUSTER_PORT_A, serverReply) == 0);
+    sendCommand(fdB, "cluster countkeysinslot 12182", serverReply);
+    assert(strcmp("{12182: 0}", serverReply) == 0);
+    close(fdA);
+    close(fdB);
+    kill(pidA, SIGTERM);
+    kill(pidB, SIGTERM);
+    waitpid(pidA, NULL, 0);
+    waitpid(pidB, NULL, 0);
+}
+
 void testServerMalformedQueries() {
     int socketFd = createSocketToServer();
     if (socketFd == -1) {
@@ -1477,6 +4007,42 @@ int main(void) {
     testReplaceThenRemove();
     testReplaceNonExistent();
 
+    testIndexRange();
+    testIndexMaintained();
+
+    testIncrBy();
+    testIncrByUpdatesIndex();
+    testVersions();
+    testChangeHandler();
+
+    testListPushPop();
+    testHashUpgrade();
+    testSetEncodings();
+    testCollectionsInHashtable();
+
+    testLz4RoundTrip();
+    testCompressedValues();
+
+    testHistogram();
+    testStats();
+    testTableStats();
+    testTableShrink();
+    testMappedTable();
+    testTieredValues();
+    testLazyFree();
+    testPubSub();
+    testScripts();
+    testTracking();
+    testConfig();
+    testSlowlog();
+    testLog();
+    testMetricsRender();
+    testReplicationBacklog();
+    testClusterSlots();
+
+    testArtInsertRemoveScan();
+    testKeyIndexMaintained();
+
     testCreateServer();
     testServerInsertString();
     testServerInsertInt();
@@ -1505,6 +4071,26 @@ int main(void) {
     testServerReplaceMultiple();
     testServerReplaceKeyNotFound();
 
+    testServerRangeQueries();
+    testServerPrefixQueries();
+    testServerIncr();
+    testServerCollections();
+    testServerCompression();
+    testServerPipelining();
+    testServerTransactions();
+    testServerPubSub();
+    testServerScripts();
+    testServerTracking();
+    testServerInfo();
+    testServerDatabases();
+    testServerSlowlog();
+    testServerMetrics();
+    testServerReplication();
+    testServerCluster();
+    testServerMapped();
+    testServerUnixSocket();
+    testServerConfig();
+
     testServerMalformedQueries();
 
     /* Post-test cleanup*/